@@ -0,0 +1,152 @@
+/**
+ * @file boot_prof.c
+ * @brief Boot stage timestamps
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+
+#include "boot_prof.h"
+
+#define BOOT_PROF_MAX_STAGES    24
+
+/**
+ * @brief One boot stage
+ */
+typedef struct {
+    const char *stage;      /**< Stage name */
+    int64_t us;             /**< esp_timer time */
+} boot_mark_t;
+
+/* Module static variables */
+static DRAM_ATTR boot_mark_t marks[BOOT_PROF_MAX_STAGES];
+static DRAM_ATTR uint32_t count;
+static DRAM_ATTR uint32_t dropped;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Indexed by esp_reset_reason_t */
+static const char *const reset_reasons[] = {
+    "UNKNOWN", "POWERON", "EXT", "SW", "PANIC", "INT_WDT", "TASK_WDT",
+    "WDT", "DEEPSLEEP", "BROWNOUT", "SDIO", "USB", "JTAG", "EFUSE",
+    "PWR_GLITCH", "CPU_LOCKUP",
+};
+
+/**
+ * @brief Public API implementations
+ */
+
+void IRAM_ATTR boot_prof_mark(const char *stage)
+{
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL_SAFE(&lock);
+    if (count < BOOT_PROF_MAX_STAGES) {
+        marks[count].stage = stage;
+        marks[count].us = now;
+        count++;
+    } else {
+        dropped++;
+    }
+    taskEXIT_CRITICAL_SAFE(&lock);
+}
+
+esp_err_t boot_prof_get(const char *stage, int64_t *us)
+{
+    if (stage == NULL || us == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    taskENTER_CRITICAL(&lock);
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(marks[i].stage, stage) == 0) {
+            *us = marks[i].us;
+            err = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&lock);
+    return err;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Boot timeline\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Boot command handler
+ */
+static int cmd_boot(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    boot_mark_t copy[BOOT_PROF_MAX_STAGES];
+    uint32_t n, lost;
+
+    taskENTER_CRITICAL(&lock);
+    n = count;
+    lost = dropped;
+    memcpy(copy, marks, n * sizeof(copy[0]));
+    taskEXIT_CRITICAL(&lock);
+
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    printf("-- Boot Timeline --\n");
+    printf("  Reset reason: %s\n",
+           (reason < sizeof(reset_reasons) / sizeof(reset_reasons[0])) ? reset_reasons[reason] : "?");
+    printf("  %10s %10s  %s\n", "t [ms]", "+dt [ms]", "Stage");
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t dt = copy[i].us - (i > 0 ? copy[i - 1].us : 0);
+        printf("  %10.1f %10.1f  %s\n", copy[i].us / 1000.0, dt / 1000.0, copy[i].stage);
+    }
+    if (lost) {
+        printf("  %"PRIu32" later marks dropped\n", lost);
+    }
+    return 0;
+}
+
+void boot_prof_register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.end = arg_end(1);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "boot",
+        .func = cmd_boot,
+        .help = "Show boot stage timestamps and the reset reason\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,43 @@
+/**
+ * @file boot_prof.h
+ * @brief Boot stage timestamps
+ *
+ * Modules mark the end of their start-up stages; the `boot` command prints
+ * the timeline together with the reset reason. Times are esp_timer time,
+ * i.e. counted from early in the application start-up, not from reset.
+ */
+
+#ifndef BOOT_PROF_H
+#define BOOT_PROF_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Record a boot stage
+ *
+ * Only the first BOOT_PROF_MAX_STAGES marks are kept, later ones are
+ * counted as dropped. Safe to call from any task and from IRAM code.
+ *
+ * @param[in] stage Stage name, must stay valid (string literal)
+ */
+void boot_prof_mark(const char *stage);
+
+/**
+ * @brief Time of a recorded stage
+ *
+ * @param[in] stage Stage name as passed to boot_prof_mark()
+ * @param[out] us esp_timer time of the first mark with that name
+ * @return ESP_OK if found
+ *         ESP_ERR_INVALID_ARG if a pointer is NULL
+ *         ESP_ERR_NOT_FOUND if the stage was not marked (yet)
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t boot_prof_get(const char *stage, int64_t *us);
+
+/**
+ * @brief Register the `boot` console command
+ */
+void boot_prof_register_cmd(void);
+
+#endif /* BOOT_PROF_H */
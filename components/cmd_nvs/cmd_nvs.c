@@ -12,6 +12,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <sys/param.h>
 #include "esp_log.h"
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
@@ -20,6 +22,33 @@
 #include "esp_err.h"
 #include "cmd_nvs.h"
 #include "nvs.h"
+#include "esp_rom_crc.h"
+#include "flash_svc.h"
+
+/* Flash service key prefix of console requests. Modules key their own
+ * writes "nvs:<namespace>/<n>"; a console write must not coalesce with,
+ * and so replace, a pending write of the module owning the namespace. */
+#define SVC_KEY_PREFIX      "con:nvs:"
+
+/* Image layout, little-endian:
+ *   "NVSI" <u8 version>
+ *   records: <u8 type> <u8 key length> <u16 value length> <key> <value>
+ *   <u32 crc32 of everything before>
+ * A record of type IMAGE_NAMESPACE starts a namespace and has no value,
+ * all other records use the nvs_type_t code and the raw value (integers
+ * in native byte order, strings with terminator). */
+#define IMAGE_MAGIC         "NVSI"
+#define IMAGE_VERSION       1
+#define IMAGE_HDR_LEN       5
+#define IMAGE_REC_HDR_LEN   4
+#define IMAGE_CRC_LEN       4
+#define IMAGE_NAMESPACE     0x00
+#define IMAGE_MAX           (32 * 1024)
+#define IMAGE_MAX_NS        16
+#define IMAGE_CONSOLE       "-"
+#define IMAGE_BEGIN         "-----BEGIN NVS IMAGE-----"
+#define IMAGE_END           "-----END NVS IMAGE-----"
+#define IMAGE_LINE_BYTES    32
 
 typedef struct {
     nvs_type_t type;
@@ -80,6 +109,17 @@ static struct {
     struct arg_end *end;
 } list_args;
 
+static struct {
+    struct arg_str *args;
+    struct arg_end *end;
+} export_args;
+
+static struct {
+    struct arg_lit *clean;
+    struct arg_str *file;
+    struct arg_end *end;
+} import_args;
+
 
 static nvs_type_t str_to_type(const char *type)
 {
@@ -370,12 +410,46 @@ static esp_err_t erase_all(const char *name)
     return ESP_OK;
 }
 
+/* Writes run on the flash service task, the caller waits for the result */
+typedef struct {
+    const char *name;
+    const char *key;
+    const char *type;
+    const char *value;
+} write_args_t;
+
+static esp_err_t set_value_op(void *ctx)
+{
+    const write_args_t *a = ctx;
+    errno = 0;  /* range checks below read errno of the service task */
+    return set_value_in_nvs(a->key, a->type, a->value);
+}
+
+static esp_err_t erase_op(void *ctx)
+{
+    const write_args_t *a = ctx;
+    return erase(a->key);
+}
+
+static esp_err_t erase_all_op(void *ctx)
+{
+    const write_args_t *a = ctx;
+    return erase_all(a->name);
+}
+
+static esp_err_t run_write(flash_svc_fn_t op, const write_args_t *a)
+{
+    char svc_key[FLASH_SVC_KEY_MAX];
+    snprintf(svc_key, sizeof(svc_key), SVC_KEY_PREFIX "%s/%s", a->name, a->key ? a->key : "*");
+    return flash_svc_run(svc_key, op, a, sizeof(*a));
+}
+
 static int list(const char *part, const char *name, const char *str_type)
 {
     nvs_type_t type = str_to_type(str_type);
 
     nvs_iterator_t it = NULL;
-    esp_err_t result = nvs_entry_find(part, NULL, type, &it);
+    esp_err_t result = nvs_entry_find(part, (name[0] != '\0') ? name : NULL, type, &it);
     if (result == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGE(TAG, "No such entry was found");
         return 1;
@@ -403,6 +477,396 @@ static int list(const char *part, const char *name, const char *str_type)
     return 0;
 }
 
+/* Image buffer, IMAGE_MAX bytes */
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    bool overflow;
+} image_t;
+
+static void image_put(image_t *img, const void *src, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    if (img->overflow || img->len + n > IMAGE_MAX) {
+        img->overflow = true;
+        return;
+    }
+    memcpy(img->data + img->len, src, n);
+    img->len += n;
+}
+
+static void image_put_record(image_t *img, uint8_t type, const char *key, const void *value, size_t len)
+{
+    uint8_t hdr[IMAGE_REC_HDR_LEN] = { type, strlen(key), len & 0xff, len >> 8 };
+    if (len > UINT16_MAX) {
+        img->overflow = true;
+        return;
+    }
+    image_put(img, hdr, sizeof(hdr));
+    image_put(img, key, strlen(key));
+    image_put(img, value, len);
+}
+
+/* Fixed value size of an integer type, 0 for str/blob, -1 if unknown */
+static int image_int_size(uint8_t type)
+{
+    switch (type) {
+    case NVS_TYPE_U8: case NVS_TYPE_I8: return 1;
+    case NVS_TYPE_U16: case NVS_TYPE_I16: return 2;
+    case NVS_TYPE_U32: case NVS_TYPE_I32: return 4;
+    case NVS_TYPE_U64: case NVS_TYPE_I64: return 8;
+    case NVS_TYPE_STR: case NVS_TYPE_BLOB: return 0;
+    default: return -1;
+    }
+}
+
+/* Append one entry, read from an open namespace */
+static esp_err_t image_put_entry(image_t *img, nvs_handle_t nvs, const nvs_entry_info_t *info)
+{
+    uint8_t value[8];
+    size_t len = image_int_size(info->type);
+    esp_err_t err;
+
+    switch (info->type) {
+    case NVS_TYPE_U8: err = nvs_get_u8(nvs, info->key, (uint8_t *)value); break;
+    case NVS_TYPE_I8: err = nvs_get_i8(nvs, info->key, (int8_t *)value); break;
+    case NVS_TYPE_U16: err = nvs_get_u16(nvs, info->key, (uint16_t *)value); break;
+    case NVS_TYPE_I16: err = nvs_get_i16(nvs, info->key, (int16_t *)value); break;
+    case NVS_TYPE_U32: err = nvs_get_u32(nvs, info->key, (uint32_t *)value); break;
+    case NVS_TYPE_I32: err = nvs_get_i32(nvs, info->key, (int32_t *)value); break;
+    case NVS_TYPE_U64: err = nvs_get_u64(nvs, info->key, (uint64_t *)value); break;
+    case NVS_TYPE_I64: err = nvs_get_i64(nvs, info->key, (int64_t *)value); break;
+    case NVS_TYPE_STR:
+    case NVS_TYPE_BLOB: {
+        /* Read straight into the image behind the record header */
+        size_t key_len = strlen(info->key);
+        size_t hdr = IMAGE_REC_HDR_LEN + key_len;
+        if (img->overflow || img->len + hdr > IMAGE_MAX) {
+            img->overflow = true;
+            return ESP_ERR_NO_MEM;
+        }
+        len = MIN(IMAGE_MAX - img->len - hdr, UINT16_MAX);
+        uint8_t *dst = img->data + img->len + hdr;
+        err = (info->type == NVS_TYPE_STR) ? nvs_get_str(nvs, info->key, (char *)dst, &len)
+                                           : nvs_get_blob(nvs, info->key, dst, &len);
+        if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+            img->overflow = true;
+            return ESP_ERR_NO_MEM;
+        }
+        if (err == ESP_OK) {
+            uint8_t rec[IMAGE_REC_HDR_LEN] = { info->type, key_len, len & 0xff, len >> 8 };
+            memcpy(img->data + img->len, rec, sizeof(rec));
+            memcpy(img->data + img->len + sizeof(rec), info->key, key_len);
+            img->len += hdr + len;
+        }
+        return err;
+    }
+    default:
+        ESP_LOGW(TAG, "Skipping '%s': unsupported type", info->key);
+        return ESP_OK;
+    }
+
+    if (err == ESP_OK) {
+        image_put_record(img, info->type, info->key, value, len);
+    }
+    return err;
+}
+
+/* Serialize a namespace, or all of them if name is NULL */
+static esp_err_t image_export(image_t *img, const char *name, int *namespaces, int *entries)
+{
+    static char names[IMAGE_MAX_NS][NVS_NS_NAME_MAX_SIZE];
+    int count = 0;
+    nvs_iterator_t it = NULL;
+    esp_err_t err;
+
+    if (name != NULL) {
+        strlcpy(names[count++], name, sizeof(names[0]));
+    } else {
+        /* Collect the namespaces first, so each one is written as one section */
+        for (err = nvs_entry_find(NVS_DEFAULT_PART_NAME, NULL, NVS_TYPE_ANY, &it);
+             err == ESP_OK; err = nvs_entry_next(&it)) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            int i;
+            for (i = 0; i < count && strcmp(names[i], info.namespace_name) != 0; i++) {
+            }
+            if (i == count) {
+                if (count == IMAGE_MAX_NS) {
+                    nvs_release_iterator(it);
+                    return ESP_ERR_NO_MEM;
+                }
+                strlcpy(names[count++], info.namespace_name, sizeof(names[0]));
+            }
+        }
+    }
+
+    *namespaces = 0;
+    *entries = 0;
+    image_put(img, IMAGE_MAGIC, strlen(IMAGE_MAGIC));
+    image_put(img, &(uint8_t){ IMAGE_VERSION }, 1);
+
+    for (int i = 0; i < count; i++) {
+        nvs_handle_t nvs;
+        err = nvs_open(names[i], NVS_READONLY, &nvs);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        image_put_record(img, IMAGE_NAMESPACE, names[i], NULL, 0);
+        (*namespaces)++;
+
+        for (err = nvs_entry_find(NVS_DEFAULT_PART_NAME, names[i], NVS_TYPE_ANY, &it);
+             err == ESP_OK; err = nvs_entry_next(&it)) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            esp_err_t e = image_put_entry(img, nvs, &info);
+            if (e != ESP_OK) {
+                nvs_release_iterator(it);
+                nvs_close(nvs);
+                return e;
+            }
+            (*entries)++;
+        }
+        nvs_close(nvs);
+
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, img->data, img->len);
+    image_put(img, &crc, sizeof(crc));
+    return img->overflow ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+static esp_err_t image_set(nvs_handle_t nvs, uint8_t type, const char *key, const uint8_t *v, size_t len)
+{
+    union {
+        uint8_t u8; int8_t i8; uint16_t u16; int16_t i16;
+        uint32_t u32; int32_t i32; uint64_t u64; int64_t i64;
+    } n;
+    memcpy(&n, v, MIN(len, sizeof(n)));
+
+    switch (type) {
+    case NVS_TYPE_U8: return nvs_set_u8(nvs, key, n.u8);
+    case NVS_TYPE_I8: return nvs_set_i8(nvs, key, n.i8);
+    case NVS_TYPE_U16: return nvs_set_u16(nvs, key, n.u16);
+    case NVS_TYPE_I16: return nvs_set_i16(nvs, key, n.i16);
+    case NVS_TYPE_U32: return nvs_set_u32(nvs, key, n.u32);
+    case NVS_TYPE_I32: return nvs_set_i32(nvs, key, n.i32);
+    case NVS_TYPE_U64: return nvs_set_u64(nvs, key, n.u64);
+    case NVS_TYPE_I64: return nvs_set_i64(nvs, key, n.i64);
+    case NVS_TYPE_STR: return nvs_set_str(nvs, key, (const char *)v);
+    default: return nvs_set_blob(nvs, key, v, len);
+    }
+}
+
+/* Walk the records of a checked image; writes them if apply is set.
+ * Every namespace is opened once and committed once. */
+static esp_err_t image_walk(const uint8_t *data, size_t len, bool apply, bool clean,
+                            int *namespaces, int *entries)
+{
+    nvs_handle_t nvs = 0;
+    bool open = false;
+    esp_err_t err = ESP_OK;
+    size_t off = IMAGE_HDR_LEN;
+
+    *namespaces = 0;
+    *entries = 0;
+
+    while (off < len && err == ESP_OK) {
+        if (len - off < IMAGE_REC_HDR_LEN) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+
+        uint8_t type = data[off];
+        size_t key_len = data[off + 1];
+        size_t value_len = data[off + 2] | (data[off + 3] << 8);
+        off += IMAGE_REC_HDR_LEN;
+
+        if (key_len == 0 || key_len >= NVS_KEY_NAME_MAX_SIZE || len - off < key_len + value_len) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        memcpy(key, data + off, key_len);
+        key[key_len] = '\0';
+        const uint8_t *value = data + off + key_len;
+        off += key_len + value_len;
+
+        if (type == IMAGE_NAMESPACE) {
+            if (value_len != 0) {
+                err = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            if (apply) {
+                if (open) {
+                    err = nvs_commit(nvs);
+                    nvs_close(nvs);
+                    open = false;
+                    if (err != ESP_OK) {
+                        break;
+                    }
+                }
+                err = nvs_open(key, NVS_READWRITE, &nvs);
+                if (err != ESP_OK) {
+                    break;
+                }
+                open = true;
+                if (clean) {
+                    err = nvs_erase_all(nvs);
+                }
+            }
+            (*namespaces)++;
+            continue;
+        }
+
+        int int_size = image_int_size(type);
+        if (*namespaces == 0 || int_size < 0
+            || (int_size > 0 && value_len != int_size)
+            || (type == NVS_TYPE_STR && (value_len == 0 || value[value_len - 1] != '\0'))) {
+            err = ESP_ERR_NVS_TYPE_MISMATCH;
+            break;
+        }
+
+        if (apply) {
+            err = image_set(nvs, type, key, value, value_len);
+        }
+        (*entries)++;
+    }
+
+    if (open) {
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    return err;
+}
+
+/* Check magic, version and checksum; returns the length without checksum */
+static esp_err_t image_check(const uint8_t *data, size_t len, size_t *body_len)
+{
+    if (len < IMAGE_HDR_LEN + IMAGE_CRC_LEN
+        || memcmp(data, IMAGE_MAGIC, strlen(IMAGE_MAGIC)) != 0
+        || data[strlen(IMAGE_MAGIC)] != IMAGE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    uint32_t crc;
+    *body_len = len - IMAGE_CRC_LEN;
+    memcpy(&crc, data + *body_len, sizeof(crc));
+    return (crc == esp_rom_crc32_le(0, data, *body_len)) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/* File and NVS writes run on the flash service */
+typedef struct {
+    const char *path;
+    uint8_t *data;
+    size_t *len;
+    bool clean;
+    int *namespaces;
+    int *entries;
+} image_op_t;
+
+static esp_err_t image_write_file_op(void *ctx)
+{
+    const image_op_t *op = ctx;
+    FILE *f = fopen(op->path, "wb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    bool ok = fwrite(op->data, 1, *op->len, f) == *op->len;
+    return (fclose(f) == 0 && ok) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t image_read_file_op(void *ctx)
+{
+    const image_op_t *op = ctx;
+    FILE *f = fopen(op->path, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *op->len = fread(op->data, 1, IMAGE_MAX, f);
+    bool too_big = fgetc(f) != EOF;
+    fclose(f);
+    return too_big ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+static esp_err_t image_import_op(void *ctx)
+{
+    const image_op_t *op = ctx;
+    return image_walk(op->data, *op->len, true, op->clean, op->namespaces, op->entries);
+}
+
+static void image_print(const uint8_t *data, size_t len)
+{
+    printf(IMAGE_BEGIN "\n");
+    for (size_t i = 0; i < len; i++) {
+        printf("%02x", data[i]);
+        if ((i + 1) % IMAGE_LINE_BYTES == 0 || i + 1 == len) {
+            printf("\n");
+        }
+    }
+    printf(IMAGE_END "\n");
+}
+
+/* Read a hex image pasted into the console */
+static esp_err_t image_read_console(uint8_t *data, size_t *len)
+{
+    char line[2 * IMAGE_LINE_BYTES + 16];
+    bool started = false;
+    int high = -1;
+
+    printf("Paste the image, ending with " IMAGE_END "\n");
+    fflush(stdout);
+    *len = 0;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (strncmp(line, IMAGE_BEGIN, strlen(IMAGE_BEGIN)) == 0) {
+            started = true;
+            continue;
+        }
+        if (strncmp(line, IMAGE_END, strlen(IMAGE_END)) == 0) {
+            return (started && high < 0) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+        }
+        if (!started) {
+            continue;
+        }
+
+        for (const char *c = line; *c != '\0'; c++) {
+            int v;
+            if (*c >= '0' && *c <= '9') {
+                v = *c - '0';
+            } else if (*c >= 'a' && *c <= 'f') {
+                v = *c - 'a' + 10;
+            } else if (*c >= 'A' && *c <= 'F') {
+                v = *c - 'A' + 10;
+            } else if (*c == '\r' || *c == '\n' || *c == ' ') {
+                continue;
+            } else {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            if (high < 0) {
+                high = v;
+            } else if (*len == IMAGE_MAX) {
+                return ESP_ERR_INVALID_SIZE;
+            } else {
+                data[(*len)++] = (high << 4) | v;
+                high = -1;
+            }
+        }
+    }
+
+    return ESP_ERR_INVALID_SIZE;
+}
+
 static int set_value(int argc, char **argv)
 {
     int nerrors = arg_parse(argc, argv, (void **) &set_args);
@@ -415,7 +879,8 @@ static int set_value(int argc, char **argv)
     const char *type = set_args.type->sval[0];
     const char *values = set_args.value->sval[0];
 
-    esp_err_t err = set_value_in_nvs(key, type, values);
+    write_args_t a = { .name = current_namespace, .key = key, .type = type, .value = values };
+    esp_err_t err = run_write(set_value_op, &a);
 
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s", esp_err_to_name(err));
@@ -456,7 +921,8 @@ static int erase_value(int argc, char **argv)
 
     const char *key = erase_args.key->sval[0];
 
-    esp_err_t err = erase(key);
+    write_args_t a = { .name = current_namespace, .key = key };
+    esp_err_t err = run_write(erase_op, &a);
 
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s", esp_err_to_name(err));
@@ -476,7 +942,8 @@ static int erase_namespace(int argc, char **argv)
 
     const char *name = erase_all_args.namespace->sval[0];
 
-    esp_err_t err = erase_all(name);
+    write_args_t a = { .name = name };
+    esp_err_t err = run_write(erase_all_op, &a);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "%s", esp_err_to_name(err));
         return 1;
@@ -518,6 +985,95 @@ static int list_entries(int argc, char **argv)
     return list(part, name, type);
 }
 
+static int export_image(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &export_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, export_args.end, argv[0]);
+        return 1;
+    }
+
+    const char *name = (export_args.args->count == 2) ? export_args.args->sval[0] : NULL;
+    const char *path = export_args.args->sval[export_args.args->count - 1];
+
+    image_t img = { .data = malloc(IMAGE_MAX) };
+    if (img.data == NULL) {
+        ESP_LOGE(TAG, "%s", esp_err_to_name(ESP_ERR_NO_MEM));
+        return 1;
+    }
+
+    int namespaces, entries;
+    esp_err_t err = image_export(&img, name, &namespaces, &entries);
+    if (err == ESP_OK) {
+        if (strcmp(path, IMAGE_CONSOLE) == 0) {
+            image_print(img.data, img.len);
+        } else {
+            image_op_t op = { .path = path, .data = img.data, .len = &img.len };
+            err = flash_svc_run(SVC_KEY_PREFIX "export", image_write_file_op, &op, sizeof(op));
+        }
+    }
+
+    if (err == ESP_OK) {
+        printf("Exported %d entries in %d namespaces (%u bytes)\n", entries, namespaces, (unsigned)img.len);
+    } else {
+        ESP_LOGE(TAG, "Export failed: %s", esp_err_to_name(err));
+    }
+
+    free(img.data);
+    return (err == ESP_OK) ? 0 : 1;
+}
+
+static int import_image(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &import_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, import_args.end, argv[0]);
+        return 1;
+    }
+
+    const char *path = import_args.file->sval[0];
+    uint8_t *data = malloc(IMAGE_MAX);
+    if (data == NULL) {
+        ESP_LOGE(TAG, "%s", esp_err_to_name(ESP_ERR_NO_MEM));
+        return 1;
+    }
+
+    size_t len = 0, body_len = 0;
+    int namespaces = 0, entries = 0;
+    image_op_t op = {
+        .path = path, .data = data, .len = &body_len, .clean = import_args.clean->count > 0,
+        .namespaces = &namespaces, .entries = &entries,
+    };
+    esp_err_t err;
+
+    if (strcmp(path, IMAGE_CONSOLE) == 0) {
+        err = image_read_console(data, &len);
+    } else {
+        err = flash_svc_run(SVC_KEY_PREFIX "import", image_read_file_op, &(image_op_t){ .path = path, .data = data, .len = &len },
+                            sizeof(image_op_t));
+    }
+
+    /* Validate everything before the first write */
+    if (err == ESP_OK) {
+        err = image_check(data, len, &body_len);
+    }
+    if (err == ESP_OK) {
+        err = image_walk(data, body_len, false, false, &namespaces, &entries);
+    }
+    if (err == ESP_OK) {
+        err = flash_svc_run(SVC_KEY_PREFIX "import", image_import_op, &op, sizeof(op));
+    }
+
+    if (err == ESP_OK) {
+        printf("Imported %d entries in %d namespaces\n", entries, namespaces);
+    } else {
+        ESP_LOGE(TAG, "Import failed: %s", esp_err_to_name(err));
+    }
+
+    free(data);
+    return (err == ESP_OK) ? 0 : 1;
+}
+
 void register_nvs(void)
 {
     set_args.key = arg_str1(NULL, NULL, "<key>", "key of the value to be set");
@@ -544,6 +1100,13 @@ void register_nvs(void)
     list_args.type = arg_str0("t", "type", "<type>", ARG_TYPE_STR);
     list_args.end = arg_end(2);
 
+    export_args.args = arg_strn(NULL, NULL, "[<namespace>] <file>", 1, 2, "namespace (default: all), file or '-' for the console");
+    export_args.end = arg_end(2);
+
+    import_args.clean = arg_lit0("c", "clean", "erase each namespace before importing it");
+    import_args.file = arg_str1(NULL, NULL, "<file>", "file or '-' to paste from the console");
+    import_args.end = arg_end(2);
+
     const esp_console_cmd_t set_cmd = {
         .command = "nvs_set",
         .help = "Set key-value pair in selected namespace.\n"
@@ -600,10 +1163,34 @@ void register_nvs(void)
         .argtable = &list_args
     };
 
+    const esp_console_cmd_t export_cmd = {
+        .command = "nvs_export",
+        .help = "Export namespaces of the 'nvs' partition into a binary image.\n"
+        "Examples:\n"
+        " nvs_export /data/nvs.bin \n"
+        " nvs_export adc_storage - \n",
+        .hint = NULL,
+        .func = &export_image,
+        .argtable = &export_args
+    };
+
+    const esp_console_cmd_t import_cmd = {
+        .command = "nvs_import",
+        .help = "Import an image made by nvs_export, one commit per namespace.\n"
+        "Examples:\n"
+        " nvs_import /data/nvs.bin \n"
+        " nvs_import -c - \n",
+        .hint = NULL,
+        .func = &import_image,
+        .argtable = &import_args
+    };
+
     ESP_ERROR_CHECK(esp_console_cmd_register(&set_cmd));
     ESP_ERROR_CHECK(esp_console_cmd_register(&get_cmd));
     ESP_ERROR_CHECK(esp_console_cmd_register(&erase_cmd));
     ESP_ERROR_CHECK(esp_console_cmd_register(&namespace_cmd));
     ESP_ERROR_CHECK(esp_console_cmd_register(&list_entries_cmd));
     ESP_ERROR_CHECK(esp_console_cmd_register(&erase_namespace_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&export_cmd));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&import_cmd));
 }
@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
 #include "esp_log.h"
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
@@ -22,21 +24,83 @@
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "cmd_wifi.h"
 
 #define JOIN_TIMEOUT_MS (10000)
+#define RECONNECT_MIN_MS CONFIG_WIFI_RECONNECT_MIN_MS
+#define RECONNECT_MAX_MS CONFIG_WIFI_RECONNECT_MAX_MS
 
 static EventGroupHandle_t wifi_event_group;
 const int CONNECTED_BIT = BIT0;
 
+/* Connection manager state, shared by the event loop and esp_timer tasks */
+static esp_timer_handle_t reconnect_timer;
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool auto_reconnect;         /* Set once an AP has been joined */
+static uint32_t backoff_step;
+static int64_t disconnected_at;     /* Time the link was lost, 0 while connected */
+static wifi_conn_stats_t conn_stats;
+
+/* Reconnect delay of a backoff step: exponential, capped, with jitter */
+static uint32_t backoff_delay_ms(uint32_t step)
+{
+    uint32_t delay = RECONNECT_MAX_MS;
+    if (step < 16 && (RECONNECT_MIN_MS << step) < RECONNECT_MAX_MS) {
+        delay = RECONNECT_MIN_MS << step;
+    }
+    return delay + esp_random() % (delay / 4 + 1);
+}
+
+static void reconnect_cb(void *arg)
+{
+    taskENTER_CRITICAL(&conn_lock);
+    conn_stats.attempts++;
+    taskEXIT_CRITICAL(&conn_lock);
+    esp_wifi_connect();
+}
 
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
+    int64_t now = esp_timer_get_time();
+
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
+        const wifi_event_sta_disconnected_t *ev = event_data;
         xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
+
+        taskENTER_CRITICAL(&conn_lock);
+        if (conn_stats.connected) {
+            conn_stats.connected = false;
+            conn_stats.disconnects++;
+            disconnected_at = now;
+        }
+        conn_stats.last_reason = ev->reason;
+        conn_stats.backoff_ms = backoff_delay_ms(backoff_step++);
+        bool retry = auto_reconnect;
+        uint32_t delay_ms = conn_stats.backoff_ms;
+        taskEXIT_CRITICAL(&conn_lock);
+
+        if (retry) {
+            ESP_LOGI(__func__, "Disconnected (reason %d), retry in %"PRIu32" ms",
+                     ev->reason, delay_ms);
+            esp_timer_stop(reconnect_timer);
+            esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+        }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        taskENTER_CRITICAL(&conn_lock);
+        conn_stats.connected = true;
+        backoff_step = 0;
+        conn_stats.backoff_ms = 0;
+        if (disconnected_at != 0) {
+            conn_stats.reconnects++;
+            conn_stats.last_reconnect_us = now - disconnected_at;
+            conn_stats.max_reconnect_us = MAX(conn_stats.max_reconnect_us,
+                                              conn_stats.last_reconnect_us);
+            disconnected_at = 0;
+        }
+        taskEXIT_CRITICAL(&conn_lock);
         xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
     }
 }
@@ -50,7 +114,16 @@ static void initialise_wifi(void)
     }
     ESP_ERROR_CHECK(esp_netif_init());
     wifi_event_group = xEventGroupCreate();
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &reconnect_timer) );
+    /* The application may have created the default loop already */
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
     esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap();
     assert(ap_netif);
     esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
@@ -74,6 +147,14 @@ static bool wifi_join(const char *ssid, const char *pass, int timeout_ms)
         strlcpy((char *) wifi_config.sta.password, pass, sizeof(wifi_config.sta.password));
     }
 
+    /* A new join restarts the backoff */
+    esp_timer_stop(reconnect_timer);
+    taskENTER_CRITICAL(&conn_lock);
+    auto_reconnect = true;
+    backoff_step = 0;
+    conn_stats.attempts++;
+    taskEXIT_CRITICAL(&conn_lock);
+
     ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK( esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
     esp_wifi_connect();
@@ -117,6 +198,40 @@ static int connect(int argc, char **argv)
     return 0;
 }
 
+bool wifi_is_connected(void)
+{
+    return wifi_event_group != NULL
+           && (xEventGroupGetBits(wifi_event_group) & CONNECTED_BIT) != 0;
+}
+
+esp_err_t wifi_get_conn_stats(wifi_conn_stats_t *stats)
+{
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&conn_lock);
+    *stats = conn_stats;
+    taskEXIT_CRITICAL(&conn_lock);
+    return ESP_OK;
+}
+
+static int wifi_status(int argc, char **argv)
+{
+    wifi_conn_stats_t st;
+    wifi_get_conn_stats(&st);
+
+    printf("State: %s\n", st.connected ? "connected" : "disconnected");
+    if (!st.connected && st.backoff_ms) {
+        printf("Next retry in: %"PRIu32" ms\n", st.backoff_ms);
+    }
+    printf("Disconnects: %"PRIu32" (last reason %u)\n", st.disconnects, st.last_reason);
+    printf("Reconnects: %"PRIu32"\n", st.reconnects);
+    printf("Connect attempts: %"PRIu32"\n", st.attempts);
+    printf("Time to reconnect: last %"PRId64" ms, max %"PRId64" ms\n",
+           st.last_reconnect_us / 1000, st.max_reconnect_us / 1000);
+    return 0;
+}
+
 void register_wifi(void)
 {
     join_args.timeout = arg_int0(NULL, "timeout", "<t>", "Connection timeout, ms");
@@ -133,4 +248,13 @@ void register_wifi(void)
     };
 
     ESP_ERROR_CHECK( esp_console_cmd_register(&join_cmd) );
+
+    const esp_console_cmd_t status_cmd = {
+        .command = "wifi",
+        .help = "Show Wi-Fi connection state and reconnect statistics",
+        .hint = NULL,
+        .func = &wifi_status,
+    };
+
+    ESP_ERROR_CHECK( esp_console_cmd_register(&status_cmd) );
 }
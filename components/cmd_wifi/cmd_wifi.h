@@ -13,13 +13,35 @@
 */
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Station connection statistics
+typedef struct {
+    bool connected;             // Station has an IP address
+    uint8_t last_reason;        // wifi_err_reason_t of the last disconnect
+    uint32_t disconnects;       // Links lost after being connected
+    uint32_t reconnects;        // Links restored after a disconnect
+    uint32_t attempts;          // esp_wifi_connect() calls
+    uint32_t backoff_ms;        // Delay of the pending retry, 0 if none
+    int64_t last_reconnect_us;  // Disconnect to IP of the last outage
+    int64_t max_reconnect_us;   // Longest outage so far
+} wifi_conn_stats_t;
+
 // Register WiFi functions
 void register_wifi(void);
 
+// True while the station is connected and has an IP address
+bool wifi_is_connected(void);
+
+// Copy the connection statistics, ESP_ERR_INVALID_ARG if stats is NULL
+esp_err_t wifi_get_conn_stats(wifi_conn_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
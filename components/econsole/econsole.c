@@ -8,9 +8,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/param.h>
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_console.h"
+#include "esp_timer.h"
 
 #include "driver/uart_vfs.h"
 #include "driver/uart.h"
@@ -21,6 +24,7 @@
 #include "esp_vfs_fat.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "freertos/semphr.h"
 
 #include "cmd_nvs.h"
 #include "cmd_wifi.h"
@@ -30,12 +34,15 @@
 #include "argtable3/argtable3.h"
 
 #include "econsole.h"
+#include "flash_svc.h"
+#include "boot_prof.h"
 #include "freertos/task.h"
 #include "portmacro.h"
 
 #define CONSOLE_MAX_CMDLINE_ARGUMENTS 10        //TODO Z
 #define CONSOLE_MAX_CMDLINE_LENGTHS 256
 #define PROMPT_MAX_LEN 16
+#define HISTORY_MAX_LINES 100
 #define PROMPT_STR CONFIG_IDF_TARGET
 
 #define TAG "console"
@@ -138,7 +145,7 @@ void initialize_console_library(const char *history_path)
     linenoiseSetHintsCallback((linenoiseHintsCallback*) &esp_console_get_hint);
 
     /* Set command history size */
-    linenoiseHistorySetMaxLen(100);
+    linenoiseHistorySetMaxLen(HISTORY_MAX_LINES);
 
     /* Set command maximum length */
     linenoiseSetMaxLineLen(console_config.max_cmdline_length);
@@ -178,11 +185,9 @@ char *setup_prompt(const char *prompt_str)
     return prompt;
 }
 
-#if CONFIG_CONSOLE_STORE_HISTORY
-
-#define MOUNT_PATH "/data"
-#define HISTORY_PATH MOUNT_PATH "/history.txt"
+static bool data_mounted;
 
+#if CONFIG_CONSOLE_DATA_FS
 static void initialize_filesystem(void)
 {
     static wl_handle_t wl_handle;
@@ -190,24 +195,210 @@ static void initialize_filesystem(void)
             .max_files = 4,
             .format_if_mount_failed = true
     };
-    esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl(MOUNT_PATH, "storage", &mount_config, &wl_handle);
+    esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl(CON_DATA_PATH, "storage", &mount_config, &wl_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to mount FATFS (%s)", esp_err_to_name(err));
         return;
     }
+    data_mounted = true;
 }
+#endif // CONFIG_CONSOLE_DATA_FS
+
+#if CONFIG_CONSOLE_STORE_HISTORY
+#define HISTORY_PATH CON_DATA_PATH "/history.txt"
 #else
 #define HISTORY_PATH NULL
 #endif // CONFIG_CONSOLE_STORE_HISTORY
 
-static void initialize_nvs(void)
+#if CONFIG_CONSOLE_STORE_HISTORY
+/* The history file is an append-only log. New commands collect in RAM
+ * and are appended on the flash service once the console is idle for
+ * CONSOLE_HISTORY_IDLE_MS, at the latest after CONSOLE_HISTORY_MAX_DELAY_MS.
+ * Loading keeps the last HISTORY_MAX_LINES lines, so the log is only
+ * compacted to them when it outgrows CONSOLE_HISTORY_COMPACT_SIZE. */
+#define HISTORY_TMP_PATH CON_DATA_PATH "/history.tmp"
+#define HISTORY_PENDING_SIZE 1024
+
+static char history_pending[HISTORY_PENDING_SIZE];
+static size_t history_pending_len;
+static int64_t history_pending_since;
+static SemaphoreHandle_t history_mutex;
+static esp_timer_handle_t history_timer;
+
+/* Flash service task only */
+static char history_io[HISTORY_PENDING_SIZE];
+static long history_file_size;
+
+/* Keep the last HISTORY_MAX_LINES lines of the log */
+static esp_err_t history_compact(void)
+{
+    FILE *in = fopen(HISTORY_PATH, "r");
+    if (in == NULL) {
+        return ESP_FAIL;
+    }
+
+    int lines = 0, c;
+    while ((c = fgetc(in)) != EOF) {
+        if (c == '\n') {
+            lines++;
+        }
+    }
+    rewind(in);
+    for (int skip = lines - HISTORY_MAX_LINES; skip > 0 && (c = fgetc(in)) != EOF; ) {
+        if (c == '\n') {
+            skip--;
+        }
+    }
+
+    FILE *out = fopen(HISTORY_TMP_PATH, "w");
+    if (out == NULL) {
+        fclose(in);
+        return ESP_FAIL;
+    }
+
+    bool ok = true;
+    size_t n;
+    while (ok && (n = fread(history_io, 1, sizeof(history_io), in)) > 0) {
+        ok = fwrite(history_io, 1, n, out) == n;
+    }
+    long size = ftell(out);
+    ok = !ferror(in) && fclose(out) == 0 && ok;
+    fclose(in);
+
+    /* FATFS cannot rename onto an existing file; history_init() finishes
+     * an interrupted swap */
+    if (!ok || remove(HISTORY_PATH) != 0 || rename(HISTORY_TMP_PATH, HISTORY_PATH) != 0) {
+        ESP_LOGW(TAG, "History compaction failed");
+        return ESP_FAIL;
+    }
+
+    history_file_size = size;
+    return ESP_OK;
+}
+
+/* Append the pending commands to the log (flash service task) */
+static esp_err_t history_flush(void *ctx)
+{
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    size_t n = history_pending_len;
+    memcpy(history_io, history_pending, n);
+    history_pending_len = 0;
+    xSemaphoreGive(history_mutex);
+
+    if (n == 0) {
+        return ESP_OK;
+    }
+
+    FILE *f = fopen(HISTORY_PATH, "a");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(history_io, 1, n, f) == n;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        return ESP_FAIL;
+    }
+
+    history_file_size += n;
+    if (history_file_size > CONFIG_CONSOLE_HISTORY_COMPACT_SIZE) {
+        return history_compact();
+    }
+    return ESP_OK;
+}
+
+static void history_timer_cb(void *arg)
+{
+    flash_svc_submit(HISTORY_PATH, history_flush, NULL, 0, NULL, NULL, 0);
+}
+
+static void history_shutdown(void)
+{
+    flash_svc_run(HISTORY_PATH, history_flush, NULL, 0);
+}
+
+/* Queue a command for the log, never touches flash unless the buffer is full */
+static void history_append(const char *line)
 {
+    size_t n = strlen(line);
+    if (n + 1 > sizeof(history_pending)) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t age;
+    for (;;) {
+        xSemaphoreTake(history_mutex, portMAX_DELAY);
+        bool fits = history_pending_len + n + 1 <= sizeof(history_pending);
+        if (fits) {
+            if (history_pending_len == 0) {
+                history_pending_since = now;
+            }
+            memcpy(history_pending + history_pending_len, line, n);
+            history_pending_len += n;
+            history_pending[history_pending_len++] = '\n';
+            age = now - history_pending_since;
+        }
+        xSemaphoreGive(history_mutex);
+
+        if (fits) {
+            break;
+        }
+        flash_svc_run(HISTORY_PATH, history_flush, NULL, 0);
+    }
+
+    int64_t left = CONFIG_CONSOLE_HISTORY_MAX_DELAY_MS * 1000LL - age;
+    esp_timer_stop(history_timer);
+    if (left <= 0) {
+        history_timer_cb(NULL);
+    } else {
+        esp_timer_start_once(history_timer, MIN(left, CONFIG_CONSOLE_HISTORY_IDLE_MS * 1000LL));
+    }
+}
+
+static esp_err_t history_init(void)
+{
+    struct stat st;
+
+    /* Finish a compaction interrupted between remove and rename */
+    if (stat(HISTORY_PATH, &st) != 0 && stat(HISTORY_TMP_PATH, &st) == 0) {
+        rename(HISTORY_TMP_PATH, HISTORY_PATH);
+    }
+    remove(HISTORY_TMP_PATH);
+    history_file_size = (stat(HISTORY_PATH, &st) == 0) ? st.st_size : 0;
+
+    history_mutex = xSemaphoreCreateMutex();
+    if (history_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = history_timer_cb,
+        .name = "history",
+    };
+    esp_err_t err = esp_timer_create(&args, &history_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return esp_register_shutdown_handler(history_shutdown);
+}
+#endif // CONFIG_CONSOLE_STORE_HISTORY
+
+void con_nvs_init(void)
+{
+    static bool done;
+    if (done) {
+        return;
+    }
+    done = true;
+
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK( nvs_flash_erase() );
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+    boot_prof_mark("nvs");
 }
 
 static void console_task(void *p) {
@@ -234,8 +425,8 @@ static void console_task(void *p) {
         if (strlen(line) > 0) {
             linenoiseHistoryAdd(line);
 #if CONFIG_CONSOLE_STORE_HISTORY
-            /* Save command history to filesystem */
-            linenoiseHistorySave(HISTORY_PATH);
+            /* Queue the command for the history log */
+            history_append(line);
 #endif // CONFIG_CONSOLE_STORE_HISTORY
         }
 		
@@ -259,9 +450,15 @@ static void console_task(void *p) {
 }
 
 BaseType_t con_init() {
-	initialize_nvs();
-#if CONFIG_CONSOLE_STORE_HISTORY
+	con_nvs_init();
+#if CONFIG_CONSOLE_DATA_FS
     initialize_filesystem();
+    boot_prof_mark("data fs");
+#endif
+#if CONFIG_CONSOLE_STORE_HISTORY
+    if (history_init() != ESP_OK) {
+        return pdFAIL;
+    }
     ESP_LOGI(TAG, "Command history enabled");
 #else
     ESP_LOGI(TAG, "Command history disabled");
@@ -272,6 +469,7 @@ BaseType_t con_init() {
 
     /* Initialize linenoise library and esp_console*/
     initialize_console_library(HISTORY_PATH);
+    boot_prof_mark("console");
 
    /* Register commands */
     esp_console_register_help_command();
@@ -286,9 +484,14 @@ BaseType_t con_init() {
     register_wifi();
 #endif
     register_nvs();
+    boot_prof_register_cmd();
 
 	return xTaskCreate(console_task, "cons", 8192, NULL, uxTaskPriorityGet(NULL), &console_task_handle);
 }
 
+bool con_data_mounted(void) {
+	return data_mounted;
+}
+
 
 
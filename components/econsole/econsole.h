@@ -8,9 +8,20 @@
 #ifndef MAIN_CONSOLE_H_
 #define MAIN_CONSOLE_H_
 
+#include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "portmacro.h"
 
+/* Mount point of the data filesystem */
+#define CON_DATA_PATH "/data"
+
 BaseType_t con_init();
 
+/* Initialize the NVS flash partition; called by con_init(), may be called
+ * earlier by modules that need NVS before the console */
+void con_nvs_init(void);
+
+/* True if the data filesystem is mounted at CON_DATA_PATH */
+bool con_data_mounted(void);
+
 #endif /* MAIN_CONSOLE_H_ */
@@ -0,0 +1,356 @@
+/**
+ * @file flash_svc.c
+ * @brief Asynchronous flash write service
+ *
+ * Requests live in a fixed slot array. The service task sleeps until a
+ * request arrives, then waits for the next window from the ADC task and
+ * runs the oldest requests until the window budget is used up. When no
+ * window opens within FLASH_SVC_MAX_DELAY_MS the requests run anyway.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "flash_svc.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define QUEUE_LEN           CONFIG_FLASH_SVC_QUEUE_LEN
+#define MAX_WAITERS         4
+#define BUDGET_US           (CONFIG_FLASH_SVC_WINDOW_BUDGET_MS * 1000)
+#define MAX_DELAY_US        (CONFIG_FLASH_SVC_MAX_DELAY_MS * 1000)
+#define TASK_STACK_SIZE     4096
+
+#define BIT_REQUEST         BIT0    /**< Request submitted */
+#define BIT_WINDOW          BIT1    /**< ADC frame drained */
+
+/**
+ * @brief Completion callback of a submitter
+ */
+typedef struct {
+    flash_svc_done_t fn;
+    void *arg;
+} waiter_t;
+
+/**
+ * @brief Pending request
+ */
+typedef struct {
+    bool used;                          /**< Slot holds a request */
+    bool running;                       /**< Write function executing, no merging */
+    char key[FLASH_SVC_KEY_MAX];        /**< Coalescing key */
+    flash_svc_fn_t fn;                  /**< Write function */
+    uint8_t ctx[FLASH_SVC_CTX_MAX];     /**< Context copy */
+    uint32_t order;                     /**< Submission order */
+    int64_t submitted_us;               /**< First submission */
+    waiter_t waiters[MAX_WAITERS];      /**< Completion callbacks */
+    uint8_t nwaiters;
+} request_t;
+
+/**
+ * @brief Synchronous request, lives on the caller's stack
+ */
+typedef struct {
+    SemaphoreHandle_t sem;
+    StaticSemaphore_t sem_buf;
+    esp_err_t err;
+} sync_t;
+
+/* Forward declarations */
+static void task_flash_svc(void *p);
+
+/* Module static variables */
+static const char *TAG = "flash_svc";
+static TaskHandle_t svc_task = NULL;
+static SemaphoreHandle_t free_slots = NULL;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static request_t slots[QUEUE_LEN];
+static uint32_t next_order;
+static volatile uint32_t pending;
+static flash_svc_stats_t stats;
+
+/**
+ * @brief Find the pending request with the given key (lock held)
+ */
+static request_t *find_key(const char *key)
+{
+    for (int i = 0; i < QUEUE_LEN; i++) {
+        if (slots[i].used && !slots[i].running && strcmp(slots[i].key, key) == 0) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the oldest request not yet running (lock held)
+ */
+static request_t *find_oldest(void)
+{
+    request_t *oldest = NULL;
+    for (int i = 0; i < QUEUE_LEN; i++) {
+        request_t *r = &slots[i];
+        if (r->used && !r->running
+            && (oldest == NULL || (int32_t)(r->order - oldest->order) < 0)) {
+            oldest = r;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief Merge a submission into a request (lock held)
+ *
+ * @return false if the request has no room for another callback
+ */
+static bool merge(request_t *r, flash_svc_fn_t fn, const void *ctx, size_t ctx_len,
+                  flash_svc_done_t done, void *arg)
+{
+    if (done != NULL && r->nwaiters >= MAX_WAITERS) {
+        return false;
+    }
+
+    r->fn = fn;
+    memset(r->ctx, 0, sizeof(r->ctx));
+    if (ctx_len > 0) {
+        memcpy(r->ctx, ctx, ctx_len);
+    }
+    if (done != NULL) {
+        r->waiters[r->nwaiters++] = (waiter_t){ done, arg };
+    }
+    return true;
+}
+
+/**
+ * @brief Completion callback of flash_svc_run()
+ */
+static void sync_done(esp_err_t err, void *arg)
+{
+    sync_t *s = arg;
+    s->err = err;
+    xSemaphoreGive(s->sem);
+}
+
+/**
+ * @brief Run one request on the service task
+ *
+ * @param[in] r Request, marked running
+ * @param[in] in_window Started inside an ADC window
+ */
+static void execute(request_t *r, bool in_window)
+{
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = r->fn(r->ctx);
+    int64_t dt = esp_timer_get_time() - t0;
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "%s: %s", r->key, esp_err_to_name(err));
+    }
+
+    waiter_t waiters[MAX_WAITERS];
+    uint8_t nwaiters;
+
+    taskENTER_CRITICAL(&lock);
+    memcpy(waiters, r->waiters, sizeof(waiters));
+    nwaiters = r->nwaiters;
+    stats.completed++;
+    if (err != ESP_OK) {
+        stats.failed++;
+    }
+    if (in_window) {
+        stats.in_window++;
+    } else {
+        stats.forced++;
+    }
+    stats.max_op_us = MAX(stats.max_op_us, dt);
+    stats.max_wait_us = MAX(stats.max_wait_us, t0 - r->submitted_us);
+    r->used = false;
+    r->running = false;
+    pending--;
+    taskEXIT_CRITICAL(&lock);
+
+    xSemaphoreGive(free_slots);
+
+    for (int i = 0; i < nwaiters; i++) {
+        waiters[i].fn(err, waiters[i].arg);
+    }
+}
+
+/**
+ * @brief Service task
+ */
+static void task_flash_svc(void *p)
+{
+    for (;;) {
+        uint32_t bits = 0;
+
+        /* Sleep while idle, otherwise until a window or the delay limit */
+        TickType_t timeout = pending ? pdMS_TO_TICKS(CONFIG_FLASH_SVC_MAX_DELAY_MS) : portMAX_DELAY;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, MAX(timeout, 1));
+
+        bool in_window = (bits & BIT_WINDOW) != 0;
+        int64_t start = esp_timer_get_time();
+
+        for (;;) {
+            taskENTER_CRITICAL(&lock);
+            request_t *r = find_oldest();
+            bool due = r != NULL
+                       && (in_window || start - r->submitted_us >= MAX_DELAY_US);
+            if (due) {
+                r->running = true;
+            }
+            taskEXIT_CRITICAL(&lock);
+
+            if (!due) {
+                break;
+            }
+
+            execute(r, in_window);
+
+            /* Keep the stall short so the next frame is served in time */
+            if (esp_timer_get_time() - start >= BUDGET_US) {
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t flash_svc_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    free_slots = xSemaphoreCreateCounting(QUEUE_LEN, QUEUE_LEN);
+    if (free_slots == NULL) {
+        ESP_LOGE(TAG, "Failed to create semaphore");
+        return pdFAIL;
+    }
+
+    if (xTaskCreate(task_flash_svc, "flash_svc", TASK_STACK_SIZE, NULL,
+                    CONFIG_FLASH_SVC_TASK_PRIO, &svc_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        return pdFAIL;
+    }
+
+    return pdPASS;
+}
+
+esp_err_t flash_svc_submit(const char *key, flash_svc_fn_t fn, const void *ctx, size_t ctx_len,
+                           flash_svc_done_t done, void *arg, TickType_t wait)
+{
+    if (key == NULL || fn == NULL || ctx_len > FLASH_SVC_CTX_MAX
+        || (ctx == NULL && ctx_len > 0) || strlen(key) >= FLASH_SVC_KEY_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Not started yet, write on the caller */
+    if (svc_task == NULL) {
+        uint8_t copy[FLASH_SVC_CTX_MAX] = { 0 };
+        if (ctx_len > 0) {
+            memcpy(copy, ctx, ctx_len);
+        }
+        esp_err_t err = fn(copy);
+        if (done != NULL) {
+            done(err, arg);
+        }
+        return ESP_OK;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    stats.submitted++;
+    request_t *r = find_key(key);
+    if (r != NULL && merge(r, fn, ctx, ctx_len, done, arg)) {
+        stats.coalesced++;
+        taskEXIT_CRITICAL(&lock);
+        return ESP_OK;
+    }
+    taskEXIT_CRITICAL(&lock);
+
+    if (xSemaphoreTake(free_slots, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    /* Another submitter may have queued the key meanwhile */
+    r = find_key(key);
+    if (r != NULL && merge(r, fn, ctx, ctx_len, done, arg)) {
+        stats.coalesced++;
+        taskEXIT_CRITICAL(&lock);
+        xSemaphoreGive(free_slots);
+        return ESP_OK;
+    }
+
+    for (r = slots; r->used; r++) {
+        /* A free slot exists, the semaphore counts them */
+    }
+    memset(r, 0, sizeof(*r));
+    r->used = true;
+    strcpy(r->key, key);
+    r->order = next_order++;
+    r->submitted_us = esp_timer_get_time();
+    merge(r, fn, ctx, ctx_len, done, arg);
+    pending++;
+    taskEXIT_CRITICAL(&lock);
+
+    xTaskNotify(svc_task, BIT_REQUEST, eSetBits);
+    return ESP_OK;
+}
+
+esp_err_t flash_svc_run(const char *key, flash_svc_fn_t fn, const void *ctx, size_t ctx_len)
+{
+    if (key == NULL || fn == NULL || ctx_len > FLASH_SVC_CTX_MAX || (ctx == NULL && ctx_len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Nested or before init: no queue to wait for */
+    if (svc_task == NULL || xTaskGetCurrentTaskHandle() == svc_task) {
+        uint8_t copy[FLASH_SVC_CTX_MAX] = { 0 };
+        if (ctx_len > 0) {
+            memcpy(copy, ctx, ctx_len);
+        }
+        return fn(copy);
+    }
+
+    sync_t s = { .err = ESP_FAIL };
+    s.sem = xSemaphoreCreateBinaryStatic(&s.sem_buf);
+
+    esp_err_t err = flash_svc_submit(key, fn, ctx, ctx_len, sync_done, &s, portMAX_DELAY);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(s.sem, portMAX_DELAY);
+    return s.err;
+}
+
+void IRAM_ATTR flash_svc_window(void)
+{
+    if (pending && svc_task != NULL) {
+        xTaskNotify(svc_task, BIT_WINDOW, eSetBits);
+    }
+}
+
+esp_err_t flash_svc_get_stats(flash_svc_stats_t *out)
+{
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    *out = stats;
+    out->pending = pending;
+    taskEXIT_CRITICAL(&lock);
+    return ESP_OK;
+}
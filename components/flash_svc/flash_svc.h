@@ -0,0 +1,122 @@
+/**
+ * @file flash_svc.h
+ * @brief Asynchronous flash write service
+ *
+ * Every flash write (NVS, FATFS) disables the flash cache and stalls all
+ * tasks. Instead of writing on their own task, modules hand a write
+ * function to this service. It runs the requests on one low-priority
+ * task in windows opened by the ADC task right after it drained its
+ * frames, so the stalls land between frames instead of in the middle of
+ * frame processing.
+ *
+ * Requests carry a key naming what they write (e.g. "nvs:adc/ch0" or a
+ * file path). A request submitted while another with the same key is
+ * still pending replaces it: only the newest data is written once and
+ * every submitter's completion callback gets the result. Requesters that
+ * write the same data differently use distinct keys, e.g. console NVS
+ * writes are keyed "con:nvs:...".
+ */
+
+#ifndef FLASH_SVC_H
+#define FLASH_SVC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define FLASH_SVC_KEY_MAX   40                          /**< Including the terminator */
+#define FLASH_SVC_CTX_MAX   CONFIG_FLASH_SVC_CTX_MAX    /**< Largest request context */
+
+/**
+ * @brief Write function, runs on the service task
+ *
+ * @param[in] ctx Copy of the context given at submission
+ * @return Result passed to the completion callbacks
+ */
+typedef esp_err_t (*flash_svc_fn_t)(void *ctx);
+
+/**
+ * @brief Completion callback, runs on the service task and must not block
+ *
+ * @param[in] err Result of the write function
+ * @param[in] arg User argument given at submission
+ */
+typedef void (*flash_svc_done_t)(esp_err_t err, void *arg);
+
+/**
+ * @brief Service statistics
+ */
+typedef struct {
+    uint32_t submitted;         /**< Requests submitted */
+    uint32_t coalesced;         /**< Requests merged into a pending one */
+    uint32_t completed;         /**< Write functions run */
+    uint32_t failed;            /**< Write functions returning an error */
+    uint32_t in_window;         /**< Writes started in an ADC window */
+    uint32_t forced;            /**< Writes started after FLASH_SVC_MAX_DELAY_MS */
+    uint32_t pending;           /**< Requests waiting now */
+    int64_t max_op_us;          /**< Longest write function */
+    int64_t max_wait_us;        /**< Longest time from submission to start */
+} flash_svc_stats_t;
+
+/**
+ * @brief Start the flash service task
+ *
+ * Until it is called every request runs synchronously on the caller.
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t flash_svc_init(void);
+
+/**
+ * @brief Queue a write
+ *
+ * @param[in] key Identifies the written data, requests with equal keys are merged
+ * @param[in] fn Write function
+ * @param[in] ctx Context copied into the request, may be NULL
+ * @param[in] ctx_len Context length (at most FLASH_SVC_CTX_MAX)
+ * @param[in] done Completion callback, may be NULL
+ * @param[in] arg User argument for done
+ * @param[in] wait Maximum time to wait for a free request slot
+ * @return ESP_OK if queued or merged
+ *         ESP_ERR_INVALID_ARG if key or fn is NULL or ctx_len is too large
+ *         ESP_ERR_TIMEOUT if no request slot became free
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t flash_svc_submit(const char *key, flash_svc_fn_t fn, const void *ctx, size_t ctx_len,
+                           flash_svc_done_t done, void *arg, TickType_t wait);
+
+/**
+ * @brief Queue a write and wait for its result
+ *
+ * Called from the service task itself (e.g. from a write function) or
+ * before flash_svc_init(), fn runs directly.
+ *
+ * @param[in] key Identifies the written data
+ * @param[in] fn Write function
+ * @param[in] ctx Context copied into the request, may be NULL
+ * @param[in] ctx_len Context length (at most FLASH_SVC_CTX_MAX)
+ * @return Result of fn, or an error of flash_svc_submit()
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t flash_svc_run(const char *key, flash_svc_fn_t fn, const void *ctx, size_t ctx_len);
+
+/**
+ * @brief Open a write window
+ *
+ * Called by the ADC task after it drained the driver pool. Cheap when
+ * nothing is pending; safe to call from IRAM code.
+ */
+void flash_svc_window(void);
+
+/**
+ * @brief Get service statistics
+ *
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if stats is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t flash_svc_get_stats(flash_svc_stats_t *stats);
+
+#endif /* FLASH_SVC_H */
@@ -7,8 +7,11 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include "esp_console.h"
 #include "esp_log.h"
@@ -16,46 +19,93 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_adc/adc_continuous.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_rom_crc.h"
+#include "esp_pm.h"
 #include "argtable3/argtable3.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "flash_svc.h"
+#include "boot_prof.h"
 
 #include "hal/adc_types.h"
 #include "util.h"
 #include "adc.h"
+#include "vchan.h"
+#include "freq.h"
+#include "pid.h"
+#include "history.h"
 
 #define LOG_LEVEL_LOCAL ESP_LOG_INFO
 
 /* ADC Hardware Configuration */
 #define ADC_UNIT                    ADC_UNIT_1
-#define SAMPLE_FREQ_HZ              20000
-#define READ_BUFFER_SIZE            1024
+#define SAMPLE_FREQ_HZ              ADC_SAMPLE_FREQ_HZ
+#define READ_BUFFER_SIZE            ADC_READ_BUFFER_SIZE
 #define ADC_CONV_MODE               ADC_CONV_SINGLE_UNIT_1
 #define ADC_ATTEN                   ADC_ATTEN_DB_12
 #define ADC_BIT_WIDTH               SOC_ADC_DIGI_MAX_BITWIDTH
 #define ADC_OUTPUT_TYPE             ADC_DIGI_OUTPUT_FORMAT_TYPE1
 
 /* Configuration from Kconfig */
-#ifndef CONFIG_ADC_MAX_CHANNELS
-#define ADC_MAX_CHANNELS 4
-#else
-#define ADC_MAX_CHANNELS CONFIG_ADC_MAX_CHANNELS
-#endif
-
 #ifndef CONFIG_ADC_RUNNING_AVG_SIZE
 #define RUNNING_AVG_SIZE 10
 #else
 #define RUNNING_AVG_SIZE CONFIG_ADC_RUNNING_AVG_SIZE
 #endif
 
+#ifndef CONFIG_ADC_AB_Q
+#define AB_Q_DEFAULT 1
+#define AB_R_DEFAULT 100
+#else
+#define AB_Q_DEFAULT CONFIG_ADC_AB_Q
+#define AB_R_DEFAULT CONFIG_ADC_AB_R
+#endif
+
 #define ADC_MIN (0)
 #define ADC_MAX (1 << 12)
 
+#define MAX_FRAME_LISTENERS 12          /* 8 modules register one, with headroom */
+#define SNAPSHOT_RETRIES    16
+#define RETAIN_MAGIC        0x52434441  /* "ADCR" */
+#define POOL_FRAMES         CONFIG_ADC_POOL_FRAMES
+#define SKEW_TAPS           4
+#define SKEW_Q              15
+#define AB_Q                16          /* Fraction bits of the alpha-beta state */
+#define AB_NOISE_MAX        1000000     /* Largest q or r */
+
+/* Acquisition hot path placement. IRAM only saves cache refills: the
+   frame processor calls flash-resident modules (virtual channels, PID,
+   history, listeners), so it is not safe to run with the cache disabled */
+#if CONFIG_ADC_HOT_PATH_IRAM
+#define HOT_ATTR            IRAM_ATTR
+#define HOT_DATA_ATTR       DRAM_ATTR
+/* Format strings live in flash, keep them out of the hot path */
+#define HOT_LOGD(...)
+#else
+#define HOT_ATTR
+#define HOT_DATA_ATTR
+#define HOT_LOGD(...)       ESP_LOGD(TAG, __VA_ARGS__)
+#endif
+
+/* Per-sample filters; the specialized processor inlines them into every
+   channel case, where the channel index is a constant */
+#if CONFIG_ADC_SPECIALIZED
+#define FILTER_FN           static inline __attribute__((always_inline))
+#else
+#define FILTER_FN           static
+#endif
+
 /* NVS Keys */
 #define NVS_NAMESPACE "adc_storage"
 #define NVS_KEY_MIN_FMT "ch%d_min"
 #define NVS_KEY_MAX_FMT "ch%d_max"
 #define NVS_KEY_HYST_FMT "ch%d_hyst"
+#define NVS_KEY_FILT_FMT "ch%d_filt"
+#define NVS_KEY_Q_FMT "ch%d_q"
+#define NVS_KEY_R_FMT "ch%d_r"
 
 /**
  * @brief Running hysteresis structure for one channel
@@ -74,6 +124,16 @@ typedef struct {
     uint8_t ptr;                        /**< Current position in buffer */
 } r_avg_t;
 
+/**
+ * @brief Alpha-beta tracker state for one channel
+ */
+typedef struct {
+    int32_t x;              /**< Value estimate, Q16 counts */
+    int32_t v;              /**< Rate estimate, Q16 counts per sample */
+    int32_t alpha;          /**< Value gain, Q16 */
+    int32_t beta;           /**< Rate gain, Q16 */
+} r_ab_t;
+
 /**
  * @brief Per-channel ADC data structure
  */
@@ -82,8 +142,13 @@ typedef struct {
     uint32_t normalized_value;  /**< Processed value */
     r_hyst_t r_hyst;           /**< Hysteresis state */
     r_avg_t r_avg;             /**< Running average state */
+    r_ab_t r_ab;               /**< Alpha-beta state */
+    uint32_t filter;           /**< adc_filter_t */
+    uint32_t q;                /**< Alpha-beta process noise */
+    uint32_t r;                /**< Alpha-beta measurement noise */
     uint32_t min_cal;          /**< Calibration minimum */
     uint32_t max_cal;          /**< Calibration maximum */
+    bool seeded;               /**< Filters primed from the first sample */
 } adc_channel_data_t;
 
 /* Module static variables */
@@ -92,37 +157,132 @@ static TaskHandle_t task_handle = NULL;
 static adc_continuous_handle_t handle = NULL;
 static SemaphoreHandle_t adc_mutex = NULL;
 
-/* Channel configuration - map to physical ADC channels */
-static const adc_channel_t physical_channels[ADC_MAX_CHANNELS] = {
-    ADC_CHANNEL_6,  /* GPIO34 */
-    ADC_CHANNEL_7,  /* GPIO35 */
+/*
+ * Channel list: X(index, physical channel), one entry per configured
+ * channel. Expands to the channel map, the Kconfig defaults and, with
+ * ADC_SPECIALIZED, one case per channel of the frame processor.
+ */
 #if ADC_MAX_CHANNELS >= 3
-    ADC_CHANNEL_4,  /* GPIO32 */
+#define ADC_CH2(X)  X(2, ADC_CHANNEL_4)     /* GPIO32 */
+#else
+#define ADC_CH2(X)
 #endif
 #if ADC_MAX_CHANNELS >= 4
-    ADC_CHANNEL_5,  /* GPIO33 */
+#define ADC_CH3(X)  X(3, ADC_CHANNEL_5)     /* GPIO33 */
+#else
+#define ADC_CH3(X)
 #endif
 #if ADC_MAX_CHANNELS >= 5
-    ADC_CHANNEL_0,  /* GPIO36 */
+#define ADC_CH4(X)  X(4, ADC_CHANNEL_0)     /* GPIO36 */
+#else
+#define ADC_CH4(X)
 #endif
 #if ADC_MAX_CHANNELS >= 6
-    ADC_CHANNEL_3,  /* GPIO39 */
+#define ADC_CH5(X)  X(5, ADC_CHANNEL_3)     /* GPIO39 */
+#else
+#define ADC_CH5(X)
 #endif
+
+#define ADC_CHANNEL_LIST(X) \
+    X(0, ADC_CHANNEL_6)     /* GPIO34 */ \
+    X(1, ADC_CHANNEL_7)     /* GPIO35 */ \
+    ADC_CH2(X) ADC_CH3(X) ADC_CH4(X) ADC_CH5(X)
+
+/* Channel configuration - map to physical ADC channels */
+#define X_PHYSICAL(i, phys)     phys,
+static const HOT_DATA_ATTR adc_channel_t physical_channels[ADC_MAX_CHANNELS] = {
+    ADC_CHANNEL_LIST(X_PHYSICAL)
 };
+#undef X_PHYSICAL
 
 /* Per-channel data */
 static adc_channel_data_t channel_data[ADC_MAX_CHANNELS];
 
 /* Error statistics */
-static struct {
-    uint32_t conversions;
-    uint32_t invalid_channel;
-    uint32_t read_errors;
-    uint32_t timeout;
-} errors;
+static adc_stats_t errors;
+
+/* Busy/idle time of the ADC task */
+static adc_power_t power;
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+#if CONFIG_ADC_PM_LOCK
+static esp_pm_lock_handle_t pm_lock = NULL;
+#endif
 
 static uint8_t result[READ_BUFFER_SIZE];
 
+/* Linearity corrections (ADC_CODES entries each, NULL for none) */
+static int8_t *lin_lut[ADC_MAX_CHANNELS];
+
+/* Raw code histogram, NULL while none is running */
+static uint32_t *hist_bins;
+static uint8_t hist_ch;
+static uint32_t hist_samples;
+
+/* Processed frame handed to the listeners */
+static adc_frame_t frame;
+
+/* Completion time of the newest DMA frame (seqlock, written by the ISR)
+   and frames taken from the driver, to tell whether a frame is the newest */
+static volatile int64_t conv_done_us;
+static uint32_t conv_done_seq;
+static uint32_t frames_read;
+
+/* Snapshot published after every frame (seqlock, odd while written) */
+static adc_snapshot_t snapshot;
+static uint32_t snapshot_seq;
+
+#if CONFIG_ADC_RTC_RETAIN
+/**
+ * @brief Filter state kept in RTC slow memory
+ *
+ * RTC_NOINIT memory survives software restarts and deep sleep but holds
+ * garbage after power-on, hence the layout fields and the checksum.
+ */
+typedef struct {
+    uint32_t magic;                 /**< RETAIN_MAGIC */
+    uint16_t channels;              /**< ADC_MAX_CHANNELS of the writer */
+    uint16_t avg_size;              /**< RUNNING_AVG_SIZE of the writer */
+    struct {
+        r_hyst_t r_hyst;            /**< Hysteresis window */
+        r_avg_t r_avg;              /**< Averaging buffer */
+        r_ab_t r_ab;                /**< Alpha-beta state and gains */
+        uint32_t filter;            /**< Filter the state belongs to */
+        uint32_t min_cal;           /**< Calibration the state belongs to */
+        uint32_t max_cal;
+        uint32_t raw_value;
+        uint32_t normalized_value;
+        bool seeded;                /**< State is valid */
+    } ch[ADC_MAX_CHANNELS];
+    adc_stats_t stats;              /**< Error statistics */
+    uint32_t frame_seq;             /**< Last frame sequence number */
+    uint32_t crc;                   /**< CRC32 of everything before */
+} adc_retained_t;
+
+static RTC_NOINIT_ATTR adc_retained_t retained;
+static bool retain_copying;             /* retained is being updated */
+static bool retain_sealed;              /* retained is final, no more copies */
+#endif
+
+#if CONFIG_ADC_SKEW_CORRECT
+/**
+ * @brief Fractional-delay filter state of one channel
+ */
+typedef struct {
+    int32_t coef[SKEW_TAPS];        /**< Lagrange coefficients, Q15 */
+    uint16_t hist[SKEW_TAPS - 1];   /**< Previous samples, newest first */
+    bool primed;                    /**< History filled */
+} skew_t;
+
+static HOT_DATA_ATTR skew_t skew[ADC_MAX_CHANNELS];
+#endif
+
+/* Frame listeners */
+static struct {
+    adc_frame_listener_t fn;
+    void *arg;
+} listeners[MAX_FRAME_LISTENERS];
+static portMUX_TYPE listeners_lock = portMUX_INITIALIZER_UNLOCKED;
+
 /* Forward declarations */
 static void register_cmd(void);
 static esp_err_t save_channel_config(uint8_t channel);
@@ -151,10 +311,29 @@ static bool IRAM_ATTR s_conv_done_cb(adc_continuous_handle_t handle,
                                      void *user_data)
 {
     BaseType_t mustYield = pdFALSE;
+
+    __atomic_fetch_add(&conv_done_seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    conv_done_us = esp_timer_get_time();
+    __atomic_fetch_add(&conv_done_seq, 1, __ATOMIC_RELEASE);
+
     vTaskNotifyGiveFromISR(task_handle, &mustYield);
     return (mustYield == pdTRUE);
 }
 
+/**
+ * @brief Driver pool overflow callback (ISR context)
+ *
+ * The driver dropped a conversion frame because the task fell behind.
+ */
+static bool IRAM_ATTR s_pool_ovf_cb(adc_continuous_handle_t handle,
+                                    const adc_continuous_evt_data_t *edata,
+                                    void *user_data)
+{
+    errors.pool_overflow++;
+    return false;
+}
+
 /**
  * @brief Initialize ADC hardware
  * 
@@ -173,7 +352,7 @@ static void continuous_adc_init(const adc_channel_t *channel, uint8_t channel_nu
     adc_continuous_handle_t adc_handle = NULL;
 
     adc_continuous_handle_cfg_t adc_config = {
-        .max_store_buf_size = READ_BUFFER_SIZE * 4,
+        .max_store_buf_size = READ_BUFFER_SIZE * POOL_FRAMES,
         .conv_frame_size = READ_BUFFER_SIZE,
     };
     ESP_ERROR_CHECK(adc_continuous_new_handle(&adc_config, &adc_handle));
@@ -210,7 +389,7 @@ static void continuous_adc_init(const adc_channel_t *channel, uint8_t channel_nu
  * @param[in] input Input ADC value
  * @return Filtered value
  */
-static uint32_t running_hyst(uint8_t channel, uint32_t input)
+FILTER_FN uint32_t HOT_ATTR running_hyst(uint8_t channel, uint32_t input)
 {
     if (!chk_chn(channel)) {
         return input;
@@ -218,7 +397,7 @@ static uint32_t running_hyst(uint8_t channel, uint32_t input)
 
     r_hyst_t *hyst = &channel_data[channel].r_hyst;
     
-    ESP_LOGD(TAG, "Ch%d running_hyst, input:%"PRIu32, channel, input);
+    HOT_LOGD("Ch%d running_hyst, input:%"PRIu32, channel, input);
     
     if (input <= hyst->max && input >= hyst->min) {
         return hyst->min + (hyst->max - hyst->min) / 2;
@@ -239,6 +418,66 @@ static uint32_t running_hyst(uint8_t channel, uint32_t input)
     return input;
 }
 
+/**
+ * @brief Set the smoothing filters to a steady value
+ *
+ * @param[in] d Channel data
+ * @param[in] value Value both filters output from now on
+ */
+static void HOT_ATTR seed_smoothing(adc_channel_data_t *d, uint32_t value)
+{
+    for (int i = 0; i < RUNNING_AVG_SIZE; i++) {
+        d->r_avg.queue[i] = value;
+    }
+    d->r_avg.ptr = 0;
+    d->r_ab.x = (int32_t)(value << AB_Q);
+    d->r_ab.v = 0;
+}
+
+/**
+ * @brief Prime the filters of a channel with its first sample
+ *
+ * Centres the hysteresis window on the sample and fills the averaging
+ * buffer with it, so the very first output is valid instead of ramping
+ * up from zero over RUNNING_AVG_SIZE samples.
+ *
+ * @param[in] channel Channel index
+ * @param[in] input First raw sample
+ */
+static void HOT_ATTR seed_filters(uint8_t channel, uint32_t input)
+{
+    adc_channel_data_t *d = &channel_data[channel];
+    uint32_t half = d->r_hyst.hysteresis / 2;
+
+    d->r_hyst.min = MAX((input > half) ? input - half : 0, d->min_cal);
+    d->r_hyst.max = MIN(d->r_hyst.min + d->r_hyst.hysteresis, d->max_cal);
+
+    /* The hysteresis output inside the window is its centre */
+    seed_smoothing(d, running_hyst(channel, input));
+    d->seeded = true;
+}
+
+/**
+ * @brief Compute the alpha-beta gains from the noise ratio
+ *
+ * Steady-state Kalman gains of a constant-velocity model sampled once
+ * per step (Kalata): with the tracking index l = sqrt(q / r),
+ * r' = (4 + l - sqrt(8l + l^2)) / 4, alpha = 1 - r'^2 and
+ * beta = 2(2 - alpha) - 4 sqrt(1 - alpha). Runs on configuration only.
+ *
+ * @param[in,out] d Channel data with q and r set
+ */
+static void ab_gains(adc_channel_data_t *d)
+{
+    float l = sqrtf((float)d->q / (float)d->r);
+    float rr = (4.0f + l - sqrtf(8.0f * l + l * l)) / 4.0f;
+    float alpha = 1.0f - rr * rr;
+    float beta = 2.0f * (2.0f - alpha) - 4.0f * sqrtf(1.0f - alpha);
+
+    d->r_ab.alpha = (int32_t)(alpha * (1 << AB_Q) + 0.5f);
+    d->r_ab.beta = (int32_t)(beta * (1 << AB_Q) + 0.5f);
+}
+
 /**
  * @brief Calculate running average
  * 
@@ -246,7 +485,7 @@ static uint32_t running_hyst(uint8_t channel, uint32_t input)
  * @param[in] input Input value
  * @return Averaged value
  */
-static uint32_t running_average(uint8_t channel, uint32_t input)
+FILTER_FN uint32_t HOT_ATTR running_average(uint8_t channel, uint32_t input)
 {
     if (!chk_chn(channel)) {
         return input;
@@ -254,7 +493,7 @@ static uint32_t running_average(uint8_t channel, uint32_t input)
 
     r_avg_t *avg = &channel_data[channel].r_avg;
     
-    ESP_LOGD(TAG, "Ch%d running_average, input:%"PRIu32, channel, input);
+    HOT_LOGD("Ch%d running_average, input:%"PRIu32, channel, input);
     
     avg->queue[avg->ptr] = input;
     avg->ptr = (avg->ptr + 1) % RUNNING_AVG_SIZE;
@@ -267,64 +506,441 @@ static uint32_t running_average(uint8_t channel, uint32_t input)
     return (sum / RUNNING_AVG_SIZE);
 }
 
+/**
+ * @brief Alpha-beta tracking filter
+ *
+ * Predicts the value one sample ahead from the rate estimate and corrects
+ * value and rate by fixed fractions of the residual. Follows ramps
+ * without the lag of the running average.
+ *
+ * @param[in] channel Channel index
+ * @param[in] input Input value
+ * @return Value estimate
+ */
+FILTER_FN uint32_t HOT_ATTR alpha_beta(uint8_t channel, uint32_t input)
+{
+    if (!chk_chn(channel)) {
+        return input;
+    }
+
+    r_ab_t *ab = &channel_data[channel].r_ab;
+
+    HOT_LOGD("Ch%d alpha_beta, input:%"PRIu32, channel, input);
+
+    int32_t pred = ab->x + ab->v;
+    int64_t res = ((int64_t)input << AB_Q) - pred;
+    int64_t x = pred + ((res * ab->alpha) >> AB_Q);
+    int64_t v = ab->v + ((res * ab->beta) >> AB_Q);
+
+    /* Keep the state within the input range so it cannot wind up */
+    const int64_t lim = (int64_t)ADC_MAX << AB_Q;
+    ab->x = (int32_t)MIN(MAX(x, 0), lim - (1 << AB_Q));
+    ab->v = (int32_t)MIN(MAX(v, -lim), lim);
+
+    return (uint32_t)((ab->x + (1 << (AB_Q - 1))) >> AB_Q);
+}
+
+/**
+ * @brief Rate estimate of a channel in counts per second
+ *
+ * @param[in] d Channel data
+ * @return Rate, 0 with the running average
+ */
+static int32_t channel_rate(const adc_channel_data_t *d)
+{
+    if (d->filter != ADC_FILTER_ALPHA_BETA) {
+        return 0;
+    }
+    return (int32_t)(((int64_t)d->r_ab.v * (SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS)) >> AB_Q);
+}
+
+#if CONFIG_ADC_RTC_RETAIN
+/**
+ * @brief Copy the filter state to RTC memory, ADC mutex held
+ *
+ * The copy stays unsealed (no magic, no checksum) until a restart or
+ * deep sleep seals it, so a crash never restores it.
+ */
+static void HOT_ATTR retain_copy(void)
+{
+    /* Either this sees retain_sealed or retain_seal() sees retain_copying */
+    __atomic_store_n(&retain_copying, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&retain_sealed, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&retain_copying, false, __ATOMIC_RELAXED);
+        return;
+    }
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        const adc_channel_data_t *d = &channel_data[ch];
+        retained.ch[ch].r_hyst = d->r_hyst;
+        retained.ch[ch].r_avg = d->r_avg;
+        retained.ch[ch].r_ab = d->r_ab;
+        retained.ch[ch].filter = d->filter;
+        retained.ch[ch].min_cal = d->min_cal;
+        retained.ch[ch].max_cal = d->max_cal;
+        retained.ch[ch].raw_value = d->raw_value;
+        retained.ch[ch].normalized_value = d->normalized_value;
+        retained.ch[ch].seeded = d->seeded;
+    }
+    retained.stats = errors;
+    retained.frame_seq = frame.seq;
+    __atomic_store_n(&retain_copying, false, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+ * @brief Publish the channel state for lock-free readers
+ *
+ * Only the ADC task writes the snapshot. With ADC_RTC_RETAIN the filter
+ * state is copied to RTC memory in the same pass.
+ */
+static void HOT_ATTR publish_snapshot(void)
+{
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+        return;
+    }
+
+    uint32_t seq = __atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshot_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    snapshot.frame_seq = frame.seq;
+    snapshot.timestamp_us = frame.timestamp_us;
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        snapshot.ch[ch].raw = channel_data[ch].raw_value;
+        snapshot.ch[ch].normalized = channel_data[ch].normalized_value;
+        snapshot.ch[ch].min_cal = channel_data[ch].min_cal;
+        snapshot.ch[ch].max_cal = channel_data[ch].max_cal;
+        snapshot.ch[ch].hysteresis = channel_data[ch].r_hyst.hysteresis;
+        snapshot.ch[ch].filter = channel_data[ch].filter;
+        snapshot.ch[ch].rate = channel_rate(&channel_data[ch]);
+    }
+#if ADC_VIRT_CHANNELS > 0
+    for (uint8_t v = 0; v < ADC_VIRT_CHANNELS; v++) {
+        uint16_t n = frame.count[ADC_MAX_CHANNELS + v];
+        if (n > 0) {
+            snapshot.virt[v] = frame.samples[ADC_MAX_CHANNELS + v][n - 1];
+        }
+    }
+#endif
+
+    __atomic_store_n(&snapshot_seq, seq + 2, __ATOMIC_RELEASE);
+#if CONFIG_ADC_RTC_RETAIN
+    retain_copy();
+#endif
+    xSemaphoreGive(adc_mutex);
+}
+
+#if CONFIG_ADC_SKEW_CORRECT
+/**
+ * @brief Compute the fractional-delay filters
+ *
+ * The channels are converted one after another in pattern order, so
+ * channel k is sampled k/N of a scan period after channel 0. Delaying
+ * channel k by 1 + k/N samples puts every channel onto the instants of
+ * channel 0 one scan earlier; a 4-tap Lagrange interpolator is most
+ * accurate for delays between 1 and 2 samples.
+ */
+static void skew_init(void)
+{
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        double d = 1.0 + (double)ch / ADC_MAX_CHANNELS;
+        for (int n = 0; n < SKEW_TAPS; n++) {
+            double h = 1.0;
+            for (int k = 0; k < SKEW_TAPS; k++) {
+                if (k != n) {
+                    h *= (d - k) / (n - k);
+                }
+            }
+            skew[ch].coef[n] = (int32_t)(h * (1 << SKEW_Q) + (h < 0 ? -0.5 : 0.5));
+        }
+        skew[ch].primed = false;
+    }
+}
+
+/**
+ * @brief Move the samples of all channels onto a common time grid
+ *
+ * Filters frame.unfiltered in place; the hysteresis and smoothing of
+ * frame.samples would be smeared by the interpolator. The filter history
+ * carries over from frame to frame, so a scan split across two frames is
+ * handled.
+ */
+static void HOT_ATTR skew_correct(void)
+{
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        skew_t *s = &skew[ch];
+        uint16_t *x = frame.unfiltered[ch];
+
+        if (frame.count[ch] > 0 && !s->primed) {
+            for (int i = 0; i < SKEW_TAPS - 1; i++) {
+                s->hist[i] = x[0];
+            }
+            s->primed = true;
+        }
+
+        for (uint16_t i = 0; i < frame.count[ch]; i++) {
+            int32_t in = x[i];
+            int32_t acc = s->coef[0] * in
+                        + s->coef[1] * s->hist[0]
+                        + s->coef[2] * s->hist[1]
+                        + s->coef[3] * s->hist[2];
+            s->hist[2] = s->hist[1];
+            s->hist[1] = s->hist[0];
+            s->hist[0] = in;
+
+            /* Round, the interpolator may overshoot at steps */
+            acc = (acc + (1 << (SKEW_Q - 1))) >> SKEW_Q;
+            x[i] = acc < 0 ? 0 : MIN(acc, ADC_MAX - 1);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Hand the processed frame to all registered listeners
+ */
+static void HOT_ATTR notify_listeners(void)
+{
+    for (int i = 0; i < MAX_FRAME_LISTENERS; i++) {
+        adc_frame_listener_t fn = listeners[i].fn;
+        if (fn) {
+            fn(&frame, listeners[i].arg);
+        }
+    }
+}
+
+/**
+ * @brief Completion time of the frame just read
+ *
+ * Only known for the newest completed frame: the ISR keeps one time
+ * stamp. Frames that waited behind others in the driver pool get 0.
+ *
+ * @return esp_timer time of the conversion-done interrupt, or 0
+ */
+static int64_t HOT_ATTR conv_done_time(void)
+{
+    uint32_t s1, s2;
+    int64_t t;
+
+    do {
+        s1 = __atomic_load_n(&conv_done_seq, __ATOMIC_ACQUIRE);
+        t = conv_done_us;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&conv_done_seq, __ATOMIC_RELAXED);
+    } while (s1 != s2 || (s1 & 1));
+
+    return s1 / 2 == frames_read ? t : 0;
+}
+
+/**
+ * @brief Filter one sample of a channel into the frame
+ *
+ * Called with adc_mutex held.
+ *
+ * @param[in] ch Channel index
+ * @param[in] raw Raw sample
+ */
+FILTER_FN void HOT_ATTR process_sample(uint8_t ch, uint32_t raw)
+{
+    adc_channel_data_t *d = &channel_data[ch];
+
+    if (hist_bins != NULL && ch == hist_ch) {
+        hist_bins[raw]++;
+        hist_samples++;
+    }
+    uint32_t in = raw;
+    if (lin_lut[ch] != NULL) {
+        /* Corrections at the ends may leave the code range */
+        int32_t c = (int32_t)raw + lin_lut[ch][raw];
+        in = c < 0 ? 0 : MIN(c, ADC_MAX - 1);
+    }
+    if (!d->seeded) {
+        seed_filters(ch, in);
+    }
+    d->raw_value = raw;
+    uint32_t hyst = running_hyst(ch, in);
+    d->normalized_value = (d->filter == ADC_FILTER_ALPHA_BETA)
+                              ? alpha_beta(ch, hyst) : running_average(ch, hyst);
+
+    frame.raw[ch] = raw;
+    if (frame.count[ch] < ADC_FRAME_MAX_SAMPLES) {
+        frame.unfiltered[ch][frame.count[ch]] = in;
+        frame.samples[ch][frame.count[ch]++] = d->normalized_value;
+    } else {
+        errors.frame_overflow++;
+    }
+}
+
+#if CONFIG_ADC_SPECIALIZED
+/**
+ * @brief Filter the samples of a frame, specialized for the channel list
+ *
+ * The channel search becomes a switch with one case per configured
+ * channel, each with its own inlined copy of the filters on a constant
+ * channel index. The mutex is taken once per frame instead of per sample;
+ * a frame that cannot get it is not processed, as with the generic path.
+ *
+ * @param[in] ret_num Number of bytes in the result buffer
+ */
+static void HOT_ATTR process_samples(uint32_t ret_num)
+{
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+        return;
+    }
+
+#define X_SAMPLE(i, phys) \
+    case (phys) & 0x7: process_sample(i, p->type1.data); break;
+
+    for (uint32_t i = 0; i < ret_num; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t*)&result[i];
+
+        switch (p->type1.channel) {
+        ADC_CHANNEL_LIST(X_SAMPLE)
+        default:
+            break;
+        }
+    }
+#undef X_SAMPLE
+
+    xSemaphoreGive(adc_mutex);
+}
+#else
+/**
+ * @brief Filter the samples of a frame
+ *
+ * @param[in] ret_num Number of bytes in the result buffer
+ */
+static void HOT_ATTR process_samples(uint32_t ret_num)
+{
+    for (uint32_t i = 0; i < ret_num; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t*)&result[i];
+
+        /* Find which channel this sample belongs to */
+        for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+            if ((physical_channels[ch] & 0x7) == p->type1.channel) {
+                if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+                    process_sample(ch, p->type1.data);
+                    xSemaphoreGive(adc_mutex);
+                }
+                break;
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Filter one frame and hand it on
+ *
+ * @param[in] ret_num Number of bytes in the result buffer
+ */
+static void HOT_ATTR process_frame(uint32_t ret_num)
+{
+    errors.conversions++;
+    frames_read++;
+    frame.seq++;
+    frame.timestamp_us = esp_timer_get_time();
+    frame.conv_done_us = conv_done_time();
+    bzero(frame.count, sizeof(frame.count));
+
+    process_samples(ret_num);
+
+#if CONFIG_ADC_SKEW_CORRECT
+    skew_correct();
+#endif
+#if ADC_VIRT_CHANNELS > 0
+    vchan_eval(&frame);
+#endif
+#if CONFIG_PID
+    /* Control output first, ahead of the mutex and the listeners */
+    pid_run(&frame);
+#endif
+#if CONFIG_ADC_HISTORY
+    history_update(&frame);
+#endif
+    publish_snapshot();
+    notify_listeners();
+}
+
 /**
  * @brief ADC processing task
- * 
+ *
+ * After a flash operation several frames are waiting in the driver pool
+ * while the notification count was cleared at once, so every wake-up
+ * drains the pool completely.
+ *
  * @param[in] p Task parameter (unused)
  */
-static void task_adc(void *p)
+static void HOT_ATTR task_adc(void *p)
 {
-    ESP_LOGD(TAG, "Enter task_adc");
+    HOT_LOGD("Enter task_adc");
     ESP_ERROR_CHECK(adc_continuous_start(handle));
+    bool first = true;
+    int64_t idle_since = esp_timer_get_time();
 
     for(;;) {
         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-        esp_err_t ret;
-        uint32_t ret_num;
-    
-        ret = adc_continuous_read(handle, result, READ_BUFFER_SIZE, &ret_num, 0);
-        
-        if (ret == ESP_OK) {
-            errors.conversions++;
-            
-            /* Process all samples in the buffer */
-            for (uint32_t i = 0; i < ret_num; i += SOC_ADC_DIGI_RESULT_BYTES) {
-                adc_digi_output_data_t *p = (adc_digi_output_data_t*)&result[i];
-                
-                /* Find which channel this sample belongs to */
-                for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
-                    if ((physical_channels[ch] & 0x7) == p->type1.channel) {
-                        if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-                            uint32_t raw = p->type1.data;
-                            channel_data[ch].raw_value = raw;
-                            channel_data[ch].normalized_value = 
-                                running_average(ch, running_hyst(ch, raw));
-                            xSemaphoreGive(adc_mutex);
-                        }
-                        break;
-                    }
+#if CONFIG_ADC_PM_LOCK
+        /* Full speed only while there is work, between frames the
+           frequency may drop or the system light-sleep */
+        esp_pm_lock_acquire(pm_lock);
+#endif
+        int64_t wake = esp_timer_get_time();
+
+        for (int n = 0; ; n++) {
+            uint32_t ret_num;
+            esp_err_t ret = adc_continuous_read(handle, result, READ_BUFFER_SIZE, &ret_num, 0);
+
+            if (ret == ESP_OK) {
+                process_frame(ret_num);
+                if (first) {
+                    /* Filters are seeded, this output is already valid */
+                    boot_prof_mark("adc first sample");
+                    first = false;
                 }
+                continue;
             }
-        } else if (ret == ESP_ERR_TIMEOUT) {
-            errors.timeout++;
-        } else {
-            errors.read_errors++;
+            if (ret != ESP_ERR_TIMEOUT) {
+                errors.read_errors++;
+            } else if (n == 0) {
+                errors.timeout++;
+            }
+            /* Pool is empty, every completed frame was read or dropped */
+            frames_read = __atomic_load_n(&conv_done_seq, __ATOMIC_ACQUIRE) / 2;
+            break;
         }
+
+        /* Pool is empty: the longest time until the next frame */
+        flash_svc_window();
+
+        int64_t now = esp_timer_get_time();
+        taskENTER_CRITICAL(&power_lock);
+        power.idle_us += wake - idle_since;
+        power.busy_us += now - wake;
+        power.max_busy_us = MAX(power.max_busy_us, now - wake);
+        power.wakeups++;
+        taskEXIT_CRITICAL(&power_lock);
+        idle_since = now;
+#if CONFIG_ADC_PM_LOCK
+        esp_pm_lock_release(pm_lock);
+#endif
     }
 }
 
 /**
- * @brief Save channel configuration to NVS
- * 
- * @param[in] channel Channel index
+ * @brief Write channel configuration to NVS (flash service task)
+ *
+ * Reads the configuration when it runs, so merged requests store the
+ * latest values.
+ *
+ * @param[in] ctx Channel index (uint8_t)
  * @return ESP_OK on success
  */
-static esp_err_t save_channel_config(uint8_t channel)
+static esp_err_t write_channel_config(void *ctx)
 {
-    if (!chk_chn(channel)) {
-        return ESP_ERR_INVALID_ARG;
-    }
+    uint8_t channel = *(uint8_t *)ctx;
 
     nvs_handle_t nvs;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
@@ -348,6 +964,19 @@ static esp_err_t save_channel_config(uint8_t channel)
     snprintf(key, sizeof(key), NVS_KEY_HYST_FMT, channel);
     err = nvs_set_u32(nvs, key, channel_data[channel].r_hyst.hysteresis);
     if (err != ESP_OK) goto cleanup;
+
+    /* Save smoothing filter */
+    snprintf(key, sizeof(key), NVS_KEY_FILT_FMT, channel);
+    err = nvs_set_u32(nvs, key, channel_data[channel].filter);
+    if (err != ESP_OK) goto cleanup;
+
+    snprintf(key, sizeof(key), NVS_KEY_Q_FMT, channel);
+    err = nvs_set_u32(nvs, key, channel_data[channel].q);
+    if (err != ESP_OK) goto cleanup;
+
+    snprintf(key, sizeof(key), NVS_KEY_R_FMT, channel);
+    err = nvs_set_u32(nvs, key, channel_data[channel].r);
+    if (err != ESP_OK) goto cleanup;
     
     err = nvs_commit(nvs);
 
@@ -356,6 +985,23 @@ cleanup:
     return err;
 }
 
+/**
+ * @brief Save channel configuration to NVS
+ *
+ * @param[in] channel Channel index
+ * @return ESP_OK on success
+ */
+static esp_err_t save_channel_config(uint8_t channel)
+{
+    if (!chk_chn(channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", channel);
+    return flash_svc_run(key, write_channel_config, &channel, sizeof(channel));
+}
+
 /**
  * @brief Load channel configuration from NVS
  * 
@@ -398,6 +1044,25 @@ static esp_err_t load_channel_config(uint8_t channel)
         channel_data[channel].r_hyst.hysteresis = value;
     }
 
+    /* Load smoothing filter */
+    snprintf(key, sizeof(key), NVS_KEY_FILT_FMT, channel);
+    err = nvs_get_u32(nvs, key, &value);
+    if (err == ESP_OK && value <= ADC_FILTER_ALPHA_BETA) {
+        channel_data[channel].filter = value;
+    }
+
+    snprintf(key, sizeof(key), NVS_KEY_Q_FMT, channel);
+    err = nvs_get_u32(nvs, key, &value);
+    if (err == ESP_OK && value >= 1 && value <= AB_NOISE_MAX) {
+        channel_data[channel].q = value;
+    }
+
+    snprintf(key, sizeof(key), NVS_KEY_R_FMT, channel);
+    err = nvs_get_u32(nvs, key, &value);
+    if (err == ESP_OK && value >= 1 && value <= AB_NOISE_MAX) {
+        channel_data[channel].r = value;
+    }
+
     nvs_close(nvs);
     return ESP_OK;
 }
@@ -406,6 +1071,94 @@ static esp_err_t load_channel_config(uint8_t channel)
  * @brief Public API implementations
  */
 
+#if CONFIG_ADC_RTC_RETAIN
+/**
+ * @brief Seal the copy kept current by the ADC task
+ *
+ * Lock-free, only sets the layout fields and the checksum. A copy torn
+ * by a stalled ADC task stays unsealed and is not restored.
+ */
+static void retain_seal(void)
+{
+    __atomic_store_n(&retain_sealed, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&retain_copying, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    retained.magic = RETAIN_MAGIC;
+    retained.channels = ADC_MAX_CHANNELS;
+    retained.avg_size = RUNNING_AVG_SIZE;
+    retained.crc = esp_rom_crc32_le(0, (const uint8_t *)&retained, offsetof(adc_retained_t, crc));
+}
+
+/**
+ * @brief Shutdown handler (esp_restart)
+ *
+ * Takes the ADC mutex so the ADC task is not in the middle of a copy;
+ * once sealed the ADC task stops updating it.
+ */
+static void retain_on_restart(void)
+{
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(20)) == pdTRUE) {
+        retain_seal();
+        xSemaphoreGive(adc_mutex);
+    }
+}
+
+/**
+ * @brief Deep sleep hook, must not call blocking FreeRTOS APIs
+ */
+static void retain_on_deep_sleep(void)
+{
+    retain_seal();
+}
+
+/**
+ * @brief Restore the filter state saved before the restart or deep sleep
+ *
+ * Channels whose calibration changed meanwhile start cold. The copy is
+ * invalidated, so a later crash does not bring back stale state.
+ *
+ * @return Number of channels restored
+ */
+static int retain_restore(void)
+{
+    int restored = 0;
+
+    if (retained.magic == RETAIN_MAGIC
+        && retained.channels == ADC_MAX_CHANNELS
+        && retained.avg_size == RUNNING_AVG_SIZE
+        && retained.crc == esp_rom_crc32_le(0, (const uint8_t *)&retained,
+                                            offsetof(adc_retained_t, crc))) {
+        for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+            adc_channel_data_t *d = &channel_data[ch];
+            if (!retained.ch[ch].seeded
+                || retained.ch[ch].min_cal != d->min_cal
+                || retained.ch[ch].max_cal != d->max_cal
+                || retained.ch[ch].r_hyst.hysteresis != d->r_hyst.hysteresis
+                || retained.ch[ch].r_avg.ptr >= RUNNING_AVG_SIZE
+                || retained.ch[ch].filter != d->filter
+                || retained.ch[ch].r_ab.alpha != d->r_ab.alpha
+                || retained.ch[ch].r_ab.beta != d->r_ab.beta) {
+                continue;
+            }
+            d->r_hyst = retained.ch[ch].r_hyst;
+            d->r_avg = retained.ch[ch].r_avg;
+            d->r_ab = retained.ch[ch].r_ab;
+            d->raw_value = retained.ch[ch].raw_value;
+            d->normalized_value = retained.ch[ch].normalized_value;
+            d->seeded = true;
+            restored++;
+        }
+        errors = retained.stats;
+        frame.seq = retained.frame_seq;
+    }
+
+    retained.magic = 0;
+    return restored;
+}
+#endif
+
 BaseType_t adc_init(void)
 {
     esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
@@ -425,37 +1178,12 @@ BaseType_t adc_init(void)
     bzero(&errors, sizeof(errors));
 
     /* Initialize channel data with defaults from Kconfig */
-    const uint32_t default_mins[] = {
-        CONFIG_ADC_CH0_MIN, CONFIG_ADC_CH1_MIN,
-#if ADC_MAX_CHANNELS >= 3
-        CONFIG_ADC_CH2_MIN,
-#endif
-#if ADC_MAX_CHANNELS >= 4
-        CONFIG_ADC_CH3_MIN,
-#endif
-#if ADC_MAX_CHANNELS >= 5
-        CONFIG_ADC_CH4_MIN,
-#endif
-#if ADC_MAX_CHANNELS >= 6
-        CONFIG_ADC_CH5_MIN,
-#endif
-    };
-
-    const uint32_t default_maxs[] = {
-        CONFIG_ADC_CH0_MAX, CONFIG_ADC_CH1_MAX,
-#if ADC_MAX_CHANNELS >= 3
-        CONFIG_ADC_CH2_MAX,
-#endif
-#if ADC_MAX_CHANNELS >= 4
-        CONFIG_ADC_CH3_MAX,
-#endif
-#if ADC_MAX_CHANNELS >= 5
-        CONFIG_ADC_CH4_MAX,
-#endif
-#if ADC_MAX_CHANNELS >= 6
-        CONFIG_ADC_CH5_MAX,
-#endif
-    };
+#define X_MIN(i, phys)      CONFIG_ADC_CH##i##_MIN,
+#define X_MAX(i, phys)      CONFIG_ADC_CH##i##_MAX,
+    const uint32_t default_mins[] = { ADC_CHANNEL_LIST(X_MIN) };
+    const uint32_t default_maxs[] = { ADC_CHANNEL_LIST(X_MAX) };
+#undef X_MIN
+#undef X_MAX
 
     for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
         bzero(&channel_data[ch], sizeof(adc_channel_data_t));
@@ -466,31 +1194,60 @@ BaseType_t adc_init(void)
         channel_data[ch].r_hyst.min = default_mins[ch];
         channel_data[ch].r_hyst.max = default_mins[ch] + CONFIG_ADC_HYSTERESIS;
         channel_data[ch].r_hyst.hysteresis = CONFIG_ADC_HYSTERESIS;
+        channel_data[ch].filter = ADC_FILTER_AVERAGE;
+        channel_data[ch].q = AB_Q_DEFAULT;
+        channel_data[ch].r = AB_R_DEFAULT;
         
         /* Try to load from NVS */
         load_channel_config(ch);
+        ab_gains(&channel_data[ch]);
         
-        ESP_LOGI(TAG, "Ch%d: min=%"PRIu32", max=%"PRIu32", hyst=%"PRIu32,
+        ESP_LOGI(TAG, "Ch%d: min=%"PRIu32", max=%"PRIu32", hyst=%"PRIu32", filter=%s",
                  ch, channel_data[ch].min_cal, channel_data[ch].max_cal,
-                 channel_data[ch].r_hyst.hysteresis);
+                 channel_data[ch].r_hyst.hysteresis,
+                 channel_data[ch].filter == ADC_FILTER_ALPHA_BETA ? "alpha-beta" : "average");
+    }
+
+#if CONFIG_ADC_RTC_RETAIN
+    int restored = retain_restore();
+    if (restored > 0) {
+        ESP_LOGI(TAG, "Filter state of %d channels restored from RTC memory", restored);
     }
+    ESP_ERROR_CHECK(esp_register_shutdown_handler(retain_on_restart));
+    ESP_ERROR_CHECK(esp_deep_sleep_register_hook(retain_on_deep_sleep));
+#endif
+
+#if CONFIG_ADC_PM_LOCK
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "adc", &pm_lock) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create PM lock");
+        return pdFAIL;
+    }
+#endif
+
+#if CONFIG_ADC_SKEW_CORRECT
+    skew_init();
+#endif
 
     /* Register callbacks */
     adc_continuous_evt_cbs_t cbs = {
         .on_conv_done = s_conv_done_cb,
+        .on_pool_ovf = s_pool_ovf_cb,
     };
     ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(handle, &cbs, NULL));
 
-    /* Register commands */
-    register_cmd();
-
     /* Create task */
     BaseType_t res = xTaskCreate(task_adc, "adc", 4096, NULL, 
                                  uxTaskPriorityGet(NULL), &task_handle);
+    boot_prof_mark("adc started");
     
     return res;
 }
 
+void adc_register_commands(void)
+{
+    register_cmd();
+}
+
 BaseType_t adc_deinit(void)
 {
     if (task_handle) {
@@ -512,6 +1269,103 @@ BaseType_t adc_deinit(void)
     return pdPASS;
 }
 
+esp_err_t adc_read_snapshot(adc_snapshot_t *snap)
+{
+    if (snap == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < SNAPSHOT_RETRIES; i++) {
+        uint32_t seq = __atomic_load_n(&snapshot_seq, __ATOMIC_ACQUIRE);
+        if (seq == 0) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (seq & 1) {
+            continue;
+        }
+
+        *snap = snapshot;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED) == seq) {
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t adc_add_frame_listener(adc_frame_listener_t fn, void *arg)
+{
+    if (fn == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&listeners_lock);
+    for (int i = 0; i < MAX_FRAME_LISTENERS; i++) {
+        if (listeners[i].fn == NULL) {
+            listeners[i].arg = arg;
+            listeners[i].fn = fn;
+            err = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&listeners_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "All %d frame listener slots are used", MAX_FRAME_LISTENERS);
+    }
+    return err;
+}
+
+esp_err_t adc_get_stats(adc_stats_t *stats)
+{
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *stats = errors;
+    return ESP_OK;
+}
+
+esp_err_t adc_get_power(adc_power_t *out)
+{
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&power_lock);
+    *out = power;
+    taskEXIT_CRITICAL(&power_lock);
+    return ESP_OK;
+}
+
+esp_err_t adc_get_status(adc_channel_status_t *status, TickType_t wait)
+{
+    if (status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(adc_mutex, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        status[ch].raw = channel_data[ch].raw_value;
+        status[ch].normalized = channel_data[ch].normalized_value;
+        status[ch].min_cal = channel_data[ch].min_cal;
+        status[ch].max_cal = channel_data[ch].max_cal;
+        status[ch].hysteresis = channel_data[ch].r_hyst.hysteresis;
+        status[ch].filter = channel_data[ch].filter;
+        status[ch].rate = channel_rate(&channel_data[ch]);
+    }
+
+    xSemaphoreGive(adc_mutex);
+
+    return ESP_OK;
+}
+
 esp_err_t adc_get_normalized(uint8_t channel, uint32_t *v, TickType_t wait)
 {
     if (!chk_chn(channel) || v == NULL) {
@@ -584,7 +1438,7 @@ esp_err_t adc_get_calibration(uint8_t channel, uint32_t *min, uint32_t *max)
 
 esp_err_t adc_set_hysteresis(uint8_t channel, uint32_t hysteresis)
 {
-    if (!chk_chn(channel) || hysteresis == 0 || hysteresis > 1000) {
+    if (!chk_chn(channel) || hysteresis == 0 || hysteresis > ADC_HYSTERESIS_MAX) {
         return ESP_ERR_INVALID_ARG;
     }
 
@@ -616,6 +1470,163 @@ esp_err_t adc_get_hysteresis(uint8_t channel, uint32_t *hysteresis)
     return ESP_OK;
 }
 
+esp_err_t adc_set_filter(uint8_t channel, adc_filter_t filter, uint32_t q, uint32_t r)
+{
+    if (!chk_chn(channel) || filter > ADC_FILTER_ALPHA_BETA
+        || q < 1 || q > AB_NOISE_MAX || r < 1 || r > AB_NOISE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    adc_channel_data_t *d = &channel_data[channel];
+    d->filter = filter;
+    d->q = q;
+    d->r = r;
+    ab_gains(d);
+    /* Continue from the current output without a jump */
+    seed_smoothing(d, d->normalized_value);
+
+    xSemaphoreGive(adc_mutex);
+
+    return save_channel_config(channel);
+}
+
+esp_err_t adc_get_filter(uint8_t channel, adc_filter_t *filter, uint32_t *q, uint32_t *r)
+{
+    if (!chk_chn(channel) || filter == NULL || q == NULL || r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    *filter = (adc_filter_t)channel_data[channel].filter;
+    *q = channel_data[channel].q;
+    *r = channel_data[channel].r;
+
+    xSemaphoreGive(adc_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t adc_get_rate(uint8_t channel, int32_t *rate, TickType_t wait)
+{
+    if (!chk_chn(channel) || rate == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(adc_mutex, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    *rate = channel_rate(&channel_data[channel]);
+    xSemaphoreGive(adc_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t adc_set_linearity(uint8_t channel, const int8_t *lut)
+{
+    if (!chk_chn(channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int8_t *copy = NULL;
+    if (lut != NULL) {
+        copy = malloc(ADC_CODES);
+        if (copy == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        /* Keep code + correction within the code range, no clamp per sample */
+        for (int k = 0; k < ADC_CODES; k++) {
+            copy[k] = MIN(MAX(lut[k], -k), ADC_CODES - 1 - k);
+        }
+    }
+
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        free(copy);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    int8_t *old = lin_lut[channel];
+    lin_lut[channel] = copy;
+
+    xSemaphoreGive(adc_mutex);
+
+    free(old);
+    return ESP_OK;
+}
+
+esp_err_t adc_get_linearity(uint8_t channel, int8_t *lut)
+{
+    if (!chk_chn(channel) || lut == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (lin_lut[channel] != NULL) {
+        memcpy(lut, lin_lut[channel], ADC_CODES);
+        err = ESP_OK;
+    }
+
+    xSemaphoreGive(adc_mutex);
+
+    return err;
+}
+
+esp_err_t adc_histogram_start(uint8_t channel, uint32_t *bins)
+{
+    if (!chk_chn(channel) || bins == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(bins, 0, ADC_CODES * sizeof(uint32_t));
+
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (hist_bins == NULL) {
+        hist_ch = channel;
+        hist_samples = 0;
+        hist_bins = bins;
+        err = ESP_OK;
+    }
+
+    xSemaphoreGive(adc_mutex);
+
+    return err;
+}
+
+esp_err_t adc_histogram_stop(uint32_t *samples)
+{
+    if (xSemaphoreTake(adc_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (hist_bins != NULL) {
+        hist_bins = NULL;
+        if (samples != NULL) {
+            *samples = hist_samples;
+        }
+        err = ESP_OK;
+    }
+
+    xSemaphoreGive(adc_mutex);
+
+    return err;
+}
+
 /**
  * @brief Command line interface implementation
  */
@@ -627,9 +1638,13 @@ struct {
     struct arg_int *min;
     struct arg_int *max;
     struct arg_int *hyst;
+    struct arg_str *filter;
+    struct arg_int *q;
+    struct arg_int *r;
     struct arg_lit *status;
     struct arg_lit *calibrate;
     struct arg_lit *errors_flag;
+    struct arg_lit *power_flag;
     struct arg_end *end;
 } args;
 
@@ -655,7 +1670,9 @@ static void print_channel_status(uint8_t channel)
         return;
     }
 
-    uint32_t raw, norm, min, max, hyst;
+    uint32_t raw, norm, min, max, hyst, q, r;
+    adc_filter_t filter;
+    int32_t rate;
     
     if (adc_get_raw(channel, &raw, pdMS_TO_TICKS(100)) != ESP_OK) {
         printf("Ch%d: Failed to read raw value\n", channel);
@@ -677,11 +1694,23 @@ static void print_channel_status(uint8_t channel)
         return;
     }
 
+    if (adc_get_filter(channel, &filter, &q, &r) != ESP_OK
+        || adc_get_rate(channel, &rate, pdMS_TO_TICKS(100)) != ESP_OK) {
+        printf("Ch%d: Failed to read filter\n", channel);
+        return;
+    }
+
     printf("-- Channel %d --\n", channel);
     printf("  Raw: %"PRIu32"\n", raw);
     printf("  Normalized: %"PRIu32"\n", norm);
     printf("  Calibration: min=%"PRIu32", max=%"PRIu32"\n", min, max);
     printf("  Hysteresis: %"PRIu32"\n", hyst);
+    if (filter == ADC_FILTER_ALPHA_BETA) {
+        printf("  Filter: alpha-beta (q=%"PRIu32", r=%"PRIu32")\n", q, r);
+        printf("  Rate: %"PRId32" counts/s\n", rate);
+    } else {
+        printf("  Filter: average (%d samples)\n", RUNNING_AVG_SIZE);
+    }
 }
 
 /**
@@ -694,6 +1723,36 @@ static void print_errors(void)
     printf("  Invalid channel: %"PRIu32"\n", errors.invalid_channel);
     printf("  Read errors: %"PRIu32"\n", errors.read_errors);
     printf("  Timeouts: %"PRIu32"\n", errors.timeout);
+    printf("  Frame overflows: %"PRIu32"\n", errors.frame_overflow);
+    printf("  Pool overflows: %"PRIu32"\n", errors.pool_overflow);
+}
+
+/**
+ * @brief Print busy/idle time of the ADC task
+ */
+static void print_power(void)
+{
+    adc_power_t p;
+    adc_get_power(&p);
+    int64_t total = p.busy_us + p.idle_us;
+
+    printf("-- Power --\n");
+#if CONFIG_ADC_PM_LOCK
+    printf("  PM lock: held while processing\n");
+    printf("  Between frames: 80 MHz (driver APB lock), no light sleep while acquiring\n");
+#else
+    printf("  PM lock: disabled\n");
+#endif
+    printf("  Wake-ups: %"PRIu32"\n", p.wakeups);
+    printf("  Busy: %"PRId64" ms (%.2f%%)\n", p.busy_us / 1000,
+           total ? 100.0 * p.busy_us / total : 0.0);
+    printf("  Idle: %"PRId64" ms (%.2f%%)\n", p.idle_us / 1000,
+           total ? 100.0 * p.idle_us / total : 0.0);
+    printf("  Longest wake-up: %"PRId64" us\n", p.max_busy_us);
+#if CONFIG_PM_PROFILING
+    /* Time per power mode and lock */
+    esp_pm_dump_locks(stdout);
+#endif
 }
 
 /**
@@ -701,6 +1760,18 @@ static void print_errors(void)
  */
 static int cmd_adc(int argc, char **argv)
 {
+#if CONFIG_ADC_FREQ
+    /* Subcommand with its own arguments */
+    if (argc > 1 && strcmp(argv[1], "freq") == 0) {
+        return freq_cmd(argc - 1, argv + 1);
+    }
+#endif
+#if CONFIG_ADC_HISTORY
+    if (argc > 1 && strcmp(argv[1], "history") == 0) {
+        return history_cmd(argc - 1, argv + 1);
+    }
+#endif
+
     int nerrors = arg_parse(argc, argv, (void *)&args);
     
     if (nerrors || args.help->count > 0) {
@@ -726,6 +1797,12 @@ static int cmd_adc(int argc, char **argv)
         return 0;
     }
 
+    /* Handle power statistics */
+    if (args.power_flag->count > 0) {
+        print_power();
+        return 0;
+    }
+
     /* Handle calibration */
     if (args.calibrate->count > 0) {
         if (args.channel->count == 0) {
@@ -755,6 +1832,39 @@ static int cmd_adc(int argc, char **argv)
                 return 1;
             }
         }
+
+        if (args.filter->count > 0 || args.q->count > 0 || args.r->count > 0) {
+            adc_filter_t filter;
+            uint32_t q, r;
+            esp_err_t err = adc_get_filter(ch, &filter, &q, &r);
+            if (err == ESP_OK && args.filter->count > 0) {
+                const char *f = args.filter->sval[0];
+                if (strcmp(f, "avg") == 0 || strcmp(f, "0") == 0) {
+                    filter = ADC_FILTER_AVERAGE;
+                } else if (strcmp(f, "ab") == 0 || strcmp(f, "1") == 0) {
+                    filter = ADC_FILTER_ALPHA_BETA;
+                } else {
+                    printf("Unknown filter '%s' (avg or ab)\n", f);
+                    return 1;
+                }
+            }
+            if (args.q->count > 0) {
+                q = args.q->ival[0];
+            }
+            if (args.r->count > 0) {
+                r = args.r->ival[0];
+            }
+            if (err == ESP_OK) {
+                err = adc_set_filter(ch, filter, q, r);
+            }
+            if (err == ESP_OK) {
+                printf("Ch%d filter set: %s (q=%"PRIu32", r=%"PRIu32")\n", ch,
+                       filter == ADC_FILTER_ALPHA_BETA ? "alpha-beta" : "average", q, r);
+            } else {
+                printf("Failed to set filter: %s\n", esp_err_to_name(err));
+                return 1;
+            }
+        }
         
         return 0;
     }
@@ -773,10 +1883,14 @@ static void register_cmd(void)
     args.min = arg_int0("m", "min", "<value>", "Minimum calibration value");
     args.max = arg_int0("M", "max", "<value>", "Maximum calibration value");
     args.hyst = arg_int0("y", "hyst", "<value>", "Hysteresis value");
+    args.filter = arg_str0("f", "filter", "<avg|ab>", "Smoothing filter");
+    args.q = arg_int0("Q", "q", "<value>", "Alpha-beta process noise");
+    args.r = arg_int0("R", "r", "<value>", "Alpha-beta measurement noise");
     args.status = arg_litn("s", "status", 0, 1, "Show channel status");
     args.calibrate = arg_litn("C", "calibrate", 0, 1, "Set calibration");
     args.errors_flag = arg_litn("e", "errors", 0, 1, "Show error statistics");
-    args.end = arg_end(8);
+    args.power_flag = arg_litn("p", "power", 0, 1, "Show busy/idle time");
+    args.end = arg_end(12);
     
     esp_console_cmd_t cmd = {
         .argtable = &args,
@@ -788,7 +1902,15 @@ static void register_cmd(void)
                 "  adc -s -c 0         Show channel 0\n"
                 "  adc -C -c 0 -m 100 -M 3900  Calibrate channel 0\n"
                 "  adc -C -c 1 -y 50   Set hysteresis for channel 1\n"
+                "  adc -C -c 2 -f ab -Q 1 -R 100  Alpha-beta filter on channel 2\n"
                 "  adc -e              Show error statistics\n"
+                "  adc -p              Show busy/idle time\n"
+#if CONFIG_ADC_FREQ
+                "  adc freq            Frequency/period measurement (adc freq -h)\n"
+#endif
+#if CONFIG_ADC_HISTORY
+                "  adc history         Min/max/mean history (adc history -h)\n"
+#endif
     };
 
     esp_console_cmd_register(&cmd);
@@ -10,20 +10,164 @@
 #ifndef ADC_H
 #define ADC_H
 
+#include <stdint.h>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "esp_err.h"
+#include "soc/soc_caps.h"
+
+/* Configuration from Kconfig */
+#ifndef CONFIG_ADC_MAX_CHANNELS
+#define ADC_MAX_CHANNELS 4
+#else
+#define ADC_MAX_CHANNELS CONFIG_ADC_MAX_CHANNELS
+#endif
+
+/** Virtual channels computed from expressions, following the physical ones */
+#ifndef CONFIG_ADC_VIRT_CHANNELS
+#define ADC_VIRT_CHANNELS 0
+#else
+#define ADC_VIRT_CHANNELS CONFIG_ADC_VIRT_CHANNELS
+#endif
+
+/** Physical plus virtual channels of a frame */
+#define ADC_TOTAL_CHANNELS (ADC_MAX_CHANNELS + ADC_VIRT_CHANNELS)
+
+/** Codes of the converter (12-bit results) */
+#define ADC_CODES                   (1 << 12)
+
+/** Largest hysteresis accepted by adc_set_hysteresis() */
+#define ADC_HYSTERESIS_MAX          1000
+
+/** Sampling frequency of the whole scan pattern (all channels together) */
+#define ADC_SAMPLE_FREQ_HZ          20000
+
+/** Size of one DMA conversion frame in bytes */
+#define ADC_READ_BUFFER_SIZE        1024
+
+/** Conversion frames per second, rounded down (39 at 20 kHz) */
+#define ADC_FRAME_RATE_HZ \
+    (ADC_SAMPLE_FREQ_HZ / (ADC_READ_BUFFER_SIZE / SOC_ADC_DIGI_RESULT_BYTES))
+
+/** Upper bound of samples one channel can get in one conversion frame */
+#define ADC_FRAME_MAX_SAMPLES \
+    ((ADC_READ_BUFFER_SIZE / SOC_ADC_DIGI_RESULT_BYTES + ADC_MAX_CHANNELS - 1) / ADC_MAX_CHANNELS)
+
+/**
+ * @brief One processed conversion frame
+ *
+ * Filled by the ADC task after every drained DMA frame and handed to the
+ * registered frame listeners. Entries ADC_MAX_CHANNELS and up of count
+ * and samples hold the virtual channels (see vchan.h); an undefined
+ * virtual channel has no samples.
+ *
+ * samples went through hysteresis and the smoothing filter, which add
+ * lag and distort the waveform. Consumers that need amplitude and phase
+ * (power, correlation) use unfiltered instead: the same samples after
+ * linearity correction only, moved onto a common time grid with
+ * ADC_SKEW_CORRECT. It has count[ch] entries per physical channel.
+ */
+typedef struct {
+    uint32_t seq;                                          /**< Frame sequence number */
+    int64_t timestamp_us;                                  /**< esp_timer time the frame was drained */
+    int64_t conv_done_us;                                  /**< esp_timer time the DMA frame completed, 0 if it waited in the pool */
+    uint32_t raw[ADC_MAX_CHANNELS];                        /**< Latest raw value per channel */
+    uint16_t count[ADC_TOTAL_CHANNELS];                    /**< Number of samples per channel */
+    uint16_t samples[ADC_TOTAL_CHANNELS][ADC_FRAME_MAX_SAMPLES]; /**< Normalized samples, then virtual channels */
+    uint16_t unfiltered[ADC_MAX_CHANNELS][ADC_FRAME_MAX_SAMPLES]; /**< Samples before hysteresis and filtering, skew-corrected; keep last */
+} adc_frame_t;
+
+/**
+ * @brief Frame listener callback
+ *
+ * Called from the ADC task after a frame has been processed. The frame is
+ * only valid during the call. The callback must not block.
+ *
+ * @param[in] frame Processed frame
+ * @param[in] arg User argument given at registration
+ */
+typedef void (*adc_frame_listener_t)(const adc_frame_t *frame, void *arg);
+
+/**
+ * @brief ADC error and conversion statistics
+ */
+typedef struct {
+    uint32_t conversions;       /**< Frames read successfully */
+    uint32_t invalid_channel;   /**< Samples of unknown channels */
+    uint32_t read_errors;       /**< Failed frame reads */
+    uint32_t timeout;           /**< Frame read timeouts */
+    uint32_t frame_overflow;    /**< Samples not fitting into adc_frame_t */
+    uint32_t pool_overflow;     /**< Frames dropped by the driver, task too slow */
+} adc_stats_t;
+
+/**
+ * @brief Time the ADC task spent processing and waiting
+ *
+ * While processing a frame the task holds a power management lock at
+ * maximum CPU frequency; while waiting the system may lower the
+ * frequency or enter light sleep.
+ */
+typedef struct {
+    int64_t busy_us;            /**< Lock held, draining and processing frames */
+    int64_t idle_us;            /**< Waiting for the next frame */
+    int64_t max_busy_us;        /**< Longest single wake-up */
+    uint32_t wakeups;           /**< Task wake-ups */
+} adc_power_t;
+
+/**
+ * @brief Smoothing filter after the hysteresis stage
+ */
+typedef enum {
+    ADC_FILTER_AVERAGE = 0,     /**< Boxcar over RUNNING_AVG_SIZE samples */
+    ADC_FILTER_ALPHA_BETA,      /**< Steady-state Kalman (alpha-beta) tracker with rate */
+} adc_filter_t;
+
+/**
+ * @brief Copy of the state of one channel
+ */
+typedef struct {
+    uint32_t raw;               /**< Latest raw ADC value */
+    uint32_t normalized;        /**< Processed value */
+    uint32_t min_cal;           /**< Calibration minimum */
+    uint32_t max_cal;           /**< Calibration maximum */
+    uint32_t hysteresis;        /**< Hysteresis value */
+    uint32_t filter;            /**< adc_filter_t */
+    int32_t rate;               /**< Rate of change (counts/s), 0 with the average filter */
+} adc_channel_status_t;
+
+/**
+ * @brief Consistent copy of all channels, published after every frame
+ */
+typedef struct {
+    uint32_t frame_seq;                         /**< Sequence number of the frame */
+    int64_t timestamp_us;                       /**< Time the frame was drained */
+    adc_channel_status_t ch[ADC_MAX_CHANNELS];  /**< Channel values and settings */
+#if ADC_VIRT_CHANNELS > 0
+    uint32_t virt[ADC_VIRT_CHANNELS];           /**< Latest value of each virtual channel */
+#endif
+} adc_snapshot_t;
 
 /**
  * @brief Initialize the ADC subsystem
  * 
  * Initializes all configured ADC channels, creates the processing task,
- * and loads calibration data from NVS flash memory.
+ * and loads calibration data from NVS flash memory, which must be
+ * initialized already (con_nvs_init()). Commands are registered
+ * separately by adc_register_commands().
  * 
  * @return pdPASS if initialization successful, pdFAIL otherwise
  * @note This function is NULL-safe
  */
 BaseType_t adc_init(void);
 
+/**
+ * @brief Register the `adc` console commands
+ *
+ * Separate from adc_init() so acquisition can start before the console
+ * is initialized (BOOT_FAST_START).
+ */
+void adc_register_commands(void);
+
 /**
  * @brief Deinitialize the ADC subsystem
  * 
@@ -37,8 +181,8 @@ BaseType_t adc_deinit(void);
 /**
  * @brief Get normalized ADC value for a specific channel
  * 
- * Returns the processed ADC value after applying running average
- * and hysteresis filtering. The value is normalized based on the
+ * Returns the processed ADC value after applying running average (or
+ * alpha-beta) and hysteresis filtering. The value is normalized based on the
  * channel's min/max configuration.
  * 
  * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
@@ -101,13 +245,58 @@ esp_err_t adc_get_calibration(uint8_t channel, uint32_t *min, uint32_t *max);
  * Sets the hysteresis threshold and stores it in NVS flash.
  * 
  * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
- * @param[in] hysteresis Hysteresis value (1-1000)
+ * @param[in] hysteresis Hysteresis value (1-ADC_HYSTERESIS_MAX)
  * @return ESP_OK if successful
  *         ESP_ERR_INVALID_ARG if channel or hysteresis is invalid
  * @note This function is NULL-safe and thread-safe
  */
 esp_err_t adc_set_hysteresis(uint8_t channel, uint32_t hysteresis);
 
+/**
+ * @brief Select the smoothing filter of a channel
+ *
+ * The alpha-beta filter tracks value and rate of change; its gains are
+ * the steady-state Kalman gains for process noise q (variance of the
+ * change in rate per sample) and measurement noise r (variance of the
+ * samples). Only the ratio q/r matters: smaller values smooth more and
+ * lag more. The filter restarts from the current value. Stored in NVS.
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[in] filter Filter type
+ * @param[in] q Process noise (alpha-beta only, 1 or more)
+ * @param[in] r Measurement noise (alpha-beta only, 1 or more)
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel, filter, q or r is invalid
+ * @note This function is thread-safe
+ */
+esp_err_t adc_set_filter(uint8_t channel, adc_filter_t filter, uint32_t q, uint32_t r);
+
+/**
+ * @brief Get the smoothing filter of a channel
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[out] filter Filter type
+ * @param[out] q Process noise
+ * @param[out] r Measurement noise
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or a pointer is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_get_filter(uint8_t channel, adc_filter_t *filter, uint32_t *q, uint32_t *r);
+
+/**
+ * @brief Get the rate of change estimated by the alpha-beta filter
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[out] rate Rate in normalized counts per second, 0 with the average filter
+ * @param[in] wait Maximum time to wait for the mutex (in ticks)
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or rate is NULL
+ *         ESP_ERR_TIMEOUT if the mutex could not be taken
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_get_rate(uint8_t channel, int32_t *rate, TickType_t wait);
+
 /**
  * @brief Get hysteresis value for a channel
  * 
@@ -121,4 +310,123 @@ esp_err_t adc_set_hysteresis(uint8_t channel, uint32_t hysteresis);
  */
 esp_err_t adc_get_hysteresis(uint8_t channel, uint32_t *hysteresis);
 
+/**
+ * @brief Install a linearity correction for a channel
+ *
+ * Every raw code k is replaced by k + lut[k] before filtering; raw values
+ * reported by the API stay uncorrected. Entries are limited so the result
+ * stays within 0..ADC_CODES-1. The table is copied.
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[in] lut ADC_CODES corrections in codes, NULL to remove the correction
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid
+ *         ESP_ERR_NO_MEM if the table could not be allocated
+ *         ESP_ERR_TIMEOUT if mutex timeout
+ * @note This function is thread-safe
+ */
+esp_err_t adc_set_linearity(uint8_t channel, const int8_t *lut);
+
+/**
+ * @brief Get the linearity correction of a channel
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[out] lut Buffer for ADC_CODES corrections
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or lut is NULL
+ *         ESP_ERR_NOT_FOUND if the channel has no correction
+ *         ESP_ERR_TIMEOUT if mutex timeout
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_get_linearity(uint8_t channel, int8_t *lut);
+
+/**
+ * @brief Start counting the raw codes of a channel
+ *
+ * From the next sample on, bins[code] is incremented for every raw sample
+ * of the channel (before the linearity correction). Only one histogram
+ * runs at a time.
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[in] bins ADC_CODES counters, cleared here, owned by the caller until stopped
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or bins is NULL
+ *         ESP_ERR_INVALID_STATE if a histogram is already running
+ *         ESP_ERR_TIMEOUT if mutex timeout
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_histogram_start(uint8_t channel, uint32_t *bins);
+
+/**
+ * @brief Stop counting raw codes
+ *
+ * @param[out] samples Samples counted, may be NULL
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_STATE if no histogram is running
+ *         ESP_ERR_TIMEOUT if mutex timeout
+ * @note This function is thread-safe
+ */
+esp_err_t adc_histogram_stop(uint32_t *samples);
+
+/**
+ * @brief Get a copy of the error statistics
+ *
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if stats is NULL
+ * @note This function is NULL-safe
+ */
+esp_err_t adc_get_stats(adc_stats_t *stats);
+
+/**
+ * @brief Get the busy/idle time of the ADC task
+ *
+ * @param[out] power Pointer to store the times
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if power is NULL
+ * @note This function is NULL-safe
+ */
+esp_err_t adc_get_power(adc_power_t *power);
+
+/**
+ * @brief Get a copy of the state of all channels
+ *
+ * The mutex is held only while the channel data is copied.
+ *
+ * @param[out] status Array of ADC_MAX_CHANNELS entries
+ * @param[in] wait Maximum time to wait for the mutex (in ticks)
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if status is NULL
+ *         ESP_ERR_TIMEOUT if mutex timeout
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_get_status(adc_channel_status_t *status, TickType_t wait);
+
+/**
+ * @brief Read the snapshot published by the ADC task
+ *
+ * Lock-free: the ADC task never waits for readers and readers never take
+ * the ADC mutex. A reader retries while the snapshot is being rewritten.
+ *
+ * @param[out] snap Pointer to store the snapshot
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if snap is NULL
+ *         ESP_ERR_INVALID_STATE if no frame has been processed yet
+ *         ESP_ERR_TIMEOUT if no consistent copy could be taken
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_read_snapshot(adc_snapshot_t *snap);
+
+/**
+ * @brief Register a processed frame listener
+ *
+ * @param[in] fn Listener callback
+ * @param[in] arg User argument passed to the callback
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if fn is NULL
+ *         ESP_ERR_NO_MEM if all 12 listener slots are used (logged)
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t adc_add_frame_listener(adc_frame_listener_t fn, void *arg);
+
 #endif /* ADC_H */
\ No newline at end of file
@@ -0,0 +1,1020 @@
+/**
+ * @file alarm.c
+ * @brief Limit alarms with deadband, time qualification and event log
+ *
+ * The frame listener reduces every enabled channel of a frame to its
+ * minimum, maximum and mean in one pass, then checks the five limits
+ * against those: low limits against the minimum, high limits against the
+ * maximum and the rate limit against the change of the frame mean. The
+ * qualification timer runs on frame timestamps.
+ *
+ * Events leave the ADC task through a queue. The alarm task numbers them,
+ * appends them to the log backlog and hands them to the subscribers. The
+ * log is a file of CONFIG_ALARM_LOG_EVENTS fixed-size records, event n
+ * going to slot n modulo the size, so the newest events overwrite the
+ * oldest and the numbering is recovered at boot from the highest valid
+ * record. Writes go through the flash service, which merges them while a
+ * write is pending.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+#include "econsole.h"
+
+#include "adc.h"
+#include "alarm.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define LOG_PATH        CON_DATA_PATH "/alarms.bin"
+#define LOG_EVENTS      CONFIG_ALARM_LOG_EVENTS
+#define LOG_BACKLOG     32          /* Events waiting for the flash service */
+#define QUEUE_LEN       CONFIG_ALARM_QUEUE_LEN
+#define TASK_STACK_SIZE 3072
+#define LIST_DEFAULT    20          /* Events shown by `alarm -L` */
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "alarm"
+#define NVS_KEY_FMT     "ch%u"
+
+/**
+ * @brief Processing state of one channel (ADC task only)
+ */
+typedef struct {
+    int64_t since[ALARM_KINDS]; /**< Frame a limit was first exceeded, -1 if not */
+    int64_t prev_us;            /**< Timestamp of the previous frame */
+    int32_t prev_mean;          /**< Mean of the previous frame */
+    bool primed;                /**< prev_us and prev_mean are valid */
+} ch_state_t;
+
+/**
+ * @brief Read request handed to the flash service
+ */
+typedef struct {
+    uint32_t seq;               /**< Newest event to read */
+    alarm_event_t *events;
+    size_t n;
+    size_t *read;
+} log_read_op_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "alarm";
+static const char *const KIND_NAMES[ALARM_KINDS] = { "lolo", "lo", "hi", "hihi", "roc" };
+static const char *const TYPE_NAMES[] = { "raise", "clear", "ack" };
+
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE out_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE log_lock = portMUX_INITIALIZER_UNLOCKED;
+static alarm_cfg_t cfg[ADC_TOTAL_CHANNELS];
+static uint32_t cfg_gen[ADC_TOTAL_CHANNELS];    /* Incremented on every configuration change */
+static uint32_t state_gen[ADC_TOTAL_CHANNELS];  /* Used by the listener only */
+static ch_state_t state[ADC_TOTAL_CHANNELS];
+static alarm_state_t alarms[ADC_TOTAL_CHANNELS][ALARM_KINDS];
+static alarm_stats_t stats;
+
+static QueueHandle_t event_queue;
+static struct {
+    alarm_subscriber_t fn;
+    void *arg;
+} subscribers[ALARM_MAX_SUBSCRIBERS];
+
+/* Log backlog, written by the alarm task and drained by the flash service */
+static bool log_ok;
+static alarm_event_t backlog[LOG_BACKLOG];
+static uint32_t backlog_head;
+static uint32_t backlog_count;
+
+/**
+ * @brief Check if channel index is valid
+ */
+static inline bool chk_ch(uint8_t channel)
+{
+    return channel < ADC_TOTAL_CHANNELS;
+}
+
+/**
+ * @brief CRC of an event record
+ */
+static uint16_t event_crc(const alarm_event_t *ev)
+{
+    return esp_rom_crc16_le(0, (const uint8_t *)ev, offsetof(alarm_event_t, crc));
+}
+
+/**
+ * @brief Pass an event to the alarm task
+ *
+ * @param[in] ev Event without number
+ * @param[in] wait Time to wait for queue space
+ */
+static void post(const alarm_event_t *ev, TickType_t wait)
+{
+    if (xQueueSend(event_queue, ev, wait) != pdTRUE) {
+        taskENTER_CRITICAL(&out_lock);
+        stats.dropped++;
+        taskEXIT_CRITICAL(&out_lock);
+    }
+}
+
+/**
+ * @brief Return the alarms of a channel to normal
+ */
+static void state_reset(uint8_t ch)
+{
+    ch_state_t *st = &state[ch];
+
+    memset(st, 0, sizeof(*st));
+    for (int k = 0; k < ALARM_KINDS; k++) {
+        st->since[k] = -1;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    for (int k = 0; k < ALARM_KINDS; k++) {
+        uint32_t raised = alarms[ch][k].raised;
+        memset(&alarms[ch][k], 0, sizeof(alarm_state_t));
+        alarms[ch][k].raised = raised;
+    }
+    taskEXIT_CRITICAL(&out_lock);
+}
+
+/**
+ * @brief Advance one alarm by a frame
+ *
+ * @param[in] ch Channel
+ * @param[in] kind Alarm kind
+ * @param[in] exceeded Limit exceeded in this frame
+ * @param[in] returned Value back past the limit by the deadband in this frame
+ * @param[in] value Value reported with the event
+ * @param[in] now_us Frame timestamp
+ * @param[in] delay_us Qualification time
+ */
+static void evaluate(uint8_t ch, uint8_t kind, bool exceeded, bool returned,
+                     int32_t value, int64_t now_us, int64_t delay_us)
+{
+    int64_t *since = &state[ch].since[kind];
+    alarm_state_t *a = &alarms[ch][kind];
+    alarm_event_t ev = {
+        .uptime_ms = now_us / 1000,
+        .value = value,
+        .channel = ch,
+        .kind = kind,
+    };
+
+    /* Only this task changes active, no lock needed to read it */
+    if (!a->active) {
+        if (!exceeded) {
+            *since = -1;
+            return;
+        }
+        if (*since < 0) {
+            *since = now_us;
+        }
+        if (now_us - *since < delay_us) {
+            return;
+        }
+        taskENTER_CRITICAL(&out_lock);
+        a->active = true;
+        a->unacked = true;
+        a->value = value;
+        a->raised++;
+        stats.raised++;
+        taskEXIT_CRITICAL(&out_lock);
+        ev.type = ALARM_EV_RAISE;
+    } else {
+        if (!returned) {
+            return;
+        }
+        *since = -1;
+        taskENTER_CRITICAL(&out_lock);
+        a->active = false;
+        a->value = value;
+        stats.cleared++;
+        taskEXIT_CRITICAL(&out_lock);
+        ev.type = ALARM_EV_CLEAR;
+    }
+
+    post(&ev, 0);
+}
+
+/**
+ * @brief Check the limits of one channel against a frame
+ */
+static void process_channel(uint8_t ch, const alarm_cfg_t *c, const uint16_t *s, uint16_t n,
+                            int64_t now_us)
+{
+    ch_state_t *st = &state[ch];
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    int64_t sum = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        const int32_t x = s[i];
+        lo = (x < lo) ? x : lo;
+        hi = (x > hi) ? x : hi;
+        sum += x;
+    }
+
+    const int32_t mean = sum / n;
+    const int64_t delay_us = (int64_t)c->delay_ms * 1000;
+    const int32_t *lim = c->limit;
+
+    for (uint8_t k = ALARM_LOLO; k <= ALARM_LO; k++) {
+        if (c->enabled & (1 << k)) {
+            evaluate(ch, k, lo < lim[k], lo > lim[k] + c->deadband, lo, now_us, delay_us);
+        }
+    }
+    for (uint8_t k = ALARM_HI; k <= ALARM_HIHI; k++) {
+        if (c->enabled & (1 << k)) {
+            evaluate(ch, k, hi > lim[k], hi < lim[k] - c->deadband, hi, now_us, delay_us);
+        }
+    }
+
+    if ((c->enabled & (1 << ALARM_ROC)) && st->primed && now_us > st->prev_us) {
+        const int32_t rate = (int64_t)(mean - st->prev_mean) * 1000000 / (now_us - st->prev_us);
+        const int32_t mag = abs(rate);
+        evaluate(ch, ALARM_ROC, mag > lim[ALARM_ROC],
+                 mag < lim[ALARM_ROC] - c->roc_deadband, rate, now_us, delay_us);
+    }
+
+    st->prev_us = now_us;
+    st->prev_mean = mean;
+    st->primed = true;
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    alarm_cfg_t c[ADC_TOTAL_CHANNELS];
+    uint32_t gen[ADC_TOTAL_CHANNELS];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(c, cfg, sizeof(c));
+    memcpy(gen, cfg_gen, sizeof(gen));
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (gen[ch] != state_gen[ch]) {
+            /* Configuration changed, start over */
+            state_reset(ch);
+            state_gen[ch] = gen[ch];
+        }
+        if (c[ch].enabled && f->count[ch] > 0) {
+            process_channel(ch, &c[ch], f->samples[ch], f->count[ch], f->timestamp_us);
+        }
+    }
+}
+
+/**
+ * @brief Write the log backlog (flash service task)
+ *
+ * @param[in] ctx Unused
+ * @return ESP_OK on success
+ */
+static esp_err_t write_log(void *ctx)
+{
+    FILE *f = fopen(LOG_PATH, "r+b");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = ESP_OK;
+    for (;;) {
+        alarm_event_t ev;
+
+        taskENTER_CRITICAL(&log_lock);
+        bool any = backlog_count > 0;
+        if (any) {
+            ev = backlog[(backlog_head - backlog_count) % LOG_BACKLOG];
+            backlog_count--;
+        }
+        taskEXIT_CRITICAL(&log_lock);
+        if (!any) {
+            break;
+        }
+
+        bool ok = fseek(f, (long)(ev.seq % LOG_EVENTS) * sizeof(ev), SEEK_SET) == 0
+                  && fwrite(&ev, sizeof(ev), 1, f) == 1;
+        taskENTER_CRITICAL(&out_lock);
+        if (ok) {
+            stats.logged++;
+        } else {
+            stats.log_dropped++;
+        }
+        taskEXIT_CRITICAL(&out_lock);
+        if (!ok) {
+            err = ESP_FAIL;
+        }
+    }
+
+    if (fclose(f) != 0) {
+        err = ESP_FAIL;
+    }
+    return err;
+}
+
+/**
+ * @brief Read events from the log file (flash service task)
+ *
+ * @param[in] ctx Request (log_read_op_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t read_log(void *ctx)
+{
+    const log_read_op_t *op = ctx;
+    FILE *f = fopen(LOG_PATH, "rb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+
+    uint32_t seq = op->seq;
+    while (*op->read < op->n && seq > 0) {
+        alarm_event_t ev;
+        if (fseek(f, (long)(seq % LOG_EVENTS) * sizeof(ev), SEEK_SET) != 0
+            || fread(&ev, sizeof(ev), 1, f) != 1
+            || ev.seq != seq || ev.crc != event_crc(&ev)) {
+            /* Overwritten or never written: end of the log */
+            break;
+        }
+        op->events[(*op->read)++] = ev;
+        seq--;
+    }
+
+    fclose(f);
+    return ESP_OK;
+}
+
+/**
+ * @brief Recover the event numbering from the log (flash service task)
+ *
+ * A log of another size is replaced by an empty one.
+ *
+ * @param[in] ctx Unused
+ * @return ESP_OK if the log can be used
+ */
+static esp_err_t open_log(void *ctx)
+{
+    uint32_t last_seq = 0;
+    uint16_t last_boot = 0;
+    long size = -1;
+
+    FILE *f = fopen(LOG_PATH, "rb");
+    if (f != NULL) {
+        alarm_event_t ev;
+        while (fread(&ev, sizeof(ev), 1, f) == 1) {
+            if (ev.seq > last_seq && ev.crc == event_crc(&ev)) {
+                last_seq = ev.seq;
+                last_boot = ev.boot;
+            }
+        }
+        size = ftell(f);
+        fclose(f);
+    }
+
+    stats.next_seq = last_seq + 1;
+    stats.boot = last_boot + 1;
+
+    if (size == (long)(LOG_EVENTS * sizeof(alarm_event_t))) {
+        return ESP_OK;
+    }
+
+    f = fopen(LOG_PATH, "wb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    static const alarm_event_t blank;
+    bool ok = true;
+    for (int i = 0; i < LOG_EVENTS && ok; i++) {
+        ok = fwrite(&blank, sizeof(blank), 1, f) == 1;
+    }
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Alarm task: number, log and forward the events
+ */
+static void task_alarm(void *p)
+{
+    alarm_event_t ev;
+
+    for (;;) {
+        xQueueReceive(event_queue, &ev, portMAX_DELAY);
+
+        taskENTER_CRITICAL(&out_lock);
+        ev.seq = stats.next_seq++;
+        ev.boot = stats.boot;
+        taskEXIT_CRITICAL(&out_lock);
+        ev.crc = event_crc(&ev);
+
+        if (ev.type == ALARM_EV_RAISE) {
+            ESP_LOGW(TAG, "#%"PRIu32" ch%u %s raised, value %"PRId32,
+                     ev.seq, ev.channel, KIND_NAMES[ev.kind], ev.value);
+        } else {
+            ESP_LOGI(TAG, "#%"PRIu32" ch%u %s %s", ev.seq, ev.channel,
+                     KIND_NAMES[ev.kind], TYPE_NAMES[ev.type]);
+        }
+
+        if (log_ok) {
+            bool full;
+            taskENTER_CRITICAL(&log_lock);
+            full = backlog_count == LOG_BACKLOG;
+            backlog[backlog_head++ % LOG_BACKLOG] = ev;
+            if (!full) {
+                backlog_count++;
+            }
+            taskEXIT_CRITICAL(&log_lock);
+
+            /* Merged with a pending write, which then writes this event too */
+            flash_svc_submit(LOG_PATH, write_log, NULL, 0, NULL, NULL, pdMS_TO_TICKS(100));
+            if (full) {
+                taskENTER_CRITICAL(&out_lock);
+                stats.log_dropped++;
+                taskEXIT_CRITICAL(&out_lock);
+            }
+        } else {
+            taskENTER_CRITICAL(&out_lock);
+            stats.log_dropped++;
+            taskEXIT_CRITICAL(&out_lock);
+        }
+
+        for (int i = 0; i < ALARM_MAX_SUBSCRIBERS; i++) {
+            taskENTER_CRITICAL(&cfg_lock);
+            alarm_subscriber_t fn = subscribers[i].fn;
+            void *arg = subscribers[i].arg;
+            taskEXIT_CRITICAL(&cfg_lock);
+            if (fn != NULL) {
+                fn(&ev, arg);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Write the configuration of a channel to NVS (flash service task)
+ *
+ * @param[in] ctx Channel index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_cfg(void *ctx)
+{
+    uint8_t ch = *(uint8_t *)ctx;
+    alarm_cfg_t c;
+
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[ch];
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, ch);
+    err = nvs_set_blob(nvs, key, &c, sizeof(c));
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Load the configuration of all channels from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        char key[16];
+        alarm_cfg_t c;
+        size_t len = sizeof(c);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, ch);
+        if (nvs_get_blob(nvs, key, &c, &len) == ESP_OK && len == sizeof(c)) {
+            taskENTER_CRITICAL(&cfg_lock);
+            cfg[ch] = c;
+            taskEXIT_CRITICAL(&cfg_lock);
+        }
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t alarm_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        cfg[ch] = (alarm_cfg_t){
+            .deadband = CONFIG_ALARM_DEADBAND,
+            .limit = { 0, 0, 4095, 4095, 4095 },
+        };
+        cfg_gen[ch]++;      /* Reset the state on the first frame */
+    }
+    load_config();
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (cfg[ch].enabled) {
+            ESP_LOGI(TAG, "Ch%u: alarms 0x%02x, deadband %u, delay %u ms",
+                     ch, cfg[ch].enabled, cfg[ch].deadband, cfg[ch].delay_ms);
+        }
+    }
+
+    if (con_data_mounted()) {
+        log_ok = flash_svc_run(LOG_PATH, open_log, NULL, 0) == ESP_OK;
+    }
+    if (log_ok) {
+        ESP_LOGI(TAG, "Event log %s, boot %u, next event #%"PRIu32,
+                 LOG_PATH, stats.boot, stats.next_seq);
+    } else {
+        stats.next_seq = 1;
+        ESP_LOGW(TAG, "Event log unavailable, events are not persisted");
+    }
+
+    event_queue = xQueueCreate(QUEUE_LEN, sizeof(alarm_event_t));
+    if (event_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create event queue");
+        return pdFAIL;
+    }
+
+    if (xTaskCreate(task_alarm, "alarm", TASK_STACK_SIZE, NULL,
+                    CONFIG_ALARM_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        return pdFAIL;
+    }
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t alarm_set_config(uint8_t channel, const alarm_cfg_t *c)
+{
+    if (!chk_ch(channel) || c == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    cfg[channel] = *c;
+    cfg_gen[channel]++;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", channel);
+    return flash_svc_run(key, write_cfg, &channel, sizeof(channel));
+}
+
+esp_err_t alarm_get_config(uint8_t channel, alarm_cfg_t *c)
+{
+    if (!chk_ch(channel) || c == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    *c = cfg[channel];
+    taskEXIT_CRITICAL(&cfg_lock);
+    return ESP_OK;
+}
+
+esp_err_t alarm_get_state(uint8_t channel, alarm_kind_t kind, alarm_state_t *s)
+{
+    if (!chk_ch(channel) || kind >= ALARM_KINDS || s == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *s = alarms[channel][kind];
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+esp_err_t alarm_ack(uint8_t channel, uint8_t kind, uint32_t *count)
+{
+    if ((channel != ALARM_ALL && !chk_ch(channel))
+        || (kind != ALARM_ALL && kind >= ALARM_KINDS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t n = 0;
+    int64_t now_us = esp_timer_get_time();
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (channel != ALARM_ALL && ch != channel) {
+            continue;
+        }
+        for (uint8_t k = 0; k < ALARM_KINDS; k++) {
+            if (kind != ALARM_ALL && k != kind) {
+                continue;
+            }
+
+            alarm_event_t ev = {
+                .uptime_ms = now_us / 1000,
+                .channel = ch,
+                .kind = k,
+                .type = ALARM_EV_ACK,
+            };
+            taskENTER_CRITICAL(&out_lock);
+            bool acked = alarms[ch][k].unacked;
+            if (acked) {
+                alarms[ch][k].unacked = false;
+                ev.value = alarms[ch][k].value;
+                stats.acked++;
+            }
+            taskEXIT_CRITICAL(&out_lock);
+
+            if (acked) {
+                post(&ev, pdMS_TO_TICKS(100));
+                n++;
+            }
+        }
+    }
+
+    if (count != NULL) {
+        *count = n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t alarm_subscribe(alarm_subscriber_t fn, void *arg)
+{
+    if (fn == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&cfg_lock);
+    for (int i = 0; i < ALARM_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].fn == NULL) {
+            subscribers[i].arg = arg;
+            subscribers[i].fn = fn;
+            err = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&cfg_lock);
+    return err;
+}
+
+esp_err_t alarm_log_read(uint32_t age, alarm_event_t *events, size_t n, size_t *read)
+{
+    if (events == NULL || read == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *read = 0;
+
+    if (!log_ok) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* Events numbered but not yet written are still in the backlog */
+    taskENTER_CRITICAL(&out_lock);
+    uint32_t newest = stats.next_seq - 1;
+    taskEXIT_CRITICAL(&out_lock);
+    uint32_t seq = (age < newest) ? newest - age : 0;
+
+    taskENTER_CRITICAL(&log_lock);
+    for (uint32_t i = 0; i < backlog_count && *read < n; i++) {
+        const alarm_event_t *ev = &backlog[(backlog_head - 1 - i) % LOG_BACKLOG];
+        if (ev->seq == seq && seq > 0) {
+            events[(*read)++] = *ev;
+            seq--;
+        }
+    }
+    taskEXIT_CRITICAL(&log_lock);
+
+    if (*read == n || seq == 0) {
+        return ESP_OK;
+    }
+
+    log_read_op_t op = {
+        .seq = seq,
+        .events = events,
+        .n = n,
+        .read = read,
+    };
+    /* Own key, a read must not replace a pending write */
+    return flash_svc_run(LOG_PATH "?r", read_log, &op, sizeof(op));
+}
+
+esp_err_t alarm_get_stats(alarm_stats_t *s)
+{
+    if (s == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *s = stats;
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *channel;
+    struct arg_str *kind;
+    struct arg_int *limit;
+    struct arg_int *deadband;
+    struct arg_int *roc_deadband;
+    struct arg_int *delay;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_lit *ack;
+    struct arg_int *list;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Limit alarms\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Look up an alarm kind by name
+ *
+ * @return Kind, ALARM_KINDS if unknown
+ */
+static uint8_t kind_by_name(const char *name)
+{
+    for (uint8_t k = 0; k < ALARM_KINDS; k++) {
+        if (strcmp(name, KIND_NAMES[k]) == 0) {
+            return k;
+        }
+    }
+    return ALARM_KINDS;
+}
+
+/**
+ * @brief Print the configuration and state of one channel
+ */
+static void print_channel(uint8_t ch)
+{
+    alarm_cfg_t c;
+    alarm_get_config(ch, &c);
+
+    printf("-- Ch%u --\n", ch);
+    printf("  Deadband: %u counts, %u counts/s; delay %u ms\n",
+           c.deadband, c.roc_deadband, c.delay_ms);
+    for (uint8_t k = 0; k < ALARM_KINDS; k++) {
+        alarm_state_t s;
+        alarm_get_state(ch, k, &s);
+        printf("  %-4s %-8s limit %6"PRId32"%s  %s%s  raised %"PRIu32"\n",
+               KIND_NAMES[k], (c.enabled & (1 << k)) ? "enabled" : "off",
+               c.limit[k], k == ALARM_ROC ? "/s" : "  ",
+               s.active ? "ACTIVE" : "normal", s.unacked ? " UNACK" : "", s.raised);
+    }
+}
+
+/**
+ * @brief Print the annunciated alarms and the statistics
+ */
+static void print_status(void)
+{
+    bool any = false;
+
+    printf("-- Alarms --\n");
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        for (uint8_t k = 0; k < ALARM_KINDS; k++) {
+            alarm_state_t s;
+            alarm_get_state(ch, k, &s);
+            if (s.active || s.unacked) {
+                printf("  ch%u %-4s %-7s%s value %"PRId32"\n", ch, KIND_NAMES[k],
+                       s.active ? "ACTIVE" : "cleared", s.unacked ? " UNACK" : "", s.value);
+                any = true;
+            }
+        }
+    }
+    if (!any) {
+        printf("  None\n");
+    }
+
+    alarm_stats_t st;
+    alarm_get_stats(&st);
+    printf("  Raised %"PRIu32", cleared %"PRIu32", acknowledged %"PRIu32", dropped %"PRIu32"\n",
+           st.raised, st.cleared, st.acked, st.dropped);
+    if (log_ok) {
+        printf("  Log: %s, %"PRIu32" written, %"PRIu32" lost, boot %u, next #%"PRIu32"\n",
+               LOG_PATH, st.logged, st.log_dropped, st.boot, st.next_seq);
+    } else {
+        printf("  Log: unavailable\n");
+    }
+}
+
+/**
+ * @brief Print the newest log events
+ */
+static void print_log(int n)
+{
+    alarm_event_t ev[8];
+    uint32_t age = 0;
+
+    while (n > 0) {
+        size_t read;
+        esp_err_t err = alarm_log_read(age, ev, MIN(n, 8), &read);
+        if (err != ESP_OK) {
+            printf("Failed to read the log: %s\n", esp_err_to_name(err));
+            return;
+        }
+        for (size_t i = 0; i < read; i++) {
+            printf("  #%-6"PRIu32" boot %-4u %9"PRIu32".%03"PRIu32" s  ch%u %-4s %-5s %"PRId32"\n",
+                   ev[i].seq, ev[i].boot, ev[i].uptime_ms / 1000, ev[i].uptime_ms % 1000,
+                   ev[i].channel, KIND_NAMES[ev[i].kind % ALARM_KINDS],
+                   TYPE_NAMES[ev[i].type % 3], ev[i].value);
+        }
+        if (read < MIN(n, 8)) {
+            break;
+        }
+        age += read;
+        n -= read;
+    }
+}
+
+/**
+ * @brief Alarm command handler
+ */
+static int cmd_alarm(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    uint8_t ch = ALARM_ALL;
+    if (args.channel->count > 0) {
+        if (args.channel->ival[0] < 0 || !chk_ch(args.channel->ival[0])) {
+            printf("Invalid channel %d (0-%d)\n", args.channel->ival[0], ADC_TOTAL_CHANNELS - 1);
+            return 1;
+        }
+        ch = args.channel->ival[0];
+    }
+
+    uint8_t kind = ALARM_ALL;
+    if (args.kind->count > 0) {
+        kind = kind_by_name(args.kind->sval[0]);
+        if (kind == ALARM_KINDS) {
+            printf("Unknown alarm '%s' (lolo, lo, hi, hihi, roc)\n", args.kind->sval[0]);
+            return 1;
+        }
+    }
+
+    if (args.ack->count > 0) {
+        uint32_t n;
+        alarm_ack(ch, kind, &n);
+        printf("%"PRIu32" alarm(s) acknowledged\n", n);
+        return 0;
+    }
+
+    if (args.list->count > 0) {
+        print_log(args.list->ival[0] > 0 ? args.list->ival[0] : LIST_DEFAULT);
+        return 0;
+    }
+
+    if (ch == ALARM_ALL) {
+        print_status();
+        return 0;
+    }
+
+    alarm_cfg_t c;
+    alarm_get_config(ch, &c);
+    bool changed = false;
+
+    if (args.limit->count > 0) {
+        if (kind == ALARM_ALL) {
+            printf("Limit needs an alarm (-k)\n");
+            return 1;
+        }
+        c.limit[kind] = args.limit->ival[0];
+        c.enabled |= 1 << kind;
+        changed = true;
+    }
+
+    const struct {
+        struct arg_int *arg;
+        uint16_t *field;
+    } u16s[] = {
+        { args.deadband, &c.deadband },
+        { args.roc_deadband, &c.roc_deadband },
+        { args.delay, &c.delay_ms },
+    };
+    for (size_t i = 0; i < sizeof(u16s) / sizeof(u16s[0]); i++) {
+        if (u16s[i].arg->count > 0) {
+            if (u16s[i].arg->ival[0] < 0 || u16s[i].arg->ival[0] > UINT16_MAX) {
+                printf("Invalid value %d\n", u16s[i].arg->ival[0]);
+                return 1;
+            }
+            *u16s[i].field = u16s[i].arg->ival[0];
+            changed = true;
+        }
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        uint8_t mask = (kind == ALARM_ALL) ? (1 << ALARM_KINDS) - 1 : 1 << kind;
+        if (args.enable->count > 0) {
+            c.enabled |= mask;
+        } else {
+            c.enabled &= ~mask;
+        }
+        changed = true;
+    }
+
+    if (changed) {
+        esp_err_t err = alarm_set_config(ch, &c);
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    }
+    print_channel(ch);
+    return 0;
+}
+
+/**
+ * @brief Register alarm commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.channel = arg_int0("c", "channel", "<ch>", "Channel");
+    args.kind = arg_str0("k", "kind", "<lolo|lo|hi|hihi|roc>", "Alarm");
+    args.limit = arg_int0("l", "limit", "<value>", "Limit (counts, roc: counts/s), enables the alarm");
+    args.deadband = arg_int0("b", "deadband", "<counts>", "Deadband of the level alarms");
+    args.roc_deadband = arg_int0("B", "roc-deadband", "<counts/s>", "Deadband of the rate alarm");
+    args.delay = arg_int0("t", "delay", "<ms>", "Time a limit must be exceeded");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable the alarm (all without -k)");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable the alarm (all without -k)");
+    args.ack = arg_litn("a", "ack", 0, 1, "Acknowledge (all, or filtered by -c/-k)");
+    args.list = arg_int0("L", "log", "<n>", "Show the newest n logged events");
+    args.end = arg_end(11);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "alarm",
+        .func = cmd_alarm,
+        .help = "Limit alarms checked on every sample\n"
+                "Examples:\n"
+                "  alarm                          Show annunciated alarms\n"
+                "  alarm -c 0 -k hi -l 3500       High alarm on ch0\n"
+                "  alarm -c 0 -b 50 -t 200        Deadband 50, raise after 200 ms\n"
+                "  alarm -c 1 -k roc -l 2000      Rate alarm, 2000 counts/s\n"
+                "  alarm -a                       Acknowledge all\n"
+                "  alarm -L 20                    Show the event log\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,209 @@
+/**
+ * @file alarm.h
+ * @brief Limit alarms with deadband, time qualification and event log
+ *
+ * Every channel, virtual channels included, has low-low, low, high,
+ * high-high and rate-of-change limits. They are checked against every
+ * sample of every frame in the ADC task, so excursions shorter than any
+ * polling interval are caught. A limit has to be exceeded for the
+ * qualification time before its alarm is raised, and the value has to
+ * return past the limit by the deadband before it clears.
+ *
+ * Alarms latch: a raised alarm stays annunciated until it is acknowledged,
+ * even after it cleared. Raise, clear and acknowledge events are numbered,
+ * written to a ring log on /data and forwarded to the subscribers.
+ *
+ * Configured and acknowledged with the `alarm` command; the configuration
+ * is stored in NVS.
+ */
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+#define ALARM_MAX_SUBSCRIBERS   4       /**< Event subscribers */
+#define ALARM_ALL               0xFF    /**< Any channel or kind, for alarm_ack() */
+
+/**
+ * @brief Alarm kinds, one limit each
+ */
+typedef enum {
+    ALARM_LOLO = 0,             /**< Below the low-low limit */
+    ALARM_LO,                   /**< Below the low limit */
+    ALARM_HI,                   /**< Above the high limit */
+    ALARM_HIHI,                 /**< Above the high-high limit */
+    ALARM_ROC,                  /**< Rate of change above the limit (either direction) */
+    ALARM_KINDS
+} alarm_kind_t;
+
+/**
+ * @brief Event types
+ */
+typedef enum {
+    ALARM_EV_RAISE = 0,         /**< Limit exceeded for the qualification time */
+    ALARM_EV_CLEAR,             /**< Value back past the limit by the deadband */
+    ALARM_EV_ACK,               /**< Acknowledged */
+} alarm_event_type_t;
+
+/**
+ * @brief Alarm configuration of one channel
+ */
+typedef struct {
+    uint8_t enabled;            /**< Bit n enables alarm kind n */
+    uint8_t reserved;
+    uint16_t deadband;          /**< Counts past a level limit to clear */
+    uint16_t roc_deadband;      /**< Counts/s below the rate limit to clear */
+    uint16_t delay_ms;          /**< Time a limit must be exceeded to raise */
+    int32_t limit[ALARM_KINDS]; /**< Level limits in counts, rate limit in counts/s */
+} alarm_cfg_t;
+
+/**
+ * @brief Alarm event, also the record of the event log
+ */
+typedef struct {
+    uint32_t seq;               /**< Event number, continues across restarts */
+    uint32_t uptime_ms;         /**< Time since boot */
+    int32_t value;              /**< Peak sample (counts) or rate (counts/s) of the frame */
+    uint16_t boot;              /**< Boot the event happened in */
+    uint8_t channel;            /**< Channel, virtual channels included */
+    uint8_t kind;               /**< alarm_kind_t */
+    uint8_t type;               /**< alarm_event_type_t */
+    uint8_t reserved;
+    uint16_t crc;               /**< CRC16 of the record before this field */
+} alarm_event_t;
+
+/**
+ * @brief State of one alarm
+ */
+typedef struct {
+    bool active;                /**< Limit exceeded */
+    bool unacked;               /**< Raised and not acknowledged yet */
+    int32_t value;              /**< Value at the last raise or clear */
+    uint32_t raised;            /**< Times raised since boot */
+} alarm_state_t;
+
+/**
+ * @brief Engine statistics
+ */
+typedef struct {
+    uint32_t raised;            /**< Alarms raised */
+    uint32_t cleared;           /**< Alarms cleared */
+    uint32_t acked;             /**< Alarms acknowledged */
+    uint32_t dropped;           /**< Events lost because the event queue was full */
+    uint32_t logged;            /**< Events written to the log */
+    uint32_t log_dropped;       /**< Events not logged (log unavailable or backlog full) */
+    uint32_t next_seq;          /**< Number of the next event */
+    uint16_t boot;              /**< Current boot number */
+} alarm_stats_t;
+
+/**
+ * @brief Event subscriber (alarm task context, may block briefly)
+ *
+ * @param[in] event Event
+ * @param[in] arg User argument given to alarm_subscribe()
+ */
+typedef void (*alarm_subscriber_t)(const alarm_event_t *event, void *arg);
+
+/**
+ * @brief Initialize the alarm engine
+ *
+ * Loads the configuration from NVS, recovers the event numbering from the
+ * log, starts the alarm task, registers the frame listener and the
+ * `alarm` command. Call after adc_init() and con_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t alarm_init(void);
+
+/**
+ * @brief Configure the alarms of a channel
+ *
+ * The alarms of the channel restart from normal.
+ *
+ * @param[in] channel Channel index, virtual channels included
+ * @param[in] cfg Configuration
+ * @return ESP_OK if applied and stored
+ *         ESP_ERR_INVALID_ARG if channel is invalid or cfg is NULL
+ *         an NVS error if the configuration could not be stored
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_set_config(uint8_t channel, const alarm_cfg_t *cfg);
+
+/**
+ * @brief Get the alarm configuration of a channel
+ *
+ * @param[in] channel Channel index
+ * @param[out] cfg Pointer to store the configuration
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or cfg is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_get_config(uint8_t channel, alarm_cfg_t *cfg);
+
+/**
+ * @brief Get the state of one alarm
+ *
+ * @param[in] channel Channel index
+ * @param[in] kind Alarm kind
+ * @param[out] state Pointer to store the state
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel or kind is invalid or state is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_get_state(uint8_t channel, alarm_kind_t kind, alarm_state_t *state);
+
+/**
+ * @brief Acknowledge alarms
+ *
+ * @param[in] channel Channel index or ALARM_ALL
+ * @param[in] kind Alarm kind or ALARM_ALL
+ * @param[out] count Number of alarms acknowledged, may be NULL
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel or kind is invalid
+ * @note This function is thread-safe
+ */
+esp_err_t alarm_ack(uint8_t channel, uint8_t kind, uint32_t *count);
+
+/**
+ * @brief Forward every event to a function
+ *
+ * @param[in] fn Subscriber
+ * @param[in] arg User argument passed to the subscriber
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if fn is NULL
+ *         ESP_ERR_NO_MEM if all ALARM_MAX_SUBSCRIBERS slots are used
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_subscribe(alarm_subscriber_t fn, void *arg);
+
+/**
+ * @brief Read events from the log, newest first
+ *
+ * @param[in] age Events to skip, 0 to start with the newest
+ * @param[out] events Buffer for the events
+ * @param[in] n Buffer size in events
+ * @param[out] read Number of events stored
+ * @return ESP_OK if successful (read may be less than n at the end of the log)
+ *         ESP_ERR_INVALID_ARG if events or read is NULL
+ *         ESP_ERR_INVALID_STATE if the log is unavailable
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_log_read(uint32_t age, alarm_event_t *events, size_t n, size_t *read);
+
+/**
+ * @brief Get engine statistics
+ *
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if stats is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t alarm_get_stats(alarm_stats_t *stats);
+
+#endif /* ALARM_H */
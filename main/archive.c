@@ -0,0 +1,838 @@
+/**
+ * @file archive.c
+ * @brief Tiered min/max/mean archive on /data with rollup compaction
+ *
+ * Every tier is a directory of files numbered with 8 hex digits (8.3
+ * names) holding whole records, at most ARCHIVE_FILE_SIZE bytes each;
+ * the newest file is appended to, the oldest is the next to go. All file
+ * operations, appends, compaction and reads alike, run on the flash
+ * service, which is the only writer of the tier bookkeeping.
+ *
+ * Compaction folds the records of the oldest file into one record per
+ * period of the next tier: minimum of the minima, maximum of the maxima,
+ * mean of the means weighted by the seconds each covers. A period split
+ * across two files is merged into the newest record of the next tier.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "flash_svc.h"
+#include "econsole.h"
+
+#include "adc.h"
+#include "history.h"
+#include "archive.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define FILE_SIZE       CONFIG_ARCHIVE_FILE_SIZE
+#define FLUSH_RECORDS   CONFIG_ARCHIVE_FLUSH_S
+#define REC_SIZE        sizeof(archive_record_t)
+#define FILE_RECORDS    (FILE_SIZE / REC_SIZE)
+#define TASK_STACK_SIZE 3072
+#define PATH_LEN        32
+#define READ_CHUNK      8           /* Records read from a file at once */
+#define LIST_DEFAULT    20          /* Records shown by `archive -t` */
+#define CLOCK_SET_S     1600000000  /* Times below are seconds since boot */
+#define SVC_KEY         CON_DATA_PATH "/arc"
+
+#if CONFIG_ARCHIVE_BUDGET_1S < 2 * FILE_SIZE || CONFIG_ARCHIVE_BUDGET_1MIN < 2 * FILE_SIZE \
+    || CONFIG_ARCHIVE_BUDGET_1H < 2 * FILE_SIZE
+#error "Every ARCHIVE_BUDGET_* must be at least twice ARCHIVE_FILE_SIZE"
+#endif
+
+/**
+ * @brief Tier layout
+ */
+static const struct {
+    const char *name;           /**< Tier in the command */
+    const char *dir;            /**< Directory of the files */
+    uint32_t period_s;          /**< Time per record */
+    uint32_t budget;            /**< Byte budget */
+} tier_def[ARCHIVE_TIERS] = {
+    [ARCHIVE_1S]   = {"1s",   CON_DATA_PATH "/arc1s", 1,    CONFIG_ARCHIVE_BUDGET_1S},
+    [ARCHIVE_1MIN] = {"1min", CON_DATA_PATH "/arc1m", 60,   CONFIG_ARCHIVE_BUDGET_1MIN},
+    [ARCHIVE_1H]   = {"1h",   CON_DATA_PATH "/arc1h", 3600, CONFIG_ARCHIVE_BUDGET_1H},
+};
+
+/**
+ * @brief File bookkeeping of one tier (written on the flash service only)
+ */
+typedef struct {
+    uint32_t first;             /**< Number of the oldest file */
+    uint32_t nfiles;            /**< Files first .. first + nfiles - 1 */
+    uint32_t bytes;             /**< Bytes in all files */
+    uint32_t last_bytes;        /**< Bytes in the newest file */
+} tier_state_t;
+
+/**
+ * @brief Batch append handed to the flash service
+ */
+typedef struct {
+    const archive_record_t *records;
+    size_t n;
+} flush_op_t;
+
+/**
+ * @brief Read request handed to the flash service
+ */
+typedef struct {
+    archive_tier_t tier;
+    uint32_t age;
+    archive_record_t *records;
+    size_t n;
+    size_t *read;
+} read_op_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "archive";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static tier_state_t tiers[ARCHIVE_TIERS];
+static archive_stats_t stats;
+static bool archive_ok;
+static archive_record_t batch[FLUSH_RECORDS];
+
+/**
+ * @brief Check if tier is valid
+ */
+static inline bool chk_tier(archive_tier_t tier)
+{
+    return (unsigned)tier < ARCHIVE_TIERS;
+}
+
+/**
+ * @brief CRC of a record
+ */
+static uint16_t record_crc(const archive_record_t *r)
+{
+    return esp_rom_crc16_le(0, (const uint8_t *)r, offsetof(archive_record_t, crc));
+}
+
+/**
+ * @brief Path of a file of a tier
+ */
+static void file_path(int tier, uint32_t num, char *path)
+{
+    snprintf(path, PATH_LEN, "%s/%08"PRIx32, tier_def[tier].dir, num);
+}
+
+/**
+ * @brief Count statistics
+ */
+static void stats_add(uint32_t *counter, uint32_t n)
+{
+    taskENTER_CRITICAL(&lock);
+    *counter += n;
+    taskEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Append records to a tier, starting new files as needed (flash service task)
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t append(int tier, const archive_record_t *r, size_t n)
+{
+    tier_state_t *s = &tiers[tier];
+    char path[PATH_LEN];
+
+    while (n > 0) {
+        if (s->nfiles == 0 || s->last_bytes + REC_SIZE > FILE_SIZE) {
+            taskENTER_CRITICAL(&lock);
+            s->nfiles++;
+            s->last_bytes = 0;
+            taskEXIT_CRITICAL(&lock);
+        }
+
+        size_t k = MIN(n, (FILE_SIZE - s->last_bytes) / REC_SIZE);
+        file_path(tier, s->first + s->nfiles - 1, path);
+        FILE *f = fopen(path, "ab");
+        if (f == NULL) {
+            return ESP_FAIL;
+        }
+        size_t w = fwrite(r, REC_SIZE, k, f);
+        if (fclose(f) != 0) {
+            w = 0;
+        }
+
+        taskENTER_CRITICAL(&lock);
+        s->last_bytes += w * REC_SIZE;
+        s->bytes += w * REC_SIZE;
+        taskEXIT_CRITICAL(&lock);
+        if (w != k) {
+            return ESP_FAIL;
+        }
+        r += k;
+        n -= k;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Delete the oldest file of a tier (flash service task)
+ */
+static void remove_oldest(int tier)
+{
+    tier_state_t *s = &tiers[tier];
+    char path[PATH_LEN];
+    struct stat st;
+
+    file_path(tier, s->first, path);
+    uint32_t size = (stat(path, &st) == 0) ? st.st_size : 0;
+    remove(path);
+
+    taskENTER_CRITICAL(&lock);
+    s->bytes -= MIN(size, s->bytes);
+    s->first++;
+    s->nfiles--;
+    if (s->nfiles == 0) {
+        s->last_bytes = 0;
+    }
+    taskEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Finish a rollup record
+ */
+static void fold_emit(archive_record_t *out, const uint32_t *sum, uint32_t n)
+{
+    for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        out->ch[ch].mean = (sum[ch] + n / 2) / n;
+    }
+    out->n = n;
+    out->crc = record_crc(out);
+}
+
+/**
+ * @brief Merge a rollup into the newest record of a tier if it has the same period
+ *
+ * @return ESP_OK if merged
+ *         ESP_ERR_NOT_FOUND if the newest record is another period
+ *         ESP_FAIL on a file error
+ */
+static esp_err_t merge_newest(int tier, const archive_record_t *r)
+{
+    const tier_state_t *s = &tiers[tier];
+    char path[PATH_LEN];
+    archive_record_t prev;
+
+    if (s->nfiles == 0 || s->last_bytes < REC_SIZE || s->last_bytes % REC_SIZE != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    file_path(tier, s->first + s->nfiles - 1, path);
+    FILE *f = fopen(path, "r+b");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    long off = (long)s->last_bytes - REC_SIZE;
+    if (fseek(f, off, SEEK_SET) != 0 || fread(&prev, REC_SIZE, 1, f) != 1) {
+        fclose(f);
+        return ESP_FAIL;
+    }
+    if (prev.crc != record_crc(&prev) || prev.t != r->t || prev.n + r->n > UINT16_MAX) {
+        fclose(f);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t n = prev.n + r->n;
+    for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        prev.ch[ch].min = MIN(prev.ch[ch].min, r->ch[ch].min);
+        prev.ch[ch].max = MAX(prev.ch[ch].max, r->ch[ch].max);
+        prev.ch[ch].mean = ((uint32_t)prev.ch[ch].mean * prev.n
+                            + (uint32_t)r->ch[ch].mean * r->n + n / 2) / n;
+    }
+    prev.n = n;
+    prev.crc = record_crc(&prev);
+
+    bool ok = fseek(f, off, SEEK_SET) == 0 && fwrite(&prev, REC_SIZE, 1, f) == 1;
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Roll the oldest file of a tier up into the next tier (flash service task)
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t compact_oldest(int tier)
+{
+    const uint32_t period = tier_def[tier + 1].period_s;
+    char path[PATH_LEN];
+
+    archive_record_t *out = malloc(FILE_RECORDS * REC_SIZE);
+    if (out == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    file_path(tier, tiers[tier].first, path);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        free(out);
+        return ESP_FAIL;
+    }
+
+    archive_record_t in[READ_CHUNK];
+    uint32_t sum[ADC_TOTAL_CHANNELS];
+    uint32_t n = 0, corrupt = 0;
+    size_t nout = 0, got;
+
+    /* Only the first FILE_RECORDS records, in case the file size setting shrank */
+    for (size_t total = 0;
+         total < FILE_RECORDS && (got = fread(in, REC_SIZE, MIN(READ_CHUNK, FILE_RECORDS - total), f)) > 0;
+         total += got) {
+        for (size_t i = 0; i < got; i++) {
+            const archive_record_t *r = &in[i];
+            if (r->crc != record_crc(r) || r->n == 0) {
+                corrupt++;
+                continue;
+            }
+
+            uint32_t t = r->t - r->t % period;
+            archive_record_t *o = &out[nout];
+            if (n > 0 && t != o->t) {
+                fold_emit(o, sum, n);
+                o = &out[++nout];
+                n = 0;
+            }
+            if (n == 0) {
+                memset(o, 0, REC_SIZE);
+                o->t = t;
+                for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+                    o->ch[ch].min = r->ch[ch].min;
+                    o->ch[ch].max = r->ch[ch].max;
+                    sum[ch] = 0;
+                }
+            }
+            for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+                o->ch[ch].min = MIN(o->ch[ch].min, r->ch[ch].min);
+                o->ch[ch].max = MAX(o->ch[ch].max, r->ch[ch].max);
+                sum[ch] += (uint32_t)r->ch[ch].mean * r->n;
+            }
+            n += r->n;
+        }
+    }
+    fclose(f);
+
+    if (n > 0) {
+        fold_emit(&out[nout++], sum, n);
+    }
+    stats_add(&stats.corrupt, corrupt);
+
+    /* The first period may continue the newest record of the next tier */
+    size_t skip = 0;
+    esp_err_t err = ESP_OK;
+    if (nout > 0) {
+        err = merge_newest(tier + 1, &out[0]);
+        skip = (err == ESP_OK);
+        err = (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+    }
+    if (err == ESP_OK) {
+        err = append(tier + 1, out + skip, nout - skip);
+    }
+    free(out);
+    return err;
+}
+
+/**
+ * @brief Bring every tier within its budget, oldest files first (flash service task)
+ *
+ * A file that cannot be rolled up is dropped anyway, so a tier never
+ * grows past its budget.
+ */
+static void maintain(void)
+{
+    for (int tier = 0; tier < ARCHIVE_TIERS; tier++) {
+        tier_state_t *s = &tiers[tier];
+
+        /* The newest file is still being appended to */
+        while (s->bytes > tier_def[tier].budget && s->nfiles > 1) {
+            if (tier + 1 < ARCHIVE_TIERS) {
+                esp_err_t err = compact_oldest(tier);
+                if (err != ESP_OK) {
+                    ESP_LOGW(TAG, "Rollup of %s failed: %s", tier_def[tier].name, esp_err_to_name(err));
+                    stats_add(&stats.errors, 1);
+                }
+                stats_add(&stats.compacted, 1);
+            } else {
+                stats_add(&stats.deleted, 1);
+            }
+            remove_oldest(tier);
+        }
+    }
+}
+
+/**
+ * @brief Append a batch of 1 s records and enforce the budgets (flash service task)
+ *
+ * @param[in] ctx Request (flush_op_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t flush_op(void *ctx)
+{
+    const flush_op_t *op = ctx;
+
+    esp_err_t err = append(ARCHIVE_1S, op->records, op->n);
+    maintain();
+    return err;
+}
+
+/**
+ * @brief Pick up the files of previous boots (flash service task)
+ *
+ * @param[in] ctx Unused
+ * @return ESP_OK if every tier directory is usable
+ */
+static esp_err_t recover_op(void *ctx)
+{
+    char path[PATH_LEN];
+
+    for (int tier = 0; tier < ARCHIVE_TIERS; tier++) {
+        tier_state_t *s = &tiers[tier];
+        struct stat st;
+
+        if (stat(tier_def[tier].dir, &st) != 0 && mkdir(tier_def[tier].dir, 0755) != 0) {
+            return ESP_FAIL;
+        }
+
+        DIR *d = opendir(tier_def[tier].dir);
+        if (d == NULL) {
+            return ESP_FAIL;
+        }
+        uint32_t lo = UINT32_MAX, hi = 0;
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            char *end;
+            uint32_t num = strtoul(e->d_name, &end, 16);
+            if (strlen(e->d_name) == 8 && *end == '\0') {
+                lo = MIN(lo, num);
+                hi = MAX(hi, num);
+            }
+        }
+        closedir(d);
+
+        *s = (tier_state_t){ 0 };
+        if (lo > hi) {
+            continue;
+        }
+        s->first = lo;
+        s->nfiles = hi - lo + 1;
+        for (uint32_t num = lo; num <= hi; num++) {
+            file_path(tier, num, path);
+            if (stat(path, &st) == 0) {
+                s->bytes += st.st_size;
+                s->last_bytes = st.st_size;
+            } else {
+                s->last_bytes = 0;
+            }
+        }
+        /* Do not append behind a torn record or a different record size */
+        if (s->last_bytes % REC_SIZE != 0) {
+            s->last_bytes = FILE_SIZE;
+        }
+    }
+
+    maintain();
+    return ESP_OK;
+}
+
+/**
+ * @brief Read records newest first (flash service task)
+ *
+ * @param[in] ctx Request (read_op_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t read_op(void *ctx)
+{
+    const read_op_t *op = ctx;
+    const tier_state_t *s = &tiers[op->tier];
+    uint32_t age = op->age;
+    size_t got = 0;
+    uint32_t corrupt = 0;
+    char path[PATH_LEN];
+
+    for (uint32_t i = s->nfiles; i-- > 0 && got < op->n; ) {
+        struct stat st;
+        file_path(op->tier, s->first + i, path);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        uint32_t count = st.st_size / REC_SIZE;
+        if (age >= count) {
+            age -= count;
+            continue;
+        }
+
+        FILE *f = fopen(path, "rb");
+        if (f == NULL) {
+            return ESP_FAIL;
+        }
+        for (uint32_t idx = count - age; idx-- > 0 && got < op->n; ) {
+            archive_record_t *r = &op->records[got];
+            if (fseek(f, (long)idx * REC_SIZE, SEEK_SET) != 0 || fread(r, REC_SIZE, 1, f) != 1) {
+                break;
+            }
+            if (r->crc != record_crc(r)) {
+                corrupt++;
+                continue;
+            }
+            got++;
+        }
+        fclose(f);
+        age = 0;
+    }
+
+    stats_add(&stats.corrupt, corrupt);
+    *op->read = got;
+    return ESP_OK;
+}
+
+/**
+ * @brief Archive task
+ *
+ * Once per second takes the 1 s history entries completed since the last
+ * pass and hands them to the flash service in batches of FLUSH_RECORDS.
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_archive(void *p)
+{
+    history_info_t ref;
+    history_get_info(0, HISTORY_1S, &ref);
+    uint32_t seen = ref.total;
+    size_t pending = 0;
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        xTaskDelayUntil(&wake, pdMS_TO_TICKS(1000));
+
+        history_get_info(0, HISTORY_1S, &ref);
+        uint32_t fresh = ref.total - seen;
+        seen = ref.total;
+        if (fresh > ref.depth) {
+            stats_add(&stats.missed, fresh - ref.depth);
+            fresh = ref.depth;
+        }
+
+        /* Channels may complete their entry a few samples apart */
+        int32_t skew[ADC_TOTAL_CHANNELS];
+        for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            history_info_t info;
+            history_get_info(ch, HISTORY_1S, &info);
+            skew[ch] = (int32_t)(info.total - ref.total);
+        }
+
+        uint32_t now = (uint32_t)time(NULL);
+        for (uint32_t age = fresh; age-- > 0; ) {
+            archive_record_t *r = &batch[pending];
+            memset(r, 0, REC_SIZE);
+            r->t = now - age - 1;
+            r->n = 1;
+            for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+                size_t got;
+                history_read(ch, HISTORY_1S, MAX((int32_t)age + skew[ch], 0), &r->ch[ch], 1, &got);
+            }
+            r->crc = record_crc(r);
+
+            if (++pending == FLUSH_RECORDS) {
+                flush_op_t op = { .records = batch, .n = pending };
+                if (flash_svc_run(SVC_KEY, flush_op, &op, sizeof(op)) == ESP_OK) {
+                    stats_add(&stats.recorded, pending);
+                } else {
+                    stats_add(&stats.errors, 1);
+                }
+                pending = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t archive_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    if (!con_data_mounted()) {
+        ESP_LOGW(TAG, "%s not mounted, archive off", CON_DATA_PATH);
+        register_cmd();
+        return pdPASS;
+    }
+
+    if (flash_svc_run(SVC_KEY, recover_op, NULL, 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot create the archive directories, archive off");
+        register_cmd();
+        return pdPASS;
+    }
+    for (int tier = 0; tier < ARCHIVE_TIERS; tier++) {
+        ESP_LOGI(TAG, "%s: %"PRIu32" files, %"PRIu32" of %"PRIu32" bytes", tier_def[tier].name,
+                 tiers[tier].nfiles, tiers[tier].bytes, tier_def[tier].budget);
+    }
+
+    if (xTaskCreate(task_archive, "archive", TASK_STACK_SIZE, NULL,
+                    CONFIG_ARCHIVE_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        return pdFAIL;
+    }
+    archive_ok = true;
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t archive_read(archive_tier_t tier, uint32_t age, archive_record_t *records,
+                       size_t n, size_t *read)
+{
+    if (!chk_tier(tier) || records == NULL || read == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *read = 0;
+
+    if (!archive_ok) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    read_op_t op = {
+        .tier = tier,
+        .age = age,
+        .records = records,
+        .n = n,
+        .read = read,
+    };
+    /* Own key, a read must not replace a pending write */
+    return flash_svc_run(SVC_KEY "?r", read_op, &op, sizeof(op));
+}
+
+esp_err_t archive_get_tier(archive_tier_t tier, archive_tier_info_t *info)
+{
+    if (!chk_tier(tier) || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    *info = (archive_tier_info_t){
+        .period_s = tier_def[tier].period_s,
+        .budget = tier_def[tier].budget,
+        .bytes = tiers[tier].bytes,
+        .files = tiers[tier].nfiles,
+    };
+    taskEXIT_CRITICAL(&lock);
+    return ESP_OK;
+}
+
+esp_err_t archive_get_stats(archive_stats_t *s)
+{
+    if (s == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    *s = stats;
+    taskEXIT_CRITICAL(&lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_str *tier;
+    struct arg_int *channel;
+    struct arg_int *count;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Tiered min/max/mean archive on %s\n", CON_DATA_PATH);
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Format the time of a record
+ */
+static void fmt_time(char *buf, size_t len, uint32_t t)
+{
+    if (t < CLOCK_SET_S) {
+        snprintf(buf, len, "+%"PRIu32" s", t);
+        return;
+    }
+    time_t tt = t;
+    struct tm tm;
+    localtime_r(&tt, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+/**
+ * @brief Print the tiers and the statistics
+ */
+static void print_status(void)
+{
+    printf("-- Archive --\n");
+    if (!archive_ok) {
+        printf("  Off (%s not mounted)\n", CON_DATA_PATH);
+        return;
+    }
+
+    for (int tier = 0; tier < ARCHIVE_TIERS; tier++) {
+        archive_tier_info_t info;
+        archive_get_tier(tier, &info);
+
+        /* Time the budget holds at this resolution */
+        uint32_t span_h = (uint32_t)((uint64_t)info.budget / REC_SIZE * info.period_s / 3600);
+        printf("  %-5s %3"PRIu32" files, %6"PRIu32" of %6"PRIu32" bytes (%.0f%%), holds ~%"PRIu32" h\n",
+               tier_def[tier].name, info.files, info.bytes, info.budget,
+               100.0 * info.bytes / info.budget, span_h);
+    }
+
+    archive_stats_t st;
+    archive_get_stats(&st);
+    printf("  Recorded %"PRIu32", missed %"PRIu32", rolled up %"PRIu32" files, "
+           "deleted %"PRIu32" files\n", st.recorded, st.missed, st.compacted, st.deleted);
+    printf("  Corrupt records %"PRIu32", errors %"PRIu32", %u bytes per record\n",
+           st.corrupt, st.errors, (unsigned)REC_SIZE);
+}
+
+/**
+ * @brief Print the newest records of a tier for one channel
+ */
+static int print_records(archive_tier_t tier, uint8_t ch, int n)
+{
+    archive_record_t *r = malloc(READ_CHUNK * REC_SIZE);
+    if (r == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    printf("-- Ch%u, %s --\n", ch, tier_def[tier].name);
+    printf("  %-19s %6s %6s %6s\n", "Time", "Min", "Max", "Mean");
+
+    uint32_t age = 0;
+    while (n > 0) {
+        size_t read;
+        esp_err_t err = archive_read(tier, age, r, MIN(n, READ_CHUNK), &read);
+        if (err != ESP_OK) {
+            printf("Failed to read the archive: %s\n", esp_err_to_name(err));
+            free(r);
+            return 1;
+        }
+        if (read == 0) {
+            break;
+        }
+        for (size_t i = 0; i < read; i++) {
+            char when[24];
+            fmt_time(when, sizeof(when), r[i].t);
+            printf("  %-19s %6u %6u %6u\n", when, r[i].ch[ch].min, r[i].ch[ch].max,
+                   r[i].ch[ch].mean);
+        }
+        age += read;
+        n -= read;
+    }
+    if (age == 0) {
+        printf("  No records yet\n");
+    }
+
+    free(r);
+    return 0;
+}
+
+/**
+ * @brief Archive command handler
+ */
+static int cmd_archive(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.tier->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    int tier = 0;
+    while (tier < ARCHIVE_TIERS && strcmp(args.tier->sval[0], tier_def[tier].name) != 0) {
+        tier++;
+    }
+    if (tier == ARCHIVE_TIERS) {
+        printf("Unknown tier '%s' (1s, 1min or 1h)\n", args.tier->sval[0]);
+        return 1;
+    }
+
+    uint8_t ch = 0;
+    if (args.channel->count > 0) {
+        if (args.channel->ival[0] < 0 || args.channel->ival[0] >= ADC_TOTAL_CHANNELS) {
+            printf("Invalid channel %d (0-%d)\n", args.channel->ival[0], ADC_TOTAL_CHANNELS - 1);
+            return 1;
+        }
+        ch = args.channel->ival[0];
+    }
+
+    int n = LIST_DEFAULT;
+    if (args.count->count > 0) {
+        if (args.count->ival[0] <= 0) {
+            printf("Invalid count %d\n", args.count->ival[0]);
+            return 1;
+        }
+        n = args.count->ival[0];
+    }
+
+    return print_records(tier, ch, n);
+}
+
+/**
+ * @brief Register archive commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.tier = arg_str0("t", "tier", "<1s|1min|1h>", "List the newest records of a tier");
+    args.channel = arg_int0("c", "channel", "<ch>", "Channel to list (default 0)");
+    args.count = arg_int0("n", "count", "<n>", "Records to list");
+    args.end = arg_end(4);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "archive",
+        .func = cmd_archive,
+        .help = "Tiered min/max/mean archive with rollup\n"
+                "Examples:\n"
+                "  archive                        Tiers, budgets, statistics\n"
+                "  archive -t 1s -c 0             Newest 1 s records of ch0\n"
+                "  archive -t 1h -c 2 -n 48       Last two days of ch2 by hour\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file archive.h
+ * @brief Tiered min/max/mean archive on /data with rollup compaction
+ *
+ * Once per second the archive task takes the newest 1 s history entry of
+ * every channel and appends it, batched, to numbered files of the 1 s
+ * tier. Each tier has a byte budget. When a tier exceeds it, its oldest
+ * file is compacted into the next coarser tier (1 min, then 1 h) as
+ * min/max/mean per period and deleted; the coarsest tier simply drops its
+ * oldest file. The same flash thus holds minutes at full resolution,
+ * days at 1 min and months at 1 h.
+ *
+ * Records carry the wall clock time if it is set, otherwise the seconds
+ * since boot. File I/O runs on the flash service.
+ *
+ * Inspected with the `archive` command.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+#include "history.h"
+
+/**
+ * @brief Archive tiers
+ */
+typedef enum {
+    ARCHIVE_1S = 0,             /**< Full resolution, 1 s records */
+    ARCHIVE_1MIN,               /**< 1 min rollups */
+    ARCHIVE_1H,                 /**< 1 h rollups */
+    ARCHIVE_TIERS
+} archive_tier_t;
+
+/**
+ * @brief Archive record, one period of all channels
+ */
+typedef struct {
+    uint32_t t;                             /**< Start of the period (s) */
+    uint16_t n;                             /**< Seconds of data folded in */
+    history_entry_t ch[ADC_TOTAL_CHANNELS]; /**< Summary per channel, virtual ones included */
+    uint16_t crc;                           /**< CRC16 of the record before this field */
+} archive_record_t;
+
+/**
+ * @brief State of one tier
+ */
+typedef struct {
+    uint32_t period_s;          /**< Time per record */
+    uint32_t budget;            /**< Byte budget */
+    uint32_t bytes;             /**< Bytes in the tier's files */
+    uint32_t files;             /**< Files in the tier */
+} archive_tier_info_t;
+
+/**
+ * @brief Archive statistics
+ */
+typedef struct {
+    uint32_t recorded;          /**< 1 s records written */
+    uint32_t missed;            /**< 1 s entries overwritten in RAM before they were taken */
+    uint32_t compacted;         /**< Files rolled up into the next tier */
+    uint32_t deleted;           /**< Files dropped from the coarsest tier */
+    uint32_t corrupt;           /**< Records skipped for a bad CRC */
+    uint32_t errors;            /**< Failed file operations */
+} archive_stats_t;
+
+/**
+ * @brief Initialize the archive
+ *
+ * Picks up the files of previous boots and starts the archive task.
+ * Call after history_init() and con_init(); without /data the archive
+ * stays off.
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t archive_init(void);
+
+/**
+ * @brief Read records of a tier, newest first
+ *
+ * @param[in] tier Tier
+ * @param[in] age Records to skip, 0 to start with the newest
+ * @param[out] records Buffer for the records
+ * @param[in] n Buffer size in records
+ * @param[out] read Number of records stored
+ * @return ESP_OK if successful (read may be less than n at the oldest record)
+ *         ESP_ERR_INVALID_ARG if tier is invalid or records or read is NULL
+ *         ESP_ERR_INVALID_STATE if the archive is off
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t archive_read(archive_tier_t tier, uint32_t age, archive_record_t *records,
+                       size_t n, size_t *read);
+
+/**
+ * @brief Get the state of a tier
+ *
+ * @param[in] tier Tier
+ * @param[out] info Pointer to store the state
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if tier is invalid or info is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t archive_get_tier(archive_tier_t tier, archive_tier_info_t *info);
+
+/**
+ * @brief Get archive statistics
+ *
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if stats is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t archive_get_stats(archive_stats_t *stats);
+
+#endif /* ARCHIVE_H */
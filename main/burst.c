@@ -0,0 +1,583 @@
+/**
+ * @file burst.c
+ * @brief Duty-cycled burst acquisition with deep sleep between bursts
+ *
+ * A frame listener accumulates min/max/sum of the normalized samples of
+ * the configured number of frames and wakes the burst task. The task
+ * appends the summary to a ring in RTC memory, which survives deep sleep,
+ * and puts the chip to sleep with the timer as wake-up source. The ADC
+ * deep sleep hook keeps the filter state, so the next burst starts with
+ * settled filters.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/param.h>
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "driver/rtc_io.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "burst.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define LOG_LEN             16
+#define RTC_MAGIC           0x54535242  /* "BRST" */
+#define BURST_TIMEOUT_MS    10000       /* Give up waiting for frames */
+#define FLUSH_WAIT_MS       1000        /* Pending flash writes before sleeping */
+#define FRAMES_MAX          10000
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "burst"
+#define NVS_KEY_ENABLE  "en"
+#define NVS_KEY_FRAMES  "frames"
+#define NVS_KEY_PERIOD  "period"
+
+/**
+ * @brief Burst configuration
+ */
+typedef struct {
+    uint8_t enabled;            /**< Sleep between bursts */
+    uint16_t frames;            /**< Frames per burst */
+    uint32_t period_s;          /**< Sleep time between bursts */
+} burst_cfg_t;
+
+/**
+ * @brief Burst log, kept in RTC memory over deep sleep
+ */
+typedef struct {
+    uint32_t magic;                     /**< RTC_MAGIC */
+    uint32_t seq;                       /**< Bursts recorded */
+    uint64_t awake_total_ms;            /**< Sum of awake_ms */
+    uint64_t sleep_total_ms;            /**< Sum of sleep_ms */
+    burst_summary_t log[LOG_LEN];       /**< Ring indexed by seq */
+    uint32_t crc;                       /**< Over everything above */
+} burst_rtc_t;
+
+/**
+ * @brief Accumulated samples of the running burst
+ */
+typedef struct {
+    uint32_t frames;
+    uint32_t n[ADC_MAX_CHANNELS];
+    uint64_t sum[ADC_MAX_CHANNELS];
+    uint16_t min[ADC_MAX_CHANNELS];
+    uint16_t max[ADC_MAX_CHANNELS];
+} burst_acc_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "burst";
+static TaskHandle_t task_handle = NULL;
+static SemaphoreHandle_t done_sem = NULL;
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE acc_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static burst_cfg_t cfg = {
+    .enabled = 0,
+    .frames = CONFIG_ADC_BURST_FRAMES,
+    .period_s = CONFIG_ADC_BURST_PERIOD_S,
+};
+static burst_acc_t acc;
+static uint32_t target_frames;      /* 0 while no burst is running */
+static RTC_NOINIT_ATTR burst_rtc_t rtc;
+
+/**
+ * @brief Take a consistent copy of the configuration
+ */
+static void cfg_copy(burst_cfg_t *out)
+{
+    taskENTER_CRITICAL(&cfg_lock);
+    *out = cfg;
+    taskEXIT_CRITICAL(&cfg_lock);
+}
+
+/**
+ * @brief Checksum of the RTC log
+ */
+static uint32_t rtc_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&rtc, offsetof(burst_rtc_t, crc));
+}
+
+/**
+ * @brief Start a new log if RTC memory does not hold a valid one
+ */
+static void rtc_check(void)
+{
+    if (rtc.magic != RTC_MAGIC || rtc.crc != rtc_crc()) {
+        memset(&rtc, 0, sizeof(rtc));
+        rtc.magic = RTC_MAGIC;
+        rtc.crc = rtc_crc();
+    }
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    if (target_frames == 0) {
+        return;
+    }
+
+    /* Reduce the frame first, the lock only covers the merge */
+    uint16_t lo[ADC_MAX_CHANNELS], hi[ADC_MAX_CHANNELS];
+    uint32_t sum[ADC_MAX_CHANNELS];
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        lo[ch] = UINT16_MAX;
+        hi[ch] = 0;
+        sum[ch] = 0;
+        for (uint16_t i = 0; i < f->count[ch]; i++) {
+            uint16_t v = f->samples[ch][i];
+            lo[ch] = MIN(lo[ch], v);
+            hi[ch] = MAX(hi[ch], v);
+            sum[ch] += v;
+        }
+    }
+
+    bool done = false;
+    taskENTER_CRITICAL(&acc_lock);
+    if (target_frames > 0) {
+        for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+            if (f->count[ch] == 0) {
+                continue;
+            }
+            acc.min[ch] = MIN(acc.min[ch], lo[ch]);
+            acc.max[ch] = MAX(acc.max[ch], hi[ch]);
+            acc.sum[ch] += sum[ch];
+            acc.n[ch] += f->count[ch];
+        }
+        if (++acc.frames >= target_frames) {
+            target_frames = 0;
+            done = true;
+        }
+    }
+    taskEXIT_CRITICAL(&acc_lock);
+
+    if (done) {
+        xSemaphoreGive(done_sem);
+    }
+}
+
+/**
+ * @brief Acquire one burst and append its summary to the RTC log
+ *
+ * @param[in] c Configuration
+ * @return The stored summary
+ */
+static const burst_summary_t *run_burst(const burst_cfg_t *c)
+{
+    xSemaphoreTake(done_sem, 0);
+
+    taskENTER_CRITICAL(&acc_lock);
+    memset(&acc, 0, sizeof(acc));
+    memset(acc.min, 0xff, sizeof(acc.min));
+    target_frames = c->frames;
+    taskEXIT_CRITICAL(&acc_lock);
+
+    if (xSemaphoreTake(done_sem, pdMS_TO_TICKS(BURST_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Timeout, %"PRIu32" of %u frames", acc.frames, c->frames);
+    }
+
+    burst_acc_t a;
+    taskENTER_CRITICAL(&acc_lock);
+    target_frames = 0;
+    a = acc;
+    taskEXIT_CRITICAL(&acc_lock);
+
+    rtc_check();
+    burst_summary_t *s = &rtc.log[rtc.seq % LOG_LEN];
+    memset(s, 0, sizeof(*s));
+    s->seq = rtc.seq++;
+    s->frames = a.frames;
+    s->awake_ms = esp_timer_get_time() / 1000;
+    s->sleep_ms = c->period_s * 1000;
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        if (a.n[ch] > 0) {
+            s->min[ch] = a.min[ch];
+            s->max[ch] = a.max[ch];
+            s->mean[ch] = (a.sum[ch] + a.n[ch] / 2) / a.n[ch];
+        }
+    }
+    rtc.awake_total_ms += s->awake_ms;
+    rtc.sleep_total_ms += s->sleep_ms;
+    rtc.crc = rtc_crc();
+
+    return s;
+}
+
+/**
+ * @brief Let queued flash writes finish, they would be lost in deep sleep
+ */
+static void wait_flash_idle(void)
+{
+    flash_svc_stats_t st;
+    for (int i = 0; i < FLUSH_WAIT_MS / 10; i++) {
+        if (flash_svc_get_stats(&st) != ESP_OK || st.pending == 0) {
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    ESP_LOGW(TAG, "%"PRIu32" flash writes still pending", st.pending);
+}
+
+/**
+ * @brief Burst task
+ *
+ * Waits while burst mode is disabled and for the holdoff after a reset
+ * that was not a burst wake-up; otherwise acquires and goes to sleep.
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_burst(void *p)
+{
+    bool holdoff = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER;
+
+    for (;;) {
+        burst_cfg_t c;
+        cfg_copy(&c);
+
+        if (!c.enabled) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (holdoff) {
+            holdoff = false;
+            ESP_LOGI(TAG, "Sleeping in %d s, `burst -d` to stay awake",
+                     CONFIG_ADC_BURST_HOLDOFF_S);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_ADC_BURST_HOLDOFF_S * 1000));
+            continue;
+        }
+
+        const burst_summary_t *s = run_burst(&c);
+
+        cfg_copy(&c);
+        if (!c.enabled) {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Burst %"PRIu32": %"PRIu32" frames, awake %"PRIu32" ms, duty %.2f%%",
+                 s->seq, s->frames, s->awake_ms,
+                 100.0 * s->awake_ms / ((double)s->awake_ms + s->sleep_ms));
+
+        wait_flash_idle();
+        esp_sleep_enable_timer_wakeup((uint64_t)c.period_s * 1000000ULL);
+#if CONFIG_IDF_TARGET_ESP32
+        /* Isolate GPIO12 pin from external circuits. This is needed for modules
+           which have an external pull-up resistor on GPIO12 (such as ESP32-WROVER)
+           to minimize current consumption. */
+        rtc_gpio_isolate(GPIO_NUM_12);
+#endif
+        esp_deep_sleep_start();
+    }
+}
+
+/**
+ * @brief Write the configuration to NVS (flash service task)
+ *
+ * @param[in] ctx Unused, the current configuration is written
+ * @return ESP_OK on success
+ */
+static esp_err_t write_config(void *ctx)
+{
+    burst_cfg_t c;
+    cfg_copy(&c);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_set_u8(nvs, NVS_KEY_ENABLE, c.enabled);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u16(nvs, NVS_KEY_FRAMES, c.frames);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u32(nvs, NVS_KEY_PERIOD, c.period_s);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Save the configuration to NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t save_config(void)
+{
+    return flash_svc_run("nvs:" NVS_NAMESPACE, write_config, NULL, 0);
+}
+
+/**
+ * @brief Load the configuration from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint32_t u32;
+    uint16_t u16;
+    uint8_t u8;
+
+    if (nvs_get_u8(nvs, NVS_KEY_ENABLE, &u8) == ESP_OK) {
+        cfg.enabled = u8 ? 1 : 0;
+    }
+    if (nvs_get_u16(nvs, NVS_KEY_FRAMES, &u16) == ESP_OK && u16 > 0 && u16 <= FRAMES_MAX) {
+        cfg.frames = u16;
+    }
+    if (nvs_get_u32(nvs, NVS_KEY_PERIOD, &u32) == ESP_OK && u32 > 0) {
+        cfg.period_s = u32;
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t burst_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    rtc_check();
+
+    done_sem = xSemaphoreCreateBinary();
+    if (done_sem == NULL) {
+        ESP_LOGE(TAG, "Failed to create semaphore");
+        return pdFAIL;
+    }
+
+    load_config();
+    ESP_LOGI(TAG, "%u frames every %"PRIu32" s, %s", cfg.frames, cfg.period_s,
+             cfg.enabled ? "enabled" : "disabled");
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+
+    return xTaskCreate(task_burst, "burst", 3072, NULL,
+                       uxTaskPriorityGet(NULL), &task_handle);
+}
+
+esp_err_t burst_get_last(burst_summary_t *summary)
+{
+    if (summary == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rtc_check();
+    if (rtc.seq == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *summary = rtc.log[(rtc.seq - 1) % LOG_LEN];
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_int *frames;
+    struct arg_int *period;
+    struct arg_lit *clear;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Burst acquisition control\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Duty cycle in percent
+ */
+static double duty(uint64_t awake_ms, uint64_t sleep_ms)
+{
+    return awake_ms + sleep_ms ? 100.0 * awake_ms / (double)(awake_ms + sleep_ms) : 0.0;
+}
+
+/**
+ * @brief Print configuration and the burst log
+ */
+static void print_status(void)
+{
+    burst_cfg_t c;
+    cfg_copy(&c);
+    rtc_check();
+
+    printf("-- Burst Mode --\n");
+    printf("  State: %s\n", c.enabled ? "enabled" : "disabled");
+    printf("  Frames per burst: %u\n", c.frames);
+    printf("  Period: %"PRIu32" s\n", c.period_s);
+    printf("  Bursts: %"PRIu32"\n", rtc.seq);
+    printf("  Total awake: %"PRIu64" ms, asleep: %"PRIu64" ms, duty %.2f%%\n",
+           rtc.awake_total_ms, rtc.sleep_total_ms,
+           duty(rtc.awake_total_ms, rtc.sleep_total_ms));
+
+    if (rtc.seq == 0) {
+        return;
+    }
+
+    printf("\n%-8s %-8s %-10s %-8s\n", "Burst", "Frames", "Awake ms", "Duty");
+    uint32_t first = rtc.seq > LOG_LEN ? rtc.seq - LOG_LEN : 0;
+    for (uint32_t i = first; i < rtc.seq; i++) {
+        const burst_summary_t *s = &rtc.log[i % LOG_LEN];
+        printf("%-8"PRIu32" %-8"PRIu32" %-10"PRIu32" %6.2f%%\n",
+               s->seq, s->frames, s->awake_ms, duty(s->awake_ms, s->sleep_ms));
+    }
+
+    const burst_summary_t *s = &rtc.log[(rtc.seq - 1) % LOG_LEN];
+    printf("\n%-8s %-8s %-8s %-8s\n", "Channel", "Min", "Mean", "Max");
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        printf("%-8d %-8u %-8u %-8u\n", ch, s->min[ch], s->mean[ch], s->max[ch]);
+    }
+}
+
+/**
+ * @brief Burst command handler
+ */
+static int cmd_burst(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    burst_cfg_t c;
+    cfg_copy(&c);
+    bool changed = false;
+
+    if (args.frames->count > 0) {
+        if (args.frames->ival[0] <= 0 || args.frames->ival[0] > FRAMES_MAX) {
+            printf("Invalid frame count %d (1-%d)\n", args.frames->ival[0], FRAMES_MAX);
+            return 1;
+        }
+        c.frames = args.frames->ival[0];
+        changed = true;
+    }
+
+    if (args.period->count > 0) {
+        if (args.period->ival[0] <= 0) {
+            printf("Invalid period %d\n", args.period->ival[0]);
+            return 1;
+        }
+        c.period_s = args.period->ival[0];
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (args.clear->count > 0) {
+        memset(&rtc, 0, sizeof(rtc));
+        rtc_check();
+    }
+
+    if (changed) {
+        taskENTER_CRITICAL(&cfg_lock);
+        cfg = c;
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        esp_err_t err = save_config();
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+        xTaskNotifyGive(task_handle);
+
+        if (c.enabled) {
+            printf("Sleeping after the next burst\n");
+        }
+    }
+
+    if (!changed && args.clear->count == 0) {
+        print_status();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register burst commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.enable = arg_litn("e", "enable", 0, 1, "Sleep between bursts");
+    args.disable = arg_litn("d", "disable", 0, 1, "Stay awake");
+    args.frames = arg_int0("n", "frames", "<n>", "Frames per burst");
+    args.period = arg_int0("p", "period", "<s>", "Sleep time between bursts");
+    args.clear = arg_litn("c", "clear", 0, 1, "Clear the burst log");
+    args.end = arg_end(6);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "burst",
+        .func = cmd_burst,
+        .help = "Duty-cycled burst acquisition\n"
+                "Examples:\n"
+                "  burst                 Show the burst log\n"
+                "  burst -n 40 -p 60 -e  40 frames every minute\n"
+                "  burst -d              Stay awake\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file burst.h
+ * @brief Duty-cycled burst acquisition with deep sleep between bursts
+ *
+ * When enabled, every wake-up acquires a configured number of frames
+ * through the normal filter path, stores a min/mean/max summary per
+ * channel in RTC memory and goes back to deep sleep on a timer. The
+ * summaries of the last bursts, the time awake per burst and the duty
+ * cycle are shown by the `burst` command.
+ *
+ * After a reset other than the burst timer the node stays awake for
+ * ADC_BURST_HOLDOFF_S first, so `burst -d` can still be entered.
+ */
+
+#ifndef BURST_H
+#define BURST_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+/**
+ * @brief Summary of one burst
+ */
+typedef struct {
+    uint32_t seq;                       /**< Burst number since power-on */
+    uint32_t frames;                    /**< Frames processed */
+    uint32_t awake_ms;                  /**< Application start to sleep */
+    uint32_t sleep_ms;                  /**< Sleep period that followed */
+    uint16_t min[ADC_MAX_CHANNELS];     /**< Lowest normalized value */
+    uint16_t mean[ADC_MAX_CHANNELS];    /**< Mean normalized value */
+    uint16_t max[ADC_MAX_CHANNELS];     /**< Highest normalized value */
+} burst_summary_t;
+
+/**
+ * @brief Initialize burst mode
+ *
+ * Registers the `burst` command and, if burst mode is enabled, starts
+ * the burst; the node goes to deep sleep when it is complete.
+ * Call after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t burst_init(void);
+
+/**
+ * @brief Get the summary of the latest burst
+ *
+ * @param[out] summary Pointer to store the summary
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if summary is NULL
+ *         ESP_ERR_NOT_FOUND if no burst was recorded since power-on
+ * @note This function is NULL-safe
+ */
+esp_err_t burst_get_last(burst_summary_t *summary);
+
+#endif /* BURST_H */
@@ -0,0 +1,524 @@
+/**
+ * @file freq.c
+ * @brief Frequency, period and duty cycle measurement per channel
+ *
+ * Sample positions are counted per channel since the configuration last
+ * changed and kept in Q8, so an interpolated edge is an integer. Per
+ * sample the listener only compares against the trigger thresholds and
+ * remembers where the signal last crossed the level; the division for
+ * the interpolation happens once per crossing. A period is counted in
+ * the gate in which it ends, so periods longer than a gate still
+ * measure correctly as long as they are shorter than the timeout.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "freq.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define FS_HZ           ((float)ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS)
+#define GATE_SAMPLES    ((int64_t)ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS * CONFIG_ADC_FREQ_GATE_MS / 1000)
+#define TIMEOUT_SAMPLES ((int64_t)ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS * CONFIG_ADC_FREQ_TIMEOUT_MS / 1000)
+#define Q               8           /* Fraction bits of sample positions */
+#define LEVEL_DEFAULT   ((1 << 12) / 2)
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "freq"
+#define NVS_KEY_FMT     "ch%u"
+
+/**
+ * @brief Processing state of one channel (ADC task only)
+ */
+typedef struct {
+    int64_t t;                  /**< Samples seen */
+    int64_t gate_start;         /**< Sample the gate started at */
+    int64_t cross;              /**< Last level crossing, Q8 position */
+    int64_t rise;               /**< Last rising edge, Q8 position, -1 if none */
+    int64_t fall;               /**< Last falling edge, Q8 position, -1 if none */
+    int64_t period_sum;         /**< Whole periods of the gate, Q8 samples */
+    int64_t high_sum;           /**< High time of those periods, Q8 samples */
+    uint32_t periods;           /**< Periods of the gate */
+    uint32_t edges;             /**< Rising edges since the reset */
+    uint32_t level_sum_n;       /**< Samples in level_sum */
+    uint64_t level_sum;         /**< Sum of the samples of the gate */
+    uint16_t level;             /**< Trigger level of the gate */
+    uint16_t prev;              /**< Previous sample */
+    bool high;                  /**< Trigger output */
+    bool primed;                /**< prev and high are valid */
+} ch_state_t;
+
+/* Forward declarations */
+static void register_args(void);
+
+/* Module static variables */
+static const char *TAG = "freq";
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE out_lock = portMUX_INITIALIZER_UNLOCKED;
+static freq_cfg_t cfg[ADC_TOTAL_CHANNELS];
+static uint32_t cfg_gen;            /* Incremented on every configuration change */
+static uint32_t state_gen;          /* Used by the listener only */
+static ch_state_t state[ADC_TOTAL_CHANNELS];
+static freq_reading_t readings[ADC_TOTAL_CHANNELS];
+
+/**
+ * @brief Check if channel index is valid
+ */
+static inline bool chk_ch(uint8_t channel)
+{
+    return channel < ADC_TOTAL_CHANNELS;
+}
+
+/**
+ * @brief Reset the processing state and results of a channel
+ */
+static void state_reset(uint8_t ch, const freq_cfg_t *c)
+{
+    ch_state_t *st = &state[ch];
+
+    memset(st, 0, sizeof(*st));
+    st->rise = -1;
+    st->fall = -1;
+    st->level = c->level ? c->level : LEVEL_DEFAULT;
+
+    taskENTER_CRITICAL(&out_lock);
+    memset(&readings[ch], 0, sizeof(readings[ch]));
+    taskEXIT_CRITICAL(&out_lock);
+}
+
+/**
+ * @brief Close a gate and publish its results
+ */
+static void publish(uint8_t ch, const freq_cfg_t *c)
+{
+    ch_state_t *st = &state[ch];
+
+    taskENTER_CRITICAL(&out_lock);
+    freq_reading_t *r = &readings[ch];
+    if (st->periods > 0) {
+        float period = (float)st->period_sum / st->periods / (1 << Q);
+        r->freq_hz = FS_HZ / period;
+        r->period_us = period * 1e6f / FS_HZ;
+        r->duty = (float)st->high_sum / st->period_sum;
+        r->rpm = c->ppr ? r->freq_hz * 60.0f / c->ppr : 0.0f;
+    } else if (st->rise < 0 || st->t - (st->rise >> Q) > TIMEOUT_SAMPLES) {
+        /* No edges for too long; otherwise keep the last period */
+        r->freq_hz = 0.0f;
+        r->period_us = 0.0f;
+        r->duty = st->high ? 1.0f : 0.0f;
+        r->rpm = 0.0f;
+    }
+    r->level = st->level;
+    r->periods = st->periods;
+    r->edges = st->edges;
+    r->valid = true;
+    taskEXIT_CRITICAL(&out_lock);
+
+    if (c->level == 0 && st->level_sum_n > 0) {
+        st->level = st->level_sum / st->level_sum_n;
+    }
+    st->gate_start = st->t;
+    st->period_sum = 0;
+    st->high_sum = 0;
+    st->periods = 0;
+    st->level_sum = 0;
+    st->level_sum_n = 0;
+}
+
+/**
+ * @brief Handle a qualified rising edge
+ *
+ * @param[in,out] st Channel state
+ * @param[in] edge Edge position, Q8
+ */
+static void on_rise(ch_state_t *st, int64_t edge)
+{
+    if (st->rise >= 0) {
+        st->period_sum += edge - st->rise;
+        if (st->fall > st->rise) {
+            st->high_sum += st->fall - st->rise;
+        }
+        st->periods++;
+    }
+    st->rise = edge;
+    st->edges++;
+}
+
+/**
+ * @brief Process the samples of one channel in a frame
+ */
+static void process_channel(uint8_t ch, const freq_cfg_t *c, const uint16_t *s, uint16_t n)
+{
+    ch_state_t *st = &state[ch];
+
+    for (uint16_t i = 0; i < n; i++) {
+        const int32_t x = s[i];
+        const int32_t level = st->level;
+        const int32_t p = st->prev;
+
+        st->level_sum += x;
+        st->level_sum_n++;
+        st->prev = x;
+
+        if (!st->primed) {
+            st->high = x >= level;
+            st->primed = true;
+        } else {
+            /* Remember where the level was crossed, interpolated */
+            if ((p < level) != (x < level)) {
+                st->cross = ((st->t - 1) << Q) + ((int64_t)(level - p) << Q) / (x - p);
+            }
+
+            /* The edge counts once the signal clears the hysteresis */
+            if (!st->high && x >= level + c->hyst) {
+                st->high = true;
+                on_rise(st, st->cross);
+            } else if (st->high && x < level - c->hyst) {
+                st->high = false;
+                st->fall = st->cross;
+            }
+        }
+
+        if (++st->t - st->gate_start >= GATE_SAMPLES) {
+            publish(ch, c);
+        }
+    }
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    freq_cfg_t c[ADC_TOTAL_CHANNELS];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(c, cfg, sizeof(c));
+    uint32_t gen = cfg_gen;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    if (gen != state_gen) {
+        /* Configuration changed, start over */
+        for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            state_reset(ch, &c[ch]);
+        }
+        state_gen = gen;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (c[ch].enabled) {
+            process_channel(ch, &c[ch], f->samples[ch], f->count[ch]);
+        }
+    }
+}
+
+/**
+ * @brief Write the configuration of a channel to NVS (flash service task)
+ *
+ * @param[in] ctx Channel index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_cfg(void *ctx)
+{
+    uint8_t ch = *(uint8_t *)ctx;
+    freq_cfg_t c;
+
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[ch];
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, ch);
+    err = nvs_set_blob(nvs, key, &c, sizeof(c));
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Load the configuration of all channels from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        char key[16];
+        freq_cfg_t c;
+        size_t len = sizeof(c);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, ch);
+        if (nvs_get_blob(nvs, key, &c, &len) == ESP_OK && len == sizeof(c)) {
+            cfg[ch] = c;
+        }
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t freq_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        cfg[ch] = (freq_cfg_t){
+            .enabled = 0,
+            .hyst = CONFIG_ADC_FREQ_HYST,
+        };
+    }
+    load_config();
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (cfg[ch].enabled) {
+            ESP_LOGI(TAG, "Ch%u: level %u, hysteresis %u", ch, cfg[ch].level, cfg[ch].hyst);
+        }
+    }
+
+    /* Force a state reset on the first frame */
+    cfg_gen++;
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_args();
+    return pdPASS;
+}
+
+esp_err_t freq_set_config(uint8_t channel, const freq_cfg_t *c)
+{
+    if (!chk_ch(channel) || c == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    cfg[channel] = *c;
+    cfg_gen++;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", channel);
+    return flash_svc_run(key, write_cfg, &channel, sizeof(channel));
+}
+
+esp_err_t freq_get_config(uint8_t channel, freq_cfg_t *c)
+{
+    if (!chk_ch(channel) || c == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    *c = cfg[channel];
+    taskEXIT_CRITICAL(&cfg_lock);
+    return ESP_OK;
+}
+
+esp_err_t freq_get(uint8_t channel, freq_reading_t *reading)
+{
+    if (!chk_ch(channel) || reading == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!cfg[channel].enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *reading = readings[channel];
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *channel;
+    struct arg_int *level;
+    struct arg_int *hyst;
+    struct arg_int *ppr;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Frequency, period and duty cycle measurement\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+    printf("Examples:\n"
+           "  adc freq                     Show measured channels\n"
+           "  adc freq -c 2 -E             Measure ch2, level from the signal mean\n"
+           "  adc freq -c 2 -l 2048 -y 100 Fixed level with hysteresis\n"
+           "  adc freq -c 2 -r 2           Tachometer with 2 pulses per revolution\n");
+}
+
+/**
+ * @brief Print the results of all measured channels
+ */
+static void print_status(void)
+{
+    bool any = false;
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        freq_cfg_t c;
+        freq_reading_t r;
+
+        freq_get_config(ch, &c);
+        if (freq_get(ch, &r) != ESP_OK) {
+            continue;
+        }
+        any = true;
+
+        printf("-- Ch%u --\n", ch);
+        printf("  Level: %u%s, hysteresis %u\n", r.level, c.level ? "" : " (mean)", c.hyst);
+        if (!r.valid) {
+            printf("  Waiting for the first gate\n");
+            continue;
+        }
+        printf("  Frequency: %.3f Hz\n", r.freq_hz);
+        printf("  Period: %.1f us\n", r.period_us);
+        printf("  Duty cycle: %.1f%%\n", r.duty * 100.0f);
+        if (c.ppr) {
+            printf("  Speed: %.1f rpm (%u pulses/rev)\n", r.rpm, c.ppr);
+        }
+        printf("  Periods: %"PRIu32" in the last gate, %"PRIu32" edges\n", r.periods, r.edges);
+    }
+
+    if (!any) {
+        printf("No channel measured\n");
+    }
+}
+
+int freq_cmd(int argc, char **argv)
+{
+    if (args.end == NULL) {
+        printf("Frequency measurement not initialized\n");
+        return 1;
+    }
+
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.channel->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    if (args.channel->ival[0] < 0 || !chk_ch(args.channel->ival[0])) {
+        printf("Invalid channel %d (0-%d)\n", args.channel->ival[0], ADC_TOTAL_CHANNELS - 1);
+        return 1;
+    }
+    uint8_t ch = args.channel->ival[0];
+
+    freq_cfg_t c;
+    freq_get_config(ch, &c);
+    bool changed = false;
+
+    if (args.level->count > 0) {
+        if (args.level->ival[0] < 0 || args.level->ival[0] > UINT16_MAX) {
+            printf("Invalid level %d\n", args.level->ival[0]);
+            return 1;
+        }
+        c.level = args.level->ival[0];
+        changed = true;
+    }
+
+    if (args.hyst->count > 0) {
+        if (args.hyst->ival[0] < 0 || args.hyst->ival[0] > UINT16_MAX) {
+            printf("Invalid hysteresis %d\n", args.hyst->ival[0]);
+            return 1;
+        }
+        c.hyst = args.hyst->ival[0];
+        changed = true;
+    }
+
+    if (args.ppr->count > 0) {
+        if (args.ppr->ival[0] < 0 || args.ppr->ival[0] > UINT8_MAX) {
+            printf("Invalid pulses per revolution %d\n", args.ppr->ival[0]);
+            return 1;
+        }
+        c.ppr = args.ppr->ival[0];
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (!changed) {
+        print_status();
+        return 0;
+    }
+
+    esp_err_t err = freq_set_config(ch, &c);
+    if (err != ESP_OK) {
+        printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Allocate the `adc freq` arguments
+ */
+static void register_args(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.channel = arg_int0("c", "channel", "<ch>", "Channel to configure");
+    args.level = arg_int0("l", "level", "<value>", "Trigger level, 0 for the signal mean");
+    args.hyst = arg_int0("y", "hyst", "<value>", "Hysteresis around the level");
+    args.ppr = arg_int0("r", "ppr", "<n>", "Pulses per revolution, 0 for no RPM");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable measurement");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable measurement");
+    args.end = arg_end(7);
+}
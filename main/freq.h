@@ -0,0 +1,104 @@
+/**
+ * @file freq.h
+ * @brief Frequency, period and duty cycle measurement per channel
+ *
+ * A Schmitt trigger around a level (fixed, or the mean of the previous
+ * gate) turns the samples of a channel into edges. The edge time is
+ * interpolated linearly between the two samples around the level, so
+ * the period resolution is a fraction of the sampling interval. Over
+ * every gate of CONFIG_ADC_FREQ_GATE_MS the whole periods are averaged
+ * into frequency, period, duty cycle and, with the pulses per revolution
+ * set, RPM. Everything is computed incrementally in the ADC task.
+ *
+ * Configured with `adc freq`; the configuration is stored in NVS.
+ */
+
+#ifndef FREQ_H
+#define FREQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+/**
+ * @brief Measurement configuration of one channel
+ */
+typedef struct {
+    uint8_t enabled;            /**< Channel is measured */
+    uint8_t ppr;                /**< Pulses per revolution for RPM, 0 for none */
+    uint16_t level;             /**< Trigger level, 0 for the mean of the previous gate */
+    uint16_t hyst;              /**< Distance from the level that qualifies an edge */
+    uint16_t reserved;
+} freq_cfg_t;
+
+/**
+ * @brief Results of one channel
+ */
+typedef struct {
+    bool valid;                 /**< At least one gate completed */
+    float freq_hz;              /**< Mean frequency, 0 without two rising edges */
+    float period_us;            /**< Mean period, 0 without two rising edges */
+    float duty;                 /**< High time per period (0..1) */
+    float rpm;                  /**< freq_hz * 60 / ppr, 0 without ppr */
+    uint16_t level;             /**< Trigger level used */
+    uint32_t periods;           /**< Periods in the last gate */
+    uint32_t edges;             /**< Rising edges since the configuration changed */
+} freq_reading_t;
+
+/**
+ * @brief Initialize the frequency measurement
+ *
+ * Loads the configuration from NVS and registers the frame listener.
+ * Call after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t freq_init(void);
+
+/**
+ * @brief Configure a channel
+ *
+ * @param[in] channel Channel index, virtual channels included
+ * @param[in] cfg Configuration
+ * @return ESP_OK if applied and stored
+ *         ESP_ERR_INVALID_ARG if channel is invalid or cfg is NULL
+ *         an NVS error if the configuration could not be stored
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t freq_set_config(uint8_t channel, const freq_cfg_t *cfg);
+
+/**
+ * @brief Get the configuration of a channel
+ *
+ * @param[in] channel Channel index
+ * @param[out] cfg Pointer to store the configuration
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or cfg is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t freq_get_config(uint8_t channel, freq_cfg_t *cfg);
+
+/**
+ * @brief Get the latest results of a channel
+ *
+ * @param[in] channel Channel index
+ * @param[out] reading Pointer to store the results
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid or reading is NULL
+ *         ESP_ERR_INVALID_STATE if the channel is not measured
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t freq_get(uint8_t channel, freq_reading_t *reading);
+
+/**
+ * @brief Handle `adc freq` (console task)
+ *
+ * @param[in] argc Argument count, argv[0] being "freq"
+ * @param[in] argv Arguments
+ * @return Command exit code
+ */
+int freq_cmd(int argc, char **argv);
+
+#endif /* FREQ_H */
@@ -0,0 +1,406 @@
+/**
+ * @file history.c
+ * @brief Multi-resolution min/max/mean history per channel
+ *
+ * Each tier has an accumulator, written by the ADC task only, and a ring
+ * of completed entries. A sample goes into the 10 ms accumulator; when
+ * it is full its entry is pushed to the 10 ms ring and folded into the
+ * 1 s accumulator as one value, and so on up. Higher tiers average the
+ * means of equal-length entries, which is the mean of all their samples.
+ * Per sample this is a compare, an add and a count; the rings are only
+ * touched once per completed entry, under a spinlock held for the copy.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+
+#include "adc.h"
+#include "history.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define SAMPLES_10MS    (ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS / 100)
+#define DEPTH_10MS      CONFIG_ADC_HISTORY_DEPTH_10MS
+#define DEPTH_1S        CONFIG_ADC_HISTORY_DEPTH_1S
+#define DEPTH_1MIN      CONFIG_ADC_HISTORY_DEPTH_1MIN
+#define DEPTH_1H        CONFIG_ADC_HISTORY_DEPTH_1H
+#define DEPTH_TOTAL     (DEPTH_10MS + DEPTH_1S + DEPTH_1MIN + DEPTH_1H)
+#define PRINT_DEFAULT   20
+#define PRINT_CHUNK     16
+
+/**
+ * @brief Tier layout
+ */
+static const struct {
+    const char *name;           /**< Resolution in the command */
+    uint32_t period_ms;         /**< Time per entry */
+    uint32_t depth;             /**< Ring size */
+    uint32_t offset;            /**< First ring entry in the channel store */
+    uint32_t fold;              /**< Samples or finer entries per entry */
+} tiers[HISTORY_TIERS] = {
+    [HISTORY_10MS] = {"10ms", 10,      DEPTH_10MS, 0, SAMPLES_10MS},
+    [HISTORY_1S]   = {"1s",   1000,    DEPTH_1S,   DEPTH_10MS, 100},
+    [HISTORY_1MIN] = {"1min", 60000,   DEPTH_1MIN, DEPTH_10MS + DEPTH_1S, 60},
+    [HISTORY_1H]   = {"1h",   3600000, DEPTH_1H,   DEPTH_10MS + DEPTH_1S + DEPTH_1MIN, 60},
+};
+
+/**
+ * @brief Entry being accumulated (ADC task only)
+ */
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;               /**< Sum of the samples or finer means */
+    uint32_t n;                 /**< Samples or finer entries so far */
+} acc_t;
+
+/**
+ * @brief Ring position of one tier
+ */
+typedef struct {
+    uint32_t head;              /**< Next slot to write */
+    uint32_t total;             /**< Entries pushed since boot */
+    int64_t newest_us;          /**< Frame time of the newest entry */
+} ring_t;
+
+/* Forward declarations */
+static void register_args(void);
+
+/* Module static variables */
+static const char *TAG = "history";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static acc_t acc[ADC_TOTAL_CHANNELS][HISTORY_TIERS];
+static ring_t rings[ADC_TOTAL_CHANNELS][HISTORY_TIERS];
+static history_entry_t store[ADC_TOTAL_CHANNELS][DEPTH_TOTAL];
+
+/**
+ * @brief Check if channel index is valid
+ */
+static inline bool chk_ch(uint8_t channel)
+{
+    return channel < ADC_TOTAL_CHANNELS;
+}
+
+/**
+ * @brief Check if tier is valid
+ */
+static inline bool chk_tier(history_tier_t tier)
+{
+    return (unsigned)tier < HISTORY_TIERS;
+}
+
+/**
+ * @brief Add a value to an accumulator
+ */
+static inline void acc_add(acc_t *a, uint16_t min, uint16_t max, uint16_t value)
+{
+    if (a->n == 0) {
+        a->min = min;
+        a->max = max;
+        a->sum = 0;
+    } else {
+        a->min = MIN(a->min, min);
+        a->max = MAX(a->max, max);
+    }
+    a->sum += value;
+    a->n++;
+}
+
+/**
+ * @brief Push the full accumulator of a tier and fold it upwards
+ *
+ * @param[in] ch Channel index
+ * @param[in] tier Tier whose accumulator is full
+ * @param[in] t_us Frame time
+ */
+static void complete(uint8_t ch, int tier, int64_t t_us)
+{
+    for (; tier < HISTORY_TIERS; tier++) {
+        acc_t *a = &acc[ch][tier];
+        ring_t *r = &rings[ch][tier];
+        history_entry_t e = {
+            .min = a->min,
+            .max = a->max,
+            .mean = (a->sum + a->n / 2) / a->n,
+        };
+        a->n = 0;
+
+        taskENTER_CRITICAL(&lock);
+        store[ch][tiers[tier].offset + r->head] = e;
+        r->head = (r->head + 1) % tiers[tier].depth;
+        r->total++;
+        r->newest_us = t_us;
+        taskEXIT_CRITICAL(&lock);
+
+        if (tier + 1 == HISTORY_TIERS) {
+            break;
+        }
+        acc_t *up = &acc[ch][tier + 1];
+        acc_add(up, e.min, e.max, e.mean);
+        if (up->n < tiers[tier + 1].fold) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t history_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    ESP_LOGI(TAG, "%u channels, %u entries each, %u bytes", ADC_TOTAL_CHANNELS,
+             DEPTH_TOTAL, (unsigned)(sizeof(store) + sizeof(acc) + sizeof(rings)));
+
+    register_args();
+    return pdPASS;
+}
+
+void history_update(const adc_frame_t *f)
+{
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        acc_t *a = &acc[ch][HISTORY_10MS];
+        const uint16_t *s = f->samples[ch];
+
+        for (uint16_t i = 0; i < f->count[ch]; i++) {
+            acc_add(a, s[i], s[i], s[i]);
+            if (a->n == SAMPLES_10MS) {
+                complete(ch, HISTORY_10MS, f->timestamp_us);
+            }
+        }
+    }
+}
+
+esp_err_t history_read(uint8_t channel, history_tier_t tier, uint32_t age,
+                       history_entry_t *entries, size_t n, size_t *read)
+{
+    if (!chk_ch(channel) || !chk_tier(tier) || entries == NULL || read == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint32_t depth = tiers[tier].depth;
+    const history_entry_t *ring = &store[channel][tiers[tier].offset];
+    size_t got = 0;
+
+    taskENTER_CRITICAL(&lock);
+    const ring_t *r = &rings[channel][tier];
+    uint32_t stored = MIN(r->total, depth);
+    for (; got < n && age + got < stored; got++) {
+        entries[got] = ring[(r->head + depth - 1 - (age + got)) % depth];
+    }
+    taskEXIT_CRITICAL(&lock);
+
+    *read = got;
+    return ESP_OK;
+}
+
+esp_err_t history_get_info(uint8_t channel, history_tier_t tier, history_info_t *info)
+{
+    if (!chk_ch(channel) || !chk_tier(tier) || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    const ring_t *r = &rings[channel][tier];
+    *info = (history_info_t){
+        .period_ms = tiers[tier].period_ms,
+        .depth = tiers[tier].depth,
+        .stored = MIN(r->total, tiers[tier].depth),
+        .total = r->total,
+        .newest_us = r->newest_us,
+    };
+    taskEXIT_CRITICAL(&lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *channel;
+    struct arg_str *res;
+    struct arg_int *count;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Min/max/mean history per channel\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+    printf("Examples:\n"
+           "  adc history                  Tiers and memory\n"
+           "  adc history -c 0             Newest entry of every tier of ch0\n"
+           "  adc history -c 0 -r 1min     Last hour of ch0 in minutes\n"
+           "  adc history -c 1 -r 10ms -n 100  Last second of ch1\n");
+}
+
+/**
+ * @brief Format a time span for the listing
+ */
+static void fmt_age(char *buf, size_t len, uint64_t ms)
+{
+    if (ms < 60000) {
+        snprintf(buf, len, "%.2f s", ms / 1000.0);
+    } else if (ms < 3600000) {
+        snprintf(buf, len, "%.1f min", ms / 60000.0);
+    } else {
+        snprintf(buf, len, "%.2f h", ms / 3600000.0);
+    }
+}
+
+/**
+ * @brief Print the tier layout
+ */
+static void print_status(void)
+{
+    printf("-- History --\n");
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        char span[16];
+        fmt_age(span, sizeof(span), (uint64_t)tiers[t].period_ms * tiers[t].depth);
+        printf("  %-5s %4"PRIu32" entries, %s\n", tiers[t].name, tiers[t].depth, span);
+    }
+    printf("  10 ms = %u samples per channel\n", SAMPLES_10MS);
+    printf("  Memory: %u bytes for %u channels\n",
+           (unsigned)(sizeof(store) + sizeof(acc) + sizeof(rings)), ADC_TOTAL_CHANNELS);
+}
+
+/**
+ * @brief Print entries of one tier, newest first
+ */
+static void print_tier(uint8_t ch, history_tier_t tier, uint32_t count)
+{
+    history_info_t info;
+    history_get_info(ch, tier, &info);
+
+    printf("-- Ch%u, %s (%"PRIu32" of %"PRIu32" entries) --\n", ch, tiers[tier].name,
+           info.stored, info.depth);
+    if (info.stored == 0) {
+        printf("  No entries yet\n");
+        return;
+    }
+    printf("  %12s %6s %6s %6s\n", "Age", "Min", "Max", "Mean");
+
+    /* Age of the newest entry: its end is within its last frame */
+    uint64_t now_ms = (esp_timer_get_time() - info.newest_us) / 1000;
+    history_entry_t e[PRINT_CHUNK];
+    uint32_t age = 0;
+
+    while (age < count) {
+        size_t got;
+        history_read(ch, tier, age, e, MIN(PRINT_CHUNK, count - age), &got);
+        if (got == 0) {
+            break;
+        }
+        for (size_t i = 0; i < got; i++) {
+            char when[16];
+            fmt_age(when, sizeof(when), now_ms + (uint64_t)(age + i) * info.period_ms);
+            printf("  %12s %6u %6u %6u\n", when, e[i].min, e[i].max, e[i].mean);
+        }
+        age += got;
+    }
+}
+
+/**
+ * @brief Print the newest entry of every tier of a channel
+ */
+static void print_channel(uint8_t ch)
+{
+    printf("-- Ch%u --\n", ch);
+    printf("  %-5s %6s %6s %6s %8s\n", "Tier", "Min", "Max", "Mean", "Entries");
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        history_entry_t e;
+        size_t got;
+
+        history_read(ch, t, 0, &e, 1, &got);
+        if (got == 0) {
+            printf("  %-5s %6s %6s %6s %8u\n", tiers[t].name, "-", "-", "-", 0);
+            continue;
+        }
+        history_info_t info;
+        history_get_info(ch, t, &info);
+        printf("  %-5s %6u %6u %6u %8"PRIu32"\n", tiers[t].name, e.min, e.max, e.mean,
+               info.stored);
+    }
+}
+
+int history_cmd(int argc, char **argv)
+{
+    if (args.end == NULL) {
+        printf("History not initialized\n");
+        return 1;
+    }
+
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.channel->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    if (args.channel->ival[0] < 0 || !chk_ch(args.channel->ival[0])) {
+        printf("Invalid channel %d (0-%d)\n", args.channel->ival[0], ADC_TOTAL_CHANNELS - 1);
+        return 1;
+    }
+    uint8_t ch = args.channel->ival[0];
+
+    if (args.res->count == 0) {
+        print_channel(ch);
+        return 0;
+    }
+
+    int tier = 0;
+    while (tier < HISTORY_TIERS && strcmp(args.res->sval[0], tiers[tier].name) != 0) {
+        tier++;
+    }
+    if (tier == HISTORY_TIERS) {
+        printf("Unknown resolution '%s' (10ms, 1s, 1min or 1h)\n", args.res->sval[0]);
+        return 1;
+    }
+
+    uint32_t count = PRINT_DEFAULT;
+    if (args.count->count > 0) {
+        if (args.count->ival[0] <= 0) {
+            printf("Invalid count %d\n", args.count->ival[0]);
+            return 1;
+        }
+        count = MIN((uint32_t)args.count->ival[0], tiers[tier].depth);
+    }
+
+    print_tier(ch, tier, count);
+    return 0;
+}
+
+/**
+ * @brief Allocate the `adc history` arguments
+ */
+static void register_args(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.channel = arg_int0("c", "channel", "<ch>", "Channel, virtual channels included");
+    args.res = arg_str0("r", "res", "<res>", "Resolution: 10ms, 1s, 1min or 1h");
+    args.count = arg_int0("n", "count", "<n>", "Entries to print, newest first");
+    args.end = arg_end(4);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file history.h
+ * @brief Multi-resolution min/max/mean history per channel
+ *
+ * Every channel, virtual channels included, keeps rings of (min, max,
+ * mean) summaries at 10 ms, 1 s, 1 min and 1 h resolution. The ADC task
+ * folds each processed sample into the finest tier; a completed entry is
+ * folded into the next tier, so every tier is rolled up incrementally and
+ * reading one is a copy. Memory is fixed by the ring depths in Kconfig.
+ *
+ * Periods count samples, not wall time: the 10 ms tier is
+ * ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS / 100 samples of a channel, and
+ * samples lost to pool overflows shift the later entries.
+ *
+ * Read with `adc history`.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+/**
+ * @brief History resolutions
+ */
+typedef enum {
+    HISTORY_10MS = 0,           /**< 10 ms entries */
+    HISTORY_1S,                 /**< 1 s entries, 100 of the 10 ms tier */
+    HISTORY_1MIN,               /**< 1 min entries, 60 of the 1 s tier */
+    HISTORY_1H,                 /**< 1 h entries, 60 of the 1 min tier */
+    HISTORY_TIERS
+} history_tier_t;
+
+/**
+ * @brief Summary of one period
+ */
+typedef struct {
+    uint16_t min;               /**< Smallest sample */
+    uint16_t max;               /**< Largest sample */
+    uint16_t mean;              /**< Mean of the samples */
+} history_entry_t;
+
+/**
+ * @brief State of one tier of a channel
+ */
+typedef struct {
+    uint32_t period_ms;         /**< Time per entry */
+    uint32_t depth;             /**< Entries the ring holds */
+    uint32_t stored;            /**< Entries currently held (up to depth) */
+    uint32_t total;             /**< Entries completed since boot */
+    int64_t newest_us;          /**< Frame time of the newest entry, 0 for none */
+} history_info_t;
+
+/**
+ * @brief Initialize the history
+ *
+ * Registers the `adc history` arguments. The ADC task fills the history
+ * from its first frame. Call after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t history_init(void);
+
+/**
+ * @brief Read entries of a tier, newest first
+ *
+ * @param[in] channel Channel index, virtual channels included
+ * @param[in] tier Resolution
+ * @param[in] age Entries to skip, 0 to start with the newest
+ * @param[out] entries Buffer for the entries
+ * @param[in] n Buffer size in entries
+ * @param[out] read Number of entries stored
+ * @return ESP_OK if successful (read may be less than n at the end of the ring)
+ *         ESP_ERR_INVALID_ARG if channel or tier is invalid or entries or read is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t history_read(uint8_t channel, history_tier_t tier, uint32_t age,
+                       history_entry_t *entries, size_t n, size_t *read);
+
+/**
+ * @brief Get the state of a tier
+ *
+ * @param[in] channel Channel index, virtual channels included
+ * @param[in] tier Resolution
+ * @param[out] info Pointer to store the state
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel or tier is invalid or info is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t history_get_info(uint8_t channel, history_tier_t tier, history_info_t *info);
+
+/**
+ * @brief Fold a frame into the history (ADC task)
+ *
+ * @param[in] frame Frame with all channels filled in
+ */
+void history_update(const adc_frame_t *frame);
+
+/**
+ * @brief Handle `adc history` (console task)
+ *
+ * @param[in] argc Argument count, argv[0] being "history"
+ * @param[in] argv Arguments
+ * @return Command exit code
+ */
+int history_cmd(int argc, char **argv);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,506 @@
+/**
+ * @file lincal.c
+ * @brief Code-density linearity calibration of the ADC channels
+ *
+ * The fraction of samples below a code gives its lower transition level
+ * through the inverse distribution of the test signal: linear for a ramp,
+ * -cos(pi c) for a sine. The end bins are dropped because they also hold
+ * everything beyond the range; the codes in between span the input
+ * interval from half a code below the lowest to half a code above the
+ * highest. The correction of a code is the distance from the code to the
+ * centre of its interval, rounded to whole codes and stored as int8.
+ *
+ * A table is a file on /data followed by its CRC16, written and read on
+ * the flash service; a file that fails the check is not installed.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "flash_svc.h"
+#include "econsole.h"
+
+#include "adc.h"
+#include "lincal.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define MIN_CODES       256         /* Codes a histogram must cover */
+#define MIN_HITS        16          /* Mean hits per code below which the result is noisy */
+#define SECONDS_DEFAULT 60
+#define SECONDS_MAX     3600
+
+#define PATH_FMT        CON_DATA_PATH "/lincal%u.bin"
+#define PATH_LEN        32
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Table file access on the flash service */
+typedef struct {
+    uint8_t ch;                 /* Channel */
+    int8_t *lut;                /* ADC_CODES entries */
+} lut_op_t;
+
+/* Module static variables */
+static const char *TAG = "lincal";
+
+/**
+ * @brief Check if channel index is valid
+ */
+static inline bool chk_ch(uint8_t channel)
+{
+    return channel < ADC_MAX_CHANNELS;
+}
+
+/**
+ * @brief Input level below which a fraction of the samples lies
+ *
+ * @param[in] wave Test signal shape
+ * @param[in] c Fraction (0..1)
+ * @param[in] lo Lowest code of the fit
+ * @param[in] hi Highest code of the fit
+ * @return Level in codes
+ */
+static double level(lincal_wave_t wave, double c, int lo, int hi)
+{
+    const double span = hi - lo + 1;
+
+    if (wave == LINCAL_SINE) {
+        return (lo + hi) / 2.0 - span / 2.0 * cos(M_PI * c);
+    }
+    return lo - 0.5 + span * c;
+}
+
+/**
+ * @brief Write or remove the table file of a channel (flash service task)
+ *
+ * @param[in] ctx Request (lut_op_t), lut NULL to remove the file
+ * @return ESP_OK on success
+ */
+static esp_err_t write_lut(void *ctx)
+{
+    const lut_op_t *op = ctx;
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), PATH_FMT, op->ch);
+
+    if (op->lut == NULL) {
+        return (unlink(path) == 0 || errno == ENOENT) ? ESP_OK : ESP_FAIL;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    uint16_t crc = esp_rom_crc16_le(0, (const uint8_t *)op->lut, ADC_CODES);
+    bool ok = fwrite(op->lut, 1, ADC_CODES, f) == ADC_CODES
+              && fwrite(&crc, sizeof(crc), 1, f) == 1;
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        /* Leave no partial table behind */
+        unlink(path);
+    }
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Read the table file of a channel (flash service task)
+ *
+ * @param[in] ctx Request (lut_op_t)
+ * @return ESP_OK on success
+ *         ESP_ERR_NOT_FOUND if there is no file
+ *         ESP_ERR_INVALID_CRC if the file is damaged
+ */
+static esp_err_t read_lut(void *ctx)
+{
+    const lut_op_t *op = ctx;
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), PATH_FMT, op->ch);
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint16_t crc;
+    bool ok = fread(op->lut, 1, ADC_CODES, f) == ADC_CODES
+              && fread(&crc, sizeof(crc), 1, f) == 1
+              && crc == esp_rom_crc16_le(0, (const uint8_t *)op->lut, ADC_CODES);
+    fclose(f);
+    return ok ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/**
+ * @brief Store the table of a channel, NULL to remove it
+ *
+ * @return ESP_OK on success
+ *         ESP_ERR_INVALID_STATE if /data is not mounted
+ *         ESP_FAIL if the file could not be written
+ */
+static esp_err_t save_lut(uint8_t ch, int8_t *lut)
+{
+    if (!con_data_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), PATH_FMT, ch);
+    lut_op_t op = { .ch = ch, .lut = lut };
+    return flash_svc_run(key, write_lut, &op, sizeof(op));
+}
+
+/**
+ * @brief Install a table, store it and undo the change if storing fails
+ *
+ * @param[in] ch Channel index
+ * @param[in] lut New table, NULL to remove the correction
+ * @return ESP_OK on success, otherwise the previous table is installed again
+ */
+static esp_err_t replace_lut(uint8_t ch, int8_t *lut)
+{
+    int8_t *old = malloc(ADC_CODES);
+    if (old == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t had = adc_get_linearity(ch, old);
+
+    esp_err_t err = adc_set_linearity(ch, lut);
+    if (err == ESP_OK) {
+        err = save_lut(ch, lut);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Ch%u: table not stored (%s), previous one kept",
+                     ch, esp_err_to_name(err));
+            adc_set_linearity(ch, had == ESP_OK ? old : NULL);
+        }
+    }
+
+    free(old);
+    return err;
+}
+
+/**
+ * @brief Install the tables stored on /data
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    if (!con_data_mounted()) {
+        ESP_LOGW(TAG, "%s not mounted, no tables loaded", CON_DATA_PATH);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int8_t *lut = malloc(ADC_CODES);
+    if (lut == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        char key[FLASH_SVC_KEY_MAX];
+        snprintf(key, sizeof(key), PATH_FMT "?r", ch);
+        lut_op_t op = { .ch = ch, .lut = lut };
+
+        esp_err_t err = flash_svc_run(key, read_lut, &op, sizeof(op));
+        if (err == ESP_OK) {
+            err = adc_set_linearity(ch, lut);
+        }
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Ch%u: linearity correction installed", ch);
+        } else if (err != ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "Ch%u: table not installed (%s)", ch, esp_err_to_name(err));
+        }
+    }
+
+    free(lut);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t lincal_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    load_config();
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t lincal_analyse(const uint32_t *bins, lincal_wave_t wave, int8_t *lut,
+                         lincal_report_t *report)
+{
+    if (bins == NULL || lut == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int lo = 0, hi = ADC_CODES - 1;
+    while (lo < ADC_CODES && bins[lo] == 0) {
+        lo++;
+    }
+    while (hi > lo && bins[hi] == 0) {
+        hi--;
+    }
+    /* The end bins also count everything beyond the range */
+    lo++;
+    hi--;
+    if (hi - lo + 1 < MIN_CODES) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint64_t total = 0;
+    for (int k = lo; k <= hi; k++) {
+        total += bins[k];
+    }
+
+    lincal_report_t r = {
+        .code_lo = lo,
+        .code_hi = hi,
+        .hits_per_code = (float)total / (hi - lo + 1),
+        .dnl_min = INFINITY,
+        .dnl_max = -INFINITY,
+    };
+    for (int k = 0; k < ADC_CODES; k++) {
+        r.samples += bins[k];
+    }
+
+    uint64_t cum = 0;
+    double t_lo = level(wave, 0.0, lo, hi);
+    for (int k = lo; k <= hi; k++) {
+        double t_hi = level(wave, (double)(cum + bins[k]) / total, lo, hi);
+        double mid = level(wave, (cum + bins[k] / 2.0) / total, lo, hi);
+        float dnl = t_hi - t_lo - 1.0;
+        float inl = mid - k;
+
+        r.dnl_min = fminf(r.dnl_min, dnl);
+        r.dnl_max = fmaxf(r.dnl_max, dnl);
+        r.inl_max = fmaxf(r.inl_max, fabsf(inl));
+        if (bins[k] == 0) {
+            r.missing++;
+        }
+        lut[k] = (int8_t)fmaxf(fminf(roundf(inl), INT8_MAX), INT8_MIN);
+
+        cum += bins[k];
+        t_lo = t_hi;
+    }
+
+    /* Beyond the fit keep the correction of the nearest end */
+    for (int k = 0; k < lo; k++) {
+        lut[k] = lut[lo];
+    }
+    for (int k = hi + 1; k < ADC_CODES; k++) {
+        lut[k] = lut[hi];
+    }
+
+    if (report != NULL) {
+        *report = r;
+    }
+    return ESP_OK;
+}
+
+esp_err_t lincal_run(uint8_t channel, lincal_wave_t wave, uint32_t seconds,
+                     lincal_report_t *report)
+{
+    if (!chk_ch(channel) || seconds == 0 || seconds > SECONDS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t *bins = malloc(ADC_CODES * sizeof(uint32_t));
+    int8_t *lut = malloc(ADC_CODES);
+    if (bins == NULL || lut == NULL) {
+        free(bins);
+        free(lut);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = adc_histogram_start(channel, bins);
+    if (err == ESP_OK) {
+        vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
+        err = adc_histogram_stop(NULL);
+    }
+    if (err == ESP_OK) {
+        err = lincal_analyse(bins, wave, lut, report);
+    }
+    if (err == ESP_OK) {
+        err = replace_lut(channel, lut);
+    }
+
+    free(bins);
+    free(lut);
+    return err;
+}
+
+esp_err_t lincal_clear(uint8_t channel)
+{
+    if (!chk_ch(channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return replace_lut(channel, NULL);
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *channel;
+    struct arg_str *wave;
+    struct arg_int *seconds;
+    struct arg_lit *clear;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Code-density linearity calibration\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print which channels are corrected
+ */
+static void print_status(void)
+{
+    int8_t *lut = malloc(ADC_CODES);
+    if (lut == NULL) {
+        printf("Out of memory\n");
+        return;
+    }
+
+    printf("-- Linearity Correction --\n");
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        if (adc_get_linearity(ch, lut) != ESP_OK) {
+            printf("  Ch%u: none\n", ch);
+            continue;
+        }
+        int lo = 0, hi = 0;
+        for (int k = 0; k < ADC_CODES; k++) {
+            lo = MIN(lo, lut[k]);
+            hi = MAX(hi, lut[k]);
+        }
+        printf("  Ch%u: installed, corrections %d..%+d codes\n", ch, lo, hi);
+    }
+
+    free(lut);
+}
+
+/**
+ * @brief Linearity calibration command handler
+ */
+static int cmd_lincal(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.channel->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    if (args.channel->ival[0] < 0 || !chk_ch(args.channel->ival[0])) {
+        printf("Invalid channel %d (0-%d)\n", args.channel->ival[0], ADC_MAX_CHANNELS - 1);
+        return 1;
+    }
+    uint8_t ch = args.channel->ival[0];
+
+    if (args.clear->count > 0) {
+        esp_err_t err = lincal_clear(ch);
+        if (err != ESP_OK) {
+            printf("Failed to remove the correction: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+        printf("Ch%u: correction removed\n", ch);
+        return 0;
+    }
+
+    lincal_wave_t wave = LINCAL_RAMP;
+    if (args.wave->count > 0) {
+        if (strcmp(args.wave->sval[0], "sine") == 0) {
+            wave = LINCAL_SINE;
+        } else if (strcmp(args.wave->sval[0], "ramp") != 0) {
+            printf("Unknown wave '%s' (ramp or sine)\n", args.wave->sval[0]);
+            return 1;
+        }
+    }
+
+    int seconds = args.seconds->count > 0 ? args.seconds->ival[0] : SECONDS_DEFAULT;
+    if (seconds <= 0 || seconds > SECONDS_MAX) {
+        printf("Invalid time %d s (1-%d)\n", seconds, SECONDS_MAX);
+        return 1;
+    }
+
+    printf("Capturing ch%u for %d s, keep the %s running...\n", ch, seconds,
+           wave == LINCAL_SINE ? "sine" : "ramp");
+
+    lincal_report_t r;
+    esp_err_t err = lincal_run(ch, wave, seconds, &r);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        printf("The signal covers fewer than %d codes\n", MIN_CODES);
+        return 1;
+    } else if (err != ESP_OK) {
+        printf("Calibration failed: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("  Samples: %"PRIu32", codes %u..%u, %.1f hits/code\n",
+           r.samples, r.code_lo, r.code_hi, r.hits_per_code);
+    printf("  DNL: %+.2f..%+.2f LSB, %u missing codes\n", r.dnl_min, r.dnl_max, r.missing);
+    printf("  INL: %.2f LSB max, corrected\n", r.inl_max);
+    if (r.hits_per_code < MIN_HITS) {
+        printf("  Few hits per code, capture longer for a less noisy table\n");
+    }
+    return 0;
+}
+
+/**
+ * @brief Register linearity calibration commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.channel = arg_int0("c", "channel", "<0-5>", "Channel to calibrate");
+    args.wave = arg_str0("w", "wave", "<ramp|sine>", "Test signal (default ramp)");
+    args.seconds = arg_int0("t", "time", "<s>", "Capture time (default 60)");
+    args.clear = arg_litn("d", "delete", 0, 1, "Remove the correction");
+    args.end = arg_end(5);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "lincal",
+        .func = cmd_lincal,
+        .help = "Linearity calibration from a code histogram\n"
+                "Examples:\n"
+                "  lincal                    Show corrected channels\n"
+                "  lincal -c 0               Calibrate ch0 with a slow ramp, 60 s\n"
+                "  lincal -c 1 -w sine -t 120  Calibrate ch1 with a sine\n"
+                "  lincal -c 0 -d            Remove the correction\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
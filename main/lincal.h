@@ -0,0 +1,106 @@
+/**
+ * @file lincal.h
+ * @brief Code-density linearity calibration of the ADC channels
+ *
+ * With a slow ramp or sine covering most of the input range, every code
+ * is hit in proportion to its width. The raw codes of one channel are
+ * counted into a histogram at the full sample rate; from it the transition
+ * levels, DNL and INL of the channel follow, and a table mapping every code
+ * to the centre of its input interval. The table is stored on /data and
+ * installed with adc_set_linearity(), one lookup per sample.
+ *
+ * The end points of the covered range define gain and offset (end-point
+ * fit); the min/max calibration still applies afterwards.
+ */
+
+#ifndef LINCAL_H
+#define LINCAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+/**
+ * @brief Test signal shape
+ */
+typedef enum {
+    LINCAL_RAMP = 0,            /**< Triangle or sawtooth, uniform code density */
+    LINCAL_SINE,                /**< Sine, arcsine code density */
+} lincal_wave_t;
+
+/**
+ * @brief Result of an analysis
+ */
+typedef struct {
+    uint32_t samples;           /**< Samples in the histogram */
+    uint16_t code_lo;           /**< Lowest code used (end bins excluded) */
+    uint16_t code_hi;           /**< Highest code used */
+    uint16_t missing;           /**< Codes between code_lo and code_hi never hit */
+    float hits_per_code;        /**< Mean samples per used code */
+    float dnl_min;              /**< Smallest code width - 1 (LSB) */
+    float dnl_max;              /**< Largest code width - 1 (LSB) */
+    float inl_max;              /**< Largest |centre - code| (LSB) */
+} lincal_report_t;
+
+/**
+ * @brief Initialize the linearity calibration
+ *
+ * Installs the tables stored on /data and registers the `lincal` command.
+ * Call after adc_init() and con_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t lincal_init(void);
+
+/**
+ * @brief Derive a correction table from a code histogram
+ *
+ * @param[in] bins ADC_CODES counters
+ * @param[in] wave Test signal shape
+ * @param[out] lut ADC_CODES corrections
+ * @param[out] report Analysis results, may be NULL
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if bins or lut is NULL
+ *         ESP_ERR_INVALID_SIZE if the histogram covers too few codes
+ * @note This function is NULL-safe
+ */
+esp_err_t lincal_analyse(const uint32_t *bins, lincal_wave_t wave, int8_t *lut,
+                         lincal_report_t *report);
+
+/**
+ * @brief Capture a histogram, derive the table, install and store it
+ *
+ * Blocks for the capture time.
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @param[in] wave Test signal shape
+ * @param[in] seconds Capture time
+ * @param[out] report Analysis results, may be NULL
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel or seconds is invalid
+ *         ESP_ERR_NO_MEM if the histogram could not be allocated
+ *         ESP_ERR_INVALID_STATE if /data is not mounted
+ *         ESP_FAIL if the table could not be stored
+ *         an error of lincal_analyse() or adc_set_linearity()
+ * @note This function is thread-safe. If the table cannot be stored the
+ *       previous one stays installed.
+ */
+esp_err_t lincal_run(uint8_t channel, lincal_wave_t wave, uint32_t seconds,
+                     lincal_report_t *report);
+
+/**
+ * @brief Remove the correction of a channel, also from /data
+ *
+ * @param[in] channel Channel index (0 to ADC_MAX_CHANNELS-1)
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if channel is invalid
+ *         ESP_ERR_INVALID_STATE if /data is not mounted
+ *         ESP_FAIL if the file could not be removed
+ * @note This function is thread-safe. If the file cannot be removed the
+ *       correction stays installed.
+ */
+esp_err_t lincal_clear(uint8_t channel);
+
+#endif /* LINCAL_H */
@@ -12,14 +12,124 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_adc/adc_continuous.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_pm.h"
 
 #include "econsole.h"
+#include "flash_svc.h"
+#include "boot_prof.h"
 #include "adc.h"
+#include "telemetry.h"
+#include "web.h"
+#include "metrics.h"
+#include "ws_stream.h"
+#include "modbus_tcp.h"
+#include "stress.h"
+#include "burst.h"
+#include "meter.h"
+#include "xcorr.h"
+#include "vchan.h"
+#include "freq.h"
+#include "pid.h"
+#include "alarm.h"
+#include "lincal.h"
+#include "history.h"
+#include "archive.h"
 
 #define TAG "main"
 
+/**
+ * @brief Bring up the TCP/IP stack and the default event loop
+ *
+ * Network services open their sockets before any AP is joined, so the
+ * stack has to exist independently of the `join` command.
+ */
+static void net_init(void)
+{
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+}
+
+#if CONFIG_PM_ENABLE
+/**
+ * @brief Enable dynamic frequency scaling and automatic light sleep
+ *
+ * Drivers and the ADC task hold locks while they need the clocks, the
+ * rest of the time the CPU runs at the XTAL frequency or sleeps.
+ */
+static void pm_init(void)
+{
+    esp_pm_config_t pm = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm));
+}
+#endif
+
 void app_main(void)
 {
+    boot_prof_mark("app_main");
+#if CONFIG_PM_ENABLE
+    pm_init();
+#endif
+    configASSERT(flash_svc_init());
+#if CONFIG_BOOT_FAST_START
+    /* Acquisition only needs the calibration from NVS */
+    con_nvs_init();
+    configASSERT(adc_init());
+    configASSERT(con_init());
+#else
     configASSERT(con_init());
     configASSERT(adc_init());
+#endif
+    adc_register_commands();
+#if ADC_VIRT_CHANNELS > 0
+    configASSERT(vchan_init());
+#endif
+#if CONFIG_ADC_LINCAL
+    configASSERT(lincal_init());
+#endif
+#if CONFIG_ADC_STRESS_CMD
+    configASSERT(stress_init());
+#endif
+#if CONFIG_ADC_BURST
+    configASSERT(burst_init());
+#endif
+#if CONFIG_METER
+    configASSERT(meter_init());
+#endif
+#if CONFIG_XCORR
+    configASSERT(xcorr_init());
+#endif
+#if CONFIG_ADC_FREQ
+    configASSERT(freq_init());
+#endif
+#if CONFIG_ADC_HISTORY
+    configASSERT(history_init());
+#endif
+#if CONFIG_PID
+    configASSERT(pid_init());
+#endif
+#if CONFIG_ALARM
+    configASSERT(alarm_init());
+#endif
+#if CONFIG_ARCHIVE
+    configASSERT(archive_init());
+#endif
+    net_init();
+    configASSERT(telemetry_init());
+    configASSERT(web_init());
+    configASSERT(metrics_init());
+#if CONFIG_WS_STREAM
+    configASSERT(ws_stream_init());
+#endif
+#if CONFIG_MODBUS_TCP
+    configASSERT(modbus_tcp_init());
+#endif
+    boot_prof_mark("services");
 }
\ No newline at end of file
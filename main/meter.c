@@ -0,0 +1,628 @@
+/**
+ * @file meter.c
+ * @brief Real/apparent power metering on voltage/current channel pairs
+ *
+ * The frame listener pairs the voltage and current samples of every
+ * enabled pair and adds them to integer sums (v, i, v², i², v·i) of the
+ * running cycle. A rising crossing of the voltage through its mean ends
+ * the cycle; whole cycles are added to the window. When the window holds
+ * METER_CYCLES cycles the results are computed from the sums with the
+ * window mean removed, so the ADC bias needs no calibration. Without
+ * crossings (DC or no signal) a window is closed after MAX_CYCLE samples
+ * and reported with frequency 0.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "meter.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define FS_HZ           ((double)ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS)
+#define WINDOW_CYCLES   CONFIG_METER_CYCLES
+#define ZC_HYST         CONFIG_METER_ZC_HYST
+#define MIN_CYCLE       (ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS / 100)  /* 100 Hz */
+#define MAX_CYCLE       (ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS / 20)   /* 20 Hz */
+#define CARRY_MAX       4
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "meter"
+#define NVS_KEY_FMT     "pair%u"
+
+/**
+ * @brief Configuration of one pair
+ */
+typedef struct {
+    uint8_t enabled;            /**< Pair is metered */
+    uint8_t v_ch;               /**< Voltage channel */
+    uint8_t i_ch;               /**< Current channel */
+    uint8_t reserved;
+    int32_t v_scale_uv;         /**< Line voltage per count (µV), sign inverts */
+    int32_t i_scale_ua;         /**< Load current per count (µA), sign inverts */
+} pair_cfg_t;
+
+/**
+ * @brief Sums over a cycle or window
+ */
+typedef struct {
+    int64_t v, i, vv, ii, vi;
+    uint32_t n;
+} sums_t;
+
+/**
+ * @brief Processing state of one pair (ADC task only)
+ */
+typedef struct {
+    uint16_t carry[2][CARRY_MAX];   /**< Samples without partner yet (v, i) */
+    uint8_t ncarry[2];
+    int32_t dc;                     /**< Crossing level, mean of the last window */
+    bool armed;                     /**< Voltage was below the crossing level */
+    bool synced;                    /**< Cycle start seen */
+    sums_t cyc;                     /**< Running cycle */
+    sums_t win;                     /**< Whole cycles of the window */
+    uint32_t win_cycles;
+} pair_state_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "meter";
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE out_lock = portMUX_INITIALIZER_UNLOCKED;
+static pair_cfg_t cfg[METER_PAIRS];
+static uint32_t cfg_gen;            /* Incremented on every configuration change */
+static uint32_t state_gen;          /* Used by the listener only */
+static pair_state_t state[METER_PAIRS];
+static meter_reading_t readings[METER_PAIRS];
+static uint32_t unpaired;           /* Samples dropped for lack of a partner */
+
+/**
+ * @brief Check if pair index is valid
+ */
+static inline bool chk_pair(uint8_t pair)
+{
+    return pair < METER_PAIRS;
+}
+
+/**
+ * @brief Reset the processing state of a pair
+ */
+static void state_reset(pair_state_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->dc = (1 << 12) / 2;
+}
+
+/**
+ * @brief Add a sample pair to sums
+ */
+static inline void sums_add(sums_t *s, int32_t v, int32_t i)
+{
+    s->v += v;
+    s->i += i;
+    s->vv += v * v;
+    s->ii += i * i;
+    s->vi += v * i;
+    s->n++;
+}
+
+/**
+ * @brief Add sums to sums
+ */
+static inline void sums_merge(sums_t *dst, const sums_t *src)
+{
+    dst->v += src->v;
+    dst->i += src->i;
+    dst->vv += src->vv;
+    dst->ii += src->ii;
+    dst->vi += src->vi;
+    dst->n += src->n;
+}
+
+/**
+ * @brief Compute and publish the results of a window
+ *
+ * @param[in] pair Pair index
+ * @param[in] c Pair configuration
+ * @param[in] s Window sums
+ * @param[in] cycles Whole cycles in the window, 0 without crossings
+ */
+static void publish(uint8_t pair, const pair_cfg_t *c, const sums_t *s, uint32_t cycles)
+{
+    if (s->n == 0) {
+        return;
+    }
+
+    double n = s->n;
+    double mv = s->v / n;
+    double mi = s->i / n;
+    double kv = c->v_scale_uv * 1e-6;
+    double ki = c->i_scale_ua * 1e-6;
+
+    /* Variances and covariance with the bias removed */
+    double vv = MAX(s->vv / n - mv * mv, 0.0);
+    double ii = MAX(s->ii / n - mi * mi, 0.0);
+    double vi = s->vi / n - mv * mi;
+
+    float v_rms = sqrt(vv) * fabs(kv);
+    float i_rms = sqrt(ii) * fabs(ki);
+    float p = vi * kv * ki;
+    float sa = v_rms * i_rms;
+    double hours = n / FS_HZ / 3600.0;
+
+    taskENTER_CRITICAL(&out_lock);
+    meter_reading_t *r = &readings[pair];
+    r->v_rms = v_rms;
+    r->i_rms = i_rms;
+    r->p_real = p;
+    r->s_apparent = sa;
+    r->pf = sa > 0 ? MIN(MAX(p / sa, -1.0f), 1.0f) : 0;
+    r->freq_hz = cycles ? cycles * FS_HZ / n : 0;
+    r->energy_wh += p * hours;
+    r->apparent_vah += sa * hours;
+    r->cycles += cycles;
+    r->windows++;
+    r->valid = true;
+    taskEXIT_CRITICAL(&out_lock);
+
+    state[pair].dc = lround(mv);
+}
+
+/**
+ * @brief Process one voltage/current sample pair
+ */
+static void meter_sample(uint8_t pair, const pair_cfg_t *c, int32_t v, int32_t i)
+{
+    pair_state_t *st = &state[pair];
+
+    /* Rising crossing with hysteresis against noise */
+    bool crossing = false;
+    if (v < st->dc - ZC_HYST) {
+        st->armed = true;
+    } else if (st->armed && v >= st->dc && (!st->synced || st->cyc.n >= MIN_CYCLE)) {
+        st->armed = false;
+        crossing = true;
+    }
+
+    if (crossing) {
+        if (st->synced) {
+            sums_merge(&st->win, &st->cyc);
+            if (++st->win_cycles >= WINDOW_CYCLES) {
+                publish(pair, c, &st->win, st->win_cycles);
+                memset(&st->win, 0, sizeof(st->win));
+                st->win_cycles = 0;
+            }
+        }
+        memset(&st->cyc, 0, sizeof(st->cyc));
+        st->synced = true;
+    }
+
+    sums_add(&st->cyc, v, i);
+
+    if (st->cyc.n >= MAX_CYCLE) {
+        /* No line frequency: report the block as DC */
+        publish(pair, c, &st->cyc, 0);
+        memset(&st->cyc, 0, sizeof(st->cyc));
+        memset(&st->win, 0, sizeof(st->win));
+        st->win_cycles = 0;
+        st->synced = false;
+    }
+}
+
+/**
+ * @brief Keep the samples of one channel that have no partner yet
+ *
+ * @param[in,out] st Pair state
+ * @param[in] k 0 for voltage, 1 for current
+ * @param[in] s Samples of the frame
+ * @param[in] used Samples consumed, carried ones first
+ * @param[in] total Carried plus frame samples
+ */
+static void carry_keep(pair_state_t *st, int k, const uint16_t *s, int used, int total)
+{
+    int nc = st->ncarry[k];
+    int first = MAX(used, total - CARRY_MAX);
+
+    unpaired += first - used;
+    for (int j = first; j < total; j++) {
+        st->carry[k][j - first] = j < nc ? st->carry[k][j] : s[j - nc];
+    }
+    st->ncarry[k] = total - first;
+}
+
+/**
+ * @brief Process the samples of one pair in a frame
+ *
+ * A frame may end in the middle of a scan, so one channel of a pair can
+ * have a sample more than the other; it is carried to the next frame.
+ */
+static void process_pair(uint8_t pair, const pair_cfg_t *c, const adc_frame_t *f)
+{
+    pair_state_t *st = &state[pair];
+    const uint16_t *vs = f->unfiltered[c->v_ch];
+    const uint16_t *is = f->unfiltered[c->i_ch];
+    int cv = st->ncarry[0];
+    int ci = st->ncarry[1];
+    int nv = cv + f->count[c->v_ch];
+    int ni = ci + f->count[c->i_ch];
+    int n = MIN(nv, ni);
+
+    for (int k = 0; k < n; k++) {
+        int32_t v = k < cv ? st->carry[0][k] : vs[k - cv];
+        int32_t i = k < ci ? st->carry[1][k] : is[k - ci];
+        meter_sample(pair, c, v, i);
+    }
+
+    carry_keep(st, 0, vs, n, nv);
+    carry_keep(st, 1, is, n, ni);
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    pair_cfg_t c[METER_PAIRS];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(c, cfg, sizeof(c));
+    uint32_t gen = cfg_gen;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    if (gen != state_gen) {
+        /* Configuration changed, start over */
+        for (uint8_t p = 0; p < METER_PAIRS; p++) {
+            state_reset(&state[p]);
+        }
+        state_gen = gen;
+    }
+
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        if (c[p].enabled) {
+            process_pair(p, &c[p], f);
+        }
+    }
+}
+
+/**
+ * @brief Write the configuration of a pair to NVS (flash service task)
+ *
+ * @param[in] ctx Pair index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_pair(void *ctx)
+{
+    uint8_t pair = *(uint8_t *)ctx;
+    pair_cfg_t c;
+
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[pair];
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, pair);
+    err = nvs_set_blob(nvs, key, &c, sizeof(c));
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Save the configuration of a pair to NVS
+ *
+ * @param[in] pair Pair index
+ * @return ESP_OK on success
+ */
+static esp_err_t save_pair(uint8_t pair)
+{
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", pair);
+    return flash_svc_run(key, write_pair, &pair, sizeof(pair));
+}
+
+/**
+ * @brief Load the configuration of all pairs from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        char key[16];
+        pair_cfg_t c;
+        size_t len = sizeof(c);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, p);
+        if (nvs_get_blob(nvs, key, &c, &len) == ESP_OK && len == sizeof(c)
+            && c.v_ch < ADC_MAX_CHANNELS && c.i_ch < ADC_MAX_CHANNELS) {
+            cfg[p] = c;
+        }
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t meter_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        cfg[p] = (pair_cfg_t){
+            .enabled = 0,
+            .v_ch = 2 * p,
+            .i_ch = 2 * p + 1,
+            .v_scale_uv = CONFIG_METER_V_SCALE_UV,
+            .i_scale_ua = CONFIG_METER_I_SCALE_UA,
+        };
+        state_reset(&state[p]);
+    }
+    load_config();
+
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        if (cfg[p].enabled) {
+            ESP_LOGI(TAG, "Pair %u: V=ch%u, I=ch%u", p, cfg[p].v_ch, cfg[p].i_ch);
+        }
+    }
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t meter_get(uint8_t pair, meter_reading_t *reading)
+{
+    if (!chk_pair(pair) || reading == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!cfg[pair].enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *reading = readings[pair];
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+esp_err_t meter_reset_energy(uint8_t pair)
+{
+    if (!chk_pair(pair)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    readings[pair].energy_wh = 0;
+    readings[pair].apparent_vah = 0;
+    readings[pair].cycles = 0;
+    readings[pair].windows = 0;
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *pair;
+    struct arg_int *v_ch;
+    struct arg_int *i_ch;
+    struct arg_int *v_scale;
+    struct arg_int *i_scale;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_lit *reset;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Power metering control\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print configuration and results of all pairs
+ */
+static void print_status(void)
+{
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        pair_cfg_t c;
+        taskENTER_CRITICAL(&cfg_lock);
+        c = cfg[p];
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        printf("-- Pair %u --\n", p);
+        printf("  State: %s\n", c.enabled ? "enabled" : "disabled");
+        printf("  Channels: V=ch%u (%"PRId32" uV/count), I=ch%u (%"PRId32" uA/count)\n",
+               c.v_ch, c.v_scale_uv, c.i_ch, c.i_scale_ua);
+
+        meter_reading_t r;
+        if (meter_get(p, &r) != ESP_OK || !r.valid) {
+            continue;
+        }
+        printf("  Voltage: %.2f V rms\n", r.v_rms);
+        printf("  Current: %.3f A rms\n", r.i_rms);
+        printf("  Real power: %.1f W\n", r.p_real);
+        printf("  Apparent power: %.1f VA\n", r.s_apparent);
+        printf("  Power factor: %.3f\n", r.pf);
+        printf("  Frequency: %.2f Hz\n", r.freq_hz);
+        printf("  Energy: %.3f Wh, %.3f VAh\n", r.energy_wh, r.apparent_vah);
+        printf("  Cycles: %"PRIu32" in %"PRIu32" windows\n", r.cycles, r.windows);
+    }
+    printf("Unpaired samples: %"PRIu32"\n", unpaired);
+}
+
+/**
+ * @brief Meter command handler
+ */
+static int cmd_meter(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.pair->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    uint8_t p = args.pair->ival[0];
+    if (!chk_pair(args.pair->ival[0])) {
+        printf("Invalid pair %d (0-%d)\n", args.pair->ival[0], METER_PAIRS - 1);
+        return 1;
+    }
+
+    if (args.reset->count > 0) {
+        meter_reset_energy(p);
+        printf("Pair %u energy cleared\n", p);
+    }
+
+    pair_cfg_t c;
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[p];
+    taskEXIT_CRITICAL(&cfg_lock);
+    bool changed = false;
+
+    if (args.v_ch->count > 0) {
+        if (args.v_ch->ival[0] < 0 || args.v_ch->ival[0] >= ADC_MAX_CHANNELS) {
+            printf("Invalid channel %d\n", args.v_ch->ival[0]);
+            return 1;
+        }
+        c.v_ch = args.v_ch->ival[0];
+        changed = true;
+    }
+
+    if (args.i_ch->count > 0) {
+        if (args.i_ch->ival[0] < 0 || args.i_ch->ival[0] >= ADC_MAX_CHANNELS) {
+            printf("Invalid channel %d\n", args.i_ch->ival[0]);
+            return 1;
+        }
+        c.i_ch = args.i_ch->ival[0];
+        changed = true;
+    }
+
+    if (args.v_scale->count > 0) {
+        c.v_scale_uv = args.v_scale->ival[0];
+        changed = true;
+    }
+
+    if (args.i_scale->count > 0) {
+        c.i_scale_ua = args.i_scale->ival[0];
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (c.v_ch == c.i_ch) {
+        printf("Voltage and current need different channels\n");
+        return 1;
+    }
+
+    if (changed) {
+        taskENTER_CRITICAL(&cfg_lock);
+        cfg[p] = c;
+        cfg_gen++;
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        esp_err_t err = save_pair(p);
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    }
+
+    if (!changed && args.reset->count == 0) {
+        print_status();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register meter commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.pair = arg_int0("p", "pair", "<n>", "Pair to configure");
+    args.v_ch = arg_int0("v", "voltage", "<ch>", "Voltage channel");
+    args.i_ch = arg_int0("i", "current", "<ch>", "Current channel");
+    args.v_scale = arg_int0("V", "vscale", "<uV>", "Line voltage per count");
+    args.i_scale = arg_int0("I", "iscale", "<uA>", "Load current per count");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable metering");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable metering");
+    args.reset = arg_litn("r", "reset", 0, 1, "Clear the energy counters");
+    args.end = arg_end(9);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "meter",
+        .func = cmd_meter,
+        .help = "Real/apparent power metering\n"
+                "Examples:\n"
+                "  meter                              Show all pairs\n"
+                "  meter -p 0 -v 0 -i 1 -E            Meter ch0 (V) and ch1 (I)\n"
+                "  meter -p 0 -V 163000 -I 4900       Set scales\n"
+                "  meter -p 0 -r                      Clear energy\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,78 @@
+/**
+ * @file meter.h
+ * @brief Real/apparent power metering on voltage/current channel pairs
+ *
+ * Each metering pair takes one channel as line voltage and one as load
+ * current. The samples are accumulated in the ADC task as they arrive;
+ * rising zero crossings of the voltage split them into cycles, and every
+ * METER_CYCLES whole cycles the RMS values, real and apparent power,
+ * power factor and line frequency are computed and the energy counters
+ * advanced. Pairs, channels and scales are set with the `meter` command
+ * and stored in NVS.
+ *
+ * Metering reads the unfiltered frame samples, skew-corrected with
+ * ADC_SKEW_CORRECT; hysteresis and smoothing would distort the waveform
+ * and shift the current against the voltage.
+ */
+
+#ifndef METER_H
+#define METER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+#define METER_PAIRS     (ADC_MAX_CHANNELS / 2)  /**< Number of metering pairs */
+
+/**
+ * @brief Results of one metering pair
+ */
+typedef struct {
+    bool valid;                 /**< At least one window computed */
+    float v_rms;                /**< RMS voltage (V) */
+    float i_rms;                /**< RMS current (A) */
+    float p_real;               /**< Real power (W) */
+    float s_apparent;           /**< Apparent power (VA) */
+    float pf;                   /**< Power factor, negative when exporting */
+    float freq_hz;              /**< Line frequency, 0 without zero crossings */
+    double energy_wh;           /**< Real energy since reset (Wh) */
+    double apparent_vah;        /**< Apparent energy since reset (VAh) */
+    uint32_t cycles;            /**< Cycles measured since reset */
+    uint32_t windows;           /**< Windows computed since reset */
+} meter_reading_t;
+
+/**
+ * @brief Initialize the metering engine
+ *
+ * Loads the pair configuration from NVS, registers the frame listener
+ * and the `meter` command. Call after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t meter_init(void);
+
+/**
+ * @brief Get the latest results of a pair
+ *
+ * @param[in] pair Pair index
+ * @param[out] reading Pointer to store the results
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if pair is invalid or reading is NULL
+ *         ESP_ERR_INVALID_STATE if the pair is disabled
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t meter_get(uint8_t pair, meter_reading_t *reading);
+
+/**
+ * @brief Clear the energy counters of a pair
+ *
+ * @param[in] pair Pair index
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if pair is invalid
+ * @note This function is thread-safe
+ */
+esp_err_t meter_reset_energy(uint8_t pair);
+
+#endif /* METER_H */
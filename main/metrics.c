@@ -0,0 +1,512 @@
+/**
+ * @file metrics.c
+ * @brief Prometheus text format metrics endpoint
+ *
+ * The response is rendered into a static buffer, so a scrape does not
+ * allocate. All handlers of the HTTP server run in the server task, which
+ * makes the buffer single-user. ADC values come from the lock-free
+ * snapshot, so a scrape never takes the ADC mutex.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+
+#include "adc.h"
+#include "telemetry.h"
+#include "cmd_wifi.h"
+#include "flash_svc.h"
+#include "meter.h"
+#include "freq.h"
+#include "pid.h"
+#include "alarm.h"
+#include "web.h"
+#include "metrics.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define BUFFER_SIZE     CONFIG_METRICS_BUFFER_SIZE
+#define MAX_TASKS       CONFIG_METRICS_MAX_TASKS
+#define CONTENT_TYPE    "text/plain; version=0.0.4"
+
+/* Module static variables */
+static const char *TAG = "metrics";
+static char buf[BUFFER_SIZE];
+static size_t len;
+static bool truncated;
+
+/* Snapshot storage, reused by every scrape */
+static adc_stats_t adc_stats;
+static adc_snapshot_t adc_snap;
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t task_status[MAX_TASKS];
+#endif
+
+/**
+ * @brief Append formatted text to the response buffer
+ */
+static void append(const char *fmt, ...)
+{
+    if (truncated) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= sizeof(buf) - len) {
+        truncated = true;
+        return;
+    }
+    len += n;
+}
+
+/**
+ * @brief Append HELP and TYPE lines of a metric family
+ */
+static void family(const char *name, const char *type, const char *help)
+{
+    append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Render the ADC metrics
+ */
+static void render_adc(void)
+{
+    adc_get_stats(&adc_stats);
+
+    family("adc_conversions_total", "counter", "Conversion frames read");
+    append("adc_conversions_total %"PRIu32"\n", adc_stats.conversions);
+    family("adc_invalid_channel_total", "counter", "Samples of unknown channels");
+    append("adc_invalid_channel_total %"PRIu32"\n", adc_stats.invalid_channel);
+    family("adc_read_errors_total", "counter", "Failed frame reads");
+    append("adc_read_errors_total %"PRIu32"\n", adc_stats.read_errors);
+    family("adc_timeouts_total", "counter", "Frame read timeouts");
+    append("adc_timeouts_total %"PRIu32"\n", adc_stats.timeout);
+    family("adc_frame_overflows_total", "counter", "Samples not fitting into a frame");
+    append("adc_frame_overflows_total %"PRIu32"\n", adc_stats.frame_overflow);
+    family("adc_pool_overflows_total", "counter", "Frames dropped by the driver");
+    append("adc_pool_overflows_total %"PRIu32"\n", adc_stats.pool_overflow);
+
+    adc_power_t p;
+    adc_get_power(&p);
+    family("adc_busy_seconds_total", "counter", "ADC task time processing frames");
+    append("adc_busy_seconds_total %.3f\n", p.busy_us / 1e6);
+    family("adc_idle_seconds_total", "counter", "ADC task time waiting for frames");
+    append("adc_idle_seconds_total %.3f\n", p.idle_us / 1e6);
+
+    if (adc_read_snapshot(&adc_snap) != ESP_OK) {
+        ESP_LOGW(TAG, "ADC status unavailable");
+        return;
+    }
+
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } gauges[] = {
+        { "adc_raw", "Latest raw ADC value", offsetof(adc_channel_status_t, raw) },
+        { "adc_normalized", "Processed ADC value", offsetof(adc_channel_status_t, normalized) },
+        { "adc_calibration_min", "Calibration minimum", offsetof(adc_channel_status_t, min_cal) },
+        { "adc_calibration_max", "Calibration maximum", offsetof(adc_channel_status_t, max_cal) },
+        { "adc_hysteresis", "Hysteresis value", offsetof(adc_channel_status_t, hysteresis) },
+    };
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        family(gauges[g].name, "gauge", gauges[g].help);
+        for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+            const uint32_t *v = (const uint32_t *)((const uint8_t *)&adc_snap.ch[ch] + gauges[g].offset);
+            append("%s{channel=\"%d\"} %"PRIu32"\n", gauges[g].name, ch, *v);
+        }
+    }
+
+    family("adc_rate", "gauge", "Rate of change from the alpha-beta filter (counts/s)");
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        if (adc_snap.ch[ch].filter == ADC_FILTER_ALPHA_BETA) {
+            append("adc_rate{channel=\"%d\"} %"PRId32"\n", ch, adc_snap.ch[ch].rate);
+        }
+    }
+
+#if ADC_VIRT_CHANNELS > 0
+    family("adc_virtual", "gauge", "Latest value of a virtual channel");
+    for (uint8_t v = 0; v < ADC_VIRT_CHANNELS; v++) {
+        append("adc_virtual{channel=\"v%d\"} %"PRIu32"\n", v, adc_snap.virt[v]);
+    }
+#endif
+}
+
+/**
+ * @brief Render the heap metrics (what 'free' and 'heap' print)
+ */
+static void render_heap(void)
+{
+    family("heap_free_bytes", "gauge", "Current free heap");
+    append("heap_free_bytes %"PRIu32"\n", esp_get_free_heap_size());
+    family("heap_min_free_bytes", "gauge", "Minimum free heap since boot");
+    append("heap_min_free_bytes %u\n",
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    family("heap_largest_free_block_bytes", "gauge", "Largest allocatable block");
+    append("heap_largest_free_block_bytes %u\n",
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+}
+
+/**
+ * @brief Render the task metrics
+ */
+static void render_tasks(void)
+{
+    family("tasks", "gauge", "Number of tasks");
+    append("tasks %u\n", (unsigned)uxTaskGetNumberOfTasks());
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    uint32_t total_runtime = 0;
+    UBaseType_t n = uxTaskGetSystemState(task_status, MAX_TASKS, &total_runtime);
+    if (n == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, task metrics skipped", MAX_TASKS);
+        return;
+    }
+
+    family("task_stack_high_water_mark_bytes", "gauge", "Minimum free stack");
+    for (UBaseType_t i = 0; i < n; i++) {
+        append("task_stack_high_water_mark_bytes{task=\"%s\"} %"PRIu32"\n",
+               task_status[i].pcTaskName, (uint32_t)task_status[i].usStackHighWaterMark);
+    }
+
+    family("task_priority", "gauge", "Current priority");
+    for (UBaseType_t i = 0; i < n; i++) {
+        append("task_priority{task=\"%s\"} %u\n",
+               task_status[i].pcTaskName, (unsigned)task_status[i].uxCurrentPriority);
+    }
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    family("task_runtime_total", "counter", "Run time counter");
+    for (UBaseType_t i = 0; i < n; i++) {
+        append("task_runtime_total{task=\"%s\"} %"PRIu32"\n",
+               task_status[i].pcTaskName, (uint32_t)task_status[i].ulRunTimeCounter);
+    }
+#endif /* CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS */
+#endif /* CONFIG_FREERTOS_USE_TRACE_FACILITY */
+}
+
+/**
+ * @brief Render the telemetry metrics
+ */
+static void render_telemetry(void)
+{
+    telemetry_stats_t t;
+    if (telemetry_get_stats(&t) != ESP_OK) {
+        return;
+    }
+
+    family("telemetry_datagrams_total", "counter", "Telemetry datagrams sent");
+    append("telemetry_datagrams_total %"PRIu32"\n", t.datagrams);
+    family("telemetry_dropped_frames_total", "counter", "Frames dropped by the telemetry queue");
+    append("telemetry_dropped_frames_total %"PRIu32"\n", t.dropped);
+    family("telemetry_send_errors_total", "counter", "Failed telemetry sends");
+    append("telemetry_send_errors_total %"PRIu32"\n", t.send_errors);
+
+    family("telemetry_oversized_total", "counter", "Telemetry records too large for a datagram");
+    append("telemetry_oversized_total %"PRIu32"\n", t.oversized);
+
+    family("telemetry_backlog_depth", "gauge", "Datagrams waiting for the link");
+    append("telemetry_backlog_depth %"PRIu32"\n", t.backlog.depth);
+    family("telemetry_backlog_spill_bytes", "gauge", "Backlog bytes held in /data");
+    append("telemetry_backlog_spill_bytes %"PRIu32"\n", t.backlog.spill_bytes);
+    family("telemetry_backlog_buffered_total", "counter", "Datagrams buffered while the link was down");
+    append("telemetry_backlog_buffered_total %"PRIu32"\n", t.backlog.pushed);
+    family("telemetry_backlog_lost_total", "counter", "Buffered datagrams dropped at the size limits");
+    append("telemetry_backlog_lost_total %"PRIu32"\n", t.backlog.dropped);
+    family("telemetry_backlog_drains_total", "counter", "Backlogs sent completely");
+    append("telemetry_backlog_drains_total %"PRIu32"\n", t.backlog.drains);
+    family("telemetry_backlog_drain_seconds", "gauge", "Time to send the last backlog");
+    append("telemetry_backlog_drain_seconds %.3f\n", t.backlog.last_drain_us / 1e6);
+    family("telemetry_backlog_drain_max_seconds", "gauge", "Longest backlog drain");
+    append("telemetry_backlog_drain_max_seconds %.3f\n", t.backlog.max_drain_us / 1e6);
+}
+
+/**
+ * @brief Wi-Fi connection manager
+ */
+static void render_wifi(void)
+{
+#if CONFIG_ESP_WIFI_ENABLED
+    wifi_conn_stats_t w;
+    if (wifi_get_conn_stats(&w) != ESP_OK) {
+        return;
+    }
+
+    family("wifi_connected", "gauge", "Station has an IP address");
+    append("wifi_connected %d\n", w.connected ? 1 : 0);
+    family("wifi_disconnects_total", "counter", "Links lost");
+    append("wifi_disconnects_total %"PRIu32"\n", w.disconnects);
+    family("wifi_connect_attempts_total", "counter", "Connection attempts");
+    append("wifi_connect_attempts_total %"PRIu32"\n", w.attempts);
+    family("wifi_reconnect_seconds", "gauge", "Time to reconnect after the last disconnect");
+    append("wifi_reconnect_seconds %.3f\n", w.last_reconnect_us / 1e6);
+    family("wifi_reconnect_max_seconds", "gauge", "Longest time to reconnect");
+    append("wifi_reconnect_max_seconds %.3f\n", w.max_reconnect_us / 1e6);
+#endif
+}
+
+/**
+ * @brief Flash write service
+ */
+static void render_flash(void)
+{
+    flash_svc_stats_t f;
+    flash_svc_get_stats(&f);
+
+    family("flash_writes_total", "counter", "Flash write requests executed");
+    append("flash_writes_total %"PRIu32"\n", f.completed);
+    family("flash_write_failures_total", "counter", "Flash write requests failed");
+    append("flash_write_failures_total %"PRIu32"\n", f.failed);
+    family("flash_writes_coalesced_total", "counter", "Requests merged into a pending one");
+    append("flash_writes_coalesced_total %"PRIu32"\n", f.coalesced);
+    family("flash_writes_forced_total", "counter", "Writes run without an ADC window");
+    append("flash_writes_forced_total %"PRIu32"\n", f.forced);
+    family("flash_writes_pending", "gauge", "Requests waiting for a window");
+    append("flash_writes_pending %"PRIu32"\n", f.pending);
+    family("flash_write_max_seconds", "gauge", "Longest write");
+    append("flash_write_max_seconds %.3f\n", f.max_op_us / 1e6);
+    family("flash_write_wait_max_seconds", "gauge", "Longest wait for a window");
+    append("flash_write_wait_max_seconds %.3f\n", f.max_wait_us / 1e6);
+}
+
+#if CONFIG_METER
+/**
+ * @brief Power metering results of the enabled pairs
+ */
+static void render_meter(void)
+{
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        size_t offset;
+    } gauges[] = {
+        { "meter_voltage_rms_volts", "gauge", "RMS line voltage", offsetof(meter_reading_t, v_rms) },
+        { "meter_current_rms_amperes", "gauge", "RMS load current", offsetof(meter_reading_t, i_rms) },
+        { "meter_power_watts", "gauge", "Real power", offsetof(meter_reading_t, p_real) },
+        { "meter_apparent_power_va", "gauge", "Apparent power", offsetof(meter_reading_t, s_apparent) },
+        { "meter_power_factor", "gauge", "Power factor", offsetof(meter_reading_t, pf) },
+        { "meter_frequency_hertz", "gauge", "Line frequency", offsetof(meter_reading_t, freq_hz) },
+    };
+
+    meter_reading_t r[METER_PAIRS];
+    bool ok[METER_PAIRS];
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        ok[p] = meter_get(p, &r[p]) == ESP_OK && r[p].valid;
+    }
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        family(gauges[g].name, gauges[g].type, gauges[g].help);
+        for (uint8_t p = 0; p < METER_PAIRS; p++) {
+            if (ok[p]) {
+                const float *v = (const float *)((const uint8_t *)&r[p] + gauges[g].offset);
+                append("%s{pair=\"%d\"} %.4f\n", gauges[g].name, p, *v);
+            }
+        }
+    }
+
+    family("meter_energy_watt_hours_total", "counter", "Real energy since reset");
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        if (ok[p]) {
+            append("meter_energy_watt_hours_total{pair=\"%d\"} %.4f\n", p, r[p].energy_wh);
+        }
+    }
+    family("meter_apparent_energy_va_hours_total", "counter", "Apparent energy since reset");
+    for (uint8_t p = 0; p < METER_PAIRS; p++) {
+        if (ok[p]) {
+            append("meter_apparent_energy_va_hours_total{pair=\"%d\"} %.4f\n", p, r[p].apparent_vah);
+        }
+    }
+}
+#endif
+
+#if CONFIG_ADC_FREQ
+/**
+ * @brief Frequency measurement results of the measured channels
+ */
+static void render_freq(void)
+{
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } gauges[] = {
+        { "adc_frequency_hertz", "Measured frequency", offsetof(freq_reading_t, freq_hz) },
+        { "adc_duty_ratio", "High time per period", offsetof(freq_reading_t, duty) },
+        { "adc_speed_rpm", "Revolutions per minute", offsetof(freq_reading_t, rpm) },
+    };
+
+    freq_reading_t r[ADC_TOTAL_CHANNELS];
+    bool ok[ADC_TOTAL_CHANNELS];
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        ok[ch] = freq_get(ch, &r[ch]) == ESP_OK && r[ch].valid;
+    }
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        family(gauges[g].name, "gauge", gauges[g].help);
+        for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            if (ok[ch]) {
+                const float *v = (const float *)((const uint8_t *)&r[ch] + gauges[g].offset);
+                append("%s{channel=\"%d\"} %.4f\n", gauges[g].name, ch, *v);
+            }
+        }
+    }
+}
+#endif
+
+#if CONFIG_PID
+/**
+ * @brief Control loop outputs and latency
+ */
+static void render_pid(void)
+{
+    pid_status_t s[PID_LOOPS];
+    bool ok[PID_LOOPS];
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        ok[l] = pid_get_status(l, &s[l]) == ESP_OK;
+    }
+
+    family("pid_output", "gauge", "Last controller output");
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        if (ok[l]) {
+            append("pid_output{loop=\"%d\"} %"PRId32"\n", l, s[l].output);
+        }
+    }
+    family("pid_steps_total", "counter", "Control steps since reset");
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        if (ok[l]) {
+            append("pid_steps_total{loop=\"%d\"} %"PRIu32"\n", l, s[l].steps);
+        }
+    }
+    family("pid_late_steps_total", "counter", "Steps on frames that waited in the pool");
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        if (ok[l]) {
+            append("pid_late_steps_total{loop=\"%d\"} %"PRIu32"\n", l, s[l].late);
+        }
+    }
+    family("pid_latency_max_seconds", "gauge", "Longest interrupt to output latency");
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        if (ok[l] && s[l].steps > s[l].late) {
+            append("pid_latency_max_seconds{loop=\"%d\"} %.6f\n", l, s[l].latency_max_us / 1e6);
+        }
+    }
+}
+#endif
+
+#if CONFIG_ALARM
+/**
+ * @brief Alarm states and counters
+ */
+static void render_alarm(void)
+{
+    static const char *const kinds[ALARM_KINDS] = { "lolo", "lo", "hi", "hihi", "roc" };
+
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } gauges[] = {
+        { "alarm_active", "Limit exceeded, enabled alarms only", offsetof(alarm_state_t, active) },
+        { "alarm_unacked", "Raised and not acknowledged", offsetof(alarm_state_t, unacked) },
+    };
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        family(gauges[g].name, "gauge", gauges[g].help);
+        for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            alarm_cfg_t c;
+            if (alarm_get_config(ch, &c) != ESP_OK) {
+                continue;
+            }
+            for (uint8_t k = 0; k < ALARM_KINDS; k++) {
+                alarm_state_t s;
+                if ((c.enabled & (1 << k)) && alarm_get_state(ch, k, &s) == ESP_OK) {
+                    const bool *v = (const bool *)((const uint8_t *)&s + gauges[g].offset);
+                    append("%s{channel=\"%d\",kind=\"%s\"} %d\n", gauges[g].name, ch, kinds[k], *v);
+                }
+            }
+        }
+    }
+
+    alarm_stats_t st;
+    if (alarm_get_stats(&st) != ESP_OK) {
+        return;
+    }
+    family("alarm_raised_total", "counter", "Alarms raised");
+    append("alarm_raised_total %"PRIu32"\n", st.raised);
+    family("alarm_events_dropped_total", "counter", "Events lost to a full queue");
+    append("alarm_events_dropped_total %"PRIu32"\n", st.dropped);
+    family("alarm_log_dropped_total", "counter", "Events not written to the log");
+    append("alarm_log_dropped_total %"PRIu32"\n", st.log_dropped);
+}
+#endif
+
+/**
+ * @brief GET /metrics handler
+ */
+static esp_err_t metrics_get(httpd_req_t *req)
+{
+    len = 0;
+    truncated = false;
+
+    render_adc();
+    render_heap();
+    render_tasks();
+    render_telemetry();
+    render_wifi();
+    render_flash();
+#if CONFIG_METER
+    render_meter();
+#endif
+#if CONFIG_ADC_FREQ
+    render_freq();
+#endif
+#if CONFIG_PID
+    render_pid();
+#endif
+#if CONFIG_ALARM
+    render_alarm();
+#endif
+
+    if (truncated) {
+        ESP_LOGE(TAG, "Response exceeds %d bytes, increase METRICS_BUFFER_SIZE", BUFFER_SIZE);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "metrics buffer too small");
+    }
+
+    httpd_resp_set_type(req, CONTENT_TYPE);
+    return httpd_resp_send(req, buf, len);
+}
+
+BaseType_t metrics_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    static const httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get,
+        .user_ctx = NULL,
+    };
+
+    esp_err_t err = web_register_uri(&uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /metrics: %s", esp_err_to_name(err));
+        return pdFAIL;
+    }
+
+    return pdPASS;
+}
@@ -0,0 +1,24 @@
+/**
+ * @file metrics.h
+ * @brief Prometheus text format metrics endpoint
+ *
+ * Serves `GET /metrics` on the shared HTTP server with the ADC error
+ * counters, per-channel values and calibration, heap figures, task
+ * statistics and telemetry counters.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Register the /metrics endpoint
+ *
+ * Must be called after web_init() and adc_init().
+ *
+ * @return pdPASS if the endpoint is registered, pdFAIL otherwise
+ */
+BaseType_t metrics_init(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,476 @@
+/**
+ * @file modbus_tcp.c
+ * @brief Modbus TCP slave exposing the channel registers
+ *
+ * One task serves all masters with select(). Register reads copy the
+ * snapshot published by the ADC task, so polling masters never touch the
+ * ADC mutex and cannot delay acquisition. Only plain BSD socket calls are
+ * used, so the server also runs on the linux target.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "adc.h"
+#include "modbus_tcp.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define PORT            CONFIG_MODBUS_TCP_PORT
+#define MAX_CLIENTS     CONFIG_MODBUS_TCP_MAX_CLIENTS
+
+/* Protocol limits */
+#define MBAP_LEN        7           /* Transaction, protocol, length, unit */
+#define PDU_MAX         253
+#define ADU_MAX         (MBAP_LEN + PDU_MAX)
+#define READ_MAX_QTY    125
+#define WRITE_MAX_QTY   123
+
+/* Function codes */
+#define FC_READ_HOLDING     0x03
+#define FC_READ_INPUT       0x04
+#define FC_WRITE_SINGLE     0x06
+#define FC_WRITE_MULTIPLE   0x10
+
+/* Exception codes */
+#define EX_ILLEGAL_FUNCTION 0x01
+#define EX_ILLEGAL_ADDRESS  0x02
+#define EX_ILLEGAL_VALUE    0x03
+#define EX_DEVICE_FAILURE   0x04
+
+/**
+ * @brief Connected master
+ */
+typedef struct {
+    int fd;                     /**< Socket, -1 if the slot is free */
+    size_t len;                 /**< Bytes in buf */
+    uint8_t buf[ADU_MAX];       /**< Receive buffer */
+} mb_client_t;
+
+/**
+ * @brief Writable channel settings, staged before they are applied
+ */
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t hyst;
+    bool cal_changed;
+    bool hyst_changed;
+} mb_stage_t;
+
+/* Module static variables */
+static const char *TAG = "modbus";
+static TaskHandle_t task_handle = NULL;
+static mb_client_t clients[MAX_CLIENTS];
+static uint8_t tx[ADU_MAX];
+static adc_snapshot_t snap;
+static mb_stage_t stage[ADC_MAX_CHANNELS];
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+/**
+ * @brief Build an exception response
+ */
+static size_t exception(uint8_t fc, uint8_t code, uint8_t *resp)
+{
+    resp[0] = fc | 0x80;
+    resp[1] = code;
+    return 2;
+}
+
+/**
+ * @brief Check whether a register lies in a per-channel group
+ */
+static inline bool in_group(uint16_t addr, uint16_t base)
+{
+    return (uint16_t)(addr - base) < ADC_MAX_CHANNELS;
+}
+
+/**
+ * @brief Read one input register from the snapshot
+ *
+ * @return true if the address is mapped
+ */
+static bool read_input(uint16_t addr, uint16_t *v)
+{
+    if (in_group(addr, MODBUS_IR_RAW)) {
+        *v = snap.ch[addr - MODBUS_IR_RAW].raw;
+    } else if (in_group(addr, MODBUS_IR_NORMALIZED)) {
+        *v = snap.ch[addr - MODBUS_IR_NORMALIZED].normalized;
+    } else if (addr == MODBUS_IR_FRAME_SEQ) {
+        *v = snap.frame_seq >> 16;
+    } else if (addr == MODBUS_IR_FRAME_SEQ + 1) {
+        *v = snap.frame_seq & 0xffff;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Locate a holding register
+ *
+ * @param[in] addr Register address
+ * @param[out] ch Channel of the register
+ * @return Base address of the register group, -1 if not mapped
+ */
+static int holding_group(uint16_t addr, uint8_t *ch)
+{
+    static const uint16_t groups[] = {
+        MODBUS_HR_CAL_MIN, MODBUS_HR_CAL_MAX, MODBUS_HR_HYSTERESIS
+    };
+
+    for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        if (in_group(addr, groups[i])) {
+            *ch = addr - groups[i];
+            return groups[i];
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Read one holding register from the snapshot
+ *
+ * @return true if the address is mapped
+ */
+static bool read_holding(uint16_t addr, uint16_t *v)
+{
+    uint8_t ch;
+    switch (holding_group(addr, &ch)) {
+    case MODBUS_HR_CAL_MIN:
+        *v = snap.ch[ch].min_cal;
+        return true;
+    case MODBUS_HR_CAL_MAX:
+        *v = snap.ch[ch].max_cal;
+        return true;
+    case MODBUS_HR_HYSTERESIS:
+        *v = snap.ch[ch].hysteresis;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief FC 0x03 / 0x04
+ */
+static size_t read_registers(const uint8_t *req, size_t req_len, uint8_t *resp)
+{
+    uint8_t fc = req[0];
+    if (req_len != 5) {
+        return exception(fc, EX_ILLEGAL_VALUE, resp);
+    }
+
+    uint16_t start = get_u16(&req[1]);
+    uint16_t qty = get_u16(&req[3]);
+    if (qty == 0 || qty > READ_MAX_QTY) {
+        return exception(fc, EX_ILLEGAL_VALUE, resp);
+    }
+
+    if (adc_read_snapshot(&snap) != ESP_OK) {
+        return exception(fc, EX_DEVICE_FAILURE, resp);
+    }
+
+    resp[0] = fc;
+    resp[1] = qty * 2;
+    for (uint16_t i = 0; i < qty; i++) {
+        uint16_t v;
+        bool ok = (fc == FC_READ_INPUT) ? read_input(start + i, &v)
+                                        : read_holding(start + i, &v);
+        if (!ok) {
+            return exception(fc, EX_ILLEGAL_ADDRESS, resp);
+        }
+        put_u16(&resp[2 + 2 * i], v);
+    }
+    return 2 + qty * 2;
+}
+
+/**
+ * @brief Stage and apply holding register writes
+ *
+ * All registers of one request are collected and every changed channel
+ * is validated before the first one is applied, so a rejected request
+ * changes nothing and one setting both calibration limits of a channel
+ * is checked as a whole.
+ *
+ * @return 0 on success, exception code otherwise
+ */
+static uint8_t write_registers(uint16_t start, uint16_t qty, const uint8_t *values)
+{
+    if (adc_read_snapshot(&snap) != ESP_OK) {
+        return EX_DEVICE_FAILURE;
+    }
+
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        stage[ch].min = snap.ch[ch].min_cal;
+        stage[ch].max = snap.ch[ch].max_cal;
+        stage[ch].hyst = snap.ch[ch].hysteresis;
+        stage[ch].cal_changed = false;
+        stage[ch].hyst_changed = false;
+    }
+
+    for (uint16_t i = 0; i < qty; i++) {
+        uint8_t ch;
+        uint16_t v = get_u16(&values[2 * i]);
+        switch (holding_group(start + i, &ch)) {
+        case MODBUS_HR_CAL_MIN:
+            stage[ch].min = v;
+            stage[ch].cal_changed = true;
+            break;
+        case MODBUS_HR_CAL_MAX:
+            stage[ch].max = v;
+            stage[ch].cal_changed = true;
+            break;
+        case MODBUS_HR_HYSTERESIS:
+            stage[ch].hyst = v;
+            stage[ch].hyst_changed = true;
+            break;
+        default:
+            return EX_ILLEGAL_ADDRESS;
+        }
+    }
+
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        const mb_stage_t *s = &stage[ch];
+        if ((s->cal_changed && (s->min >= s->max || s->max > ADC_CODES))
+            || (s->hyst_changed && (s->hyst == 0 || s->hyst > ADC_HYSTERESIS_MAX))) {
+            return EX_ILLEGAL_VALUE;
+        }
+    }
+
+    for (uint8_t ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        esp_err_t err = ESP_OK;
+        if (stage[ch].cal_changed) {
+            err = adc_set_calibration(ch, stage[ch].min, stage[ch].max);
+        }
+        if (err == ESP_OK && stage[ch].hyst_changed) {
+            err = adc_set_hysteresis(ch, stage[ch].hyst);
+        }
+        if (err == ESP_ERR_INVALID_ARG) {
+            return EX_ILLEGAL_VALUE;
+        }
+        if (err != ESP_OK) {
+            return EX_DEVICE_FAILURE;
+        }
+    }
+    return 0;
+}
+
+size_t modbus_tcp_process_pdu(const uint8_t *req, size_t req_len, uint8_t *resp)
+{
+    if (req == NULL || resp == NULL || req_len == 0) {
+        return 0;
+    }
+
+    uint8_t fc = req[0];
+    uint8_t ex;
+
+    switch (fc) {
+    case FC_READ_HOLDING:
+    case FC_READ_INPUT:
+        return read_registers(req, req_len, resp);
+
+    case FC_WRITE_SINGLE:
+        if (req_len != 5) {
+            return exception(fc, EX_ILLEGAL_VALUE, resp);
+        }
+        ex = write_registers(get_u16(&req[1]), 1, &req[3]);
+        if (ex) {
+            return exception(fc, ex, resp);
+        }
+        memcpy(resp, req, 5);
+        return 5;
+
+    case FC_WRITE_MULTIPLE: {
+        if (req_len < 6) {
+            return exception(fc, EX_ILLEGAL_VALUE, resp);
+        }
+        uint16_t qty = get_u16(&req[3]);
+        if (qty == 0 || qty > WRITE_MAX_QTY || req[5] != qty * 2 || req_len != 6 + qty * 2) {
+            return exception(fc, EX_ILLEGAL_VALUE, resp);
+        }
+        ex = write_registers(get_u16(&req[1]), qty, &req[6]);
+        if (ex) {
+            return exception(fc, ex, resp);
+        }
+        memcpy(resp, req, 5);
+        return 5;
+    }
+
+    default:
+        return exception(fc, EX_ILLEGAL_FUNCTION, resp);
+    }
+}
+
+/**
+ * @brief Close a client connection
+ */
+static void client_close(mb_client_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+/**
+ * @brief Process all complete requests in a client buffer
+ *
+ * @return false if the connection must be closed
+ */
+static bool client_process(mb_client_t *c)
+{
+    while (c->len >= MBAP_LEN) {
+        uint16_t protocol = get_u16(&c->buf[2]);
+        uint16_t length = get_u16(&c->buf[4]);
+        size_t adu_len = 6 + length;
+
+        if (protocol != 0 || length < 2 || adu_len > ADU_MAX) {
+            ESP_LOGW(TAG, "Malformed MBAP header, closing %d", c->fd);
+            return false;
+        }
+        if (c->len < adu_len) {
+            break;
+        }
+
+        size_t pdu_len = modbus_tcp_process_pdu(&c->buf[MBAP_LEN], adu_len - MBAP_LEN,
+                                                &tx[MBAP_LEN]);
+        memcpy(tx, c->buf, 4);                  /* Transaction and protocol id */
+        put_u16(&tx[4], pdu_len + 1);
+        tx[6] = c->buf[6];                      /* Unit id */
+
+        size_t tx_len = MBAP_LEN + pdu_len;
+        if (send(c->fd, tx, tx_len, 0) != (ssize_t)tx_len) {
+            return false;
+        }
+
+        c->len -= adu_len;
+        memmove(c->buf, &c->buf[adu_len], c->len);
+    }
+    return true;
+}
+
+/**
+ * @brief Accept a new master
+ */
+static void accept_client(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            clients[i].fd = fd;
+            clients[i].len = 0;
+            ESP_LOGI(TAG, "Master connected (%d)", fd);
+            return;
+        }
+    }
+
+    ESP_LOGW(TAG, "Too many masters, rejecting connection");
+    close(fd);
+}
+
+/**
+ * @brief Modbus TCP server task
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_modbus(void *p)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listen_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listen_fd, MAX_CLIENTS) != 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d", PORT);
+        close(listen_fd);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Listening on port %d", PORT);
+
+    for (;;) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(listen_fd, &rfds);
+        int max_fd = listen_fd;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0) {
+                FD_SET(clients[i].fd, &rfds);
+                max_fd = MAX(max_fd, clients[i].fd);
+            }
+        }
+
+        if (select(max_fd + 1, &rfds, NULL, NULL, NULL) < 0) {
+            continue;
+        }
+
+        if (FD_ISSET(listen_fd, &rfds)) {
+            accept_client(listen_fd);
+        }
+
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            mb_client_t *c = &clients[i];
+            if (c->fd < 0 || !FD_ISSET(c->fd, &rfds)) {
+                continue;
+            }
+
+            ssize_t n = recv(c->fd, &c->buf[c->len], sizeof(c->buf) - c->len, 0);
+            if (n <= 0) {
+                ESP_LOGI(TAG, "Master disconnected (%d)", c->fd);
+                client_close(c);
+                continue;
+            }
+
+            c->len += n;
+            if (!client_process(c)) {
+                client_close(c);
+            }
+        }
+    }
+}
+
+BaseType_t modbus_tcp_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    return xTaskCreate(task_modbus, "modbus", 4096, NULL,
+                       uxTaskPriorityGet(NULL), &task_handle);
+}
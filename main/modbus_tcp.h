@@ -0,0 +1,59 @@
+/**
+ * @file modbus_tcp.h
+ * @brief Modbus TCP slave exposing the channel registers
+ *
+ * Register map (ch = channel index, 16-bit registers):
+ * @code
+ *   Input registers (FC 0x04)
+ *     0x0000 + ch   raw value
+ *     0x0010 + ch   normalized value
+ *     0x0020        frame sequence number, high word
+ *     0x0021        frame sequence number, low word
+ *
+ *   Holding registers (FC 0x03 read, FC 0x06 / 0x10 write)
+ *     0x0000 + ch   calibration minimum
+ *     0x0010 + ch   calibration maximum
+ *     0x0020 + ch   hysteresis
+ * @endcode
+ * Reads are served from the lock-free ADC snapshot. Writes go through
+ * adc_set_calibration() / adc_set_hysteresis() and are stored in NVS.
+ * Any unit identifier is accepted.
+ */
+
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+
+#define MODBUS_IR_RAW           0x0000
+#define MODBUS_IR_NORMALIZED    0x0010
+#define MODBUS_IR_FRAME_SEQ     0x0020
+#define MODBUS_HR_CAL_MIN       0x0000
+#define MODBUS_HR_CAL_MAX       0x0010
+#define MODBUS_HR_HYSTERESIS    0x0020
+
+/**
+ * @brief Start the Modbus TCP server task
+ *
+ * The TCP/IP stack and adc_init() must be initialized first.
+ *
+ * @return pdPASS if the server task was created, pdFAIL otherwise
+ */
+BaseType_t modbus_tcp_init(void);
+
+/**
+ * @brief Process one Modbus PDU
+ *
+ * Transport independent; used by the TCP server for every request.
+ *
+ * @param[in] req Request PDU (function code and data)
+ * @param[in] req_len Request PDU length
+ * @param[out] resp Buffer for the response PDU (at least 253 bytes)
+ * @return Response PDU length, 0 if req is NULL or empty
+ * @note This function is NULL-safe
+ */
+size_t modbus_tcp_process_pdu(const uint8_t *req, size_t req_len, uint8_t *resp);
+
+#endif /* MODBUS_TCP_H */
@@ -0,0 +1,637 @@
+/**
+ * @file pid.c
+ * @brief PID control loops executed in the ADC task
+ *
+ * pid_run() is called by the ADC task right after the channels of a
+ * frame are computed, ahead of the snapshot (which takes the ADC mutex)
+ * and of the frame listeners, so the only work between the interrupt and
+ * the actuator is draining the DMA frame and filtering it. Everything in
+ * the step is integer arithmetic on Q16 values.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "driver/ledc.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "pid.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define ONE             (1 << PID_GAIN_Q)
+#define PWM_MAX         ((1 << CONFIG_PID_PWM_BITS) - 1)
+#define PWM_TIMER       LEDC_TIMER_0
+#define PWM_MODE        LEDC_LOW_SPEED_MODE
+
+/* Reset requests, two bits per loop */
+#define REQ_STATE(l)    (1u << (2 * (l)))
+#define REQ_STATS(l)    (2u << (2 * (l)))
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "pid"
+#define NVS_KEY_FMT     "loop%u"
+
+/**
+ * @brief Controller state of one loop (ADC task only)
+ */
+typedef struct {
+    int64_t integ;              /**< Integrator, Q16 output units */
+    int32_t prev;               /**< Previous input */
+    bool primed;                /**< prev is valid */
+} loop_state_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "pid";
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE out_lock = portMUX_INITIALIZER_UNLOCKED;
+static pid_cfg_t cfg[PID_LOOPS];
+static struct {
+    pid_output_t fn;
+    void *arg;
+} outputs[PID_LOOPS];
+static uint32_t reset_req;          /* REQ_* bits, taken by the ADC task */
+static loop_state_t state[PID_LOOPS];
+static pid_status_t status[PID_LOOPS];
+static const int pwm_gpio[PID_LOOPS] = { CONFIG_PID_LOOP0_GPIO, CONFIG_PID_LOOP1_GPIO };
+
+/**
+ * @brief Check if loop index is valid
+ */
+static inline bool chk_loop(uint8_t loop)
+{
+    return loop < PID_LOOPS;
+}
+
+/**
+ * @brief Clamp a value to a range
+ */
+static inline int64_t clamp64(int64_t v, int64_t lo, int64_t hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+/**
+ * @brief Default output: PWM duty on the LEDC channel of the loop
+ */
+static void pwm_output(uint8_t loop, int32_t value, void *arg)
+{
+    uint32_t duty = clamp64(value, 0, PWM_MAX);
+
+    ledc_set_duty(PWM_MODE, (ledc_channel_t)loop, duty);
+    ledc_update_duty(PWM_MODE, (ledc_channel_t)loop);
+}
+
+/**
+ * @brief One control step
+ *
+ * @param[in,out] st Loop state
+ * @param[in] c Loop configuration
+ * @param[in] pv Measured value
+ * @param[out] s Status to update with input, error and output
+ * @return Controller output
+ */
+static int32_t step(loop_state_t *st, const pid_cfg_t *c, int32_t pv, pid_status_t *s)
+{
+    const int64_t lo = (int64_t)c->out_min * ONE;
+    const int64_t hi = (int64_t)c->out_max * ONE;
+    int32_t e = c->setpoint - pv;
+    int32_t dpv = st->primed ? pv - st->prev : 0;
+
+    if (c->reverse) {
+        e = -e;
+        dpv = -dpv;
+    }
+    st->prev = pv;
+    st->primed = true;
+
+    const int64_t p = (int64_t)c->kp * e;
+    const int64_t d = -(int64_t)c->kd * dpv;
+    int64_t integ = clamp64(st->integ + (int64_t)c->ki * e, lo, hi);
+    int64_t u = p + integ + d;
+
+    /* Anti-windup: do not integrate further into a saturated output */
+    if ((u > hi && e > 0) || (u < lo && e < 0)) {
+        integ = st->integ;
+        u = p + integ + d;
+    }
+    st->integ = integ;
+
+    bool sat = u >= hi || u <= lo;
+    u = clamp64(u, lo, hi);
+
+    s->input = pv;
+    s->error = e;
+    s->integral = integ / ONE;
+    s->saturated += sat && c->out_min != c->out_max;
+    return (int32_t)((u + ONE / 2) >> PID_GAIN_Q);
+}
+
+void pid_run(const adc_frame_t *f)
+{
+    pid_cfg_t c[PID_LOOPS];
+    pid_output_t fn[PID_LOOPS];
+    void *arg[PID_LOOPS];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(c, cfg, sizeof(c));
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        fn[l] = outputs[l].fn;
+        arg[l] = outputs[l].arg;
+    }
+    uint32_t req = reset_req;
+    reset_req = 0;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        pid_status_t *s = &status[l];
+
+        if (req & REQ_STATE(l)) {
+            state[l] = (loop_state_t){
+                .integ = clamp64(0, (int64_t)c[l].out_min * ONE, (int64_t)c[l].out_max * ONE),
+            };
+        }
+        if (req & REQ_STATS(l)) {
+            taskENTER_CRITICAL(&out_lock);
+            memset(s, 0, sizeof(*s));
+            s->latency_min_us = UINT32_MAX;
+            taskEXIT_CRITICAL(&out_lock);
+        }
+
+        uint16_t n = f->count[c[l].channel];
+        if (!c[l].enabled || n == 0) {
+            continue;
+        }
+
+        /* Only this task writes the status */
+        pid_status_t upd = *s;
+
+        /* The newest sample is the one closest to the interrupt */
+        int32_t out = step(&state[l], &c[l], f->samples[c[l].channel][n - 1], &upd);
+        if (fn[l]) {
+            fn[l](l, out, arg[l]);
+        }
+        int64_t done = esp_timer_get_time();
+
+        upd.output = out;
+        upd.steps++;
+        if (f->conv_done_us == 0) {
+            upd.late++;
+        } else {
+            uint32_t lat = done - f->conv_done_us;
+            upd.latency_us = lat;
+            upd.latency_min_us = MIN(upd.latency_min_us, lat);
+            upd.latency_max_us = MAX(upd.latency_max_us, lat);
+            upd.latency_sum_us += lat;
+        }
+
+        taskENTER_CRITICAL(&out_lock);
+        *s = upd;
+        taskEXIT_CRITICAL(&out_lock);
+    }
+}
+
+/**
+ * @brief Write the configuration of a loop to NVS (flash service task)
+ *
+ * @param[in] ctx Loop index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_cfg(void *ctx)
+{
+    uint8_t loop = *(uint8_t *)ctx;
+    pid_cfg_t c;
+
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[loop];
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, loop);
+    err = nvs_set_blob(nvs, key, &c, sizeof(c));
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Check a configuration
+ */
+static bool chk_cfg(const pid_cfg_t *c)
+{
+    return c->channel < ADC_TOTAL_CHANNELS && c->out_min <= c->out_max;
+}
+
+/**
+ * @brief Load the configuration of all loops from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        char key[16];
+        pid_cfg_t c;
+        size_t len = sizeof(c);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, l);
+        if (nvs_get_blob(nvs, key, &c, &len) == ESP_OK && len == sizeof(c) && chk_cfg(&c)) {
+            taskENTER_CRITICAL(&cfg_lock);
+            cfg[l] = c;
+            taskEXIT_CRITICAL(&cfg_lock);
+        }
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Set up the PWM outputs of the loops that have a GPIO
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t pwm_init(void)
+{
+    ledc_timer_config_t timer = {
+        .speed_mode = PWM_MODE,
+        .duty_resolution = CONFIG_PID_PWM_BITS,
+        .timer_num = PWM_TIMER,
+        .freq_hz = CONFIG_PID_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    bool timer_done = false;
+
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        if (pwm_gpio[l] < 0) {
+            continue;
+        }
+
+        esp_err_t err;
+        if (!timer_done) {
+            err = ledc_timer_config(&timer);
+            if (err != ESP_OK) {
+                return err;
+            }
+            timer_done = true;
+        }
+
+        ledc_channel_config_t ch = {
+            .gpio_num = pwm_gpio[l],
+            .speed_mode = PWM_MODE,
+            .channel = (ledc_channel_t)l,
+            .intr_type = LEDC_INTR_DISABLE,
+            .timer_sel = PWM_TIMER,
+            .duty = 0,
+            .hpoint = 0,
+        };
+        err = ledc_channel_config(&ch);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        outputs[l].fn = pwm_output;
+        outputs[l].arg = NULL;
+        ESP_LOGI(TAG, "Loop %u output: PWM on GPIO%d", l, pwm_gpio[l]);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t pid_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    /* The ADC task already runs pid_run(), it sees the configuration
+       from the next frame on */
+    taskENTER_CRITICAL(&cfg_lock);
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        cfg[l] = (pid_cfg_t){
+            .enabled = 0,
+            .channel = l,
+            .setpoint = (1 << 12) / 2,
+            .kp = ONE,
+            .out_min = 0,
+            .out_max = PWM_MAX,
+        };
+        reset_req |= REQ_STATE(l) | REQ_STATS(l);
+    }
+    taskEXIT_CRITICAL(&cfg_lock);
+    load_config();
+
+    esp_err_t err = pwm_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "PWM setup failed: %s", esp_err_to_name(err));
+        return pdFAIL;
+    }
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t pid_set_output(uint8_t loop, pid_output_t fn, void *arg)
+{
+    if (!chk_loop(loop)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    outputs[loop].fn = fn;
+    outputs[loop].arg = arg;
+    taskEXIT_CRITICAL(&cfg_lock);
+    return ESP_OK;
+}
+
+esp_err_t pid_set_config(uint8_t loop, const pid_cfg_t *c)
+{
+    if (!chk_loop(loop) || c == NULL || !chk_cfg(c)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    if ((c->enabled && !cfg[loop].enabled) || c->channel != cfg[loop].channel) {
+        reset_req |= REQ_STATE(loop) | REQ_STATS(loop);
+    }
+    cfg[loop] = *c;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", loop);
+    return flash_svc_run(key, write_cfg, &loop, sizeof(loop));
+}
+
+esp_err_t pid_get_config(uint8_t loop, pid_cfg_t *c)
+{
+    if (!chk_loop(loop) || c == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    *c = cfg[loop];
+    taskEXIT_CRITICAL(&cfg_lock);
+    return ESP_OK;
+}
+
+esp_err_t pid_get_status(uint8_t loop, pid_status_t *s)
+{
+    if (!chk_loop(loop) || s == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *s = status[loop];
+    taskEXIT_CRITICAL(&out_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *loop;
+    struct arg_int *channel;
+    struct arg_int *setpoint;
+    struct arg_dbl *kp;
+    struct arg_dbl *ki;
+    struct arg_dbl *kd;
+    struct arg_int *out_min;
+    struct arg_int *out_max;
+    struct arg_int *reverse;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_lit *reset;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("PID control loops\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print configuration and state of all loops
+ */
+static void print_status(void)
+{
+    for (uint8_t l = 0; l < PID_LOOPS; l++) {
+        pid_cfg_t c;
+        pid_status_t s;
+        pid_get_config(l, &c);
+        pid_get_status(l, &s);
+
+        printf("-- Loop %u --\n", l);
+        printf("  State: %s, output %s\n", c.enabled ? "enabled" : "disabled",
+               pwm_gpio[l] >= 0 ? "PWM" : "callback");
+        printf("  Input: ch%u, setpoint %"PRId32"%s\n", c.channel, c.setpoint,
+               c.reverse ? ", reverse acting" : "");
+        printf("  Gains: kp %.4f, ki %.4f, kd %.4f (per frame)\n",
+               (double)c.kp / ONE, (double)c.ki / ONE, (double)c.kd / ONE);
+        printf("  Output range: %"PRId32"..%"PRId32"\n", c.out_min, c.out_max);
+        if (s.steps == 0) {
+            continue;
+        }
+        printf("  Input %"PRId32", error %"PRId32", integral %"PRId32", output %"PRId32"\n",
+               s.input, s.error, s.integral, s.output);
+        printf("  Steps: %"PRIu32" (%"PRIu32" saturated, %"PRIu32" late)\n",
+               s.steps, s.saturated, s.late);
+        uint32_t timed = s.steps - s.late;
+        if (timed > 0) {
+            printf("  Latency: last %"PRIu32" us, min %"PRIu32", mean %"PRIu64", max %"PRIu32"\n",
+                   s.latency_us, s.latency_min_us, s.latency_sum_us / timed, s.latency_max_us);
+        }
+    }
+}
+
+/**
+ * @brief Convert a gain to Q16
+ *
+ * @return false if out of range
+ */
+static bool to_gain(double g, int32_t *q)
+{
+    if (g < 0.0 || g * ONE > INT32_MAX) {
+        return false;
+    }
+    *q = (int32_t)(g * ONE + 0.5);
+    return true;
+}
+
+/**
+ * @brief PID command handler
+ */
+static int cmd_pid(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.loop->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    if (args.loop->ival[0] < 0 || !chk_loop(args.loop->ival[0])) {
+        printf("Invalid loop %d (0-%d)\n", args.loop->ival[0], PID_LOOPS - 1);
+        return 1;
+    }
+    uint8_t l = args.loop->ival[0];
+
+    if (args.reset->count > 0) {
+        taskENTER_CRITICAL(&cfg_lock);
+        reset_req |= REQ_STATS(l);
+        taskEXIT_CRITICAL(&cfg_lock);
+        printf("Loop %u statistics cleared\n", l);
+    }
+
+    pid_cfg_t c;
+    pid_get_config(l, &c);
+    bool changed = false;
+
+    if (args.channel->count > 0) {
+        if (args.channel->ival[0] < 0 || args.channel->ival[0] >= ADC_TOTAL_CHANNELS) {
+            printf("Invalid channel %d\n", args.channel->ival[0]);
+            return 1;
+        }
+        c.channel = args.channel->ival[0];
+        changed = true;
+    }
+
+    if (args.setpoint->count > 0) {
+        c.setpoint = args.setpoint->ival[0];
+        changed = true;
+    }
+
+    struct {
+        struct arg_dbl *arg;
+        int32_t *gain;
+    } gains[] = {
+        { args.kp, &c.kp }, { args.ki, &c.ki }, { args.kd, &c.kd },
+    };
+    for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        if (gains[g].arg->count > 0) {
+            if (!to_gain(gains[g].arg->dval[0], gains[g].gain)) {
+                printf("Invalid gain %g\n", gains[g].arg->dval[0]);
+                return 1;
+            }
+            changed = true;
+        }
+    }
+
+    if (args.out_min->count > 0) {
+        c.out_min = args.out_min->ival[0];
+        changed = true;
+    }
+
+    if (args.out_max->count > 0) {
+        c.out_max = args.out_max->ival[0];
+        changed = true;
+    }
+
+    if (args.reverse->count > 0) {
+        c.reverse = args.reverse->ival[0] != 0;
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (c.out_min > c.out_max) {
+        printf("Output minimum above maximum\n");
+        return 1;
+    }
+
+    if (changed) {
+        esp_err_t err = pid_set_config(l, &c);
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    } else if (args.reset->count == 0) {
+        print_status();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register PID commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.loop = arg_int0("l", "loop", "<n>", "Loop to configure");
+    args.channel = arg_int0("c", "channel", "<ch>", "Input channel");
+    args.setpoint = arg_int0("s", "setpoint", "<value>", "Setpoint (normalized counts)");
+    args.kp = arg_dbl0("p", "kp", "<gain>", "Proportional gain");
+    args.ki = arg_dbl0("i", "ki", "<gain>", "Integral gain per frame");
+    args.kd = arg_dbl0("d", "kd", "<gain>", "Derivative gain per frame");
+    args.out_min = arg_int0("m", "min", "<value>", "Output minimum");
+    args.out_max = arg_int0("M", "max", "<value>", "Output maximum");
+    args.reverse = arg_int0("R", "reverse", "<0|1>", "Reverse acting");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable the loop");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable the loop");
+    args.reset = arg_litn("r", "reset", 0, 1, "Clear the statistics");
+    args.end = arg_end(13);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "pid",
+        .func = cmd_pid,
+        .help = "PID control loops run on every ADC frame\n"
+                "Examples:\n"
+                "  pid                                Show all loops\n"
+                "  pid -l 0 -c 1 -s 2000 -E           Hold ch1 at 2000\n"
+                "  pid -l 0 -p 0.5 -i 0.02 -d 0.1     Tune live\n"
+                "  pid -l 0 -r                        Clear latency statistics\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,153 @@
+/**
+ * @file pid.h
+ * @brief PID control loops executed in the ADC task
+ *
+ * Each loop reads the newest sample of its input channel from every
+ * processed frame, computes a fixed-point PID step and hands the result
+ * to its output callback before the frame is published or passed to any
+ * listener. The control period is one frame. By default the output of
+ * loop n drives an LEDC PWM channel on CONFIG_PID_LOOPn_GPIO; another
+ * actuator can be installed with pid_set_output(). A disabled loop leaves
+ * its output where it was.
+ *
+ * Control is per frame, not per sample. A frame is ADC_READ_BUFFER_SIZE
+ * bytes of conversions, 512 samples or 25.6 ms at 20 kHz, so a change at
+ * the input reaches the output after up to one frame plus the lag of the
+ * channel filter: the loop reads filtered samples, and the running
+ * average delays them by (ADC_RUNNING_AVG_SIZE - 1) / 2 samples of the
+ * channel (0.9 ms with 10 samples at 5 kHz per channel), on top of the
+ * hysteresis dead band. Tune the gains for that loop delay.
+ *
+ * The latency statistics cover only the part after the frame completed:
+ * from the DMA conversion-done interrupt of the frame to the return of
+ * the output callback. Frames that waited behind others in the driver
+ * pool are counted as late.
+ *
+ * Gains are per control period: the integral term adds ki * error per
+ * frame, the derivative term is kd times the change of the measured
+ * value per frame (on measurement, so setpoint steps do not kick).
+ * Integration stops while the output is saturated in the direction of
+ * the error, and the integrator is clamped to the output range.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+#define PID_LOOPS       2       /**< Number of control loops */
+#define PID_GAIN_Q      16      /**< Fraction bits of the gains */
+
+/**
+ * @brief Output callback (ADC task context, must not block)
+ *
+ * @param[in] loop Loop index
+ * @param[in] value Controller output, within out_min..out_max
+ * @param[in] arg User argument given to pid_set_output()
+ */
+typedef void (*pid_output_t)(uint8_t loop, int32_t value, void *arg);
+
+/**
+ * @brief Configuration of one loop
+ */
+typedef struct {
+    uint8_t enabled;            /**< Loop runs */
+    uint8_t channel;            /**< Input channel, virtual channels included */
+    uint8_t reverse;            /**< Output rises when the input is above the setpoint */
+    uint8_t reserved;
+    int32_t setpoint;           /**< Target in normalized counts */
+    int32_t kp;                 /**< Proportional gain, Q16 */
+    int32_t ki;                 /**< Integral gain per frame, Q16 */
+    int32_t kd;                 /**< Derivative gain per frame, Q16 */
+    int32_t out_min;            /**< Lowest output */
+    int32_t out_max;            /**< Highest output */
+} pid_cfg_t;
+
+/**
+ * @brief State and latency statistics of one loop
+ */
+typedef struct {
+    int32_t input;              /**< Last measured value */
+    int32_t output;             /**< Last output */
+    int32_t error;              /**< Last error, setpoint - input (inverted if reverse) */
+    int32_t integral;           /**< Integrator, output units */
+    uint32_t steps;             /**< Control steps since reset */
+    uint32_t late;              /**< Steps on frames that waited in the pool */
+    uint32_t saturated;         /**< Steps with the output at a limit */
+    uint32_t latency_us;        /**< Latency of the last timed step */
+    uint32_t latency_min_us;    /**< Shortest latency since reset */
+    uint32_t latency_max_us;    /**< Longest latency since reset */
+    uint64_t latency_sum_us;    /**< Sum over the timed steps (steps - late) */
+} pid_status_t;
+
+/**
+ * @brief Initialize the control loops
+ *
+ * Loads the configuration from NVS, sets up the PWM outputs and registers
+ * the `pid` command. Call after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t pid_init(void);
+
+/**
+ * @brief Replace the output of a loop
+ *
+ * @param[in] loop Loop index
+ * @param[in] fn Output callback, NULL for none
+ * @param[in] arg User argument passed to the callback
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if loop is invalid
+ * @note This function is thread-safe
+ */
+esp_err_t pid_set_output(uint8_t loop, pid_output_t fn, void *arg);
+
+/**
+ * @brief Configure a loop
+ *
+ * Gains and limits take effect on the next frame without resetting the
+ * integrator; enabling the loop or changing its input resets it.
+ *
+ * @param[in] loop Loop index
+ * @param[in] cfg Configuration
+ * @return ESP_OK if applied and stored
+ *         ESP_ERR_INVALID_ARG if loop is invalid, cfg is NULL or inconsistent
+ *         an NVS error if the configuration could not be stored
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t pid_set_config(uint8_t loop, const pid_cfg_t *cfg);
+
+/**
+ * @brief Get the configuration of a loop
+ *
+ * @param[in] loop Loop index
+ * @param[out] cfg Pointer to store the configuration
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if loop is invalid or cfg is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t pid_get_config(uint8_t loop, pid_cfg_t *cfg);
+
+/**
+ * @brief Get the state and latency statistics of a loop
+ *
+ * @param[in] loop Loop index
+ * @param[out] status Pointer to store the status
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if loop is invalid or status is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t pid_get_status(uint8_t loop, pid_status_t *status);
+
+/**
+ * @brief Run one control step of every enabled loop (ADC task)
+ *
+ * @param[in] frame Frame with all channels filled in
+ */
+void pid_run(const adc_frame_t *frame);
+
+#endif /* PID_H */
@@ -0,0 +1,601 @@
+/**
+ * @file sfq.c
+ * @brief Store-and-forward queue for outgoing payloads
+ *
+ * Every payload is stored as a 16-bit length followed by the payload,
+ * both in the RAM ring and in the spill files. Spill files are numbered
+ * with 8 hex digits (8.3 names) and hold at most SFQ_FILE_SIZE bytes; the
+ * newest one is kept open and doubles as read handle once the reader
+ * catches up with it. File I/O runs on the flash service while the owner
+ * task waits.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "econsole.h"
+#include "flash_svc.h"
+#include "sfq.h"
+
+#define FILE_SIZE       CONFIG_SFQ_FILE_SIZE
+#define MAX_FILES       (CONFIG_SFQ_SPILL_MAX / CONFIG_SFQ_FILE_SIZE)
+#define NAME_MAX_LEN    8
+#define LEN_BYTES       sizeof(uint16_t)
+#define PATH_LEN        32
+
+#if MAX_FILES < 2
+#error "SFQ_SPILL_MAX must be at least twice SFQ_FILE_SIZE"
+#endif
+
+/**
+ * @brief Spill file bookkeeping
+ */
+typedef struct {
+    uint32_t bytes;             /**< Bytes written */
+    uint32_t records;           /**< Payloads written */
+} spill_file_t;
+
+struct sfq {
+    char dir[PATH_LEN];         /**< Spill directory */
+    bool spill;                 /**< Spill files usable */
+    uint32_t count;             /**< Payloads queued */
+
+    uint8_t *ram;               /**< RAM ring */
+    size_t ram_size;
+    size_t head;                /**< Offset of the oldest byte */
+    size_t used;                /**< Bytes in the ring */
+    uint32_t ram_count;         /**< Payloads in the ring */
+
+    uint32_t first;             /**< Number of the oldest spill file */
+    uint32_t nfiles;            /**< Spill files first .. first + nfiles - 1 */
+    spill_file_t files[MAX_FILES];  /**< Indexed by file number % MAX_FILES */
+    FILE *wr;                   /**< Newest file, NULL once closed */
+    FILE *rd;                   /**< Oldest file if it is not the newest */
+    uint32_t rd_off;            /**< Read offset in the oldest file */
+    uint32_t rd_records;        /**< Payloads consumed from the oldest file */
+
+    int64_t backlog_since_us;   /**< Time the queue became non-empty */
+    int64_t drain_start_us;     /**< First pop of the current backlog, 0 if none */
+
+    portMUX_TYPE lock;          /**< Guards stats */
+    sfq_stats_t stats;
+};
+
+/**
+ * @brief Spill file operation handed to the flash service
+ */
+typedef struct {
+    sfq_t *q;
+    const void *data;           /**< Payload to append */
+    void *buf;                  /**< Buffer for a read payload */
+    size_t size;                /**< Payload or buffer length */
+    size_t *len;                /**< Read payload length */
+} spill_op_t;
+
+/* Module static variables */
+static const char *TAG = "sfq";
+
+/**
+ * @brief Path of a spill file
+ */
+static void file_path(const sfq_t *q, uint32_t num, char *path)
+{
+    snprintf(path, PATH_LEN, "%s/%08"PRIx32, q->dir, num);
+}
+
+/**
+ * @brief Publish depth and spill size to the statistics
+ */
+static void stats_sync(sfq_t *q)
+{
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < q->nfiles; i++) {
+        bytes += q->files[(q->first + i) % MAX_FILES].bytes;
+    }
+
+    taskENTER_CRITICAL(&q->lock);
+    q->stats.depth = q->count;
+    q->stats.peak_depth = MAX(q->stats.peak_depth, q->count);
+    q->stats.spill_bytes = bytes;
+    taskEXIT_CRITICAL(&q->lock);
+}
+
+/**
+ * @brief Count lost payloads
+ */
+static void stats_drop(sfq_t *q, uint32_t n)
+{
+    taskENTER_CRITICAL(&q->lock);
+    q->stats.dropped += n;
+    taskEXIT_CRITICAL(&q->lock);
+}
+
+/**
+ * @brief RAM ring primitives
+ */
+static void ring_write(sfq_t *q, const void *src, size_t n)
+{
+    size_t pos = (q->head + q->used) % q->ram_size;
+    size_t part = MIN(n, q->ram_size - pos);
+    memcpy(&q->ram[pos], src, part);
+    memcpy(q->ram, (const uint8_t *)src + part, n - part);
+    q->used += n;
+}
+
+static void ring_read(const sfq_t *q, size_t off, void *dst, size_t n)
+{
+    size_t pos = (q->head + off) % q->ram_size;
+    size_t part = MIN(n, q->ram_size - pos);
+    memcpy(dst, &q->ram[pos], part);
+    memcpy((uint8_t *)dst + part, q->ram, n - part);
+}
+
+static uint16_t ring_head_len(const sfq_t *q)
+{
+    uint16_t len;
+    ring_read(q, 0, &len, LEN_BYTES);
+    return len;
+}
+
+static void ring_pop(sfq_t *q)
+{
+    size_t n = LEN_BYTES + ring_head_len(q);
+    q->head = (q->head + n) % q->ram_size;
+    q->used -= n;
+    q->ram_count--;
+    q->count--;
+}
+
+static void ring_push(sfq_t *q, const void *data, uint16_t len)
+{
+    ring_write(q, &len, LEN_BYTES);
+    ring_write(q, data, len);
+    q->ram_count++;
+    q->count++;
+}
+
+/**
+ * @brief Delete the oldest spill file
+ *
+ * Payloads not yet consumed from it are counted as dropped.
+ */
+static void spill_remove_first(sfq_t *q)
+{
+    char path[PATH_LEN];
+    spill_file_t *f = &q->files[q->first % MAX_FILES];
+    uint32_t lost = f->records - q->rd_records;
+
+    if (q->rd != NULL) {
+        fclose(q->rd);
+        q->rd = NULL;
+    }
+    if (q->nfiles == 1 && q->wr != NULL) {
+        fclose(q->wr);
+        q->wr = NULL;
+    }
+
+    file_path(q, q->first, path);
+    remove(path);
+
+    q->count -= lost;
+    q->first++;
+    q->nfiles--;
+    q->rd_off = 0;
+    q->rd_records = 0;
+
+    if (lost) {
+        ESP_LOGW(TAG, "%s: dropped %"PRIu32" spilled payloads", q->dir, lost);
+        stats_drop(q, lost);
+    }
+}
+
+/**
+ * @brief Close the newest spill file and start another one
+ */
+static esp_err_t spill_open_next(sfq_t *q)
+{
+    char path[PATH_LEN];
+
+    if (q->wr != NULL) {
+        fclose(q->wr);
+        q->wr = NULL;
+    }
+    if (q->nfiles == MAX_FILES) {
+        spill_remove_first(q);
+    }
+
+    uint32_t num = q->first + q->nfiles;
+    file_path(q, num, path);
+    q->wr = fopen(path, "w+b");
+    if (q->wr == NULL) {
+        ESP_LOGE(TAG, "Cannot create %s", path);
+        return ESP_FAIL;
+    }
+
+    q->files[num % MAX_FILES] = (spill_file_t){ 0 };
+    q->nfiles++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Append a payload to the newest spill file
+ */
+static esp_err_t spill_write(sfq_t *q, const void *data, uint16_t len)
+{
+    size_t need = LEN_BYTES + len;
+    spill_file_t *f = (q->nfiles > 0) ? &q->files[(q->first + q->nfiles - 1) % MAX_FILES] : NULL;
+
+    if (q->wr == NULL || f->bytes + need > FILE_SIZE) {
+        if (spill_open_next(q) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        f = &q->files[(q->first + q->nfiles - 1) % MAX_FILES];
+    }
+
+    if (fseek(q->wr, 0, SEEK_END) != 0
+        || fwrite(&len, LEN_BYTES, 1, q->wr) != 1
+        || fwrite(data, 1, len, q->wr) != len) {
+        /* Never append after a partial write, the file ends here */
+        ESP_LOGE(TAG, "%s: spill write failed", q->dir);
+        fclose(q->wr);
+        q->wr = NULL;
+        return ESP_FAIL;
+    }
+
+    f->bytes += need;
+    f->records++;
+    q->count++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Position on the oldest spilled payload
+ *
+ * Consumed and corrupted files are removed on the way.
+ *
+ * @param[in] q Queue
+ * @param[out] fp Stream positioned on the payload
+ * @param[out] len Payload length
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if no spilled payload is left
+ */
+static esp_err_t spill_head(sfq_t *q, FILE **fp, uint16_t *len)
+{
+    char path[PATH_LEN];
+
+    while (q->nfiles > 0) {
+        const spill_file_t *f = &q->files[q->first % MAX_FILES];
+
+        if (q->rd_off + LEN_BYTES <= f->bytes) {
+            if (q->nfiles == 1 && q->wr != NULL) {
+                *fp = q->wr;
+            } else {
+                if (q->rd == NULL) {
+                    file_path(q, q->first, path);
+                    q->rd = fopen(path, "rb");
+                }
+                *fp = q->rd;
+            }
+
+            if (*fp != NULL
+                && fseek(*fp, q->rd_off, SEEK_SET) == 0
+                && fread(len, LEN_BYTES, 1, *fp) == 1
+                && *len > 0
+                && q->rd_off + LEN_BYTES + *len <= f->bytes) {
+                return ESP_OK;
+            }
+            ESP_LOGW(TAG, "%s: corrupted spill file %08"PRIx32, q->dir, q->first);
+        }
+
+        spill_remove_first(q);
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Copy the oldest spilled payload (flash service task)
+ */
+static esp_err_t spill_peek_op(void *ctx)
+{
+    const spill_op_t *op = ctx;
+    FILE *fp;
+    uint16_t n;
+
+    esp_err_t err = spill_head(op->q, &fp, &n);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (n > op->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (fread(op->buf, 1, n, fp) != n) {
+        return ESP_FAIL;
+    }
+    *op->len = n;
+    return ESP_OK;
+}
+
+/**
+ * @brief Consume the oldest spilled payload (flash service task)
+ */
+static esp_err_t spill_pop_op(void *ctx)
+{
+    const spill_op_t *op = ctx;
+    sfq_t *q = op->q;
+    FILE *fp;
+    uint16_t n;
+
+    if (spill_head(q, &fp, &n) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    q->rd_off += LEN_BYTES + n;
+    q->rd_records++;
+    q->count--;
+    if (q->rd_off >= q->files[q->first % MAX_FILES].bytes && q->rd != NULL) {
+        /* Fully consumed and no longer written */
+        spill_remove_first(q);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Append a payload to the spill files (flash service task)
+ */
+static esp_err_t spill_write_op(void *ctx)
+{
+    const spill_op_t *op = ctx;
+    return spill_write(op->q, op->data, op->size);
+}
+
+/**
+ * @brief Delete all spill files (flash service task)
+ */
+static esp_err_t spill_clear_op(void *ctx)
+{
+    const spill_op_t *op = ctx;
+    while (op->q->nfiles > 0) {
+        spill_remove_first(op->q);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Pick up spill files left by a previous boot
+ */
+static void spill_recover(sfq_t *q)
+{
+    char path[PATH_LEN];
+    uint32_t lo = UINT32_MAX, hi = 0;
+
+    DIR *d = opendir(q->dir);
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        char *end;
+        uint32_t num = strtoul(e->d_name, &end, 16);
+        if (strlen(e->d_name) == 8 && *end == '\0') {
+            lo = MIN(lo, num);
+            hi = MAX(hi, num);
+        }
+    }
+    closedir(d);
+
+    if (lo > hi) {
+        return;
+    }
+
+    /* Keep the newest files only */
+    for (; hi - lo + 1 > MAX_FILES; lo++) {
+        file_path(q, lo, path);
+        remove(path);
+    }
+
+    q->first = lo;
+    q->nfiles = hi - lo + 1;
+    for (uint32_t num = lo; num <= hi; num++) {
+        spill_file_t *f = &q->files[num % MAX_FILES];
+        *f = (spill_file_t){ 0 };
+
+        struct stat st;
+        file_path(q, num, path);
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL || stat(path, &st) != 0) {
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            continue;
+        }
+        /* A torn payload at the end of the file is ignored */
+        uint16_t len;
+        while (fread(&len, LEN_BYTES, 1, fp) == 1 && len > 0
+               && f->bytes + LEN_BYTES + len <= (uint32_t)st.st_size
+               && fseek(fp, len, SEEK_CUR) == 0) {
+            f->bytes += LEN_BYTES + len;
+            f->records++;
+        }
+        fclose(fp);
+        q->count += f->records;
+    }
+
+    if (q->count == 0) {
+        while (q->nfiles > 0) {
+            spill_remove_first(q);
+        }
+    } else {
+        ESP_LOGI(TAG, "%s: %"PRIu32" payloads left from previous boot", q->dir, q->count);
+        q->backlog_since_us = esp_timer_get_time();
+    }
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+sfq_t *sfq_create(const char *name, size_t ram_size)
+{
+    if (name == NULL || strlen(name) == 0 || strlen(name) > NAME_MAX_LEN
+        || ram_size <= LEN_BYTES) {
+        return NULL;
+    }
+
+    sfq_t *q = calloc(1, sizeof(sfq_t));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->ram = malloc(ram_size);
+    if (q->ram == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->ram_size = ram_size;
+    portMUX_INITIALIZE(&q->lock);
+    snprintf(q->dir, sizeof(q->dir), "%s/%s", CON_DATA_PATH, name);
+
+    if (con_data_mounted()) {
+        struct stat st;
+        if (stat(q->dir, &st) == 0 || mkdir(q->dir, 0755) == 0) {
+            q->spill = true;
+            spill_recover(q);
+            stats_sync(q);
+        } else {
+            ESP_LOGW(TAG, "Cannot create %s, buffering in RAM only", q->dir);
+        }
+    }
+
+    return q;
+}
+
+esp_err_t sfq_push(sfq_t *q, const void *data, size_t len)
+{
+    if (q == NULL || data == NULL || len == 0 || len > UINT16_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t need = LEN_BYTES + len;
+    if (q->count == 0) {
+        q->backlog_since_us = esp_timer_get_time();
+        q->drain_start_us = 0;
+    }
+
+    if (q->nfiles == 0 && q->ram_size - q->used >= need) {
+        ring_push(q, data, len);
+    } else if (q->spill
+               && flash_svc_run(q->dir, spill_write_op,
+                                &(spill_op_t){ .q = q, .data = data, .size = len },
+                                sizeof(spill_op_t)) == ESP_OK) {
+        taskENTER_CRITICAL(&q->lock);
+        q->stats.spilled++;
+        taskEXIT_CRITICAL(&q->lock);
+    } else if (q->nfiles == 0 && need <= q->ram_size) {
+        /* No filesystem: the oldest payloads make room */
+        uint32_t lost = 0;
+        while (q->ram_size - q->used < need) {
+            ring_pop(q);
+            lost++;
+        }
+        stats_drop(q, lost);
+        ring_push(q, data, len);
+    } else {
+        stats_drop(q, 1);
+        stats_sync(q);
+        return ESP_ERR_NO_MEM;
+    }
+
+    taskENTER_CRITICAL(&q->lock);
+    q->stats.pushed++;
+    taskEXIT_CRITICAL(&q->lock);
+    stats_sync(q);
+    return ESP_OK;
+}
+
+esp_err_t sfq_peek(sfq_t *q, void *buf, size_t size, size_t *len)
+{
+    if (q == NULL || buf == NULL || len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (q->ram_count > 0) {
+        uint16_t n = ring_head_len(q);
+        if (n > size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ring_read(q, LEN_BYTES, buf, n);
+        *len = n;
+        return ESP_OK;
+    }
+
+    spill_op_t op = { .q = q, .buf = buf, .size = size, .len = len };
+    esp_err_t err = flash_svc_run(q->dir, spill_peek_op, &op, sizeof(op));
+    stats_sync(q);
+    return err;
+}
+
+esp_err_t sfq_pop(sfq_t *q)
+{
+    if (q == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spill_op_t op = { .q = q };
+
+    if (q->ram_count > 0) {
+        ring_pop(q);
+    } else if (flash_svc_run(q->dir, spill_pop_op, &op, sizeof(op)) != ESP_OK) {
+        stats_sync(q);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (q->drain_start_us == 0) {
+        q->drain_start_us = now;
+    }
+
+    taskENTER_CRITICAL(&q->lock);
+    q->stats.popped++;
+    if (q->count == 0) {
+        q->stats.drains++;
+        q->stats.last_drain_us = now - q->drain_start_us;
+        q->stats.max_drain_us = MAX(q->stats.max_drain_us, q->stats.last_drain_us);
+        q->stats.last_backlog_us = now - q->backlog_since_us;
+    }
+    taskEXIT_CRITICAL(&q->lock);
+
+    if (q->count == 0 && q->nfiles > 0) {
+        /* Close and delete the newest file as well */
+        flash_svc_run(q->dir, spill_clear_op, &op, sizeof(op));
+    }
+
+    stats_sync(q);
+    return ESP_OK;
+}
+
+uint32_t sfq_depth(const sfq_t *q)
+{
+    return (q != NULL) ? q->count : 0;
+}
+
+esp_err_t sfq_get_stats(sfq_t *q, sfq_stats_t *stats)
+{
+    if (q == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&q->lock);
+    *stats = q->stats;
+    taskEXIT_CRITICAL(&q->lock);
+    return ESP_OK;
+}
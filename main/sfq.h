@@ -0,0 +1,112 @@
+/**
+ * @file sfq.h
+ * @brief Store-and-forward queue for outgoing payloads
+ *
+ * Payloads that cannot be sent are queued in a RAM ring. When the ring is
+ * full they spill to numbered files under /data/<name>/, so an outage of
+ * several minutes is bridged without loss. Payloads are returned strictly
+ * in the order they were pushed, RAM before files, and spill files left
+ * over from a previous boot are drained first.
+ *
+ * When the spill limit is reached the oldest file is dropped; without
+ * the /data filesystem the oldest RAM payload is dropped instead. Drops
+ * are counted, never silent.
+ *
+ * A queue has one owner task which pushes, peeks and pops. Only
+ * sfq_get_stats() may be called from other tasks.
+ */
+
+#ifndef SFQ_H
+#define SFQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/**
+ * @brief Queue handle
+ */
+typedef struct sfq sfq_t;
+
+/**
+ * @brief Queue statistics
+ */
+typedef struct {
+    uint32_t depth;             /**< Payloads queued */
+    uint32_t peak_depth;        /**< Highest depth so far */
+    uint32_t pushed;            /**< Payloads queued */
+    uint32_t popped;            /**< Payloads forwarded */
+    uint32_t spilled;           /**< Payloads written to spill files */
+    uint32_t dropped;           /**< Payloads lost to the size limits */
+    uint32_t spill_bytes;       /**< Bytes held in spill files */
+    uint32_t drains;            /**< Backlogs fully drained */
+    int64_t last_drain_us;      /**< First forward to empty queue, last backlog */
+    int64_t max_drain_us;       /**< Longest drain so far */
+    int64_t last_backlog_us;    /**< First push to empty queue, last backlog */
+} sfq_stats_t;
+
+/**
+ * @brief Create a queue
+ *
+ * @param[in] name Queue name, at most 8 characters; names the spill directory
+ * @param[in] ram_size Size of the RAM ring in bytes
+ * @return Queue handle, NULL if out of memory or arguments are invalid
+ */
+sfq_t *sfq_create(const char *name, size_t ram_size);
+
+/**
+ * @brief Append a payload
+ *
+ * @param[in] q Queue
+ * @param[in] data Payload
+ * @param[in] len Payload length (1 - 65535)
+ * @return ESP_OK if queued (possibly after dropping older payloads)
+ *         ESP_ERR_INVALID_ARG if q or data is NULL or len is out of range
+ *         ESP_ERR_NO_MEM if the payload was dropped
+ */
+esp_err_t sfq_push(sfq_t *q, const void *data, size_t len);
+
+/**
+ * @brief Copy the oldest payload without removing it
+ *
+ * @param[in] q Queue
+ * @param[out] buf Buffer for the payload
+ * @param[in] size Buffer size
+ * @param[out] len Payload length
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if a pointer is NULL
+ *         ESP_ERR_NOT_FOUND if the queue is empty
+ *         ESP_ERR_INVALID_SIZE if the payload does not fit into buf
+ */
+esp_err_t sfq_peek(sfq_t *q, void *buf, size_t size, size_t *len);
+
+/**
+ * @brief Remove the oldest payload
+ *
+ * @param[in] q Queue
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if q is NULL
+ *         ESP_ERR_NOT_FOUND if the queue is empty
+ */
+esp_err_t sfq_pop(sfq_t *q);
+
+/**
+ * @brief Number of queued payloads
+ *
+ * @param[in] q Queue
+ * @return Queue depth, 0 if q is NULL
+ */
+uint32_t sfq_depth(const sfq_t *q);
+
+/**
+ * @brief Get queue statistics
+ *
+ * @param[in] q Queue
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if q or stats is NULL
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t sfq_get_stats(sfq_t *q, sfq_stats_t *stats);
+
+#endif /* SFQ_H */
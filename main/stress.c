@@ -0,0 +1,358 @@
+/**
+ * @file stress.c
+ * @brief Flash write stress test for the acquisition path
+ *
+ * Helper tasks hammer NVS commits, FATFS writes and calibration saves
+ * while a frame listener counts the ADC frames that arrive. Every flash
+ * write disables the cache and stalls all tasks; the test passes when
+ * the driver pool bridged every stall, i.e. no frame was dropped, and
+ * the frames received match the sample rate over the run. The second
+ * check catches frames lost without a pool overflow, e.g. a stalled DMA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "argtable3/argtable3.h"
+#include "nvs.h"
+
+#include "econsole.h"
+#include "adc.h"
+#include "stress.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define DEFAULT_SECONDS     10
+#define MAX_SECONDS         600
+#define NVS_NAMESPACE       "stress"
+#define NVS_BLOB_SIZE       256
+#define FAT_PATH            CON_DATA_PATH "/stress.bin"
+#define FAT_WRITE_SIZE      4096
+#define SAMPLES_PER_FRAME   (ADC_READ_BUFFER_SIZE / SOC_ADC_DIGI_RESULT_BYTES)
+
+/* Frames that may be missing against the sample rate: the frames cut by
+   start and end of the run, plus the error of the ADC clock divider */
+#define MISSING_FRAMES      2
+#define MISSING_PERCENT     2
+
+/**
+ * @brief Flash writer
+ */
+typedef struct {
+    const char *name;           /**< Report label */
+    bool (*op)(void);           /**< One write operation */
+    bool enabled;               /**< Selected for this run */
+    uint32_t ops;               /**< Operations completed */
+    uint32_t failures;          /**< Operations failed */
+    int64_t max_us;             /**< Longest operation */
+} stress_writer_t;
+
+/* Forward declarations */
+static bool nvs_op(void);
+static bool fat_op(void);
+static bool cal_op(void);
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "stress";
+static SemaphoreHandle_t done = NULL;
+static int64_t deadline_us;
+
+static stress_writer_t writers[] = {
+    { .name = "NVS commit", .op = nvs_op },
+    { .name = "FATFS write", .op = fat_op },
+    { .name = "Calibration save", .op = cal_op },
+};
+
+static uint8_t nvs_blob[NVS_BLOB_SIZE];
+static uint8_t fat_buf[FAT_WRITE_SIZE];
+
+/* Frame accounting, written by the ADC task */
+static volatile bool active;
+static uint32_t frames;
+static int64_t last_ts;
+static int64_t max_gap_us;
+
+/**
+ * @brief Frame listener (ADC task context)
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    if (!active) {
+        return;
+    }
+
+    if (last_ts != 0) {
+        max_gap_us = MAX(max_gap_us, f->timestamp_us - last_ts);
+    }
+    last_ts = f->timestamp_us;
+    frames++;
+}
+
+/**
+ * @brief Write and commit a blob in a scratch namespace
+ */
+static bool nvs_op(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    nvs_blob[esp_random() % sizeof(nvs_blob)]++;
+    esp_err_t err = nvs_set_blob(nvs, "blob", nvs_blob, sizeof(nvs_blob));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err == ESP_OK;
+}
+
+/**
+ * @brief Rewrite a scratch file on /data and sync it
+ */
+static bool fat_op(void)
+{
+    FILE *f = fopen(FAT_PATH, "wb");
+    if (f == NULL) {
+        return false;
+    }
+
+    fat_buf[esp_random() % sizeof(fat_buf)]++;
+    bool ok = fwrite(fat_buf, 1, sizeof(fat_buf), f) == sizeof(fat_buf)
+              && fflush(f) == 0
+              && fsync(fileno(f)) == 0;
+    return (fclose(f) == 0) && ok;
+}
+
+/**
+ * @brief Save the unchanged calibration of channel 0
+ */
+static bool cal_op(void)
+{
+    uint32_t min, max;
+    return adc_get_calibration(0, &min, &max) == ESP_OK
+           && adc_set_calibration(0, min, max) == ESP_OK;
+}
+
+/**
+ * @brief Writer task, repeats its operation until the deadline
+ *
+ * @param[in] p stress_writer_t to run
+ */
+static void task_writer(void *p)
+{
+    stress_writer_t *w = p;
+
+    while (esp_timer_get_time() < deadline_us) {
+        int64_t t0 = esp_timer_get_time();
+        bool ok = w->op();
+        int64_t dt = esp_timer_get_time() - t0;
+
+        if (ok) {
+            w->ops++;
+        } else {
+            w->failures++;
+        }
+        w->max_us = MAX(w->max_us, dt);
+        vTaskDelay(1);
+    }
+
+    xSemaphoreGive(done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Remove the scratch data
+ */
+static void cleanup(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_all(nvs);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    remove(FAT_PATH);
+}
+
+/**
+ * @brief Run the stress test
+ *
+ * @param[in] seconds Duration
+ * @return true if no frame was dropped or missing
+ */
+static bool run(int seconds)
+{
+    adc_stats_t before, after;
+    int running = 0;
+
+    frames = 0;
+    last_ts = 0;
+    max_gap_us = 0;
+    adc_get_stats(&before);
+
+    int64_t start_us = esp_timer_get_time();
+    deadline_us = start_us + (int64_t)seconds * 1000000;
+    active = true;
+
+    for (size_t i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+        stress_writer_t *w = &writers[i];
+        w->ops = w->failures = 0;
+        w->max_us = 0;
+        if (w->enabled
+            && xTaskCreate(task_writer, "stress", 3072, w, tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+            running++;
+        }
+    }
+
+    for (int i = 0; i < running; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+
+    active = false;
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    adc_get_stats(&after);
+    cleanup();
+
+    uint32_t dropped = after.pool_overflow - before.pool_overflow;
+    uint64_t expected = (uint64_t)elapsed_us * ADC_SAMPLE_FREQ_HZ / SAMPLES_PER_FRAME / 1000000;
+    uint64_t tolerance = MISSING_FRAMES + expected * MISSING_PERCENT / 100;
+    uint64_t missing = expected > frames ? expected - frames : 0;
+    bool pass = dropped == 0 && missing <= tolerance;
+
+    printf("-- Flash Stress Test --\n");
+    for (size_t i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+        const stress_writer_t *w = &writers[i];
+        if (w->enabled) {
+            printf("  %s: %"PRIu32" ops, %"PRIu32" failed, max %"PRId64" ms\n",
+                   w->name, w->ops, w->failures, w->max_us / 1000);
+        }
+    }
+    printf("  Frames: %"PRIu32" (expected ~%"PRIu64", %"PRIu64" missing, %"PRIu64" allowed)\n",
+           frames, expected, missing, tolerance);
+    printf("  Longest frame gap: %"PRId64" ms\n", max_gap_us / 1000);
+    printf("  Read errors: %"PRIu32", timeouts: %"PRIu32"\n",
+           after.read_errors - before.read_errors, after.timeout - before.timeout);
+    printf("  Dropped frames: %"PRIu32"\n", dropped);
+    printf("  Dropped samples: %"PRIu32"\n", dropped * SAMPLES_PER_FRAME);
+    printf("  Result: %s\n", pass ? "PASS" : "FAIL");
+
+    return pass;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t stress_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    done = xSemaphoreCreateCounting(sizeof(writers) / sizeof(writers[0]), 0);
+    if (done == NULL) {
+        ESP_LOGE(TAG, "Failed to create semaphore");
+        return pdFAIL;
+    }
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+    return pdPASS;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *time;
+    struct arg_lit *nvs;
+    struct arg_lit *fat;
+    struct arg_lit *cal;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Flash write stress test\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Stress command handler
+ */
+static int cmd_stress(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    int seconds = args.time->count > 0 ? args.time->ival[0] : DEFAULT_SECONDS;
+    if (seconds <= 0 || seconds > MAX_SECONDS) {
+        printf("Invalid duration %d (1-%d s)\n", seconds, MAX_SECONDS);
+        return 1;
+    }
+
+    /* No selection runs all writers */
+    bool all = args.nvs->count == 0 && args.fat->count == 0 && args.cal->count == 0;
+    writers[0].enabled = all || args.nvs->count > 0;
+    writers[1].enabled = (all || args.fat->count > 0) && con_data_mounted();
+    writers[2].enabled = all || args.cal->count > 0;
+
+    if (args.fat->count > 0 && !con_data_mounted()) {
+        printf("/data is not mounted, skipping FATFS writes\n");
+    }
+
+    printf("Stressing flash for %d s...\n", seconds);
+    return run(seconds) ? 0 : 1;
+}
+
+/**
+ * @brief Register stress commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.time = arg_int0("t", "time", "<s>", "Duration in seconds");
+    args.nvs = arg_litn("n", "nvs", 0, 1, "NVS commits");
+    args.fat = arg_litn("f", "fat", 0, 1, "FATFS writes");
+    args.cal = arg_litn("c", "cal", 0, 1, "Calibration saves");
+    args.end = arg_end(5);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "stress",
+        .func = cmd_stress,
+        .help = "Measure dropped ADC samples during flash writes\n"
+                "Examples:\n"
+                "  stress              All writers for 10 s\n"
+                "  stress -t 60 -n     NVS commits only, 60 s\n"
+                "  stress -c           Calibration saves only\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
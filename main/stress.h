@@ -0,0 +1,27 @@
+/**
+ * @file stress.h
+ * @brief Flash write stress test for the acquisition path
+ *
+ * The `stress` console command writes NVS, FATFS and calibration data
+ * for a given time and reports ADC frames dropped meanwhile. It prints
+ * "Result: PASS" when the driver pool never overflowed and the frames
+ * received fall short of the sample rate by at most 2 frames plus 2 %,
+ * and returns non-zero otherwise, so it can be scripted on the device and
+ * in QEMU alike.
+ */
+
+#ifndef STRESS_H
+#define STRESS_H
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Register the stress command
+ *
+ * Must be called after adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t stress_init(void);
+
+#endif /* STRESS_H */
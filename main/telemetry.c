@@ -0,0 +1,729 @@
+/**
+ * @file telemetry.c
+ * @brief UDP telemetry publisher for processed ADC frames
+ *
+ * The ADC task hands every processed frame to a listener which queues it
+ * (without blocking) for the sender task. The sender task packs records
+ * into a datagram buffer and sends it once the next record would not fit
+ * into the payload limit or the flush interval expires, so the lwIP
+ * per-packet cost is paid once per batch, not once per frame.
+ *
+ * Datagrams that cannot be sent are kept in a store-and-forward queue
+ * and sent ahead of new ones once the link is back, so a Wi-Fi outage
+ * shows up at the receiver as late data rather than a sequence gap.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include "util.h"
+#include "adc.h"
+#include "sfq.h"
+#include "telemetry.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define PAYLOAD_MAX     CONFIG_TELEMETRY_MAX_PAYLOAD
+#define QUEUE_LEN       CONFIG_TELEMETRY_QUEUE_LEN
+#define FLUSH_MS        CONFIG_TELEMETRY_FLUSH_MS
+#define DRAIN_BURST     CONFIG_TELEMETRY_DRAIN_BURST
+#define HOST_MAX_LEN    64
+#define SAMPLE_MASK     0x0fff
+/* Snapshots are taken from whole frames, at most one per frame */
+#define RATE_MAX        ADC_FRAME_RATE_HZ
+
+/* Largest record: a sample block with every channel full */
+#define RECORD_MAX      (sizeof(int64_t) + sizeof(uint32_t) + ADC_TOTAL_CHANNELS * sizeof(uint16_t) \
+                         + ADC_TOTAL_CHANNELS * ((ADC_FRAME_MAX_SAMPLES + 1) / 2 * 3))
+
+/* Only the filtered samples are sent; the unfiltered copy at the end of
+   the frame stays out of the queue */
+#define QUEUE_ITEM      offsetof(adc_frame_t, unfiltered)
+
+_Static_assert(sizeof(telemetry_hdr_t) + RECORD_MAX <= PAYLOAD_MAX,
+               "A full sample block does not fit TELEMETRY_MAX_PAYLOAD, raise it "
+               "or lower ADC_READ_BUFFER_SIZE / ADC_VIRT_CHANNELS");
+_Static_assert(CONFIG_TELEMETRY_DEFAULT_RATE_HZ <= RATE_MAX,
+               "TELEMETRY_DEFAULT_RATE_HZ exceeds the ADC frame rate");
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "telemetry"
+#define NVS_KEY_HOST    "host"
+#define NVS_KEY_PORT    "port"
+#define NVS_KEY_RATE    "rate"
+#define NVS_KEY_MODE    "mode"
+#define NVS_KEY_ENABLE  "en"
+
+/**
+ * @brief Telemetry configuration
+ */
+typedef struct {
+    char host[HOST_MAX_LEN];    /**< Destination host name or address */
+    uint16_t port;              /**< Destination UDP port */
+    uint16_t rate_hz;           /**< Snapshot rate */
+    uint8_t mode;               /**< telemetry_mode_t */
+    uint8_t enabled;            /**< Publisher enabled */
+} telemetry_cfg_t;
+
+/* Module static variables */
+static const char *TAG = "telemetry";
+static TaskHandle_t task_handle = NULL;
+static QueueHandle_t frame_queue = NULL;
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static telemetry_cfg_t cfg = {
+    .host = "",
+    .port = CONFIG_TELEMETRY_DEFAULT_PORT,
+    .rate_hz = CONFIG_TELEMETRY_DEFAULT_RATE_HZ,
+    .mode = TELEMETRY_MODE_SNAPSHOT,
+    .enabled = 0,
+};
+static uint32_t cfg_gen;            /* Incremented on every configuration change */
+static int64_t next_snapshot_us;    /* Used by the listener only */
+static telemetry_stats_t stats;
+
+/* Sender task state */
+static adc_frame_t rx_frame;
+static uint8_t dgram[PAYLOAD_MAX];
+static size_t dgram_len;
+static uint8_t dgram_records;
+static uint8_t dgram_type;
+static uint32_t dgram_seq;
+
+/* Datagrams waiting for the link */
+static sfq_t *backlog = NULL;
+static uint8_t resend[PAYLOAD_MAX];
+static TickType_t retry_at;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/**
+ * @brief Take a consistent copy of the configuration
+ *
+ * @param[out] out Pointer to store the configuration
+ * @return Configuration generation
+ */
+static uint32_t cfg_copy(telemetry_cfg_t *out)
+{
+    taskENTER_CRITICAL(&cfg_lock);
+    *out = cfg;
+    uint32_t gen = cfg_gen;
+    taskEXIT_CRITICAL(&cfg_lock);
+    return gen;
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    if (!cfg.enabled) {
+        return;
+    }
+
+    if (cfg.mode == TELEMETRY_MODE_SNAPSHOT) {
+        if (f->timestamp_us < next_snapshot_us) {
+            return;
+        }
+        int64_t period_us = 1000000LL / MAX(cfg.rate_hz, 1);
+        next_snapshot_us = MAX(next_snapshot_us + period_us, f->timestamp_us);
+    }
+
+    if (xQueueSend(frame_queue, f, 0) != pdTRUE) {
+        stats.dropped++;
+    }
+}
+
+/**
+ * @brief Size of a record built from a frame
+ *
+ * @param[in] f Frame
+ * @param[in] mode Payload type
+ * @return Record size in bytes
+ */
+static size_t record_size(const adc_frame_t *f, uint8_t mode)
+{
+    if (mode == TELEMETRY_MODE_SNAPSHOT) {
+        return sizeof(int64_t) + 2 * ADC_TOTAL_CHANNELS * sizeof(uint16_t);
+    }
+
+    size_t size = sizeof(int64_t) + sizeof(uint32_t) + ADC_TOTAL_CHANNELS * sizeof(uint16_t);
+    for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        size += (f->count[ch] + 1) / 2 * 3;
+    }
+    return size;
+}
+
+/**
+ * @brief Append a little-endian value to the datagram
+ */
+static inline void put_le(uint64_t v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        dgram[dgram_len++] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+/**
+ * @brief Pack samples as 12-bit pairs
+ *
+ * @param[in] s Samples
+ * @param[in] n Number of samples
+ */
+static void put_packed(const uint16_t *s, uint16_t n)
+{
+    for (uint16_t i = 0; i < n; i += 2) {
+        uint16_t a = s[i] & SAMPLE_MASK;
+        uint16_t b = (i + 1 < n) ? (s[i + 1] & SAMPLE_MASK) : 0;
+        dgram[dgram_len++] = a & 0xff;
+        dgram[dgram_len++] = (a >> 8) | ((b & 0x0f) << 4);
+        dgram[dgram_len++] = b >> 4;
+    }
+}
+
+/**
+ * @brief Start a new datagram
+ *
+ * @param[in] mode Payload type of the records
+ */
+static void dgram_begin(uint8_t mode)
+{
+    dgram_len = sizeof(telemetry_hdr_t);
+    dgram_records = 0;
+    dgram_type = mode;
+}
+
+/**
+ * @brief Send one complete datagram
+ *
+ * @param[in] sock UDP socket
+ * @param[in] dest Destination address
+ * @param[in] buf Datagram
+ * @param[in] len Datagram length
+ * @return true if sent
+ */
+static bool dgram_send(int sock, const struct sockaddr_in *dest, const uint8_t *buf, size_t len)
+{
+    if (sock >= 0 && sendto(sock, buf, len, 0,
+                            (const struct sockaddr *)dest, sizeof(*dest)) == (ssize_t)len) {
+        stats.datagrams++;
+        stats.records += ((const telemetry_hdr_t *)buf)->records;
+        return true;
+    }
+
+    stats.send_errors++;
+    return false;
+}
+
+/**
+ * @brief Send buffered datagrams, oldest first
+ *
+ * After a failed send the backlog is left alone for one flush interval,
+ * so a dead link costs one sendto() per interval.
+ *
+ * @param[in] sock UDP socket
+ * @param[in] dest Destination address
+ */
+static void backlog_drain(int sock, const struct sockaddr_in *dest)
+{
+    if ((int32_t)(xTaskGetTickCount() - retry_at) < 0) {
+        return;
+    }
+
+    size_t len;
+    for (int i = 0; i < DRAIN_BURST; i++) {
+        esp_err_t err = sfq_peek(backlog, resend, sizeof(resend), &len);
+        if (err == ESP_ERR_NOT_FOUND) {
+            return;
+        }
+        if (err != ESP_OK) {
+            sfq_pop(backlog);           /* Unreadable, skip it */
+            continue;
+        }
+        if (!dgram_send(sock, dest, resend, len)) {
+            retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(FLUSH_MS);
+            return;
+        }
+        sfq_pop(backlog);
+    }
+}
+
+/**
+ * @brief Send the pending datagram, if any
+ *
+ * @param[in] sock UDP socket
+ * @param[in] dest Destination address
+ */
+static void dgram_flush(int sock, const struct sockaddr_in *dest)
+{
+    if (dgram_records == 0) {
+        return;
+    }
+
+    telemetry_hdr_t hdr = {
+        .magic = TELEMETRY_MAGIC,
+        .version = TELEMETRY_VERSION,
+        .type = dgram_type,
+        .channels = ADC_TOTAL_CHANNELS,
+        .records = dgram_records,
+        .seq = dgram_seq++,
+        .dropped = stats.dropped,
+    };
+    memcpy(dgram, &hdr, sizeof(hdr));
+
+    /* Never overtake buffered datagrams */
+    if (sfq_depth(backlog) == 0) {
+        if (dgram_send(sock, dest, dgram, dgram_len)) {
+            dgram_begin(dgram_type);
+            return;
+        }
+        retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(FLUSH_MS);
+    }
+
+    sfq_push(backlog, dgram, dgram_len);
+    dgram_begin(dgram_type);
+}
+
+/**
+ * @brief Append a frame as one record
+ *
+ * @param[in] f Frame
+ * @param[in] mode Payload type
+ */
+static void dgram_append(const adc_frame_t *f, uint8_t mode)
+{
+    if (mode == TELEMETRY_MODE_SNAPSHOT) {
+        put_le(f->timestamp_us, sizeof(int64_t));
+        for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            /* Virtual channels have no raw value, repeat the processed one */
+            uint16_t n = f->count[ch];
+            put_le(ch < ADC_MAX_CHANNELS ? f->raw[ch] : n ? f->samples[ch][n - 1] : 0,
+                   sizeof(uint16_t));
+        }
+        for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            uint16_t n = f->count[ch];
+            put_le(n ? f->samples[ch][n - 1] : 0, sizeof(uint16_t));
+        }
+    } else {
+        put_le(f->timestamp_us, sizeof(int64_t));
+        put_le(f->seq, sizeof(uint32_t));
+        for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            put_le(f->count[ch], sizeof(uint16_t));
+        }
+        for (int ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            put_packed(f->samples[ch], f->count[ch]);
+        }
+    }
+    dgram_records++;
+}
+
+/**
+ * @brief Resolve the destination of a configuration
+ *
+ * @param[in] c Configuration
+ * @param[out] dest Resolved address
+ * @return true if the destination is usable
+ */
+static bool resolve_dest(const telemetry_cfg_t *c, struct sockaddr_in *dest)
+{
+    if (c->host[0] == '\0' || c->port == 0) {
+        return false;
+    }
+
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(c->host, NULL, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGW(TAG, "Cannot resolve '%s'", c->host);
+        return false;
+    }
+
+    memcpy(dest, res->ai_addr, sizeof(*dest));
+    dest->sin_port = htons(c->port);
+    freeaddrinfo(res);
+    return true;
+}
+
+/**
+ * @brief Telemetry sender task
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_telemetry(void *p)
+{
+    telemetry_cfg_t local;
+    struct sockaddr_in dest = { 0 };
+    uint32_t gen = cfg_gen - 1;
+    bool dest_ok = false;
+    TickType_t batch_start = 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+    }
+
+    dgram_begin(TELEMETRY_MODE_SNAPSHOT);
+
+    for (;;) {
+        /* Poll quickly while a backlog is draining */
+        TickType_t wait = pdMS_TO_TICKS(FLUSH_MS);
+        if (sfq_depth(backlog) > 0 && (int32_t)(xTaskGetTickCount() - retry_at) >= 0) {
+            wait = 1;
+        }
+        BaseType_t got = xQueueReceive(frame_queue, &rx_frame, wait);
+
+        if (cfg_copy(&local) != gen) {
+            /* Configuration changed, drop the half-built batch */
+            gen = cfg_gen;
+            dest_ok = resolve_dest(&local, &dest);
+            dgram_begin(local.mode);
+        }
+
+        if (!dest_ok || !local.enabled) {
+            dgram_begin(local.mode);
+            continue;
+        }
+
+        if (got == pdTRUE) {
+            size_t size = record_size(&rx_frame, local.mode);
+            if (sizeof(telemetry_hdr_t) + size > PAYLOAD_MAX) {
+                /* Would not fit even an empty datagram */
+                stats.oversized++;
+            } else {
+                if (dgram_len + size > PAYLOAD_MAX || dgram_records == UINT8_MAX) {
+                    dgram_flush(sock, &dest);
+                }
+                if (dgram_records == 0) {
+                    batch_start = xTaskGetTickCount();
+                }
+                dgram_append(&rx_frame, local.mode);
+            }
+        }
+
+        if (dgram_records > 0
+            && xTaskGetTickCount() - batch_start >= pdMS_TO_TICKS(FLUSH_MS)) {
+            dgram_flush(sock, &dest);
+        }
+
+        backlog_drain(sock, &dest);
+    }
+}
+
+/**
+ * @brief Write the configuration to NVS (flash service task)
+ *
+ * @param[in] ctx Unused, the current configuration is written
+ * @return ESP_OK on success
+ */
+static esp_err_t write_config(void *ctx)
+{
+    telemetry_cfg_t c;
+    cfg_copy(&c);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_set_str(nvs, NVS_KEY_HOST, c.host);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u16(nvs, NVS_KEY_PORT, c.port);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u16(nvs, NVS_KEY_RATE, c.rate_hz);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u8(nvs, NVS_KEY_MODE, c.mode);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_set_u8(nvs, NVS_KEY_ENABLE, c.enabled);
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Save the configuration to NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t save_config(void)
+{
+    return flash_svc_run("nvs:" NVS_NAMESPACE, write_config, NULL, 0);
+}
+
+/**
+ * @brief Load the configuration from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t len = sizeof(cfg.host);
+    uint16_t u16;
+    uint8_t u8;
+
+    if (nvs_get_str(nvs, NVS_KEY_HOST, cfg.host, &len) != ESP_OK) {
+        cfg.host[0] = '\0';
+    }
+    if (nvs_get_u16(nvs, NVS_KEY_PORT, &u16) == ESP_OK) {
+        cfg.port = u16;
+    }
+    if (nvs_get_u16(nvs, NVS_KEY_RATE, &u16) == ESP_OK && u16 > 0) {
+        cfg.rate_hz = MIN(u16, RATE_MAX);
+    }
+    if (nvs_get_u8(nvs, NVS_KEY_MODE, &u8) == ESP_OK
+        && (u8 == TELEMETRY_MODE_SNAPSHOT || u8 == TELEMETRY_MODE_BLOCK)) {
+        cfg.mode = u8;
+    }
+    if (nvs_get_u8(nvs, NVS_KEY_ENABLE, &u8) == ESP_OK) {
+        cfg.enabled = u8 ? 1 : 0;
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t telemetry_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    frame_queue = xQueueCreate(QUEUE_LEN, QUEUE_ITEM);
+    if (frame_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create frame queue");
+        return pdFAIL;
+    }
+
+    backlog = sfq_create("tlm", CONFIG_SFQ_RAM_SIZE);
+    if (backlog == NULL) {
+        ESP_LOGE(TAG, "Failed to create backlog queue");
+        return pdFAIL;
+    }
+
+    load_config();
+    ESP_LOGI(TAG, "%s:%u, %s, %u Hz, %s", cfg.host, cfg.port,
+             cfg.mode == TELEMETRY_MODE_BLOCK ? "block" : "snapshot",
+             cfg.rate_hz, cfg.enabled ? "enabled" : "disabled");
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+
+    return xTaskCreate(task_telemetry, "telemetry", 4096, NULL,
+                       uxTaskPriorityGet(NULL), &task_handle);
+}
+
+esp_err_t telemetry_get_stats(telemetry_stats_t *out)
+{
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out = stats;
+    return sfq_get_stats(backlog, &out->backlog);
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_str *host;
+    struct arg_int *port;
+    struct arg_int *rate;
+    struct arg_str *mode;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_lit *status;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("UDP telemetry control\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print configuration and statistics
+ */
+static void print_status(void)
+{
+    telemetry_cfg_t c;
+    cfg_copy(&c);
+
+    printf("-- Telemetry --\n");
+    printf("  State: %s\n", c.enabled ? "enabled" : "disabled");
+    printf("  Destination: %s:%u\n", c.host[0] ? c.host : "<none>", c.port);
+    printf("  Mode: %s\n", c.mode == TELEMETRY_MODE_BLOCK ? "block" : "snapshot");
+    printf("  Snapshot rate: %u Hz\n", c.rate_hz);
+    printf("  Datagrams: %"PRIu32"\n", stats.datagrams);
+    printf("  Records: %"PRIu32"\n", stats.records);
+    printf("  Dropped frames: %"PRIu32"\n", stats.dropped);
+    printf("  Send errors: %"PRIu32"\n", stats.send_errors);
+    printf("  Oversized records: %"PRIu32"\n", stats.oversized);
+
+    sfq_stats_t b;
+    if (sfq_get_stats(backlog, &b) == ESP_OK) {
+        printf("  Backlog: %"PRIu32" datagrams (peak %"PRIu32", %"PRIu32" bytes spilled)\n",
+               b.depth, b.peak_depth, b.spill_bytes);
+        printf("  Buffered: %"PRIu32", spilled %"PRIu32", lost %"PRIu32"\n",
+               b.pushed, b.spilled, b.dropped);
+        printf("  Drains: %"PRIu32" (last %"PRId64" ms, max %"PRId64" ms)\n",
+               b.drains, b.last_drain_us / 1000, b.max_drain_us / 1000);
+    }
+}
+
+/**
+ * @brief Telemetry command handler
+ */
+static int cmd_telemetry(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    telemetry_cfg_t c;
+    cfg_copy(&c);
+    bool changed = false;
+
+    if (args.host->count > 0) {
+        strlcpy(c.host, args.host->sval[0], sizeof(c.host));
+        changed = true;
+    }
+
+    if (args.port->count > 0) {
+        if (args.port->ival[0] <= 0 || args.port->ival[0] > UINT16_MAX) {
+            printf("Invalid port %d\n", args.port->ival[0]);
+            return 1;
+        }
+        c.port = args.port->ival[0];
+        changed = true;
+    }
+
+    if (args.rate->count > 0) {
+        if (args.rate->ival[0] <= 0 || args.rate->ival[0] > RATE_MAX) {
+            printf("Invalid rate %d (1-%d Hz, one snapshot per frame at most)\n",
+                   args.rate->ival[0], RATE_MAX);
+            return 1;
+        }
+        c.rate_hz = args.rate->ival[0];
+        changed = true;
+    }
+
+    if (args.mode->count > 0) {
+        if (strcmp(args.mode->sval[0], "snapshot") == 0) {
+            c.mode = TELEMETRY_MODE_SNAPSHOT;
+        } else if (strcmp(args.mode->sval[0], "block") == 0) {
+            c.mode = TELEMETRY_MODE_BLOCK;
+        } else {
+            printf("Invalid mode '%s'\n", args.mode->sval[0]);
+            return 1;
+        }
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (changed) {
+        taskENTER_CRITICAL(&cfg_lock);
+        cfg = c;
+        cfg_gen++;
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        esp_err_t err = save_config();
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    }
+
+    if (args.status->count > 0 || !changed) {
+        print_status();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register telemetry commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.host = arg_str0("H", "host", "<host>", "Destination host");
+    args.port = arg_int0("p", "port", "<port>", "Destination UDP port");
+    args.rate = arg_int0("r", "rate", "<hz>", "Snapshot rate");
+    args.mode = arg_str0("m", "mode", "<snapshot|block>", "Payload type");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable publishing");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable publishing");
+    args.status = arg_litn("s", "status", 0, 1, "Show telemetry status");
+    args.end = arg_end(8);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "telemetry",
+        .func = cmd_telemetry,
+        .help = "UDP telemetry control\n"
+                "Examples:\n"
+                "  telemetry -s                        Show status\n"
+                "  telemetry -H 192.168.1.10 -p 5005   Set destination\n"
+                "  telemetry -m block -E               Stream every sample\n"
+                "  telemetry -m snapshot -r 50 -E      Send 50 snapshots/s\n"
+                "  telemetry -D                        Stop publishing\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,94 @@
+/**
+ * @file telemetry.h
+ * @brief UDP telemetry publisher for processed ADC frames
+ *
+ * Batches processed frames into UDP datagrams sized to fit the MTU and
+ * sends them to a configurable destination. Two payload types exist:
+ * periodic snapshots of the latest values and full-rate sample blocks
+ * with 12-bit packed samples. Destination, rate and mode are set through
+ * the `telemetry` console command and stored in NVS.
+ *
+ * Datagrams that cannot be sent are buffered (RAM, then /data) and sent
+ * in order once the link is back; receivers see them late, not missing.
+ *
+ * Datagram layout (little-endian):
+ * @code
+ *   telemetry_hdr_t  header
+ *   record[records]  snapshot or block records, see below
+ *
+ *   snapshot record: int64 timestamp_us, uint16 raw[channels], uint16 norm[channels]
+ *   block record:    int64 timestamp_us, uint32 frame_seq, uint16 count[channels],
+ *                    then per channel count samples packed as 12-bit pairs
+ *                    (3 bytes per 2 samples, odd count padded to a full pair)
+ * @endcode
+ *
+ * Channels are the physical ones followed by the virtual channels
+ * (vchan.h); a virtual channel repeats its processed value as raw.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sfq.h"
+
+#define TELEMETRY_MAGIC     0x54434441  /* "ADCT" */
+#define TELEMETRY_VERSION   1
+
+/**
+ * @brief Telemetry payload type
+ */
+typedef enum {
+    TELEMETRY_MODE_SNAPSHOT = 1,    /**< Latest raw/normalized values at a fixed rate */
+    TELEMETRY_MODE_BLOCK = 2,       /**< Every normalized sample, 12-bit packed */
+} telemetry_mode_t;
+
+/**
+ * @brief Datagram header
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;         /**< TELEMETRY_MAGIC */
+    uint8_t version;        /**< TELEMETRY_VERSION */
+    uint8_t type;           /**< telemetry_mode_t of the records */
+    uint8_t channels;       /**< Number of channels in every record */
+    uint8_t records;        /**< Number of records in the datagram */
+    uint32_t seq;           /**< Datagram sequence number */
+    uint32_t dropped;       /**< Frames dropped on the device so far */
+} telemetry_hdr_t;
+
+/**
+ * @brief Telemetry statistics
+ */
+typedef struct {
+    uint32_t datagrams;     /**< Datagrams sent */
+    uint32_t records;       /**< Records sent */
+    uint32_t dropped;       /**< Frames dropped because the queue was full */
+    uint32_t send_errors;   /**< Failed sendto() calls */
+    uint32_t oversized;     /**< Records dropped because they exceed a datagram */
+    sfq_stats_t backlog;    /**< Datagrams buffered while the link was down */
+} telemetry_stats_t;
+
+/**
+ * @brief Initialize the telemetry publisher
+ *
+ * Loads the configuration from NVS, hooks into the ADC frame stream,
+ * creates the sender task and registers the `telemetry` command.
+ * Must be called after adc_init() and after the network stack is up.
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t telemetry_init(void);
+
+/**
+ * @brief Get telemetry statistics
+ *
+ * @param[out] stats Pointer to store the statistics
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if stats is NULL
+ * @note This function is NULL-safe
+ */
+esp_err_t telemetry_get_stats(telemetry_stats_t *stats);
+
+#endif /* TELEMETRY_H */
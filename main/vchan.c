@@ -0,0 +1,736 @@
+/**
+ * @file vchan.c
+ * @brief Virtual channels derived from expressions over physical channels
+ *
+ * A recursive-descent parser turns an expression into postfix bytecode
+ * for a small stack machine. Evaluation is done per frame and per
+ * operation: every stack slot is a vector holding one value per sample,
+ * so the dispatch cost is paid once per operation instead of once per
+ * sample. The ADC task works on a private copy of the program table that
+ * is refreshed only when a definition changes.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "vchan.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define PROG_MAX        32      /* Instructions per program */
+#define CONST_MAX       8       /* Constants per program */
+#define STACK_MAX       6       /* Evaluation stack depth */
+#define NEST_MAX        12      /* Nested parentheses, signs and calls */
+#define VALUE_MAX       ((1 << 12) - 1) /* Range of normalized samples */
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "vchan"
+#define NVS_KEY_FMT     "v%u"
+
+/**
+ * @brief Stack machine operations
+ */
+typedef enum {
+    OP_CH = 0,      /**< Push physical channel arg */
+    OP_VIRT,        /**< Push virtual channel arg */
+    OP_CONST,       /**< Push constant arg */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,         /**< Division by zero gives 0 */
+    OP_NEG,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+} op_t;
+
+/**
+ * @brief One instruction
+ */
+typedef struct {
+    uint8_t op;         /**< op_t */
+    uint8_t arg;        /**< Channel or constant index */
+} insn_t;
+
+/**
+ * @brief Compiled expression
+ */
+typedef struct {
+    uint8_t len;                /**< Instructions, 0 if undefined */
+    uint8_t nk;                 /**< Constants */
+    uint16_t refs;              /**< Referenced channels, bit per frame channel */
+    insn_t code[PROG_MAX];
+    float k[CONST_MAX];
+} prog_t;
+
+/**
+ * @brief Parser state
+ */
+typedef struct {
+    const char *p;              /**< Next character */
+    uint8_t self;               /**< Virtual channel being defined */
+    uint8_t depth;              /**< Stack depth after the emitted code */
+    uint8_t nest;               /**< Parser recursion depth */
+    const char *err;            /**< First error, NULL if none */
+    prog_t *prog;
+} parser_t;
+
+static const char *TAG = "vchan";
+
+/* Definitions, guarded by cfg_lock */
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static char exprs[ADC_VIRT_CHANNELS][VCHAN_EXPR_MAX];
+static prog_t progs[ADC_VIRT_CHANNELS];
+static uint32_t cfg_gen;
+
+/* ADC task copy of the programs and evaluation stack */
+static prog_t run_progs[ADC_VIRT_CHANNELS];
+static uint32_t run_gen;
+static float stack[STACK_MAX][ADC_FRAME_MAX_SAMPLES];
+
+static void register_cmd(void);
+
+/**
+ * @brief Compiler implementation
+ */
+
+static void parse_expr(parser_t *ps);
+
+/**
+ * @brief Record an error, keeping the first one
+ */
+static void fail(parser_t *ps, const char *err)
+{
+    if (ps->err == NULL) {
+        ps->err = err;
+    }
+}
+
+static void skip_ws(parser_t *ps)
+{
+    while (isspace((unsigned char)*ps->p)) {
+        ps->p++;
+    }
+}
+
+/**
+ * @brief Consume a character if it comes next
+ */
+static bool accept(parser_t *ps, char c)
+{
+    skip_ws(ps);
+    if (*ps->p == c) {
+        ps->p++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Append an instruction and track the stack depth
+ *
+ * @param[in] delta Stack depth change of the instruction
+ */
+static void emit(parser_t *ps, op_t op, uint8_t arg, int delta)
+{
+    prog_t *pr = ps->prog;
+
+    if (pr->len >= PROG_MAX) {
+        fail(ps, "expression too long");
+        return;
+    }
+    pr->code[pr->len++] = (insn_t){ .op = op, .arg = arg };
+    ps->depth += delta;
+    if (ps->depth > STACK_MAX) {
+        fail(ps, "expression nested too deeply");
+    }
+}
+
+/**
+ * @brief Parse an identifier: a channel reference or a function call
+ */
+static void parse_name(parser_t *ps)
+{
+    char name[8];
+    size_t n = 0;
+
+    while (isalnum((unsigned char)*ps->p) && n < sizeof(name) - 1) {
+        name[n++] = tolower((unsigned char)*ps->p++);
+    }
+    name[n] = '\0';
+
+    if ((strncmp(name, "ch", 2) == 0 && isdigit((unsigned char)name[2]))
+        || (name[0] == 'v' && isdigit((unsigned char)name[1]))) {
+        bool virt = name[0] == 'v';
+        char *end;
+        long ch = strtol(name + (virt ? 1 : 2), &end, 10);
+        if (*end != '\0') {
+            fail(ps, "invalid channel");
+        } else if (!virt && ch >= ADC_MAX_CHANNELS) {
+            fail(ps, "no such physical channel");
+        } else if (virt && ch >= ps->self) {
+            fail(ps, "only earlier virtual channels can be used");
+        } else {
+            ps->prog->refs |= 1u << (virt ? ADC_MAX_CHANNELS + ch : ch);
+            emit(ps, virt ? OP_VIRT : OP_CH, ch, 1);
+        }
+        return;
+    }
+
+    op_t op;
+    int nargs;
+    if (strcmp(name, "abs") == 0) {
+        op = OP_ABS;
+        nargs = 1;
+    } else if (strcmp(name, "min") == 0) {
+        op = OP_MIN;
+        nargs = 2;
+    } else if (strcmp(name, "max") == 0) {
+        op = OP_MAX;
+        nargs = 2;
+    } else {
+        fail(ps, "unknown name");
+        return;
+    }
+
+    if (!accept(ps, '(')) {
+        fail(ps, "expected '('");
+        return;
+    }
+    parse_expr(ps);
+    if (nargs == 2) {
+        if (!accept(ps, ',')) {
+            fail(ps, "expected ','");
+            return;
+        }
+        parse_expr(ps);
+    }
+    if (!accept(ps, ')')) {
+        fail(ps, "expected ')'");
+        return;
+    }
+    emit(ps, op, 0, 1 - nargs);
+}
+
+/**
+ * @brief primary := number | name | '(' expr ')' | '-' primary
+ */
+static void parse_primary(parser_t *ps)
+{
+    skip_ws(ps);
+
+    if (ps->err != NULL) {
+        return;
+    }
+    if (++ps->nest > NEST_MAX) {
+        fail(ps, "expression nested too deeply");
+        return;
+    }
+
+    if (accept(ps, '-')) {
+        parse_primary(ps);
+        emit(ps, OP_NEG, 0, 0);
+    } else if (accept(ps, '(')) {
+        parse_expr(ps);
+        if (!accept(ps, ')')) {
+            fail(ps, "expected ')'");
+        }
+    } else if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+        char *end;
+        float k = strtof(ps->p, &end);
+        ps->p = end;
+        if (ps->prog->nk >= CONST_MAX) {
+            fail(ps, "too many constants");
+            return;
+        }
+        ps->prog->k[ps->prog->nk] = k;
+        emit(ps, OP_CONST, ps->prog->nk++, 1);
+    } else if (isalpha((unsigned char)*ps->p)) {
+        parse_name(ps);
+    } else {
+        fail(ps, *ps->p ? "unexpected character" : "unexpected end");
+    }
+    ps->nest--;
+}
+
+/**
+ * @brief term := primary (('*' | '/') primary)*
+ */
+static void parse_term(parser_t *ps)
+{
+    parse_primary(ps);
+    while (ps->err == NULL) {
+        if (accept(ps, '*')) {
+            parse_primary(ps);
+            emit(ps, OP_MUL, 0, -1);
+        } else if (accept(ps, '/')) {
+            parse_primary(ps);
+            emit(ps, OP_DIV, 0, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief expr := term (('+' | '-') term)*
+ */
+static void parse_expr(parser_t *ps)
+{
+    parse_term(ps);
+    while (ps->err == NULL) {
+        if (accept(ps, '+')) {
+            parse_term(ps);
+            emit(ps, OP_ADD, 0, -1);
+        } else if (accept(ps, '-')) {
+            parse_term(ps);
+            emit(ps, OP_SUB, 0, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Compile an expression
+ *
+ * @param[in] expr Expression text
+ * @param[in] index Virtual channel the expression defines
+ * @param[out] prog Compiled program
+ * @return NULL on success, error description otherwise
+ */
+static const char *compile(const char *expr, uint8_t index, prog_t *prog)
+{
+    parser_t ps = { .p = expr, .self = index, .prog = prog };
+
+    memset(prog, 0, sizeof(*prog));
+    parse_expr(&ps);
+    skip_ws(&ps);
+    if (ps.err == NULL && *ps.p != '\0') {
+        fail(&ps, "unexpected character");
+    }
+    if (ps.err != NULL) {
+        memset(prog, 0, sizeof(*prog));
+    }
+    return ps.err;
+}
+
+/**
+ * @brief Evaluator implementation
+ */
+
+/**
+ * @brief Run one program over n samples
+ *
+ * @param[in] pr Program
+ * @param[in] frame Frame holding the operands
+ * @param[in] n Number of samples
+ * @param[out] out Results
+ */
+static void run(const prog_t *pr, const adc_frame_t *frame, uint16_t n, uint16_t *out)
+{
+    int sp = -1;
+
+    for (uint8_t pc = 0; pc < pr->len; pc++) {
+        const insn_t in = pr->code[pc];
+
+        if (in.op == OP_CH || in.op == OP_VIRT) {
+            const uint16_t *src =
+                frame->samples[in.op == OP_CH ? in.arg : ADC_MAX_CHANNELS + in.arg];
+            float *dst = stack[++sp];
+            for (uint16_t i = 0; i < n; i++) dst[i] = src[i];
+            continue;
+        }
+
+        if (in.op == OP_CONST) {
+            const float k = pr->k[in.arg];
+            float *dst = stack[++sp];
+            for (uint16_t i = 0; i < n; i++) dst[i] = k;
+            continue;
+        }
+
+        /* Unary operations work on the top, binary ones pop it into the next */
+        float *x = stack[in.op == OP_NEG || in.op == OP_ABS ? sp : sp - 1];
+        const float *y = stack[sp];
+
+        switch (in.op) {
+        case OP_NEG:
+            for (uint16_t i = 0; i < n; i++) x[i] = -x[i];
+            break;
+        case OP_ABS:
+            for (uint16_t i = 0; i < n; i++) x[i] = fabsf(x[i]);
+            break;
+        case OP_ADD:
+            for (uint16_t i = 0; i < n; i++) x[i] += y[i];
+            break;
+        case OP_SUB:
+            for (uint16_t i = 0; i < n; i++) x[i] -= y[i];
+            break;
+        case OP_MUL:
+            for (uint16_t i = 0; i < n; i++) x[i] *= y[i];
+            break;
+        case OP_DIV:
+            for (uint16_t i = 0; i < n; i++) x[i] = y[i] != 0.0f ? x[i] / y[i] : 0.0f;
+            break;
+        case OP_MIN:
+            for (uint16_t i = 0; i < n; i++) x[i] = fminf(x[i], y[i]);
+            break;
+        case OP_MAX:
+            for (uint16_t i = 0; i < n; i++) x[i] = fmaxf(x[i], y[i]);
+            break;
+        }
+
+        if (x != y) {
+            sp--;
+        }
+    }
+
+    for (uint16_t i = 0; i < n; i++) {
+        float v = stack[0][i] + 0.5f;
+        out[i] = v <= 0.0f ? 0 : v >= VALUE_MAX ? VALUE_MAX : (uint16_t)v;
+    }
+}
+
+void vchan_eval(adc_frame_t *frame)
+{
+    uint32_t gen = __atomic_load_n(&cfg_gen, __ATOMIC_ACQUIRE);
+    if (gen != run_gen) {
+        taskENTER_CRITICAL(&cfg_lock);
+        memcpy(run_progs, progs, sizeof(run_progs));
+        run_gen = cfg_gen;
+        taskEXIT_CRITICAL(&cfg_lock);
+    }
+
+    for (uint8_t v = 0; v < ADC_VIRT_CHANNELS; v++) {
+        const prog_t *pr = &run_progs[v];
+        uint16_t *count = &frame->count[ADC_MAX_CHANNELS + v];
+
+        *count = 0;
+        if (pr->len == 0) {
+            continue;
+        }
+
+        /* As many samples as the scarcest operand; one per scan without any */
+        uint16_t n = pr->refs ? ADC_FRAME_MAX_SAMPLES : frame->count[0];
+        for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+            if ((pr->refs & (1u << ch)) && frame->count[ch] < n) {
+                n = frame->count[ch];
+            }
+        }
+
+        run(pr, frame, n, frame->samples[ADC_MAX_CHANNELS + v]);
+        *count = n;
+    }
+}
+
+/**
+ * @brief Configuration implementation
+ */
+
+/**
+ * @brief Check a virtual channel index
+ */
+static bool chk_index(int index)
+{
+    return index >= 0 && index < ADC_VIRT_CHANNELS;
+}
+
+/**
+ * @brief Write the expression of a virtual channel to NVS (flash service task)
+ *
+ * @param[in] ctx Virtual channel index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_expr(void *ctx)
+{
+    uint8_t index = *(uint8_t *)ctx;
+    char expr[VCHAN_EXPR_MAX];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(expr, exprs[index], sizeof(expr));
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, index);
+    if (expr[0] != '\0') {
+        err = nvs_set_str(nvs, key, expr);
+    } else {
+        err = nvs_erase_key(nvs, key);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Save the expression of a virtual channel to NVS
+ *
+ * @param[in] index Virtual channel index
+ * @return ESP_OK on success
+ */
+static esp_err_t save_expr(uint8_t index)
+{
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", index);
+    return flash_svc_run(key, write_expr, &index, sizeof(index));
+}
+
+/**
+ * @brief Load and compile all expressions from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t v = 0; v < ADC_VIRT_CHANNELS; v++) {
+        char key[16];
+        char expr[VCHAN_EXPR_MAX];
+        size_t len = sizeof(expr);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, v);
+        if (nvs_get_str(nvs, key, expr, &len) != ESP_OK) {
+            continue;
+        }
+
+        const char *cerr = compile(expr, v, &progs[v]);
+        if (cerr != NULL) {
+            ESP_LOGW(TAG, "v%u: %s: %s", v, expr, cerr);
+            continue;
+        }
+        memcpy(exprs[v], expr, sizeof(expr));
+        ESP_LOGI(TAG, "v%u = %s", v, expr);
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t vchan_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    load_config();
+
+    taskENTER_CRITICAL(&cfg_lock);
+    cfg_gen++;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t vchan_define(uint8_t index, const char *expr, const char **err)
+{
+    if (!chk_index(index) || expr == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strlen(expr) >= VCHAN_EXPR_MAX) {
+        if (err != NULL) {
+            *err = "expression too long";
+        }
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    prog_t prog;
+    const char *cerr = compile(expr, index, &prog);
+    if (err != NULL) {
+        *err = cerr;
+    }
+    if (cerr != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    strcpy(exprs[index], expr);
+    progs[index] = prog;
+    cfg_gen++;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    return save_expr(index);
+}
+
+esp_err_t vchan_remove(uint8_t index)
+{
+    if (!chk_index(index)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Later channels built on this one now read an empty channel */
+    taskENTER_CRITICAL(&cfg_lock);
+    exprs[index][0] = '\0';
+    memset(&progs[index], 0, sizeof(progs[index]));
+    cfg_gen++;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    return save_expr(index);
+}
+
+esp_err_t vchan_get_expr(uint8_t index, char *buf)
+{
+    if (!chk_index(index) || buf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(buf, exprs[index], VCHAN_EXPR_MAX);
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    return buf[0] != '\0' ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *index;
+    struct arg_str *expr;
+    struct arg_lit *remove;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Virtual channel definitions\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print all definitions with their latest values
+ */
+static void print_status(void)
+{
+    adc_snapshot_t snap;
+    bool have_snap = adc_read_snapshot(&snap) == ESP_OK;
+
+    for (uint8_t v = 0; v < ADC_VIRT_CHANNELS; v++) {
+        char expr[VCHAN_EXPR_MAX];
+        if (vchan_get_expr(v, expr) != ESP_OK) {
+            printf("v%u (ch%u): undefined\n", v, ADC_MAX_CHANNELS + v);
+            continue;
+        }
+        printf("v%u (ch%u) = %s", v, ADC_MAX_CHANNELS + v, expr);
+        if (have_snap) {
+            printf("  [%"PRIu32"]", snap.virt[v]);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Vchan command handler
+ */
+static int cmd_vchan(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.index->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    int v = args.index->ival[0];
+    if (!chk_index(v)) {
+        printf("Invalid virtual channel %d (0-%d)\n", v, ADC_VIRT_CHANNELS - 1);
+        return 1;
+    }
+
+    esp_err_t err;
+    if (args.remove->count > 0) {
+        err = vchan_remove(v);
+    } else if (args.expr->count > 0) {
+        const char *cerr = NULL;
+        err = vchan_define(v, args.expr->sval[0], &cerr);
+        if (cerr != NULL) {
+            printf("Invalid expression: %s\n", cerr);
+            return 1;
+        }
+    } else {
+        print_status();
+        return 0;
+    }
+
+    if (err != ESP_OK) {
+        printf("Failed to save definition: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Register vchan commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.index = arg_int0(NULL, NULL, "<n>", "Virtual channel");
+    args.expr = arg_str0(NULL, NULL, "<expr>", "Expression, quoted if it has spaces");
+    args.remove = arg_litn("d", "delete", 0, 1, "Remove the definition");
+    args.end = arg_end(4);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "vchan",
+        .func = cmd_vchan,
+        .help = "Virtual channels computed from physical ones\n"
+                "Operands: ch0.., earlier v0.., numbers; + - * / abs() min() max()\n"
+                "Results are clamped to 0..4095\n"
+                "Examples:\n"
+                "  vchan                              Show definitions\n"
+                "  vchan 0 \"ch0 - ch1 + 2048\"         Offset difference\n"
+                "  vchan 1 \"1000 * ch2 / ch3\"         Ratio in 1/1000\n"
+                "  vchan 1 -d                         Remove v1\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
@@ -0,0 +1,84 @@
+/**
+ * @file vchan.h
+ * @brief Virtual channels derived from expressions over physical channels
+ *
+ * A virtual channel is defined by an expression such as
+ * `ch0 - ch1 + 2048`, `abs(ch2 - ch3)`, `1000 * ch0 / ch1` or
+ * `max(ch0, ch1)`. Operands are physical channels `ch0`..`chN`, earlier
+ * virtual channels `v0`..`vN` and decimal constants; operators are
+ * `+ - * /`, unary minus, parentheses and the functions abs(), min()
+ * and max().
+ *
+ * Expressions are compiled into stack bytecode when defined and stored
+ * in NVS as text. The ADC task evaluates every program once per frame,
+ * one operation over all samples at a time, and appends the results to
+ * the frame as channel ADC_MAX_CHANNELS + n, so every frame consumer
+ * sees them like physical channels. Results are rounded and clamped to
+ * the range of normalized samples (0..4095); add an offset for
+ * quantities that can be negative. Division by zero gives 0.
+ */
+
+#ifndef VCHAN_H
+#define VCHAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "adc.h"
+
+#define VCHAN_EXPR_MAX      64      /**< Expression length including the terminator */
+
+/**
+ * @brief Initialize virtual channels
+ *
+ * Compiles the expressions stored in NVS and registers the `vchan`
+ * command. Until it is called virtual channels have no samples.
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t vchan_init(void);
+
+/**
+ * @brief Define or replace a virtual channel
+ *
+ * @param[in] index Virtual channel index (0..ADC_VIRT_CHANNELS-1)
+ * @param[in] expr Expression
+ * @param[out] err Error description if the expression is invalid, may be NULL
+ * @return ESP_OK if compiled and stored
+ *         ESP_ERR_INVALID_ARG if index is invalid, expr is NULL or does not compile
+ *         an NVS error if the expression could not be stored
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t vchan_define(uint8_t index, const char *expr, const char **err);
+
+/**
+ * @brief Remove a virtual channel
+ *
+ * @param[in] index Virtual channel index
+ * @return ESP_OK if removed
+ *         ESP_ERR_INVALID_ARG if index is invalid
+ *         an NVS error if the definition could not be erased
+ */
+esp_err_t vchan_remove(uint8_t index);
+
+/**
+ * @brief Get the expression of a virtual channel
+ *
+ * @param[in] index Virtual channel index
+ * @param[out] buf Buffer of at least VCHAN_EXPR_MAX bytes
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if index is invalid or buf is NULL
+ *         ESP_ERR_NOT_FOUND if the channel is not defined
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t vchan_get_expr(uint8_t index, char *buf);
+
+/**
+ * @brief Compute the virtual channels of a frame (ADC task)
+ *
+ * @param[in,out] frame Frame with the physical channels filled in
+ */
+void vchan_eval(adc_frame_t *frame);
+
+#endif /* VCHAN_H */
@@ -0,0 +1,57 @@
+/**
+ * @file web.c
+ * @brief Shared HTTP server for the network endpoints
+ */
+
+#include "esp_log.h"
+#include "esp_http_server.h"
+
+#include "web.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+/* Module static variables */
+static const char *TAG = "web";
+static httpd_handle_t server = NULL;
+
+BaseType_t web_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    if (server) {
+        return pdPASS;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_WEB_SERVER_PORT;
+    config.max_uri_handlers = CONFIG_WEB_MAX_URI_HANDLERS;
+    config.lru_purge_enable = true;
+
+    esp_err_t err = httpd_start(&server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start HTTP server: %s", esp_err_to_name(err));
+        server = NULL;
+        return pdFAIL;
+    }
+
+    ESP_LOGI(TAG, "HTTP server listening on port %d", config.server_port);
+    return pdPASS;
+}
+
+esp_err_t web_register_uri(const httpd_uri_t *uri)
+{
+    if (uri == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (server == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return httpd_register_uri_handler(server, uri);
+}
+
+httpd_handle_t web_get_server(void)
+{
+    return server;
+}
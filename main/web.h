@@ -0,0 +1,45 @@
+/**
+ * @file web.h
+ * @brief Shared HTTP server for the network endpoints
+ *
+ * One esp_http_server instance serves all endpoints of the application
+ * (metrics, streaming, ...). Modules register their URI handlers after
+ * web_init().
+ */
+
+#ifndef WEB_H
+#define WEB_H
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/**
+ * @brief Start the HTTP server
+ *
+ * The TCP/IP stack must be initialized before calling this function.
+ *
+ * @return pdPASS if the server is running, pdFAIL otherwise
+ */
+BaseType_t web_init(void);
+
+/**
+ * @brief Register a URI handler on the shared server
+ *
+ * @param[in] uri URI handler description
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if uri is NULL
+ *         ESP_ERR_INVALID_STATE if the server is not running
+ *         Other errors from httpd_register_uri_handler()
+ * @note This function is NULL-safe
+ */
+esp_err_t web_register_uri(const httpd_uri_t *uri);
+
+/**
+ * @brief Get the handle of the shared server
+ *
+ * @return Server handle, NULL if the server is not running
+ */
+httpd_handle_t web_get_server(void);
+
+#endif /* WEB_H */
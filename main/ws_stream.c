@@ -0,0 +1,445 @@
+/**
+ * @file ws_stream.c
+ * @brief WebSocket live waveform streaming
+ *
+ * The ADC task builds a block for every subscribed client directly into
+ * that client's queue slot and never waits: if the queue is full the
+ * oldest block is discarded. The sender task copies queued blocks out
+ * under a short critical section and sends them synchronously, so a slow
+ * client only delays its own data (and the other clients), never the
+ * acquisition.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+
+#include "adc.h"
+#include "web.h"
+#include "ws_stream.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define MAX_CLIENTS     CONFIG_WS_STREAM_MAX_CLIENTS
+#define QUEUE_DEPTH     CONFIG_WS_STREAM_QUEUE_DEPTH
+#define MAX_DECIMATION  255
+#define MSG_MAX_LEN     32
+#define BLOCK_MAX_SIZE  (sizeof(ws_block_hdr_t) \
+                         + ADC_TOTAL_CHANNELS * sizeof(uint16_t) \
+                         + ADC_TOTAL_CHANNELS * ADC_FRAME_MAX_SAMPLES * sizeof(uint16_t))
+
+/**
+ * @brief Queued block
+ */
+typedef struct {
+    uint16_t len;                   /**< Block length in bytes */
+    uint8_t data[BLOCK_MAX_SIZE];   /**< Block contents */
+} ws_block_t;
+
+/**
+ * @brief Per-client state
+ */
+typedef struct {
+    int fd;                         /**< Socket, -1 if the slot is free */
+    uint8_t mask;                   /**< Subscribed channels, 0 if not subscribed */
+    uint8_t decimation;             /**< Keep every n-th sample */
+    uint8_t phase[ADC_TOTAL_CHANNELS];/**< Decimation phase per channel */
+    uint32_t seq;                   /**< Next block sequence number */
+    uint32_t dropped;               /**< Blocks dropped (drop-oldest) */
+    uint32_t gen;                   /**< Incremented on every (un)subscription */
+    uint8_t head;                   /**< Next slot to write */
+    uint8_t tail;                   /**< Oldest queued slot */
+    uint8_t count;                  /**< Queued blocks */
+    ws_block_t queue[QUEUE_DEPTH];  /**< Block queue */
+} ws_client_t;
+
+/**
+ * @brief Subscription state a block is built from, copied under the lock
+ */
+typedef struct {
+    uint8_t mask;                   /**< Subscribed channels */
+    uint8_t decimation;             /**< Keep every n-th sample */
+    uint8_t phase[ADC_TOTAL_CHANNELS];/**< Decimation phase per channel */
+    uint32_t seq;                   /**< Block sequence number */
+    uint32_t dropped;               /**< Blocks dropped so far */
+} ws_sub_t;
+
+/* Module static variables */
+static const char *TAG = "ws_stream";
+static TaskHandle_t task_handle = NULL;
+static portMUX_TYPE clients_lock = portMUX_INITIALIZER_UNLOCKED;
+static ws_client_t clients[MAX_CLIENTS];
+static ws_block_t tx_block;
+
+/**
+ * @brief Append a little-endian 16-bit value
+ */
+static inline uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+/**
+ * @brief Build a block of a frame for one client
+ *
+ * @param[in,out] c Subscription, seq and phases are advanced
+ * @param[in] f Frame
+ * @param[out] b Block to fill
+ */
+static void build_block(ws_sub_t *c, const adc_frame_t *f, ws_block_t *b)
+{
+    ws_block_hdr_t hdr = {
+        .seq = c->seq++,
+        .frame_seq = f->seq,
+        .timestamp_us = f->timestamp_us,
+        .dropped = c->dropped,
+        .mask = c->mask,
+        .decimation = c->decimation,
+    };
+    memcpy(b->data, &hdr, sizeof(hdr));
+
+    uint8_t *counts = b->data + sizeof(hdr);
+    uint8_t *p = counts;
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (c->mask & (1 << ch)) {
+            p += sizeof(uint16_t);
+        }
+    }
+
+    for (uint8_t ch = 0; ch < ADC_TOTAL_CHANNELS; ch++) {
+        if (!(c->mask & (1 << ch))) {
+            continue;
+        }
+
+        uint16_t n = 0;
+        uint8_t phase = c->phase[ch];
+        for (uint16_t i = 0; i < f->count[ch]; i++) {
+            if (phase == 0) {
+                p = put_u16(p, f->samples[ch][i]);
+                n++;
+            }
+            if (++phase >= c->decimation) {
+                phase = 0;
+            }
+        }
+        c->phase[ch] = phase;
+        counts = put_u16(counts, n);
+    }
+
+    b->len = p - b->data;
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    bool queued = false;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ws_client_t *c = &clients[i];
+
+        taskENTER_CRITICAL(&clients_lock);
+        bool active = c->fd >= 0 && c->mask != 0;
+        if (active && c->count == QUEUE_DEPTH) {
+            /* Drop the oldest block to make room */
+            c->tail = (c->tail + 1) % QUEUE_DEPTH;
+            c->count--;
+            c->dropped++;
+        }
+        uint8_t slot = c->head;
+        uint32_t gen = c->gen;
+        ws_sub_t sub = {
+            .mask = c->mask,
+            .decimation = c->decimation,
+            .seq = c->seq,
+            .dropped = c->dropped,
+        };
+        memcpy(sub.phase, c->phase, sizeof(sub.phase));
+        taskEXIT_CRITICAL(&clients_lock);
+
+        if (!active) {
+            continue;
+        }
+
+        /* The head slot is outside the queued range, the sender won't touch it */
+        build_block(&sub, f, &c->queue[slot]);
+
+        taskENTER_CRITICAL(&clients_lock);
+        if (c->gen == gen) {
+            /* Not resubscribed meanwhile */
+            c->seq = sub.seq;
+            memcpy(c->phase, sub.phase, sizeof(c->phase));
+            c->head = (c->head + 1) % QUEUE_DEPTH;
+            c->count++;
+            queued = true;
+        }
+        taskEXIT_CRITICAL(&clients_lock);
+    }
+
+    if (queued && task_handle) {
+        xTaskNotifyGive(task_handle);
+    }
+}
+
+/**
+ * @brief Release a client slot
+ *
+ * @param[in] c Client
+ */
+static void client_free(ws_client_t *c)
+{
+    taskENTER_CRITICAL(&clients_lock);
+    c->fd = -1;
+    c->mask = 0;
+    c->gen++;
+    c->count = 0;
+    c->head = c->tail = 0;
+    taskEXIT_CRITICAL(&clients_lock);
+}
+
+/**
+ * @brief Sender task
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_ws(void *p)
+{
+    httpd_handle_t server = web_get_server();
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        bool pending;
+        do {
+            pending = false;
+            for (int i = 0; i < MAX_CLIENTS; i++) {
+                ws_client_t *c = &clients[i];
+
+                taskENTER_CRITICAL(&clients_lock);
+                int fd = c->fd;
+                bool have = c->count > 0;
+                if (have) {
+                    const ws_block_t *b = &c->queue[c->tail];
+                    tx_block.len = b->len;
+                    memcpy(tx_block.data, b->data, b->len);
+                    c->tail = (c->tail + 1) % QUEUE_DEPTH;
+                    c->count--;
+                    pending |= c->count > 0;
+                }
+                taskEXIT_CRITICAL(&clients_lock);
+
+                if (fd < 0) {
+                    continue;
+                }
+
+                if (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+                    ESP_LOGI(TAG, "Client %d gone", fd);
+                    client_free(c);
+                    continue;
+                }
+
+                if (!have) {
+                    continue;
+                }
+
+                httpd_ws_frame_t frame = {
+                    .final = true,
+                    .type = HTTPD_WS_TYPE_BINARY,
+                    .payload = tx_block.data,
+                    .len = tx_block.len,
+                };
+                if (httpd_ws_send_data(server, fd, &frame) != ESP_OK) {
+                    ESP_LOGW(TAG, "Send to client %d failed, dropping it", fd);
+                    client_free(c);
+                }
+            }
+        } while (pending);
+    }
+}
+
+/**
+ * @brief Find the slot of a socket, optionally allocating one
+ *
+ * @param[in] fd Socket
+ * @param[in] alloc Allocate a free slot if the socket has none
+ * @return Client or NULL
+ */
+static ws_client_t *client_find(int fd, bool alloc)
+{
+    ws_client_t *free_slot = NULL;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd == fd) {
+            return &clients[i];
+        }
+        if (clients[i].fd < 0 && free_slot == NULL) {
+            free_slot = &clients[i];
+        }
+    }
+
+    if (alloc && free_slot) {
+        taskENTER_CRITICAL(&clients_lock);
+        free_slot->fd = fd;
+        free_slot->mask = 0;
+        taskEXIT_CRITICAL(&clients_lock);
+    }
+    return alloc ? free_slot : NULL;
+}
+
+/**
+ * @brief Send a text reply
+ */
+static esp_err_t reply(httpd_req_t *req, const char *text)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)text,
+        .len = strlen(text),
+    };
+    return httpd_ws_send_frame(req, &frame);
+}
+
+/**
+ * @brief Handle a subscription message
+ *
+ * @param[in] req Request
+ * @param[in] msg NUL terminated message
+ * @return ESP_OK on success
+ */
+static esp_err_t handle_msg(httpd_req_t *req, char *msg)
+{
+    int fd = httpd_req_to_sockfd(req);
+    char *save = NULL;
+    const char *cmd = strtok_r(msg, " ", &save);
+
+    if (cmd && strcmp(cmd, "unsub") == 0) {
+        ws_client_t *c = client_find(fd, false);
+        if (c) {
+            client_free(c);
+        }
+        return reply(req, "ok");
+    }
+
+    if (cmd == NULL || strcmp(cmd, "sub") != 0) {
+        return reply(req, "err unknown command");
+    }
+
+    const char *s_mask = strtok_r(NULL, " ", &save);
+    const char *s_decim = strtok_r(NULL, " ", &save);
+    unsigned long mask = s_mask ? strtoul(s_mask, NULL, 0) : 0;
+    unsigned long decim = s_decim ? strtoul(s_decim, NULL, 0) : 1;
+
+    if (mask == 0 || mask >= (1UL << ADC_TOTAL_CHANNELS)) {
+        return reply(req, "err invalid channel mask");
+    }
+    if (decim == 0 || decim > MAX_DECIMATION) {
+        return reply(req, "err invalid decimation");
+    }
+
+    ws_client_t *c = client_find(fd, true);
+    if (c == NULL) {
+        return reply(req, "err too many clients");
+    }
+
+    taskENTER_CRITICAL(&clients_lock);
+    c->mask = 0;
+    c->gen++;
+    c->count = 0;
+    c->head = c->tail = 0;
+    c->seq = 0;
+    c->dropped = 0;
+    c->decimation = decim;
+    bzero(c->phase, sizeof(c->phase));
+    c->mask = mask;
+    taskEXIT_CRITICAL(&clients_lock);
+
+    ESP_LOGI(TAG, "Client %d subscribed: mask=0x%lx, decimation=%lu", fd, mask, decim);
+    return reply(req, "ok");
+}
+
+/**
+ * @brief /ws/stream handler
+ */
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        /* Handshake done */
+        return ESP_OK;
+    }
+
+    char msg[MSG_MAX_LEN];
+    httpd_ws_frame_t frame = {
+        .payload = (uint8_t *)msg,
+    };
+
+    /* Get the length first, then the payload */
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.len >= sizeof(msg)) {
+        /* The payload can't be skipped, left unread it would be parsed as
+         * the next frame: close the connection */
+        ESP_LOGW(TAG, "Client %d sent %u bytes, closing", httpd_req_to_sockfd(req),
+                 (unsigned)frame.len);
+        reply(req, "err message too long");
+        return ESP_FAIL;
+    }
+
+    /* Always consume the payload, even of frames that are ignored */
+    err = httpd_ws_recv_frame(req, &frame, sizeof(msg) - 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.type != HTTPD_WS_TYPE_TEXT) {
+        return ESP_OK;
+    }
+    msg[frame.len] = '\0';
+
+    return handle_msg(req, msg);
+}
+
+BaseType_t ws_stream_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    static const httpd_uri_t uri = {
+        .uri = "/ws/stream",
+        .method = HTTP_GET,
+        .handler = ws_handler,
+        .user_ctx = NULL,
+        .is_websocket = true,
+    };
+
+    esp_err_t err = web_register_uri(&uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /ws/stream: %s", esp_err_to_name(err));
+        return pdFAIL;
+    }
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    return xTaskCreate(task_ws, "ws_stream", 4096, NULL,
+                       uxTaskPriorityGet(NULL), &task_handle);
+}
@@ -0,0 +1,53 @@
+/**
+ * @file ws_stream.h
+ * @brief WebSocket live waveform streaming
+ *
+ * A client connects to `ws://<device>/ws/stream` and sends a text
+ * subscription:
+ * @code
+ *   sub <channel mask> <decimation>     e.g. "sub 0x5 4"
+ *   unsub
+ * @endcode
+ * The device answers "ok" or "err <reason>" and then pushes one binary
+ * block per processed ADC frame:
+ * @code
+ *   ws_block_hdr_t header
+ *   uint16 count[n]            samples per subscribed channel, ascending channel order
+ *   uint16 samples[...]        normalized samples, channel after channel
+ * @endcode
+ * where n is the number of bits set in the mask. Mask bits above the
+ * physical channels select the virtual channels (vchan.h). All values are
+ * little-endian. Every client has its own queue; when a client cannot keep
+ * up the oldest queued block is dropped and counted in the header.
+ */
+
+#ifndef WS_STREAM_H
+#define WS_STREAM_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Binary block header
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t seq;           /**< Block sequence number of this client */
+    uint32_t frame_seq;     /**< ADC frame sequence number */
+    int64_t timestamp_us;   /**< Time the frame was drained */
+    uint32_t dropped;       /**< Blocks dropped for this client so far */
+    uint8_t mask;           /**< Subscribed channel mask */
+    uint8_t decimation;     /**< Decimation factor */
+} ws_block_hdr_t;
+
+/**
+ * @brief Initialize WebSocket streaming
+ *
+ * Registers the /ws/stream endpoint on the shared HTTP server, hooks into
+ * the ADC frame stream and creates the sender task. Must be called after
+ * web_init() and adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t ws_stream_init(void);
+
+#endif /* WS_STREAM_H */
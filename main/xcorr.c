@@ -0,0 +1,781 @@
+/**
+ * @file xcorr.c
+ * @brief Cross-correlation and phase difference between channel pairs
+ *
+ * The frame listener appends the unfiltered samples of every channel to
+ * a ring buffer. Once both channels of a pair hold HOP new samples it
+ * copies the last window into the job buffer and wakes the analysis task,
+ * unless that is still busy with the previous job; a window that has
+ * left the ring meanwhile is counted as skipped.
+ *
+ * The analysis removes the means, takes Q15 FFTs of both zero-padded
+ * windows (radix 2, halved every stage so nothing overflows) and picks
+ * the bin with the largest product of magnitudes for the phase. The
+ * correlation over ±max_lag is summed directly when that is cheaper than
+ * an inverse FFT of the cross spectrum, otherwise the cross spectrum is
+ * normalized to 14 bits and transformed back.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "argtable3/argtable3.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "flash_svc.h"
+
+#include "adc.h"
+#include "xcorr.h"
+
+#define LOG_LEVEL_LOCAL ESP_LOG_INFO
+
+#define N               XCORR_WINDOW
+#define FFT_LOG2        (CONFIG_XCORR_WINDOW_LOG2 + 1)
+#define FFT_SIZE        (1 << FFT_LOG2)             /* Zero padded, no circular wrap */
+#define HOP             (XCORR_WINDOW / 2)
+#define RING            (2 * XCORR_WINDOW)          /* Power of two */
+#define MAX_LAG         (XCORR_WINDOW / 2)
+#define FS_HZ           ((float)ADC_SAMPLE_FREQ_HZ / ADC_MAX_CHANNELS)
+#define IN_SHIFT        3                           /* 12-bit deviations to Q15 */
+#define TASK_STACK_SIZE 4096
+
+/* NVS Keys */
+#define NVS_NAMESPACE   "xcorr"
+#define NVS_KEY_FMT     "pair%u"
+
+/**
+ * @brief Configuration of one pair
+ */
+typedef struct {
+    uint8_t enabled;            /**< Pair is analysed */
+    uint8_t ch_a;               /**< Reference channel */
+    uint8_t ch_b;               /**< Compared channel */
+    uint8_t reserved;
+    uint16_t max_lag;           /**< Lag range searched, samples each side */
+} pair_cfg_t;
+
+/**
+ * @brief Complex Q15 value
+ */
+typedef struct {
+    int16_t re;
+    int16_t im;
+} cplx_t;
+
+/**
+ * @brief Window handed to the analysis task
+ */
+typedef struct {
+    uint8_t pair;
+    pair_cfg_t cfg;
+    uint16_t a[N];
+    uint16_t b[N];
+} job_t;
+
+/* Forward declarations */
+static void register_cmd(void);
+
+/* Module static variables */
+static const char *TAG = "xcorr";
+static TaskHandle_t task_handle = NULL;
+static portMUX_TYPE cfg_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE out_lock = portMUX_INITIALIZER_UNLOCKED;
+static pair_cfg_t cfg[XCORR_PAIRS];
+static uint32_t cfg_gen;            /* Incremented on every configuration change */
+static xcorr_result_t results[XCORR_PAIRS];
+
+/* Listener state (ADC task) */
+static uint32_t state_gen;
+static uint16_t ring[ADC_MAX_CHANNELS][RING];
+static uint32_t total[ADC_MAX_CHANNELS];
+static uint32_t next_end[XCORR_PAIRS];
+static uint32_t skipped[XCORR_PAIRS];
+
+/* Job handed over, owned by the analysis task while busy */
+static job_t job;
+static bool job_busy;
+
+/* Analysis task state */
+static int16_t x[N], y[N];
+static cplx_t fx[FFT_SIZE], fy[FFT_SIZE];
+static cplx_t twiddle[FFT_SIZE / 2];
+static float r[2 * MAX_LAG + 1];
+
+/**
+ * @brief Check if pair index is valid
+ */
+static inline bool chk_pair(uint8_t pair)
+{
+    return pair < XCORR_PAIRS;
+}
+
+/**
+ * @brief Fill the twiddle table, exp(-j·2πk/FFT_SIZE) in Q15
+ */
+static void fft_init(void)
+{
+    for (int k = 0; k < FFT_SIZE / 2; k++) {
+        double a = 2.0 * M_PI * k / FFT_SIZE;
+        twiddle[k].re = lround(cos(a) * INT16_MAX);
+        twiddle[k].im = lround(-sin(a) * INT16_MAX);
+    }
+}
+
+/**
+ * @brief In-place radix-2 FFT, result scaled by 1/FFT_SIZE
+ *
+ * Halving after every stage keeps values with a magnitude up to
+ * INT16_MAX in range.
+ *
+ * @param[in,out] a FFT_SIZE values
+ */
+static void fft(cplx_t *a)
+{
+    for (int i = 1, j = 0; i < FFT_SIZE; i++) {
+        int bit = FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            cplx_t t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= FFT_SIZE; len <<= 1) {
+        int half = len / 2;
+        int step = FFT_SIZE / len;
+        for (int i = 0; i < FFT_SIZE; i += len) {
+            for (int k = 0; k < half; k++) {
+                cplx_t w = twiddle[k * step];
+                cplx_t *u = &a[i + k];
+                cplx_t *v = &a[i + k + half];
+                int32_t tr = ((int32_t)v->re * w.re - (int32_t)v->im * w.im + (1 << 14)) >> 15;
+                int32_t ti = ((int32_t)v->re * w.im + (int32_t)v->im * w.re + (1 << 14)) >> 15;
+                int32_t ur = u->re;
+                int32_t ui = u->im;
+                u->re = (ur + tr) >> 1;
+                u->im = (ui + ti) >> 1;
+                v->re = (ur - tr) >> 1;
+                v->im = (ui - ti) >> 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Correlation at one lag, sum of x[n]·y[n+lag]
+ */
+static int64_t corr_at(int lag)
+{
+    int64_t acc = 0;
+    int from = MAX(0, -lag);
+    int to = MIN(N, N - lag);
+    for (int n = from; n < to; n++) {
+        acc += (int32_t)x[n] * y[n + lag];
+    }
+    return acc;
+}
+
+/**
+ * @brief Correlation over ±lags through the inverse FFT of conj(X)·Y
+ *
+ * Overwrites fx. The result is only proportional to the correlation.
+ */
+static void corr_fft(int lags)
+{
+    /* Largest cross spectrum component, for block scaling */
+    int64_t peak = 1;
+    for (int k = 0; k < FFT_SIZE; k++) {
+        int64_t re = (int64_t)fx[k].re * fy[k].re + (int64_t)fx[k].im * fy[k].im;
+        int64_t im = (int64_t)fx[k].re * fy[k].im - (int64_t)fx[k].im * fy[k].re;
+        peak = MAX(peak, MAX(llabs(re), llabs(im)));
+    }
+
+    int shift = 0;
+    while ((peak >> shift) >= (1 << 14)) {
+        shift++;
+    }
+    if (shift == 0) {
+        while (shift > -16 && (peak << (1 - shift)) < (1 << 14)) {
+            shift--;
+        }
+    }
+
+    /* Inverse transform as conj(FFT(conj(D))); only the real part is used */
+    for (int k = 0; k < FFT_SIZE; k++) {
+        int64_t re = (int64_t)fx[k].re * fy[k].re + (int64_t)fx[k].im * fy[k].im;
+        int64_t im = (int64_t)fx[k].re * fy[k].im - (int64_t)fx[k].im * fy[k].re;
+        if (shift >= 0) {
+            re >>= shift;
+            im >>= shift;
+        } else {
+            re <<= -shift;
+            im <<= -shift;
+        }
+        fx[k].re = re;
+        fx[k].im = -im;
+    }
+    fft(fx);
+
+    for (int lag = -lags; lag <= lags; lag++) {
+        r[lag + lags] = fx[(lag + FFT_SIZE) % FFT_SIZE].re;
+    }
+}
+
+/**
+ * @brief Analyse one window
+ *
+ * @param[in] j Job
+ * @param[out] res Results, statistics fields untouched
+ */
+static void analyse(const job_t *j, xcorr_result_t *res)
+{
+    int lags = MIN(j->cfg.max_lag, MAX_LAG);
+
+    /* Remove the means */
+    int32_t sa = 0, sb = 0;
+    for (int n = 0; n < N; n++) {
+        sa += j->a[n];
+        sb += j->b[n];
+    }
+    int32_t ma = (sa + N / 2) / N;
+    int32_t mb = (sb + N / 2) / N;
+
+    int64_t exx = 0, eyy = 0;
+    for (int n = 0; n < N; n++) {
+        x[n] = j->a[n] - ma;
+        y[n] = j->b[n] - mb;
+        exx += (int32_t)x[n] * x[n];
+        eyy += (int32_t)y[n] * y[n];
+    }
+
+    res->lag = 0;
+    res->delay_us = 0;
+    res->coeff = 0;
+    res->freq_hz = 0;
+    res->phase_deg = 0;
+    memset(res->curve, 0, sizeof(res->curve));
+    if (exx == 0 || eyy == 0) {
+        /* A flat channel correlates with nothing */
+        return;
+    }
+
+    /* Spectra of the zero-padded windows */
+    for (int n = 0; n < FFT_SIZE; n++) {
+        fx[n] = (cplx_t){ n < N ? x[n] << IN_SHIFT : 0, 0 };
+        fy[n] = (cplx_t){ n < N ? y[n] << IN_SHIFT : 0, 0 };
+    }
+    fft(fx);
+    fft(fy);
+
+    /* Strongest common frequency; phase of X·conj(Y) is b behind a */
+    uint64_t best = 0;
+    int kbest = 0;
+    for (int k = 1; k < FFT_SIZE / 2; k++) {
+        uint64_t px = (int64_t)fx[k].re * fx[k].re + (int64_t)fx[k].im * fx[k].im;
+        uint64_t py = (int64_t)fy[k].re * fy[k].re + (int64_t)fy[k].im * fy[k].im;
+        if (px * py > best) {
+            best = px * py;
+            kbest = k;
+        }
+    }
+    if (kbest > 0) {
+        float cre = (int64_t)fx[kbest].re * fy[kbest].re + (int64_t)fx[kbest].im * fy[kbest].im;
+        float cim = (int64_t)fx[kbest].im * fy[kbest].re - (int64_t)fx[kbest].re * fy[kbest].im;
+        res->freq_hz = kbest * FS_HZ / FFT_SIZE;
+        res->phase_deg = atan2f(cim, cre) * (180.0f / (float)M_PI);
+    }
+
+    /* Direct sums cost N per lag, the inverse FFT about 2·FFT_SIZE per stage */
+    bool use_fft = N * (2 * lags + 1) > 2 * FFT_SIZE * FFT_LOG2;
+    res->method = use_fft ? XCORR_METHOD_FFT : XCORR_METHOD_DIRECT;
+    if (use_fft) {
+        corr_fft(lags);
+    } else {
+        for (int lag = -lags; lag <= lags; lag++) {
+            r[lag + lags] = corr_at(lag);
+        }
+    }
+
+    int ipeak = 0;
+    for (int i = 1; i <= 2 * lags; i++) {
+        if (fabsf(r[i]) > fabsf(r[ipeak])) {
+            ipeak = i;
+        }
+    }
+
+    /* FFT values are relative, scale them with the exact peak */
+    float norm = sqrtf((float)exx * (float)eyy);
+    float scale = 1.0f / norm;
+    if (use_fft && r[ipeak] != 0) {
+        scale = corr_at(ipeak - lags) / r[ipeak] / norm;
+    }
+    for (int i = 0; i <= 2 * lags; i++) {
+        r[i] *= scale;
+    }
+
+    /* Parabola through the peak and its neighbours */
+    float frac = 0;
+    if (ipeak > 0 && ipeak < 2 * lags) {
+        float d = r[ipeak - 1] - 2 * r[ipeak] + r[ipeak + 1];
+        if (d != 0) {
+            frac = MIN(MAX(0.5f * (r[ipeak - 1] - r[ipeak + 1]) / d, -0.5f), 0.5f);
+        }
+    }
+
+    res->lag = ipeak - lags + frac;
+    res->delay_us = res->lag / FS_HZ * 1e6f;
+    res->coeff = MIN(MAX(r[ipeak], -1.0f), 1.0f);
+
+    for (int lag = -XCORR_CURVE_LAGS; lag <= XCORR_CURVE_LAGS; lag++) {
+        if (lag >= -lags && lag <= lags) {
+            float v = MIN(MAX(r[lag + lags], -1.0f), 1.0f);
+            res->curve[lag + XCORR_CURVE_LAGS] = lroundf(v * INT16_MAX);
+        }
+    }
+}
+
+/**
+ * @brief Analysis task
+ *
+ * @param[in] p Task parameter (unused)
+ */
+static void task_xcorr(void *p)
+{
+    static xcorr_result_t res;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t t0 = esp_timer_get_time();
+        analyse(&job, &res);
+        uint32_t dt = esp_timer_get_time() - t0;
+
+        taskENTER_CRITICAL(&out_lock);
+        xcorr_result_t *out = &results[job.pair];
+        res.valid = true;
+        res.windows = out->windows + 1;
+        res.skipped = out->skipped;
+        res.last_us = dt;
+        *out = res;
+        taskEXIT_CRITICAL(&out_lock);
+
+        __atomic_store_n(&job_busy, false, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Hand the window ending at the given sample to the analysis task
+ */
+static void post_job(uint8_t pair, const pair_cfg_t *c, uint32_t end)
+{
+    job.pair = pair;
+    job.cfg = *c;
+    for (int n = 0; n < N; n++) {
+        uint32_t i = (end - N + n) % RING;
+        job.a[n] = ring[c->ch_a][i];
+        job.b[n] = ring[c->ch_b][i];
+    }
+
+    __atomic_store_n(&job_busy, true, __ATOMIC_RELEASE);
+    xTaskNotifyGive(task_handle);
+}
+
+/**
+ * @brief Frame listener (ADC task context, must not block)
+ *
+ * @param[in] f Processed frame
+ * @param[in] arg Unused
+ */
+static void on_frame(const adc_frame_t *f, void *arg)
+{
+    pair_cfg_t c[XCORR_PAIRS];
+
+    taskENTER_CRITICAL(&cfg_lock);
+    memcpy(c, cfg, sizeof(c));
+    uint32_t gen = cfg_gen;
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    bool any = false;
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        any |= c[p].enabled;
+    }
+    if (!any) {
+        return;
+    }
+
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        for (uint16_t i = 0; i < f->count[ch]; i++) {
+            ring[ch][total[ch]++ % RING] = f->unfiltered[ch][i];
+        }
+    }
+
+    if (gen != state_gen) {
+        /* Configuration changed, the first window starts now */
+        for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+            next_end[p] = MIN(total[c[p].ch_a], total[c[p].ch_b]) + N;
+        }
+        state_gen = gen;
+    }
+
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        if (!c[p].enabled) {
+            continue;
+        }
+
+        /* A frame may end in the middle of a scan, use common samples only */
+        uint32_t ta = total[c[p].ch_a];
+        uint32_t tb = total[c[p].ch_b];
+        uint32_t end = MIN(ta, tb);
+        if ((int32_t)(end - next_end[p]) < 0
+            || __atomic_load_n(&job_busy, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        /* Oldest sample still in both rings */
+        uint32_t oldest = MAX(ta, tb) - RING;
+        uint32_t we = next_end[p];
+        if ((int32_t)(we - N - oldest) < 0) {
+            skipped[p] += (end - we) / HOP + 1;
+            we = end;
+        }
+
+        post_job(p, &c[p], we);
+        next_end[p] = we + HOP;
+    }
+}
+
+/**
+ * @brief Write the configuration of a pair to NVS (flash service task)
+ *
+ * @param[in] ctx Pair index (uint8_t)
+ * @return ESP_OK on success
+ */
+static esp_err_t write_pair(void *ctx)
+{
+    uint8_t pair = *(uint8_t *)ctx;
+    pair_cfg_t c;
+
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[pair];
+    taskEXIT_CRITICAL(&cfg_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), NVS_KEY_FMT, pair);
+    err = nvs_set_blob(nvs, key, &c, sizeof(c));
+    if (err != ESP_OK) goto cleanup;
+
+    err = nvs_commit(nvs);
+
+cleanup:
+    nvs_close(nvs);
+    return err;
+}
+
+/**
+ * @brief Save the configuration of a pair to NVS
+ *
+ * @param[in] pair Pair index
+ * @return ESP_OK on success
+ */
+static esp_err_t save_pair(uint8_t pair)
+{
+    char key[FLASH_SVC_KEY_MAX];
+    snprintf(key, sizeof(key), "nvs:" NVS_NAMESPACE "/%u", pair);
+    return flash_svc_run(key, write_pair, &pair, sizeof(pair));
+}
+
+/**
+ * @brief Load the configuration of all pairs from NVS
+ *
+ * @return ESP_OK on success
+ */
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        char key[16];
+        pair_cfg_t c;
+        size_t len = sizeof(c);
+
+        snprintf(key, sizeof(key), NVS_KEY_FMT, p);
+        if (nvs_get_blob(nvs, key, &c, &len) == ESP_OK && len == sizeof(c)
+            && c.ch_a < ADC_MAX_CHANNELS && c.ch_b < ADC_MAX_CHANNELS
+            && c.max_lag > 0 && c.max_lag <= MAX_LAG) {
+            cfg[p] = c;
+        }
+    }
+
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Public API implementations
+ */
+
+BaseType_t xcorr_init(void)
+{
+    esp_log_level_set(TAG, LOG_LEVEL_LOCAL);
+
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        cfg[p] = (pair_cfg_t){
+            .enabled = 0,
+            .ch_a = 0,
+            .ch_b = (p + 1) % ADC_MAX_CHANNELS,
+            .max_lag = MIN(CONFIG_XCORR_DEFAULT_MAX_LAG, MAX_LAG),
+        };
+    }
+    load_config();
+    fft_init();
+    cfg_gen++;          /* First frame starts the windows */
+
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        if (cfg[p].enabled) {
+            ESP_LOGI(TAG, "Pair %u: ch%u/ch%u, lags ±%u", p, cfg[p].ch_a, cfg[p].ch_b, cfg[p].max_lag);
+        }
+    }
+
+    if (xTaskCreate(task_xcorr, "xcorr", TASK_STACK_SIZE, NULL,
+                    CONFIG_XCORR_TASK_PRIO, &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        return pdFAIL;
+    }
+
+    if (adc_add_frame_listener(on_frame, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register frame listener");
+        return pdFAIL;
+    }
+
+    register_cmd();
+    return pdPASS;
+}
+
+esp_err_t xcorr_get(uint8_t pair, xcorr_result_t *result)
+{
+    if (!chk_pair(pair) || result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!cfg[pair].enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL(&out_lock);
+    *result = results[pair];
+    taskEXIT_CRITICAL(&out_lock);
+    result->skipped = skipped[pair];
+    return ESP_OK;
+}
+
+/**
+ * @brief Command line interface implementation
+ */
+
+/* Command arguments */
+static struct {
+    struct arg_lit *help;
+    struct arg_int *pair;
+    struct arg_int *ch_a;
+    struct arg_int *ch_b;
+    struct arg_int *lags;
+    struct arg_lit *curve;
+    struct arg_lit *enable;
+    struct arg_lit *disable;
+    struct arg_end *end;
+} args;
+
+/**
+ * @brief Print command help
+ */
+static void print_help(void)
+{
+    printf("Cross-correlation control\n");
+    arg_print_syntax(stdout, (void *) &args, "\n");
+    arg_print_glossary(stdout, (void *)&args, "  %-25s %s\n");
+}
+
+/**
+ * @brief Print configuration and results of all pairs
+ */
+static void print_status(void)
+{
+    printf("Window: %d samples (%.1f ms), hop %d\n", N, N / FS_HZ * 1000, HOP);
+
+    for (uint8_t p = 0; p < XCORR_PAIRS; p++) {
+        pair_cfg_t c;
+        taskENTER_CRITICAL(&cfg_lock);
+        c = cfg[p];
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        printf("-- Pair %u --\n", p);
+        printf("  State: %s\n", c.enabled ? "enabled" : "disabled");
+        printf("  Channels: a=ch%u, b=ch%u, lags ±%u\n", c.ch_a, c.ch_b, c.max_lag);
+
+        xcorr_result_t r;
+        if (xcorr_get(p, &r) != ESP_OK || !r.valid) {
+            continue;
+        }
+        printf("  Peak: lag %.2f samples (%.1f us), coefficient %.3f\n",
+               r.lag, r.delay_us, r.coeff);
+        printf("  Phase: %.1f deg at %.1f Hz\n", r.phase_deg, r.freq_hz);
+        printf("  Method: %s, %"PRIu32" us\n",
+               r.method == XCORR_METHOD_FFT ? "fft" : "direct", r.last_us);
+        printf("  Windows: %"PRIu32" (skipped %"PRIu32")\n", r.windows, r.skipped);
+    }
+}
+
+/**
+ * @brief Print the correlation curve of a pair
+ */
+static void print_curve(uint8_t pair)
+{
+    xcorr_result_t r;
+    if (xcorr_get(pair, &r) != ESP_OK || !r.valid) {
+        printf("No results for pair %u\n", pair);
+        return;
+    }
+
+    for (int lag = -XCORR_CURVE_LAGS; lag <= XCORR_CURVE_LAGS; lag++) {
+        int16_t v = r.curve[lag + XCORR_CURVE_LAGS];
+        int bar = (v + INT16_MAX) * 30 / (2 * INT16_MAX);
+        printf("%4d %7.3f |%*s*\n", lag, v / (float)INT16_MAX, bar, "");
+    }
+}
+
+/**
+ * @brief Xcorr command handler
+ */
+static int cmd_xcorr(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void *)&args);
+
+    if (nerrors || args.help->count > 0) {
+        print_help();
+        return 0;
+    }
+
+    if (args.pair->count == 0) {
+        print_status();
+        return 0;
+    }
+
+    uint8_t p = args.pair->ival[0];
+    if (!chk_pair(args.pair->ival[0])) {
+        printf("Invalid pair %d (0-%d)\n", args.pair->ival[0], XCORR_PAIRS - 1);
+        return 1;
+    }
+
+    if (args.curve->count > 0) {
+        print_curve(p);
+        return 0;
+    }
+
+    pair_cfg_t c;
+    taskENTER_CRITICAL(&cfg_lock);
+    c = cfg[p];
+    taskEXIT_CRITICAL(&cfg_lock);
+    bool changed = false;
+
+    if (args.ch_a->count > 0) {
+        if (args.ch_a->ival[0] < 0 || args.ch_a->ival[0] >= ADC_MAX_CHANNELS) {
+            printf("Invalid channel %d\n", args.ch_a->ival[0]);
+            return 1;
+        }
+        c.ch_a = args.ch_a->ival[0];
+        changed = true;
+    }
+
+    if (args.ch_b->count > 0) {
+        if (args.ch_b->ival[0] < 0 || args.ch_b->ival[0] >= ADC_MAX_CHANNELS) {
+            printf("Invalid channel %d\n", args.ch_b->ival[0]);
+            return 1;
+        }
+        c.ch_b = args.ch_b->ival[0];
+        changed = true;
+    }
+
+    if (args.lags->count > 0) {
+        if (args.lags->ival[0] <= 0 || args.lags->ival[0] > MAX_LAG) {
+            printf("Invalid lag range %d (1-%d)\n", args.lags->ival[0], MAX_LAG);
+            return 1;
+        }
+        c.max_lag = args.lags->ival[0];
+        changed = true;
+    }
+
+    if (args.enable->count > 0 || args.disable->count > 0) {
+        c.enabled = args.enable->count > 0;
+        changed = true;
+    }
+
+    if (changed) {
+        taskENTER_CRITICAL(&cfg_lock);
+        cfg[p] = c;
+        cfg_gen++;
+        taskEXIT_CRITICAL(&cfg_lock);
+
+        esp_err_t err = save_pair(p);
+        if (err != ESP_OK) {
+            printf("Failed to save configuration: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+    } else {
+        print_status();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Register xcorr commands
+ */
+static void register_cmd(void)
+{
+    args.help = arg_litn("h", "help", 0, 1, "Show help");
+    args.pair = arg_int0("p", "pair", "<n>", "Pair to configure");
+    args.ch_a = arg_int0("a", NULL, "<ch>", "Reference channel");
+    args.ch_b = arg_int0("b", NULL, "<ch>", "Compared channel");
+    args.lags = arg_int0("l", "lags", "<n>", "Lag range, samples each side");
+    args.curve = arg_litn("c", "curve", 0, 1, "Print the correlation curve");
+    args.enable = arg_litn("E", "enable", 0, 1, "Enable analysis");
+    args.disable = arg_litn("D", "disable", 0, 1, "Disable analysis");
+    args.end = arg_end(8);
+
+    esp_console_cmd_t cmd = {
+        .argtable = &args,
+        .command = "xcorr",
+        .func = cmd_xcorr,
+        .help = "Cross-correlation and phase difference\n"
+                "Examples:\n"
+                "  xcorr                      Show all pairs\n"
+                "  xcorr -p 0 -a 0 -b 1 -E    Correlate ch0 and ch1\n"
+                "  xcorr -p 0 -l 100          Search lags up to ±100 (FFT)\n"
+                "  xcorr -p 0 -c              Print the correlation curve\n"
+    };
+
+    esp_console_cmd_register(&cmd);
+}
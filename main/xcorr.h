@@ -0,0 +1,79 @@
+/**
+ * @file xcorr.h
+ * @brief Cross-correlation and phase difference between channel pairs
+ *
+ * For every configured pair the ADC task keeps the latest samples of
+ * both channels; every half window a low-priority task correlates the
+ * last XCORR_WINDOW samples. Short lag ranges are computed directly,
+ * long ones through a zero-padded Q15 FFT. The task reports the lag of
+ * the correlation peak (interpolated between samples), the correlation
+ * coefficient there, and the phase difference at the strongest common
+ * frequency. Like metering it reads the unfiltered, skew-corrected
+ * frame samples, so the channel filters add no lag of their own.
+ *
+ * Sign convention: a positive lag and phase mean channel b lags
+ * channel a.
+ */
+
+#ifndef XCORR_H
+#define XCORR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#define XCORR_PAIRS         2                               /**< Number of correlation pairs */
+#define XCORR_WINDOW        (1 << CONFIG_XCORR_WINDOW_LOG2) /**< Samples per window */
+#define XCORR_CURVE_LAGS    32                              /**< Stored lags each side of 0 */
+
+/**
+ * @brief Correlation method used for a window
+ */
+typedef enum {
+    XCORR_METHOD_DIRECT = 0,    /**< Sum over the lag range */
+    XCORR_METHOD_FFT,           /**< Inverse FFT of the cross spectrum */
+} xcorr_method_t;
+
+/**
+ * @brief Results of one pair
+ */
+typedef struct {
+    bool valid;                 /**< At least one window analysed */
+    uint8_t method;             /**< xcorr_method_t of the last window */
+    float lag;                  /**< Lag of the correlation peak (samples) */
+    float delay_us;             /**< Lag as time */
+    float coeff;                /**< Normalized correlation at the peak (-1..1) */
+    float freq_hz;              /**< Strongest common frequency */
+    float phase_deg;            /**< Phase of b behind a at freq_hz (-180..180) */
+    uint32_t windows;           /**< Windows analysed */
+    uint32_t skipped;           /**< Windows lost while the task was busy */
+    uint32_t last_us;           /**< Computation time of the last window */
+    int16_t curve[2 * XCORR_CURVE_LAGS + 1]; /**< Normalized correlation around lag 0, Q15 */
+} xcorr_result_t;
+
+/**
+ * @brief Initialize the correlation stage
+ *
+ * Loads the pair configuration from NVS, registers the frame listener
+ * and the `xcorr` command and starts the analysis task. Call after
+ * adc_init().
+ *
+ * @return pdPASS if initialization successful, pdFAIL otherwise
+ */
+BaseType_t xcorr_init(void);
+
+/**
+ * @brief Get the latest results of a pair
+ *
+ * @param[in] pair Pair index
+ * @param[out] result Pointer to store the results
+ * @return ESP_OK if successful
+ *         ESP_ERR_INVALID_ARG if pair is invalid or result is NULL
+ *         ESP_ERR_INVALID_STATE if the pair is disabled
+ * @note This function is NULL-safe and thread-safe
+ */
+esp_err_t xcorr_get(uint8_t pair, xcorr_result_t *result);
+
+#endif /* XCORR_H */
@@ -15,3 +15,14 @@ def test_adc_continuous(dut: Dut) -> None:
     res = dut.expect(r'TASK: ret is 0, ret_num is (\d+) bytes')
     num = res.group(1).decode('utf8')
     assert int(num) == 256
+
+
+@pytest.mark.adc
+@idf_parametrize('target', ['esp32'], indirect=['target'])
+def test_flash_stress(dut: Dut) -> None:
+    # Runs on hardware and in QEMU (--embedded-services idf,qemu)
+    dut.expect_exact('esp32>')
+    dut.write('stress -t 10')
+    res = dut.expect(r'Dropped samples: (\d+)', timeout=60)
+    assert int(res.group(1).decode('utf8')) == 0
+    dut.expect_exact('Result: PASS')
@@ -0,0 +1,59 @@
+/* Host stub of argtable3.h, enough to compile command handlers */
+#pragma once
+
+#include <stdio.h>
+
+struct arg_lit { int count; };
+struct arg_int { int count; int *ival; };
+struct arg_dbl { int count; double *dval; };
+struct arg_str { int count; const char **sval; };
+struct arg_end { int count; };
+
+static inline struct arg_lit *arg_litn(const char *s, const char *l, int min, int max,
+                                       const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_lit *arg_lit0(const char *s, const char *l, const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_int *arg_int0(const char *s, const char *l, const char *d,
+                                       const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_int *arg_int1(const char *s, const char *l, const char *d,
+                                       const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_dbl *arg_dbl0(const char *s, const char *l, const char *d,
+                                       const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_str *arg_str0(const char *s, const char *l, const char *d,
+                                       const char *g)
+{
+    return NULL;
+}
+
+static inline struct arg_end *arg_end(int max)
+{
+    return NULL;
+}
+
+static inline int arg_parse(int argc, char **argv, void **argtable)
+{
+    return 1;
+}
+
+static inline void arg_print_syntax(FILE *fp, void **argtable, const char *suffix) {}
+static inline void arg_print_glossary(FILE *fp, void **argtable, const char *format) {}
+static inline void arg_print_errors(FILE *fp, struct arg_end *end, const char *name) {}
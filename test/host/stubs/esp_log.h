@@ -0,0 +1,17 @@
+/* Host stub of esp_log.h, logging is dropped */
+#pragma once
+
+typedef enum {
+    ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#define ESP_LOGE(tag, ...)  ((void)(tag))
+#define ESP_LOGW(tag, ...)  ((void)(tag))
+#define ESP_LOGI(tag, ...)  ((void)(tag))
+#define ESP_LOGD(tag, ...)  ((void)(tag))
+
+static inline void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    (void)level;
+}
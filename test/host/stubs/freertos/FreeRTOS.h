@@ -0,0 +1,23 @@
+/* Host stub of FreeRTOS.h, single-threaded */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+#define pdFAIL                  0
+#define portMAX_DELAY           0xffffffffu
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define taskENTER_CRITICAL(m)   ((void)(m))
+#define taskEXIT_CRITICAL(m)    ((void)(m))
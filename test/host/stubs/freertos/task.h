@@ -0,0 +1,28 @@
+/* Host stub of task.h, tasks are never started */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                                     void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+    (void)fn; (void)name; (void)stack; (void)arg; (void)prio;
+    if (handle != NULL) {
+        *handle = NULL;
+    }
+    return pdPASS;
+}
+
+static inline void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+}
+
+static inline UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    (void)task;
+    return 1;
+}
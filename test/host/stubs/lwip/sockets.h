@@ -0,0 +1,10 @@
+/* Host stub of lwip/sockets.h, the host BSD sockets */
+#pragma once
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
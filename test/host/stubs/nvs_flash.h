@@ -0,0 +1,4 @@
+/* Host stub of nvs_flash.h */
+#pragma once
+
+#include "nvs.h"
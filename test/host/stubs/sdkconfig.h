@@ -0,0 +1,12 @@
+/* Configuration of the host tests, defaults of main/Kconfig */
+#pragma once
+
+#define CONFIG_ADC_MAX_CHANNELS         4
+#define CONFIG_ADC_VIRT_CHANNELS        2
+#define CONFIG_FLASH_SVC_CTX_MAX        64
+#define CONFIG_MODBUS_TCP_PORT          502
+#define CONFIG_MODBUS_TCP_MAX_CLIENTS   4
+#define CONFIG_PID_LOOP0_GPIO           4
+#define CONFIG_PID_LOOP1_GPIO           -1
+#define CONFIG_PID_PWM_BITS             10
+#define CONFIG_PID_PWM_FREQ_HZ          5000
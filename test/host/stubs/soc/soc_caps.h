@@ -0,0 +1,4 @@
+/* Host stub of soc_caps.h (ESP32) */
+#pragma once
+
+#define SOC_ADC_DIGI_RESULT_BYTES   2
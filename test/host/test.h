@@ -0,0 +1,40 @@
+/**
+ * @file test.h
+ * @brief Minimal check macros of the host tests
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_checks;
+static int test_failures;
+
+/** Record a check, report it if it fails */
+#define CHECK(cond) do { \
+        test_checks++; \
+        if (!(cond)) { \
+            test_failures++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+/** Run one test function */
+#define RUN(fn) do { \
+        printf("  %s\n", #fn); \
+        fn(); \
+    } while (0)
+
+/**
+ * @brief Print the summary
+ *
+ * @return Process exit code, 0 if every check passed
+ */
+static inline int test_summary(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif /* TEST_H */
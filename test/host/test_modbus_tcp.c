@@ -0,0 +1,295 @@
+/**
+ * @file test_modbus_tcp.c
+ * @brief Host test of the Modbus TCP request handling
+ *
+ * Runs the PDU handler and the MBAP framing of modbus_tcp.c against a
+ * stub snapshot. The ADC setters validate like the driver and record
+ * what they apply; send() captures the response.
+ */
+
+#define send stub_send
+#include "modbus_tcp.c"
+#undef send
+
+#include "test.h"
+
+/* Stub ADC state */
+static adc_snapshot_t stub_snap;
+static int applied;
+
+/* Last response sent */
+static uint8_t sent[ADU_MAX];
+static size_t sent_len;
+static int sends;
+
+ssize_t stub_send(int fd, const void *buf, size_t len, int flags)
+{
+    memcpy(sent, buf, len);
+    sent_len = len;
+    sends++;
+    return len;
+}
+
+esp_err_t adc_read_snapshot(adc_snapshot_t *s)
+{
+    *s = stub_snap;
+    return ESP_OK;
+}
+
+esp_err_t adc_set_calibration(uint8_t channel, uint32_t min, uint32_t max)
+{
+    if (channel >= ADC_MAX_CHANNELS || min >= max || max > ADC_CODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stub_snap.ch[channel].min_cal = min;
+    stub_snap.ch[channel].max_cal = max;
+    applied++;
+    return ESP_OK;
+}
+
+esp_err_t adc_set_hysteresis(uint8_t channel, uint32_t hysteresis)
+{
+    if (channel >= ADC_MAX_CHANNELS || hysteresis == 0 || hysteresis > ADC_HYSTERESIS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stub_snap.ch[channel].hysteresis = hysteresis;
+    applied++;
+    return ESP_OK;
+}
+
+static void setup(void)
+{
+    memset(&stub_snap, 0, sizeof(stub_snap));
+    for (int ch = 0; ch < ADC_MAX_CHANNELS; ch++) {
+        stub_snap.ch[ch].raw = 1000 + ch;
+        stub_snap.ch[ch].normalized = 2000 + ch;
+        stub_snap.ch[ch].min_cal = 100 + ch;
+        stub_snap.ch[ch].max_cal = 4000 + ch;
+        stub_snap.ch[ch].hysteresis = 10 + ch;
+    }
+    stub_snap.frame_seq = 0x12345678;
+    applied = 0;
+    sends = 0;
+    sent_len = 0;
+}
+
+static size_t pdu(const uint8_t *req, size_t len, uint8_t *resp)
+{
+    return modbus_tcp_process_pdu(req, len, resp);
+}
+
+static bool is_exception(const uint8_t *resp, size_t len, uint8_t fc, uint8_t code)
+{
+    return len == 2 && resp[0] == (fc | 0x80) && resp[1] == code;
+}
+
+static void test_read_holding(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t req[] = { 0x03, 0x00, 0x10, 0x00, 0x04 };
+
+    size_t n = pdu(req, sizeof(req), resp);
+    CHECK(n == 2 + 8);
+    CHECK(resp[0] == 0x03 && resp[1] == 8);
+    for (int ch = 0; ch < 4; ch++) {
+        CHECK(get_u16(&resp[2 + 2 * ch]) == 4000 + ch);
+    }
+}
+
+static void test_read_input(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t raw[] = { 0x04, 0x00, 0x00, 0x00, 0x02 };
+    const uint8_t seq[] = { 0x04, 0x00, 0x20, 0x00, 0x02 };
+    const uint8_t norm[] = { 0x04, 0x00, 0x13, 0x00, 0x01 };
+
+    size_t n = pdu(raw, sizeof(raw), resp);
+    CHECK(n == 6 && get_u16(&resp[2]) == 1000 && get_u16(&resp[4]) == 1001);
+
+    n = pdu(seq, sizeof(seq), resp);
+    CHECK(n == 6 && get_u16(&resp[2]) == 0x1234 && get_u16(&resp[4]) == 0x5678);
+
+    n = pdu(norm, sizeof(norm), resp);
+    CHECK(n == 4 && get_u16(&resp[2]) == 2003);
+}
+
+static void test_read_exceptions(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t unmapped[] = { 0x04, 0x00, 0x21, 0x00, 0x02 };   /* Runs past 0x0021 */
+    const uint8_t zero[] = { 0x03, 0x00, 0x00, 0x00, 0x00 };
+    const uint8_t many[] = { 0x03, 0x00, 0x00, 0x00, 126 };
+    const uint8_t short_req[] = { 0x03, 0x00, 0x00, 0x00 };
+
+    CHECK(is_exception(resp, pdu(unmapped, sizeof(unmapped), resp), 0x04, EX_ILLEGAL_ADDRESS));
+    CHECK(is_exception(resp, pdu(zero, sizeof(zero), resp), 0x03, EX_ILLEGAL_VALUE));
+    CHECK(is_exception(resp, pdu(many, sizeof(many), resp), 0x03, EX_ILLEGAL_VALUE));
+    CHECK(is_exception(resp, pdu(short_req, sizeof(short_req), resp), 0x03, EX_ILLEGAL_VALUE));
+}
+
+static void test_write_single(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t req[] = { 0x06, 0x00, 0x21, 0x00, 50 };          /* Hysteresis ch1 */
+    const uint8_t zero[] = { 0x06, 0x00, 0x22, 0x00, 0x00 };
+    const uint8_t unmapped[] = { 0x06, 0x00, 0x30, 0x00, 0x01 };
+
+    size_t n = pdu(req, sizeof(req), resp);
+    CHECK(n == 5 && memcmp(resp, req, 5) == 0);
+    CHECK(stub_snap.ch[1].hysteresis == 50 && applied == 1);
+
+    CHECK(is_exception(resp, pdu(zero, sizeof(zero), resp), 0x06, EX_ILLEGAL_VALUE));
+    CHECK(is_exception(resp, pdu(unmapped, sizeof(unmapped), resp), 0x06, EX_ILLEGAL_ADDRESS));
+    CHECK(stub_snap.ch[2].hysteresis == 12 && applied == 1);
+}
+
+static void test_write_multiple(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    /* ch3 minimum is valid, 0x0004 is not mapped */
+    const uint8_t gap[] = { 0x10, 0x00, 0x03, 0x00, 0x02, 4, 0x00, 0x05, 0x00, 0x06 };
+    /* ch0 minimum above its maximum */
+    const uint8_t crossed[] = { 0x10, 0x00, 0x00, 0x00, 0x01, 2, 0x0f, 0xb0 };
+    const uint8_t max[] = { 0x10, 0x00, 0x10, 0x00, 0x02, 4, 0x0f, 0xa0, 0x0f, 0xa1 };
+    const uint8_t hyst[] = { 0x10, 0x00, 0x20, 0x00, 0x04, 8, 0, 1, 0, 2, 0, 3, 0, 4 };
+
+    CHECK(is_exception(resp, pdu(gap, sizeof(gap), resp), 0x10, EX_ILLEGAL_ADDRESS));
+    CHECK(is_exception(resp, pdu(crossed, sizeof(crossed), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(applied == 0 && stub_snap.ch[3].min_cal == 103 && stub_snap.ch[0].min_cal == 100);
+
+    size_t n = pdu(max, sizeof(max), resp);
+    CHECK(n == 5 && memcmp(resp, max, 5) == 0);
+    CHECK(stub_snap.ch[0].max_cal == 4000 && stub_snap.ch[1].max_cal == 4001 && applied == 2);
+
+    n = pdu(hyst, sizeof(hyst), resp);
+    CHECK(n == 5 && resp[0] == 0x10 && get_u16(&resp[1]) == 0x20 && get_u16(&resp[3]) == 4);
+    for (int ch = 0; ch < 4; ch++) {
+        CHECK(stub_snap.ch[ch].hysteresis == (uint32_t)ch + 1);
+    }
+}
+
+static void test_write_multiple_atomic(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    /* Hysteresis of ch0..ch2 valid, ch3 out of range */
+    const uint8_t req[] = { 0x10, 0x00, 0x20, 0x00, 0x04, 8, 0, 20, 0, 21, 0, 22, 0x03, 0xe9 };
+
+    CHECK(is_exception(resp, pdu(req, sizeof(req), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(applied == 0);
+    for (int ch = 0; ch < 4; ch++) {
+        CHECK(stub_snap.ch[ch].hysteresis == 10u + ch);
+    }
+
+    /* Limits of ch0 valid, ch1 crossed */
+    const uint8_t cal[] = { 0x10, 0x00, 0x00, 0x00, 0x02, 4, 0x00, 0x05, 0x0f, 0xff };
+    CHECK(is_exception(resp, pdu(cal, sizeof(cal), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(applied == 0 && stub_snap.ch[0].min_cal == 100);
+}
+
+static void test_write_multiple_format(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t count[] = { 0x10, 0x00, 0x20, 0x00, 0x02, 3, 0, 1, 0, 2 };
+    const uint8_t len[] = { 0x10, 0x00, 0x20, 0x00, 0x02, 4, 0, 1, 0 };
+    const uint8_t zero[] = { 0x10, 0x00, 0x20, 0x00, 0x00, 0 };
+
+    CHECK(is_exception(resp, pdu(count, sizeof(count), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(is_exception(resp, pdu(len, sizeof(len), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(is_exception(resp, pdu(zero, sizeof(zero), resp), 0x10, EX_ILLEGAL_VALUE));
+    CHECK(applied == 0);
+}
+
+static void test_illegal_function(void)
+{
+    setup();
+    uint8_t resp[PDU_MAX];
+    const uint8_t req[] = { 0x01, 0x00, 0x00, 0x00, 0x01 };
+
+    CHECK(is_exception(resp, pdu(req, sizeof(req), resp), 0x01, EX_ILLEGAL_FUNCTION));
+    CHECK(pdu(NULL, 5, resp) == 0);
+    CHECK(pdu(req, 0, resp) == 0);
+}
+
+static void test_mbap(void)
+{
+    setup();
+    mb_client_t c = { .fd = 3 };
+    /* Two requests in one segment, unit ids 0x11 and 0xff */
+    const uint8_t adu[] = {
+        0xab, 0xcd, 0x00, 0x00, 0x00, 0x06, 0x11, 0x04, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x07, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x00, 0x20, 0x00, 0x01,
+    };
+
+    memcpy(c.buf, adu, 12);
+    c.len = 12;
+    CHECK(client_process(&c));
+    CHECK(sends == 1 && c.len == 0);
+    CHECK(sent_len == 11);
+    CHECK(get_u16(&sent[0]) == 0xabcd && get_u16(&sent[2]) == 0);
+    CHECK(get_u16(&sent[4]) == 5 && sent[6] == 0x11);
+    CHECK(sent[7] == 0x04 && get_u16(&sent[9]) == 1000);
+
+    /* Second ADU split across two receives */
+    memcpy(c.buf, &adu[12], 9);
+    c.len = 9;
+    CHECK(client_process(&c));
+    CHECK(sends == 1 && c.len == 9);
+    memcpy(&c.buf[9], &adu[21], 3);
+    c.len = 12;
+    CHECK(client_process(&c));
+    CHECK(sends == 2 && c.len == 0);
+    CHECK(get_u16(&sent[0]) == 0x0007 && sent[6] == 0xff);
+    CHECK(sent[7] == 0x03 && get_u16(&sent[9]) == 10);
+
+    /* Exceptions keep the framing */
+    const uint8_t bad_fc[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x2b };
+    memcpy(c.buf, bad_fc, sizeof(bad_fc));
+    c.len = sizeof(bad_fc);
+    CHECK(client_process(&c));
+    CHECK(sent_len == 9 && get_u16(&sent[4]) == 3 && sent[6] == 0x00);
+    CHECK(sent[7] == 0xab && sent[8] == EX_ILLEGAL_FUNCTION);
+}
+
+static void test_mbap_malformed(void)
+{
+    setup();
+    mb_client_t c = { .fd = 3 };
+    const uint8_t protocol[] = { 0x00, 0x01, 0x00, 0x01, 0x00, 0x06, 0x01, 0x04, 0, 0, 0, 1 };
+    const uint8_t too_short[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01 };
+    const uint8_t too_long[] = { 0x00, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01 };
+
+    memcpy(c.buf, protocol, sizeof(protocol));
+    c.len = sizeof(protocol);
+    CHECK(!client_process(&c));
+
+    memcpy(c.buf, too_short, sizeof(too_short));
+    c.len = sizeof(too_short);
+    CHECK(!client_process(&c));
+
+    memcpy(c.buf, too_long, sizeof(too_long));
+    c.len = sizeof(too_long);
+    CHECK(!client_process(&c));
+    CHECK(sends == 0);
+}
+
+int main(void)
+{
+    RUN(test_read_holding);
+    RUN(test_read_input);
+    RUN(test_read_exceptions);
+    RUN(test_write_single);
+    RUN(test_write_multiple);
+    RUN(test_write_multiple_atomic);
+    RUN(test_write_multiple_format);
+    RUN(test_illegal_function);
+    RUN(test_mbap);
+    RUN(test_mbap_malformed);
+    return test_summary("modbus_tcp");
+}
@@ -0,0 +1,290 @@
+/**
+ * @file test_pid.c
+ * @brief Host test of the PID control step
+ *
+ * Drives pid_run() with synthetic frames through the default PWM output,
+ * whose ledc_* calls are recorded, and checks the output clamp, the
+ * anti-windup, setpoint steps and the latency bookkeeping.
+ */
+
+#include "pid.c"
+
+#include "test.h"
+
+#define Q(g)        ((int32_t)((g) * (1 << PID_GAIN_Q)))
+
+int64_t stub_time_us;
+
+/* Recorded LEDC calls */
+static int timer_configs;
+static int channel_configs;
+static int gpio_of[PID_LOOPS];
+static uint32_t duty[PID_LOOPS];
+static int updates[PID_LOOPS];
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *c)
+{
+    timer_configs++;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *c)
+{
+    channel_configs++;
+    gpio_of[c->channel] = c->gpio_num;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t d)
+{
+    duty[channel] = d;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel)
+{
+    updates[channel]++;
+    return ESP_OK;
+}
+
+esp_err_t flash_svc_run(const char *key, flash_svc_fn_t fn, const void *ctx, size_t ctx_len)
+{
+    return fn((void *)ctx);
+}
+
+static adc_frame_t frame;
+
+/**
+ * @brief Run one frame with the given value as newest sample of ch0
+ */
+static void run(int32_t pv)
+{
+    frame.seq++;
+    frame.count[0] = 3;
+    frame.samples[0][0] = 0;
+    frame.samples[0][1] = 0;
+    frame.samples[0][2] = pv;
+    pid_run(&frame);
+}
+
+/**
+ * @brief Configure and enable loop 0 on ch0
+ */
+static void configure(int32_t setpoint, double kp, double ki, double kd,
+                      int32_t out_min, int32_t out_max)
+{
+    pid_cfg_t c = {
+        .enabled = 1,
+        .channel = 0,
+        .setpoint = setpoint,
+        .kp = Q(kp),
+        .ki = Q(ki),
+        .kd = Q(kd),
+        .out_min = out_min,
+        .out_max = out_max,
+    };
+    /* Disable first so enabling resets the integrator */
+    pid_cfg_t off = c;
+    off.enabled = 0;
+    CHECK(pid_set_config(0, &off) == ESP_OK);
+    CHECK(pid_set_config(0, &c) == ESP_OK);
+}
+
+static pid_status_t status_of(uint8_t loop)
+{
+    pid_status_t s;
+    pid_get_status(loop, &s);
+    return s;
+}
+
+static void test_init(void)
+{
+    CHECK(pid_init() == pdPASS);
+    CHECK(timer_configs == 1 && channel_configs == 1);
+    CHECK(gpio_of[0] == CONFIG_PID_LOOP0_GPIO);
+
+    pid_cfg_t c;
+    CHECK(pid_get_config(0, &c) == ESP_OK);
+    CHECK(!c.enabled && c.out_max == PWM_MAX);
+
+    /* Disabled loops leave their output alone */
+    run(100);
+    CHECK(updates[0] == 0 && updates[1] == 0);
+}
+
+static void test_invalid_config(void)
+{
+    pid_cfg_t c = { .channel = ADC_TOTAL_CHANNELS, .out_max = 10 };
+    CHECK(pid_set_config(0, &c) == ESP_ERR_INVALID_ARG);
+    c.channel = 0;
+    c.out_min = 11;
+    CHECK(pid_set_config(0, &c) == ESP_ERR_INVALID_ARG);
+    CHECK(pid_set_config(PID_LOOPS, &c) == ESP_ERR_INVALID_ARG);
+    CHECK(pid_set_config(0, NULL) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_proportional_clamp(void)
+{
+    configure(2000, 1.0, 0, 0, 0, 1000);
+
+    run(1500);
+    CHECK(duty[0] == 500 && status_of(0).output == 500);
+    CHECK(status_of(0).error == 500);
+
+    /* Far below the setpoint: clamped to out_max */
+    run(0);
+    CHECK(duty[0] == 1000 && status_of(0).output == 1000);
+    uint32_t sat = status_of(0).saturated;
+    CHECK(sat == 1);
+
+    /* Far above: clamped to out_min */
+    run(4000);
+    CHECK(duty[0] == 0 && status_of(0).output == 0);
+    CHECK(status_of(0).saturated == sat + 1);
+}
+
+static void test_pwm_range(void)
+{
+    /* Outputs beyond the PWM resolution are clipped by the PWM output only */
+    configure(2000, 4.0, 0, 0, -5000, 5000);
+
+    run(0);
+    CHECK(status_of(0).output == 5000 && duty[0] == PWM_MAX);
+    run(4000);
+    CHECK(status_of(0).output == -5000 && duty[0] == 0);
+}
+
+static void test_integral(void)
+{
+    configure(1000, 0, 0.5, 0, 0, 1000);
+
+    /* Error 100, +50 per frame */
+    for (int i = 1; i <= 4; i++) {
+        run(900);
+        CHECK(status_of(0).output == 50 * i);
+    }
+    CHECK(status_of(0).integral == 200);
+}
+
+static void test_anti_windup(void)
+{
+    configure(1000, 1.0, 0.5, 0, 0, 1000);
+
+    /* P alone saturates: the integrator must not keep growing */
+    for (int i = 0; i < 100; i++) {
+        run(0);
+    }
+    pid_status_t s = status_of(0);
+    CHECK(s.output == 1000);
+    CHECK(s.integral == 0);
+
+    /* On the first frame above the setpoint the output leaves the limit */
+    run(1100);
+    s = status_of(0);
+    CHECK(s.output == 0);
+
+    /* Integrator clamped to the output range on its own */
+    configure(1000, 0, 1.0, 0, 0, 300);
+    for (int i = 0; i < 10; i++) {
+        run(900);
+    }
+    CHECK(status_of(0).integral == 300);
+    run(1100);
+    CHECK(status_of(0).output == 200);
+}
+
+static void test_setpoint_step(void)
+{
+    /* Derivative on measurement: a setpoint step moves the output by kp only */
+    configure(1000, 1.0, 0, 8.0, -4000, 4000);
+    run(1000);
+    run(1000);
+    CHECK(status_of(0).output == 0);
+
+    pid_cfg_t c;
+    pid_get_config(0, &c);
+    c.setpoint = 1200;
+    CHECK(pid_set_config(0, &c) == ESP_OK);
+    run(1000);
+    CHECK(status_of(0).output == 200);
+
+    /* The same step in the measurement is damped by kd */
+    run(800);
+    CHECK(status_of(0).output == 400 + 8 * 200);
+    run(800);
+    CHECK(status_of(0).output == 400);
+}
+
+static void test_reverse(void)
+{
+    pid_cfg_t c = {
+        .enabled = 1, .channel = 0, .reverse = 1, .setpoint = 1000,
+        .kp = Q(1.0), .out_min = 0, .out_max = 1000,
+    };
+    pid_cfg_t off = c;
+    off.enabled = 0;
+    pid_set_config(0, &off);
+    pid_set_config(0, &c);
+
+    run(1300);
+    CHECK(status_of(0).output == 300 && status_of(0).error == 300);
+    run(700);
+    CHECK(status_of(0).output == 0);
+}
+
+static void test_latency(void)
+{
+    configure(1000, 1.0, 0, 0, 0, 1000);
+
+    /* Timed from the conversion-done interrupt of the frame */
+    frame.conv_done_us = 10000;
+    stub_time_us = 10250;
+    run(1000);
+    /* A frame that waited in the pool has no interrupt time */
+    frame.conv_done_us = 0;
+    run(1000);
+
+    pid_status_t s = status_of(0);
+    CHECK(s.steps == 2 && s.late == 1);
+    CHECK(s.latency_us == 250);
+    CHECK(s.latency_min_us == 250 && s.latency_max_us == 250 && s.latency_sum_us == 250);
+}
+
+static int32_t seen = -1;
+static int calls;
+
+static void record_output(uint8_t loop, int32_t value, void *arg)
+{
+    seen = value;
+    calls++;
+}
+
+static void test_custom_output(void)
+{
+    int before = updates[0];
+    CHECK(pid_set_output(0, record_output, NULL) == ESP_OK);
+    configure(1000, 1.0, 0, 0, 0, 1000);
+    run(900);
+    CHECK(calls == 1 && seen == 100);
+    CHECK(updates[0] == before);
+
+    /* No sample of the input channel: no step */
+    frame.count[0] = 0;
+    pid_run(&frame);
+    CHECK(calls == 1);
+}
+
+int main(void)
+{
+    RUN(test_init);
+    RUN(test_invalid_config);
+    RUN(test_proportional_clamp);
+    RUN(test_pwm_range);
+    RUN(test_integral);
+    RUN(test_anti_windup);
+    RUN(test_setpoint_step);
+    RUN(test_reverse);
+    RUN(test_latency);
+    RUN(test_custom_output);
+    return test_summary("pid");
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""UDP telemetry receiver for the multi-channel ADC firmware.
+
+Listens for telemetry datagrams (see main/telemetry.h), reports lost
+datagrams from the sequence numbers and optionally writes the samples to
+a CSV file.
+
+Usage:
+    telemetry_rx.py [--bind ADDR] [--port PORT] [--csv FILE] [--quiet]
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+MAGIC = 0x54434441
+VERSION = 1
+MODE_SNAPSHOT = 1
+MODE_BLOCK = 2
+
+HDR = struct.Struct('<IBBBBII')
+
+
+def unpack12(buf, offset, count):
+    """Unpack count 12-bit samples stored as 3 bytes per pair."""
+    out = []
+    for i in range(0, count, 2):
+        b0, b1, b2 = buf[offset], buf[offset + 1], buf[offset + 2]
+        out.append(b0 | ((b1 & 0x0f) << 8))
+        if i + 1 < count:
+            out.append((b1 >> 4) | (b2 << 4))
+        offset += 3
+    return out, offset
+
+
+def parse(data):
+    """Parse one datagram into (header, records)."""
+    if len(data) < HDR.size:
+        raise ValueError('short datagram')
+    magic, version, mode, channels, records, seq, dropped = HDR.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('bad magic/version')
+
+    hdr = {'type': mode, 'channels': channels, 'records': records,
+           'seq': seq, 'dropped': dropped}
+    out = []
+    off = HDR.size
+    for _ in range(records):
+        if mode == MODE_SNAPSHOT:
+            fmt = '<q%dH' % (2 * channels)
+            vals = struct.unpack_from(fmt, data, off)
+            off += struct.calcsize(fmt)
+            out.append({'ts': vals[0],
+                        'raw': list(vals[1:1 + channels]),
+                        'norm': list(vals[1 + channels:])})
+        elif mode == MODE_BLOCK:
+            fmt = '<qI%dH' % channels
+            vals = struct.unpack_from(fmt, data, off)
+            off += struct.calcsize(fmt)
+            samples = []
+            for count in vals[2:]:
+                s, off = unpack12(data, off, count)
+                samples.append(s)
+            out.append({'ts': vals[0], 'frame': vals[1], 'samples': samples})
+        else:
+            raise ValueError('unknown record type %d' % mode)
+    return hdr, out
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument('--bind', default='0.0.0.0', help='local address')
+    ap.add_argument('--port', type=int, default=5005, help='local UDP port')
+    ap.add_argument('--csv', help='append samples to this CSV file')
+    ap.add_argument('--quiet', action='store_true', help='print statistics only')
+    args = ap.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+    sock.bind((args.bind, args.port))
+
+    csv = open(args.csv, 'a') if args.csv else None
+    expected = None
+    received = lost = errors = 0
+    last_report = time.monotonic()
+
+    try:
+        while True:
+            data, peer = sock.recvfrom(2048)
+            try:
+                hdr, records = parse(data)
+            except (ValueError, struct.error) as e:
+                errors += 1
+                print('%s: %s' % (peer[0], e), file=sys.stderr)
+                continue
+
+            received += 1
+            if expected is not None and hdr['seq'] != expected:
+                lost += (hdr['seq'] - expected) & 0xffffffff
+            expected = (hdr['seq'] + 1) & 0xffffffff
+
+            for r in records:
+                if hdr['type'] == MODE_SNAPSHOT:
+                    if not args.quiet:
+                        print('%d raw=%s norm=%s' % (r['ts'], r['raw'], r['norm']))
+                    if csv:
+                        csv.write('%d,%s\n' % (r['ts'], ','.join(map(str, r['raw'] + r['norm']))))
+                else:
+                    if not args.quiet:
+                        print('%d frame=%d counts=%s' %
+                              (r['ts'], r['frame'], [len(s) for s in r['samples']]))
+                    if csv:
+                        for ch, s in enumerate(r['samples']):
+                            csv.write('%d,%d,%d,%s\n' % (r['ts'], r['frame'], ch, ','.join(map(str, s))))
+
+            now = time.monotonic()
+            if now - last_report >= 5.0:
+                print('datagrams=%d lost=%d bad=%d device_dropped=%d' %
+                      (received, lost, errors, hdr['dropped']), file=sys.stderr)
+                last_report = now
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if csv:
+            csv.close()
+        print('datagrams=%d lost=%d bad=%d' % (received, lost, errors), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()